@@ -0,0 +1,297 @@
+#include "AnimationCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace {
+
+    const float TIME_SCALE = 65535.0f;
+    const float VALUE_SCALE = 65535.0f;
+
+    // Smallest-three components lie in [-1/sqrt(2), 1/sqrt(2)]
+    const float QUAT_RANGE = 0.70710678118f;
+    const uint16_t QUAT_COMPONENT_MASK = 0x7fff;
+    const float QUAT_COMPONENT_SCALE = 32767.0f;
+
+    uint16_t quantizeUnit(float x, float scale) {
+        return (uint16_t) std::lround(glm::clamp(x, 0.0f, 1.0f) * scale);
+    }
+
+    uint16_t quantizeTime(double time, double duration) {
+        if (duration <= 0) {
+            return 0;
+        }
+        return quantizeUnit((float) (time / duration), TIME_SCALE);
+    }
+
+    void encodeQuat(glm::quat q, uint16_t out[3]) {
+        q = glm::normalize(q);
+
+        int largest = 0;
+        for (int i = 1; i < 4; i++) {
+            if (std::abs(q[i]) > std::abs(q[largest])) {
+                largest = i;
+            }
+        }
+
+        // q and -q are the same rotation, so make the dropped component positive
+        if (q[largest] < 0) {
+            q = -q;
+        }
+
+        int j = 0;
+        for (int i = 0; i < 4; i++) {
+            if (i == largest) {
+                continue;
+            }
+            float unit = (q[i] + QUAT_RANGE) / (2 * QUAT_RANGE);
+            out[j++] = quantizeUnit(unit, QUAT_COMPONENT_SCALE);
+        }
+
+        out[0] |= (uint16_t) ((largest & 1) << 15);
+        out[1] |= (uint16_t) (((largest >> 1) & 1) << 15);
+    }
+
+    glm::quat decodeQuat(const uint16_t in[3]) {
+        int largest = (in[0] >> 15) | ((in[1] >> 15) << 1);
+
+        float small[3];
+        float sumSquares = 0;
+        for (int j = 0; j < 3; j++) {
+            float unit = (float) (in[j] & QUAT_COMPONENT_MASK) / QUAT_COMPONENT_SCALE;
+            small[j] = unit * 2 * QUAT_RANGE - QUAT_RANGE;
+            sumSquares += small[j] * small[j];
+        }
+
+        glm::quat q;
+        int j = 0;
+        for (int i = 0; i < 4; i++) {
+            q[i] = i == largest ? std::sqrt(std::max(0.0f, 1 - sumSquares)) : small[j++];
+        }
+        return glm::normalize(q);
+    }
+
+    float rotationError(const glm::quat& a, const glm::quat& b) {
+        float d = std::min(1.0f, std::abs(glm::dot(glm::normalize(a), glm::normalize(b))));
+        return 2 * std::acos(d);
+    }
+
+    float vec3Error(const glm::vec3& approx, const glm::vec3& exact, bool relative) {
+        float error = glm::length(approx - exact);
+        return relative ? error / std::max(glm::length(exact), 1e-6f) : error;
+    }
+
+    // Greedy keyframe reduction: starting from an anchor key, extend the segment
+    // for as long as every skipped key is reproduced by interpolating the segment
+    // end points within tolerance. Returns the indices of the keys to keep.
+    std::vector<size_t> reduceKeys(
+            size_t n,
+            const std::function<float(size_t anchor, size_t end, size_t k)>& interpolationError,
+            const std::function<float(size_t k)>& constantError,
+            float tolerance
+    ) {
+        if (n == 0) {
+            return {};
+        }
+
+        bool constant = true;
+        for (size_t k = 1; k < n && constant; k++) {
+            constant = constantError(k) <= tolerance;
+        }
+        if (constant) {
+            return {0};
+        }
+
+        std::vector<size_t> kept = {0};
+        size_t anchor = 0;
+        for (size_t end = 2; end < n; end++) {
+            for (size_t k = anchor + 1; k < end; k++) {
+                if (interpolationError(anchor, end, k) > tolerance) {
+                    anchor = end - 1;
+                    kept.push_back(anchor);
+                    break;
+                }
+            }
+        }
+        kept.push_back(n - 1);
+
+        return kept;
+    }
+
+    template<class T>
+    std::vector<std::pair<double, T>> flatten(const std::map<double, T>& keys) {
+        return {keys.begin(), keys.end()};
+    }
+
+    float alphaBetween(double t0, double t1, double t) {
+        return t1 > t0 ? (float) ((t - t0) / (t1 - t0)) : 0.0f;
+    }
+
+    template<class Track>
+    size_t findUpperKey(const Track& track, float normalizedTime) {
+        float t = glm::clamp(normalizedTime, 0.0f, 1.0f) * TIME_SCALE;
+        auto upper = std::upper_bound(
+                track.times.begin(),
+                track.times.end(),
+                t,
+                [](float value, uint16_t key) { return value < (float) key; }
+        );
+        return upper - track.times.begin();
+    }
+
+    template<class Track>
+    float trackAlpha(const Track& track, size_t lower, size_t upper, float normalizedTime) {
+        float t = glm::clamp(normalizedTime, 0.0f, 1.0f) * TIME_SCALE;
+        return (t - track.times[lower]) / (float) (track.times[upper] - track.times[lower]);
+    }
+
+}
+
+glm::vec3 QuantizedVec3Track::key(size_t i) const {
+    glm::vec3 unit(
+            (float) values[3 * i + 0] / VALUE_SCALE,
+            (float) values[3 * i + 1] / VALUE_SCALE,
+            (float) values[3 * i + 2] / VALUE_SCALE
+    );
+    return min + extent * unit;
+}
+
+glm::vec3 QuantizedVec3Track::sample(float normalizedTime) const {
+    size_t upper = findUpperKey(*this, normalizedTime);
+    if (upper == 0) {
+        return key(0);
+    } else if (upper == times.size()) {
+        return key(times.size() - 1);
+    }
+    return glm::mix(key(upper - 1), key(upper), trackAlpha(*this, upper - 1, upper, normalizedTime));
+}
+
+size_t QuantizedVec3Track::bytes() const {
+    return sizeof(*this) + sizeof(uint16_t) * (times.size() + values.size());
+}
+
+glm::quat QuantizedQuatTrack::key(size_t i) const {
+    return decodeQuat(&values[3 * i]);
+}
+
+glm::quat QuantizedQuatTrack::sample(float normalizedTime) const {
+    size_t upper = findUpperKey(*this, normalizedTime);
+    if (upper == 0) {
+        return key(0);
+    } else if (upper == times.size()) {
+        return key(times.size() - 1);
+    }
+    return glm::slerp(key(upper - 1), key(upper), trackAlpha(*this, upper - 1, upper, normalizedTime));
+}
+
+size_t QuantizedQuatTrack::bytes() const {
+    return sizeof(*this) + sizeof(uint16_t) * (times.size() + values.size());
+}
+
+void AnimationCompressionStats::add(const AnimationCompressionStats& other) {
+    rawBytes += other.rawBytes;
+    compressedBytes += other.compressedBytes;
+    rawKeys += other.rawKeys;
+    compressedKeys += other.compressedKeys;
+    maxTranslationError = std::max(maxTranslationError, other.maxTranslationError);
+    maxRotationError = std::max(maxRotationError, other.maxRotationError);
+    maxScaleError = std::max(maxScaleError, other.maxScaleError);
+}
+
+QuantizedVec3Track AnimationCompression::compressVec3Track(
+        const std::map<double, glm::vec3>& keys,
+        double duration,
+        float tolerance,
+        bool relativeTolerance,
+        float& maxError
+) {
+    QuantizedVec3Track track;
+    maxError = 0;
+    if (keys.empty()) {
+        return track;
+    }
+
+    auto flat = flatten(keys);
+
+    // Spend half of the budget on key reduction; quantization takes the rest
+    std::vector<size_t> kept = reduceKeys(
+            flat.size(),
+            [&](size_t a, size_t b, size_t k) {
+                float alpha = alphaBetween(flat[a].first, flat[b].first, flat[k].first);
+                return vec3Error(glm::mix(flat[a].second, flat[b].second, alpha), flat[k].second, relativeTolerance);
+            },
+            [&](size_t k) {
+                return vec3Error(flat[0].second, flat[k].second, relativeTolerance);
+            },
+            tolerance / 2
+    );
+
+    glm::vec3 lo = flat[kept[0]].second;
+    glm::vec3 hi = lo;
+    for (size_t i : kept) {
+        lo = glm::min(lo, flat[i].second);
+        hi = glm::max(hi, flat[i].second);
+    }
+    track.min = lo;
+    track.extent = hi - lo;
+
+    track.times.reserve(kept.size());
+    track.values.reserve(3 * kept.size());
+    for (size_t i : kept) {
+        track.times.push_back(quantizeTime(flat[i].first, duration));
+        for (int c = 0; c < 3; c++) {
+            float unit = track.extent[c] > 0 ? (flat[i].second[c] - lo[c]) / track.extent[c] : 0.0f;
+            track.values.push_back(quantizeUnit(unit, VALUE_SCALE));
+        }
+    }
+
+    // Measure the error of the decoded track against every original key
+    for (const auto& key : flat) {
+        float t = duration > 0 ? (float) (key.first / duration) : 0.0f;
+        maxError = std::max(maxError, vec3Error(track.sample(t), key.second, relativeTolerance));
+    }
+
+    return track;
+}
+
+QuantizedQuatTrack AnimationCompression::compressQuatTrack(
+        const std::map<double, glm::quat>& keys,
+        double duration,
+        float tolerance,
+        float& maxError
+) {
+    QuantizedQuatTrack track;
+    maxError = 0;
+    if (keys.empty()) {
+        return track;
+    }
+
+    auto flat = flatten(keys);
+
+    std::vector<size_t> kept = reduceKeys(
+            flat.size(),
+            [&](size_t a, size_t b, size_t k) {
+                float alpha = alphaBetween(flat[a].first, flat[b].first, flat[k].first);
+                return rotationError(glm::slerp(flat[a].second, flat[b].second, alpha), flat[k].second);
+            },
+            [&](size_t k) {
+                return rotationError(flat[0].second, flat[k].second);
+            },
+            tolerance / 2
+    );
+
+    track.times.reserve(kept.size());
+    track.values.resize(3 * kept.size());
+    for (size_t j = 0; j < kept.size(); j++) {
+        track.times.push_back(quantizeTime(flat[kept[j]].first, duration));
+        encodeQuat(flat[kept[j]].second, &track.values[3 * j]);
+    }
+
+    for (const auto& key : flat) {
+        float t = duration > 0 ? (float) (key.first / duration) : 0.0f;
+        maxError = std::max(maxError, rotationError(track.sample(t), key.second));
+    }
+
+    return track;
+}
@@ -0,0 +1,91 @@
+#ifndef CS5625_ANIMATIONCOMPRESSION_H
+#define CS5625_ANIMATIONCOMPRESSION_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Keyframes exactly as they come out of assimp. Only lives for the duration of
+// the import; Scene keeps the compressed Channel instead.
+struct RawChannel {
+    std::string nodeName;
+    std::map<double, glm::vec3> translation;
+    std::map<double, glm::quat> rotation;
+    std::map<double, glm::vec3> scale;
+};
+
+// A vec3 track with key times quantized to 16 bits over [0, duration] and
+// values quantized to 16 bits per component over the track's bounding box.
+struct QuantizedVec3Track {
+    std::vector<uint16_t> times;
+    std::vector<uint16_t> values; // 3 per key
+    glm::vec3 min = glm::vec3(0);
+    glm::vec3 extent = glm::vec3(0);
+
+    glm::vec3 sample(float normalizedTime) const;
+    glm::vec3 key(size_t i) const;
+    size_t bytes() const;
+};
+
+// A rotation track with key times quantized to 16 bits over [0, duration] and
+// rotations stored with smallest-three encoding in 48 bits per key: three
+// 15-bit components plus the 2-bit index of the dropped largest component,
+// which is split across the top bits of the first two words.
+struct QuantizedQuatTrack {
+    std::vector<uint16_t> times;
+    std::vector<uint16_t> values; // 3 per key
+
+    glm::quat sample(float normalizedTime) const;
+    glm::quat key(size_t i) const;
+    size_t bytes() const;
+};
+
+struct AnimationCompressionSettings {
+    float translationTolerance = 1e-3f; // scene units
+    float rotationTolerance = 1e-3f;    // radians
+    float scaleTolerance = 1e-3f;       // relative
+};
+
+struct AnimationCompressionStats {
+    size_t rawBytes = 0;
+    size_t compressedBytes = 0;
+    size_t rawKeys = 0;
+    size_t compressedKeys = 0;
+    float maxTranslationError = 0;
+    float maxRotationError = 0;
+    float maxScaleError = 0;
+
+    void add(const AnimationCompressionStats& other);
+};
+
+namespace AnimationCompression {
+
+    QuantizedVec3Track compressVec3Track(
+            const std::map<double, glm::vec3>& keys,
+            double duration,
+            float tolerance,
+            bool relativeTolerance,
+            float& maxError
+    );
+
+    QuantizedQuatTrack compressQuatTrack(
+            const std::map<double, glm::quat>& keys,
+            double duration,
+            float tolerance,
+            float& maxError
+    );
+
+    // Approximate heap footprint of a std::map based track: one red-black
+    // tree node per key holding the key/value pair.
+    template<class T>
+    size_t rawTrackBytes(const std::map<double, T>& keys) {
+        const size_t rbNodeOverhead = 4 * sizeof(void*);
+        return sizeof(keys) + keys.size() * (rbNodeOverhead + sizeof(std::pair<const double, T>));
+    }
+
+}
+
+#endif //CS5625_ANIMATIONCOMPRESSION_H
@@ -9,24 +9,25 @@ Animators::Animators(
         const std::shared_ptr<OceanScene> &oceanScene
 ) : birdAnimator(scene),
     oceanAnimator(oceanScene) {
-    addAnimators(scene, scene->root);
+    addAnimators(scene);
 
     for (const auto& light : scene->pointLights) {
         if (light->name.find("SunLight") != std::string::npos) {
-            auto node = scene->findNode("SunLightNode");
-            sunLightAnimators.emplace_back(light, node);
+            NodeHandle node = scene->findNode("SunLightNode");
+            if (node == NullNode) {
+                continue;
+            }
+            sunLightAnimators.emplace_back(light, scene, node);
             std::cout << "Found Sun Light" << std::endl;
         }
     }
 }
 
-void Animators::addAnimators(const std::shared_ptr<Scene>& scene, const std::shared_ptr<Node> &node) {
-    if (BoatNodeAnimator::is_boat(node->name)) {
-        boatAnimators.emplace_back(node);
-        std::cout << "Found boat node " << node->name << std::endl;
-    }
-
-    for (auto &child: node->children) {
-        addAnimators(scene, child);
+void Animators::addAnimators(const std::shared_ptr<Scene>& scene) {
+    for (NodeHandle handle = 0; handle < scene->nodes.size(); handle++) {
+        if (BoatNodeAnimator::is_boat(scene->node(handle).name)) {
+            boatAnimators.emplace_back(scene, handle);
+            std::cout << "Found boat node " << scene->node(handle).name << std::endl;
+        }
     }
 }
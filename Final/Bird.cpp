@@ -3,61 +3,102 @@
 //
 
 #include "Bird.hpp"
+#include <cctype>
 #include <glm/gtx/io.hpp>
 
-const double bound = 15.0;
-const float randomVelocity = 30.0;
-const float height = 15.0;
-Wind Bird::wind;
-std::vector<Wall> Bird::walls {
-        Wall{ glm::vec3 {  bound, bound,  0 }, glm::normalize(glm::vec3{  -bound, 0,  0 }) },
-        Wall{ glm::vec3 { -bound, bound,  0 }, glm::normalize(glm::vec3{   bound, 0,  0 }) },
-        Wall{ glm::vec3 {  0,   bound,  bound }, glm::normalize(glm::vec3{ 0,   0, -bound }) },
-        Wall{ glm::vec3 {  0,   bound, -bound }, glm::normalize(glm::vec3{ 0,   0,  bound }) }
-};
-
-Bird::Bird(std::shared_ptr<Node> birdNode) {
-    std::random_device rd;
-    std::mt19937_64 mt(rd());
-    std::uniform_int_distribution<int> dist_int(-(int) bound, (int) bound);
-    std::uniform_real_distribution<float> dist_real(-randomVelocity, randomVelocity);
-
-    this->nodePtr = birdNode;
-    this->position = glm::vec3{ dist_int(mt), height, dist_int(mt) };
-    this->velocity = glm::vec3{ dist_real(mt), 0, dist_real(mt) };
-    this->initVelocity = glm::length(this->velocity);
+std::vector<Wall> BirdFlockParams::walls() const {
+    glm::vec3 c = this->center;
+    glm::vec2 e = this->halfExtent;
+    return {
+            Wall{ glm::vec3 { c.x + e.x, c.y, c.z }, glm::vec3{ -1, 0,  0 } },
+            Wall{ glm::vec3 { c.x - e.x, c.y, c.z }, glm::vec3{  1, 0,  0 } },
+            Wall{ glm::vec3 { c.x, c.y, c.z + e.y }, glm::vec3{  0, 0, -1 } },
+            Wall{ glm::vec3 { c.x, c.y, c.z - e.y }, glm::vec3{  0, 0,  1 } }
+    };
+}
+
+namespace {
+
+    bool ends_with(const std::string& s, const std::string& suffix) {
+        return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+}
+
+bool Bird::is_bird(const std::string& nodeName) {
+    return ends_with(flock_name(nodeName), "Bird");
+}
+
+bool Bird::is_bounds(const std::string& nodeName) {
+    return ends_with(nodeName, "BirdBounds");
+}
+
+std::string Bird::flock_name(const std::string& nodeName) {
+    size_t end = nodeName.size();
+    while (end > 0 && std::isdigit((unsigned char) nodeName[end - 1])) {
+        end--;
+    }
+    if (end < nodeName.size() && end > 0 && nodeName[end - 1] == '.') {
+        end--;
+    }
+    return nodeName.substr(0, end);
+}
+
+void Bird::add(
+        BirdFlockState& flock,
+        NodeHandle node,
+        const glm::mat4& initialTransform,
+        const BirdFlockParams& params,
+        std::mt19937_64& rng
+) {
+    std::uniform_int_distribution<int> dist_x(-(int) params.halfExtent.x, (int) params.halfExtent.x);
+    std::uniform_int_distribution<int> dist_z(-(int) params.halfExtent.y, (int) params.halfExtent.y);
+    std::uniform_real_distribution<float> dist_real(-params.randomVelocity, params.randomVelocity);
+
+    glm::vec3 position{ params.center.x + dist_x(rng), params.center.y, params.center.z + dist_z(rng) };
+    glm::vec3 velocity{ dist_real(rng), 0, dist_real(rng) };
+
     glm::mat4 scaleMat = glm::scale(glm::mat4(1), glm::vec3{
-        glm::length(glm::vec3(this->nodePtr->transform[0])),
-        glm::length(glm::vec3(this->nodePtr->transform[1])),
-        glm::length(glm::vec3(this->nodePtr->transform[2]))
+        glm::length(glm::vec3(initialTransform[0])),
+        glm::length(glm::vec3(initialTransform[1])),
+        glm::length(glm::vec3(initialTransform[2]))
     });
-    glm::mat4 transformCopy(this->nodePtr->transform);
+    glm::mat4 transformCopy(initialTransform);
     transformCopy[3][0] = transformCopy[3][1] = transformCopy[3][2] = 0;
     transformCopy[0] /= glm::length(transformCopy[0]);
     transformCopy[1] /= glm::length(transformCopy[1]);
     transformCopy[2] /= glm::length(transformCopy[2]);
     glm::mat4 rotationMat= transformCopy;
-    this->rotScale = rotationMat * scaleMat;
 
-    update_self(glm::vec3(0));
+    flock.px.push_back(position.x);
+    flock.py.push_back(position.y);
+    flock.pz.push_back(position.z);
+    flock.vx.push_back(velocity.x);
+    flock.vy.push_back(velocity.y);
+    flock.vz.push_back(velocity.z);
+    flock.initSpeed.push_back(glm::length(velocity));
+    flock.rotScale.push_back(rotationMat * scaleMat);
+    flock.nodes.push_back(node);
+    flock.tier.push_back(BirdLodTier_Near);
+    flock.pendingDeltaT.push_back(0);
+    flock.separationWeight.push_back(1);
+    flock.deltaVx.push_back(0);
+    flock.deltaVz.push_back(0);
+    flock.transforms.push_back(transform(flock, flock.size() - 1, glm::vec3(0)));
 }
 
-void Bird::update_self(glm::vec3 deltaV) {
-    if (glm::length(this->velocity) > this->initVelocity) this->velocity *= 0.99f;
+glm::mat4 Bird::transform(const BirdFlockState& flock, size_t i, glm::vec3 deltaV) {
+    glm::vec3 velocity = flock.velocity(i);
     glm::qua<float> lookAtQuat = glm::quatLookAt(
-            -glm::normalize(glm::vec3{
-                this->velocity.x,
-                this->velocity.y,
-                this->velocity.z
-                }),
+            -glm::normalize(velocity),
             glm::vec3{ 0, 1, 0 }
         );
-    float rollTheta = glm::pow(glm::dot(glm::vec3(0, 1, 0), glm::cross(deltaV, this->velocity)) / 200.0f, 3.0f) / 100.0f;
-    this->nodePtr->transform =
-            glm::translate(glm::mat4(1), this->position) *
+    float rollTheta = glm::pow(glm::dot(glm::vec3(0, 1, 0), glm::cross(deltaV, velocity)) / 200.0f, 3.0f) / 100.0f;
+    return
+            glm::translate(glm::mat4(1), flock.position(i)) *
             glm::rotate(glm::mat4(1),
                         glm::clamp(rollTheta, -1.0f, 1.0f),
-                        glm::normalize(this->velocity)) *
+                        glm::normalize(velocity)) *
             glm::mat4_cast(lookAtQuat) *
-            this->rotScale;
-}
\ No newline at end of file
+            flock.rotScale[i];
+}
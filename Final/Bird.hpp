@@ -21,9 +21,8 @@ struct Wall
 
 struct Wind
 {
-    Wind() {
-        std::random_device rd;
-        std::mt19937_64 mt(rd());
+    explicit Wind(uint64_t seed = 5625) {
+        std::mt19937_64 mt(seed);
         std::uniform_real_distribution<float> dist(-0.25, 0.25);
         for (int i = 0; i < 10; i++) {
             this->windDirs.insert(std::make_pair(i, glm::vec3 {
@@ -32,7 +31,7 @@ struct Wind
         }
     }
 
-    glm::vec3 get_wind_dir(double time) {
+    glm::vec3 get_wind_dir(double time) const {
         double mapSize = this->windDirs.size();
         return glm::mix(
                 this->windDirs.lower_bound(std::fmod(time, mapSize))->second,
@@ -43,18 +42,78 @@ struct Wind
     std::map<int, glm::vec3> windDirs;
 };
 
+// Per-flock settings. The bounds are a box around center; birds start at its
+// height and turn back from its four vertical sides.
+struct BirdFlockParams
+{
+    glm::vec3 center { 0, 15, 0 };
+    glm::vec2 halfExtent { 15, 15 };
+    float randomVelocity = 30;
+    float avoidanceRadius = 5;
+    uint64_t windSeed = 5625;
+
+    std::vector<Wall> walls() const;
+};
+
+// How much of the flocking simulation a bird gets, by distance from the camera
+enum BirdLodTier : uint8_t
+{
+    BirdLodTier_Near, // every term, every step
+    BirdLodTier_Mid,  // neighbor search every few steps, extrapolated between
+    BirdLodTier_Far   // steered with the other far birds as one group every few steps, carried along between
+};
+
+// The whole flock in structure-of-arrays layout, so that the integration
+// kernel can load eight birds per AVX2 register.
+struct BirdFlockState
+{
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> initSpeed;
+    std::vector<glm::mat4> rotScale;
+    std::vector<NodeHandle> nodes;
+
+    // Level of detail: the current tier, simulated time a mid-tier bird has
+    // not yet applied to its velocity, and how much of its separation term it
+    // gets (faded in and out so tier changes do not pop)
+    std::vector<BirdLodTier> tier;
+    std::vector<float> pendingDeltaT;
+    std::vector<float> separationWeight;
+
+    // Per-step results
+    std::vector<float> deltaVx, deltaVz;
+    std::vector<glm::mat4> transforms;
+
+    size_t size() const { return nodes.size(); }
+    glm::vec3 position(size_t i) const { return { px[i], py[i], pz[i] }; }
+    glm::vec3 velocity(size_t i) const { return { vx[i], vy[i], vz[i] }; }
+};
+
 struct Bird
 {
-    Bird(std::shared_ptr<Node> birdNode);
-
-    static bool is_bird(const std::string& nodeName) { return nodeName.find("Bird") != std::string::npos; };
-    static std::vector<Wall> walls;
-    static Wind wind;
-    void update_self(glm::vec3 deltaV);
-
-    glm::vec3 position;
-    float initVelocity;
-    glm::vec3 velocity;
-    glm::mat4 rotScale;
-    std::shared_ptr<Node> nodePtr;
+    // Bird nodes are named <Species>Bird, optionally numbered: "Bird",
+    // "Bird.001", "Bird7" and "GullBird.003" are all birds
+    static bool is_bird(const std::string& nodeName);
+
+    // A node named <flock>Bounds, e.g. "BirdBounds" or "GullBirdBounds",
+    // sets the bounds of that flock, see BirdFlockParams
+    static bool is_bounds(const std::string& nodeName);
+
+    // The flock a bird node belongs to: its name without the number, either
+    // the ".001"-style suffix that duplicating it in Blender adds or plain
+    // trailing digits
+    static std::string flock_name(const std::string& nodeName);
+
+    // Append a bird with a random start position and heading inside the
+    // flock's bounds, keeping the rotation and scale of its node
+    static void add(
+            BirdFlockState& flock,
+            NodeHandle node,
+            const glm::mat4& initialTransform,
+            const BirdFlockParams& params,
+            std::mt19937_64& rng
+    );
+
+    // Node transform of bird i, banking into the turn given by deltaV
+    static glm::mat4 transform(const BirdFlockState& flock, size_t i, glm::vec3 deltaV);
 };
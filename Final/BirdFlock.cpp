@@ -0,0 +1,667 @@
+#include "BirdFlock.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <glm/gtx/transform.hpp>
+#include "BirdKernel.h"
+
+#if defined(CS5625_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+    // Level of detail: tiers by distance from the camera, widened by
+    // lodHysteresis before a bird drops a tier so that birds near a boundary
+    // do not flicker between tiers
+    const float nearDistance = 40.0f;
+    const float midDistance = 120.0f;
+    const float lodHysteresis = 1.15f;
+    // Mid-tier birds search for neighbors every midInterval steps, and grouped
+    // far birds are steered every farInterval steps, staggered
+    const uint64_t midInterval = 4;
+    const uint64_t farInterval = 8;
+    // Seconds for the separation term to fade fully in or out
+    const float separationFadeTime = 0.5f;
+    // Birds this far outside the view (in NDC) still count as visible
+    const float visibleMargin = 0.1f;
+
+    // Obstacle avoidance: each searching bird looks lookAheadTime seconds
+    // (plus the avoidance radius) along its velocity and steers away from the
+    // first surface it sees, harder the closer it is
+    const float lookAheadTime = 1.0f;
+    const float obstacleSteering = 0.5f;
+
+    // Birds per task; small enough to spread a few thousand birds over all cores
+    const size_t grainSize = 512;
+
+    // Size of boneTransforms in the vertex shaders, and the most phase offsets
+    // the flock is posed at
+    const int maxBoneTransforms = 100;
+    const int maxPhases = 8;
+
+    // Rows of the baked vertex animation per loop of the clip
+    const int vertexAnimationFrames = 64;
+
+    /* collects the nodes from just below ancestor down to node, returning false if ancestor is not an ancestor
+     * of node
+     */
+    bool path_below(const Scene& scene, NodeHandle ancestor, NodeHandle node, std::vector<NodeHandle>& path) {
+        path.clear();
+        for (NodeHandle handle = node; handle != ancestor; handle = scene.node(handle).parent) {
+            if (handle == NullNode) {
+                return false;
+            }
+            path.push_back(handle);
+        }
+        std::reverse(path.begin(), path.end());
+        return true;
+    }
+
+    // How a bird in the far group is moved this step: steered by the group
+    // (every farInterval steps), or only carried along its velocity
+    enum BirdGroupState : uint8_t {
+        BirdGroup_None,
+        BirdGroup_Steered,
+        BirdGroup_Moved
+    };
+
+    struct StepConstants {
+        glm::vec3 sumPosition;
+        glm::vec3 sumVelocity;
+        glm::vec3 flockCenter;
+        glm::vec3 windTerm;
+        float inverseOtherBirds;
+        float deltaT;
+        bool scatter;
+    };
+
+    /* adds up the cohesion, alignment, separation, scatter and wind terms for birds [begin, end) and integrates
+     * their velocity (over vdt, which is zero for birds that are only extrapolated this step) and position
+     */
+    void integrate_scalar(
+            BirdFlockState& flock,
+            const std::vector<float>& sx, const std::vector<float>& sy, const std::vector<float>& sz,
+            const std::vector<float>& vdt,
+            const StepConstants& c,
+            size_t begin, size_t end
+    ) {
+        for (size_t i = begin; i < end; i++) {
+            glm::vec3 position = flock.position(i);
+            glm::vec3 velocity = flock.velocity(i);
+
+            glm::vec3 centerOfMass = ((c.sumPosition - position) * c.inverseOtherBirds - position) / 150.f;
+            glm::vec3 centerOfVelocity = ((c.sumVelocity - velocity) * c.inverseOtherBirds - velocity) / 160.f;
+            glm::vec3 deltaV = centerOfMass + glm::vec3(sx[i], sy[i], sz[i]) + centerOfVelocity;
+            if (c.scatter) {
+                glm::vec3 scatterVector = position - c.flockCenter;
+                deltaV += scatterVector * (250.f / glm::dot(scatterVector, scatterVector));
+            }
+            deltaV += c.windTerm;
+            deltaV *= 51.14f;
+            deltaV.y = 0;
+
+            velocity += deltaV * vdt[i];
+            position += velocity * c.deltaT;
+            if (glm::dot(velocity, velocity) > flock.initSpeed[i] * flock.initSpeed[i]) velocity *= 0.99f;
+
+            flock.px[i] = position.x;
+            flock.py[i] = position.y;
+            flock.pz[i] = position.z;
+            flock.vx[i] = velocity.x;
+            flock.vy[i] = velocity.y;
+            flock.vz[i] = velocity.z;
+            flock.deltaVx[i] = deltaV.x;
+            flock.deltaVz[i] = deltaV.z;
+        }
+    }
+
+    /* true if the AVX2 kernel was built and the CPU running it has AVX2 */
+    bool avx2_supported() {
+#if defined(CS5625_AVX2) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+#elif defined(CS5625_AVX2) && defined(_MSC_VER)
+        static const bool supported = [] {
+            // AVX2 in leaf 7, and the OS saving the ymm registers (OSXSAVE, then XCR0)
+            int info[4];
+            __cpuid(info, 1);
+            if (!(info[2] & (1 << 27))) {
+                return false;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0 && (_xgetbv(0) & 6) == 6;
+        }();
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    void integrate(
+            BirdFlockState& flock,
+            const std::vector<float>& sx, const std::vector<float>& sy, const std::vector<float>& sz,
+            const std::vector<float>& vdt,
+            const StepConstants& c,
+            size_t begin, size_t end
+    ) {
+        if (avx2_supported()) {
+            BirdKernelArrays arrays{
+                    flock.px.data(), flock.py.data(), flock.pz.data(),
+                    flock.vx.data(), flock.vy.data(), flock.vz.data(),
+                    flock.deltaVx.data(), flock.deltaVz.data(),
+                    flock.initSpeed.data(), sx.data(), sz.data(), vdt.data()
+            };
+            BirdKernelConstants constants{
+                    c.sumPosition.x, c.sumPosition.z,
+                    c.sumVelocity.x, c.sumVelocity.z,
+                    c.flockCenter.x, c.flockCenter.y, c.flockCenter.z,
+                    c.windTerm.x, c.windTerm.z,
+                    c.inverseOtherBirds,
+                    c.deltaT,
+                    c.scatter
+            };
+            begin = integrate_birds_avx2(arrays, constants, begin, end);
+        }
+        integrate_scalar(flock, sx, sy, sz, vdt, c, begin, end);
+    }
+
+    /* the tier bird i should be in, given the one it is in now, and whether it is on screen */
+    BirdLodTier pick_tier(const BirdFlockState& flock, size_t i, const BirdLodView& view, bool& onScreen) {
+        onScreen = true;
+        if (!view.enabled) {
+            return BirdLodTier_Near;
+        }
+
+        // Dropping a tier takes a little more than gaining one
+        float margin = 1 + visibleMargin * (flock.tier[i] != BirdLodTier_Far ? lodHysteresis : 1.0f);
+
+        glm::vec4 clip = view.viewProjection * glm::vec4(flock.position(i), 1);
+        bool visible = clip.w > 0
+                && glm::abs(clip.x) <= clip.w * margin
+                && glm::abs(clip.y) <= clip.w * margin
+                && glm::abs(clip.z) <= clip.w * margin;
+        if (!visible) {
+            onScreen = false;
+            return BirdLodTier_Far;
+        }
+
+        float distance = glm::distance(view.cameraPosition, flock.position(i));
+        float nearLimit = nearDistance * (flock.tier[i] == BirdLodTier_Near ? lodHysteresis : 1.0f);
+        float midLimit = midDistance * (flock.tier[i] != BirdLodTier_Far ? lodHysteresis : 1.0f);
+        if (distance <= nearLimit) {
+            return BirdLodTier_Near;
+        }
+        return distance <= midLimit ? BirdLodTier_Mid : BirdLodTier_Far;
+    }
+
+}
+
+BirdFlock::BirdFlock(
+        std::shared_ptr<Scene> scene,
+        std::string name,
+        const std::vector<NodeHandle>& birds,
+        const BirdFlockParams& params,
+        uint64_t seed
+) : scene(std::move(scene)),
+    flockName(std::move(name)),
+    params(params),
+    walls(params.walls()),
+    wind(params.windSeed),
+    rng(seed) {
+    for (NodeHandle handle : birds) {
+        Bird::add(this->flock, handle, this->scene->node(handle).transform, this->params, this->rng);
+    }
+    write_back_transforms();
+    set_up_instancing();
+}
+
+void BirdFlock::set_up_instancing() {
+    if (this->flock.size() == 0) {
+        return;
+    }
+
+    // The mesh node under the first bird is the one every bird is drawn
+    // with. Only one is instanced, so a bird made of several mesh nodes is
+    // left to the per-node draw path rather than losing all but one.
+    const NodeHandle bird = this->flock.nodes[0];
+    std::vector<NodeHandle> path;
+    std::vector<NodeHandle> below;
+    NodeHandle meshNode = NullNode;
+    int meshNodeCount = 0;
+    for (NodeHandle handle = bird; handle < this->scene->nodes.size(); handle++) {
+        if (!this->scene->node(handle).meshIndices.empty() && path_below(*this->scene, bird, handle, below)) {
+            if (meshNodeCount++ == 0) {
+                meshNode = handle;
+                path = below;
+            }
+        }
+    }
+    if (meshNode == NullNode) {
+        return;
+    }
+    if (meshNodeCount > 1) {
+        std::cerr << "warning: flock " << this->flockName << " is not instanced, its birds have "
+                  << meshNodeCount << " mesh nodes" << std::endl;
+        return;
+    }
+
+    BirdInstancing info;
+    for (NodeHandle handle : path) {
+        info.meshTransform *= this->scene->node(handle).transform;
+    }
+
+    // Every mesh of the node is posed with the same palette, so they must share their bones
+    const std::vector<unsigned int>& meshIndices = this->scene->node(meshNode).meshIndices;
+    const std::vector<Bone>& bones = this->scene->meshes[meshIndices[0]].bones;
+    for (unsigned int meshIndex : meshIndices) {
+        const std::vector<Bone>& meshBones = this->scene->meshes[meshIndex].bones;
+        bool sameBones = meshBones.size() == bones.size();
+        for (size_t j = 0; j < bones.size() && sameBones; j++) {
+            sameBones = meshBones[j].node == bones[j].node;
+        }
+        if (!sameBones) {
+            return;
+        }
+    }
+    if ((int) bones.size() > maxBoneTransforms) {
+        return;
+    }
+
+    std::unordered_map<NodeHandle, int> channels;
+    if (!this->scene->animations.empty()) {
+        const std::vector<Channel>& animationChannels = this->scene->animations[0].channels;
+        for (size_t i = 0; i < animationChannels.size(); i++) {
+            channels[animationChannels[i].node] = (int) i;
+        }
+    }
+
+    this->bonePaths.clear();
+    for (const Bone& bone : bones) {
+        BonePath bonePath;
+        bonePath.offset = bone.offset;
+        if (!path_below(*this->scene, bird, bone.node, bonePath.nodes)) {
+            // The skeleton is not part of the bird, so it cannot be posed per bird
+            return;
+        }
+        for (NodeHandle handle : bonePath.nodes) {
+            auto channel = channels.find(handle);
+            bonePath.channels.push_back(channel == channels.end() ? -1 : channel->second);
+        }
+        this->bonePaths.push_back(std::move(bonePath));
+    }
+
+    info.boneCount = (int) bones.size();
+    info.phaseCount = info.boneCount > 0 ? glm::clamp(maxBoneTransforms / info.boneCount, 1, maxPhases) : 1;
+
+    std::uniform_real_distribution<float> dist_phase(0, 1);
+    for (size_t i = 0; i < this->flock.size(); i++) {
+        info.phases.push_back(dist_phase(this->rng));
+    }
+
+    const Animation* animation = this->scene->animations.empty() ? nullptr : &this->scene->animations[0];
+    if (animation && animation->ticksPerSecond > 0) {
+        info.clipSeconds = animation->duration / animation->ticksPerSecond;
+    }
+
+    if (info.boneCount > 0) {
+        for (unsigned int meshIndex : meshIndices) {
+            info.vertexAnimations.push_back(bakeVertexAnimation(
+                    this->scene->meshes[meshIndex],
+                    vertexAnimationFrames,
+                    [&](double fraction, std::vector<glm::mat4>& palette) {
+                        pose_bird_local(fraction * info.clipSeconds, palette.data());
+                    }
+            ));
+        }
+    }
+
+    for (size_t k = 0; k < meshIndices.size(); k++) {
+        if (info.vertexAnimations.empty()) {
+            info.bounds.extend(this->scene->meshes[meshIndices[k]].bounds.transformed(info.meshTransform));
+        } else {
+            for (const glm::vec4& position : info.vertexAnimations[k].positions) {
+                info.bounds.extend(glm::vec3(position));
+            }
+        }
+    }
+
+    info.meshIndices = meshIndices;
+    this->instancingInfo = std::move(info);
+}
+
+void BirdFlock::pose_bird_local(double time, glm::mat4* palette) const {
+    for (size_t j = 0; j < this->bonePaths.size(); j++) {
+        const BonePath& bonePath = this->bonePaths[j];
+        glm::mat4 boneToBird(1);
+        for (size_t n = 0; n < bonePath.nodes.size(); n++) {
+            boneToBird *= bonePath.channels[n] >= 0
+                    ? this->scene->sampleChannel(0, bonePath.channels[n], time)
+                    : this->scene->node(bonePath.nodes[n]).transform;
+        }
+        palette[j] = boneToBird * bonePath.offset;
+    }
+}
+
+void BirdFlock::update_instances(double time, bool palettes) {
+    if (!this->instancingInfo.enabled()) {
+        return;
+    }
+
+    this->instanceTransforms.resize(this->flock.size());
+    for (size_t i = 0; i < this->flock.size(); i++) {
+        NodeHandle parent = this->scene->node(this->flock.nodes[i]).parent;
+        this->instanceTransforms[i] = this->scene->worldTransform(parent) * this->flock.transforms[i];
+    }
+
+    const BirdInstancing& info = this->instancingInfo;
+    if (!palettes || info.boneCount == 0) {
+        this->phasePalettes.clear();
+        return;
+    }
+
+    /* phase block k poses the skeleton k / phaseCount of the way further into the clip */
+    this->phasePalettes.resize(info.phaseCount * info.boneCount);
+    for (int k = 0; k < info.phaseCount; k++) {
+        pose_bird_local(time + info.clipSeconds * k / info.phaseCount, &this->phasePalettes[k * info.boneCount]);
+    }
+}
+
+void BirdFlock::speed_up() {
+    for (size_t i = 0; i < this->flock.size(); i++) {
+        this->flock.vx[i] += 0.2f * this->flock.vx[i];
+        this->flock.vz[i] += 0.2f * this->flock.vz[i];
+    }
+}
+
+void BirdFlock::slow_down() {
+    for (size_t i = 0; i < this->flock.size(); i++) {
+        this->flock.vx[i] -= 0.2f * this->flock.vx[i];
+        this->flock.vz[i] -= 0.2f * this->flock.vz[i];
+    }
+}
+
+void BirdFlock::animate(double time, double deltaT, const BirdLodView& view, TaskScheduler& scheduler) {
+    const size_t n = this->flock.size();
+    if (n == 0) {
+        return;
+    }
+
+    /* every bird reacts to the flock as it was at the start of the step, so take the flock-wide sums and a
+     * spatial hash of the positions before anything moves
+     */
+    this->positions.resize(n);
+    StepConstants c{};
+    for (size_t i = 0; i < n; i++) {
+        this->positions[i] = this->flock.position(i);
+        c.sumPosition += this->positions[i];
+        c.sumVelocity += this->flock.velocity(i);
+    }
+    const float avoidanceRadius = this->params.avoidanceRadius;
+    this->grid.build(this->positions, avoidanceRadius);
+    c.inverseOtherBirds = 1.f / (float) glm::max(n - 1, (size_t) 1);
+    c.flockCenter = c.sumPosition / (float) n;
+    c.windTerm = this->wind.get_wind_dir(time) / 200.f;
+    c.deltaT = (float) deltaT;
+    c.scatter = this->scatterPending;
+
+    /* returns the vector we need to add to the position of the current boid to prevent collision with
+     * other boids
+     */
+    const auto separation = [&](const size_t currBoid) -> glm::vec3 {
+        glm::vec3 correctionAmt(0);
+        const glm::vec3& position = this->positions[currBoid];
+        this->grid.forEachNeighbor(position, avoidanceRadius, [&](uint32_t currNeighbor) {
+            if (currBoid != currNeighbor) {
+                float distance = glm::distance(position, this->positions[currNeighbor]);
+                correctionAmt -=
+                        (this->positions[currNeighbor] - position) *
+                        ((avoidanceRadius - distance) / avoidanceRadius) / 1.5f;
+            }
+        });
+        return correctionAmt;
+    };
+
+    /* returns the vector that keeps the current boid inside the walls */
+    const auto wall_correction = [&](const size_t currBoid) -> glm::vec3 {
+        glm::vec3 correctionAmt(0);
+        const glm::vec3& position = this->positions[currBoid];
+
+        // if a bird is going to go out of bounds, make it turn hard
+        for (auto & wall : this->walls) {
+            float distance_to_wall = glm::dot(wall.normal, position - wall.point);
+            if (distance_to_wall <= 8.0) {
+                // Apply a force in the direction of the wall's normal.
+                float correction_magnitude = glm::clamp(std::exp(-distance_to_wall - 20.0f), 0.0f, 0.2f);
+
+                glm::vec4 dir4;
+                switch (currBoid % 3) {
+                    case 0:
+                        dir4 = glm::rotate(
+                            glm::pi<float>() / 4,
+                            glm::vec3(0, 1, 0)
+                        ) * glm::vec4(wall.normal, 0);
+                        break;
+                    case 1:
+                        dir4 = glm::rotate(
+                            0.0f,
+                            glm::vec3(0, 1, 0)
+                        ) * glm::vec4(wall.normal, 0);
+                        break;
+                    default:
+                        dir4 = glm::rotate(
+                            -glm::pi<float>() / 6,
+                            glm::vec3(0, 1, 0)
+                        ) * glm::vec4(wall.normal, 0);
+                        break;
+                }
+                glm::vec3 dir = glm::normalize(glm::vec3(dir4.x, dir4.y, dir4.z));
+                correctionAmt += correction_magnitude * dir;
+            }
+        }
+        return correctionAmt;
+    };
+
+    /* pass 1: pick each bird's tier and do the neighbor search for the birds that get one this step, reading
+     * only the start-of-step positions. Mid-tier birds that skip the search keep their last correction and
+     * are only extrapolated. Far birds join the far group once their separation has faded out (at once when
+     * they are off screen); a grouped bird is only looked at every farInterval steps, staggered, and then
+     * only gets its tier and wall correction, no neighbor search or look-ahead.
+     */
+    this->separationX.resize(n);
+    this->separationY.resize(n);
+    this->separationZ.resize(n);
+    this->velocityDeltaT.resize(n);
+    this->grouped.resize(n, BirdGroup_None);
+    this->looking.resize((n + grainSize - 1) / grainSize);
+    const float fadeStep = c.deltaT / separationFadeTime;
+    scheduler.parallelFor(n, grainSize, [&](size_t begin, size_t end) {
+        // Birds in this chunk that computed a correction this step
+        std::vector<size_t>& looking = this->looking[begin / grainSize];
+        looking.clear();
+        for (size_t i = begin; i < end; i++) {
+            // A scatter is a one-step push, so it reaches every grouped bird
+            if (this->grouped[i] != BirdGroup_None && !c.scatter && (i + this->stepCount) % farInterval != 0) {
+                this->grouped[i] = BirdGroup_Moved;
+                this->flock.pendingDeltaT[i] += c.deltaT;
+                continue;
+            }
+
+            bool onScreen;
+            BirdLodTier tier = pick_tier(this->flock, i, view, onScreen);
+            this->flock.tier[i] = tier;
+
+            glm::vec3 correction;
+            if (tier == BirdLodTier_Far && (!onScreen || this->flock.separationWeight[i] <= 0)) {
+                this->grouped[i] = BirdGroup_Steered;
+                this->flock.separationWeight[i] = 0;
+                this->flock.pendingDeltaT[i] += c.deltaT;
+                correction = wall_correction(i);
+                this->separationX[i] = correction.x;
+                this->separationZ[i] = correction.z;
+                continue;
+            }
+
+            // Separation fades out while a bird in sight crosses into the far
+            // tier, and back in after it leaves it
+            this->grouped[i] = BirdGroup_None;
+            float weight = this->flock.separationWeight[i] + (tier == BirdLodTier_Far ? -fadeStep : fadeStep);
+            this->flock.separationWeight[i] = glm::clamp(weight, 0.0f, 1.0f);
+            this->flock.pendingDeltaT[i] += c.deltaT;
+
+            bool search = tier != BirdLodTier_Mid || (i + this->stepCount) % midInterval == 0;
+            if (!search) {
+                this->velocityDeltaT[i] = 0;
+                continue;
+            }
+            this->velocityDeltaT[i] = this->flock.pendingDeltaT[i];
+            this->flock.pendingDeltaT[i] = 0;
+            correction = this->flock.separationWeight[i] * separation(i) + wall_correction(i);
+
+            this->separationX[i] = correction.x;
+            this->separationY[i] = correction.y;
+            this->separationZ[i] = correction.z;
+            if (this->obstacles) {
+                looking.push_back(i);
+            }
+        }
+
+        /* look ahead for obstacles, eight birds per packet */
+        for (size_t k = 0; k < looking.size(); k += 8) {
+            int count = (int) std::min(looking.size() - k, (size_t) 8);
+            glm::vec3 origins[8], directions[8];
+            float distances[8];
+            for (int j = 0; j < count; j++) {
+                size_t i = looking[k + j];
+                glm::vec3 velocity = this->flock.velocity(i);
+                float speed = glm::length(velocity);
+                origins[j] = this->positions[i];
+                directions[j] = speed > 0 ? velocity / speed : glm::vec3(1, 0, 0);
+                distances[j] = speed * lookAheadTime + avoidanceRadius;
+            }
+
+            ObstacleHits hits;
+            this->obstacles->intersect8(count, origins, directions, distances, hits);
+
+            for (int j = 0; j < count; j++) {
+                if (!std::isfinite(hits.t[j])) {
+                    continue;
+                }
+                // Birds only steer horizontally, so turn along the horizontal
+                // part of the surface normal, or sideways off a floor or ceiling
+                glm::vec3 normal = glm::normalize(hits.normal[j]);
+                if (glm::dot(normal, directions[j]) > 0) {
+                    normal = -normal;
+                }
+                glm::vec3 away(normal.x, 0, normal.z);
+                if (glm::dot(away, away) < 1e-4f) {
+                    away = glm::vec3(-directions[j].z, 0, directions[j].x);
+                }
+                if (glm::dot(away, away) < 1e-8f) {
+                    continue;
+                }
+                away = glm::normalize(away) * obstacleSteering * (1 - hits.t[j] / distances[j]);
+
+                size_t i = looking[k + j];
+                this->separationX[i] += away.x;
+                this->separationZ[i] += away.z;
+            }
+        }
+    });
+    this->stepCount++;
+
+    /* the far group steers as one body: the cohesion, alignment and wind terms are taken once, at its centroid
+     * and mean velocity as of the last step, and every grouped bird gets the same change in velocity, so the
+     * group keeps its shape and turns around its centroid
+     */
+    this->farGroup.deltaV = glm::vec3(0);
+    if (this->farGroup.count > 0) {
+        glm::vec3 center = this->farGroup.sumPosition / (float) this->farGroup.count;
+        glm::vec3 velocity = this->farGroup.sumVelocity / (float) this->farGroup.count;
+        glm::vec3 centerOfMass = ((c.sumPosition - center) * c.inverseOtherBirds - center) / 150.f;
+        glm::vec3 centerOfVelocity = ((c.sumVelocity - velocity) * c.inverseOtherBirds - velocity) / 160.f;
+        this->farGroup.deltaV = (centerOfMass + centerOfVelocity + c.windTerm) * 51.14f;
+        this->farGroup.deltaV.y = 0;
+    }
+
+    /* pass 2: integrate and orient, each bird only touching its own state. Runs of ungrouped birds go through
+     * the kernel; grouped birds are moved here, and only the steered ones take a change in velocity
+     */
+    std::mutex groupMutex;
+    glm::vec3 groupSumPosition(0), groupSumVelocity(0);
+    size_t groupCount = 0;
+    scheduler.parallelFor(n, grainSize, [&](size_t begin, size_t end) {
+        glm::vec3 sumPosition(0), sumVelocity(0);
+        size_t count = 0;
+        for (size_t i = begin; i < end;) {
+            if (this->grouped[i] == BirdGroup_None) {
+                size_t runEnd = i + 1;
+                while (runEnd < end && this->grouped[runEnd] == BirdGroup_None) {
+                    runEnd++;
+                }
+                integrate(this->flock, this->separationX, this->separationY, this->separationZ,
+                          this->velocityDeltaT, c, i, runEnd);
+                for (; i < runEnd; i++) {
+                    glm::vec3 deltaV(this->flock.deltaVx[i], 0, this->flock.deltaVz[i]);
+                    this->flock.transforms[i] = Bird::transform(this->flock, i, deltaV);
+                }
+                continue;
+            }
+
+            glm::vec3 velocity = this->flock.velocity(i);
+            glm::vec3 offset = velocity * c.deltaT;
+            if (this->grouped[i] == BirdGroup_Steered) {
+                glm::vec3 deltaV = this->farGroup.deltaV + glm::vec3(this->separationX[i], 0, this->separationZ[i]) * 51.14f;
+                if (c.scatter) {
+                    glm::vec3 scatterVector = this->positions[i] - c.flockCenter;
+                    deltaV += scatterVector * (250.f / glm::max(glm::dot(scatterVector, scatterVector), 1e-4f)) * 51.14f;
+                    deltaV.y = 0;
+                }
+                velocity += deltaV * this->flock.pendingDeltaT[i];
+                this->flock.pendingDeltaT[i] = 0;
+                offset = velocity * c.deltaT;
+                if (glm::dot(velocity, velocity) > this->flock.initSpeed[i] * this->flock.initSpeed[i]) velocity *= 0.99f;
+                this->flock.vx[i] = velocity.x;
+                this->flock.vy[i] = velocity.y;
+                this->flock.vz[i] = velocity.z;
+                this->flock.deltaVx[i] = deltaV.x;
+                this->flock.deltaVz[i] = deltaV.z;
+            }
+            this->flock.px[i] += offset.x;
+            this->flock.py[i] += offset.y;
+            this->flock.pz[i] += offset.z;
+            if (this->grouped[i] == BirdGroup_Steered) {
+                glm::vec3 deltaV(this->flock.deltaVx[i], 0, this->flock.deltaVz[i]);
+                this->flock.transforms[i] = Bird::transform(this->flock, i, deltaV);
+            } else {
+                // Heading and bank are kept until the bird is steered again
+                this->flock.transforms[i][3] += glm::vec4(offset, 0);
+            }
+
+            sumPosition += this->flock.position(i);
+            sumVelocity += velocity;
+            count++;
+            i++;
+        }
+
+        std::lock_guard<std::mutex> lock(groupMutex);
+        groupSumPosition += sumPosition;
+        groupSumVelocity += sumVelocity;
+        groupCount += count;
+    });
+    this->farGroup.sumPosition = groupSumPosition;
+    this->farGroup.sumVelocity = groupSumVelocity;
+    this->farGroup.count = groupCount;
+
+    write_back_transforms();
+    this->scatterPending = false;
+}
+
+void BirdFlock::write_back_transforms() {
+    for (size_t i = 0; i < this->flock.size(); i++) {
+        this->scene->node(this->flock.nodes[i]).transform = this->flock.transforms[i];
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include "Bird.hpp"
+#include "ObstacleScene.h"
+#include "Scene.h"
+#include "SpatialHash.h"
+#include "TaskScheduler.h"
+#include "VertexAnimation.h"
+
+// Every bird is drawn as an instance of the first bird's mesh node; birds
+// with more than one mesh node are not instanced at all. Skinned
+// meshes are posed with bird-local bone palettes, sampled at a few phase
+// offsets into the clip so that the birds do not all flap in lockstep.
+struct BirdInstancing
+{
+    // Meshes of the first bird, drawn once per bird
+    std::vector<unsigned int> meshIndices;
+    // Mesh node relative to the bird node, for meshes without bones
+    glm::mat4 meshTransform = glm::mat4(1);
+
+    // Fraction of the clip each bird is ahead by, per instance
+    std::vector<float> phases;
+    int phaseCount = 1;
+    int boneCount = 0;
+
+    // Length of one loop of the clip in seconds, and the clip baked for each
+    // skinned mesh (parallel to meshIndices, empty without bones)
+    double clipSeconds = 0;
+    std::vector<VertexAnimationData> vertexAnimations;
+
+    // Of one bird's meshes in bird space, over the whole baked clip
+    Bounds bounds;
+
+    bool enabled() const { return !meshIndices.empty(); }
+};
+
+// Where the flock is seen from, used to pick each bird's simulation tier.
+// With enabled unset every bird is simulated in full.
+struct BirdLodView
+{
+    bool enabled = false;
+    glm::vec3 cameraPosition = glm::vec3(0);
+    glm::mat4 viewProjection = glm::mat4(1);
+};
+
+// One flock of boids with its own bounds, wind and random state. Flocks
+// share nothing but the (read-only) obstacle scene, so different flocks can
+// be stepped concurrently.
+class BirdFlock
+{
+public:
+    BirdFlock(
+            std::shared_ptr<Scene> scene,
+            std::string name,
+            const std::vector<NodeHandle>& birds,
+            const BirdFlockParams& params,
+            uint64_t seed
+    );
+
+    const std::string& name() const { return this->flockName; }
+    size_t size() const { return this->flock.size(); }
+
+    void speed_up();
+    void slow_down();
+    // Push the birds away from the flock's center on the next step
+    void scatter() { this->scatterPending = true; }
+    // Steer around the given geometry from the next step on
+    void set_obstacles(const ObstacleScene* obstacles) { this->obstacles = obstacles; }
+
+    // Advance the flock by deltaT seconds, ending at the given time. The work
+    // is split across the scheduler's threads. Birds far from (or out of
+    // sight of) the view get a cheaper simulation; see BirdLodTier.
+    void animate(double time, double deltaT, const BirdLodView& view, TaskScheduler& scheduler);
+
+    const BirdInstancing& instancing() const { return this->instancingInfo; }
+
+    // Fill instanceTransforms, and phasePalettes unless the flock is played
+    // back from its baked vertex animation, for the given time. Reads world
+    // transforms, so run it after Scene::updateWorldTransforms.
+    void update_instances(double time, bool palettes);
+
+    // Bird-to-world transform per instance
+    std::vector<glm::mat4> instanceTransforms;
+    // Bird-local skinning matrices, phaseCount blocks of boneCount each
+    std::vector<glm::mat4> phasePalettes;
+
+private:
+    std::shared_ptr<Scene> scene;
+    std::string flockName;
+    BirdFlockParams params;
+    // Static and animated scene geometry to steer around; may be null
+    const ObstacleScene* obstacles = nullptr;
+    std::vector<Wall> walls;
+    Wind wind;
+    std::mt19937_64 rng;
+    BirdFlockState flock;
+    bool scatterPending = false;
+
+    // Per-step scratch, kept to avoid reallocating
+    std::vector<glm::vec3> positions;
+    std::vector<float> separationX, separationY, separationZ;
+    std::vector<float> velocityDeltaT;
+    std::vector<uint8_t> grouped; // per bird, how the far group moves it this step
+    std::vector<std::vector<size_t>> looking; // per chunk, birds casting look-ahead rays
+    SpatialHash grid;
+    uint64_t stepCount = 0;
+
+    // The far tier's birds as one body: its sums as of the end of the last
+    // step, and the change in velocity it steers its birds by this step
+    struct FarGroup {
+        glm::vec3 sumPosition = glm::vec3(0);
+        glm::vec3 sumVelocity = glm::vec3(0);
+        size_t count = 0;
+        glm::vec3 deltaV = glm::vec3(0);
+    } farGroup;
+
+    BirdInstancing instancingInfo;
+
+    // Nodes from just below the first bird down to each bone of the shared
+    // mesh, with the channel (or -1) that animates each of them
+    struct BonePath {
+        std::vector<NodeHandle> nodes;
+        std::vector<int> channels;
+        glm::mat4 offset;
+    };
+    std::vector<BonePath> bonePaths;
+
+    void write_back_transforms();
+    void set_up_instancing();
+    void pose_bird_local(double time, glm::mat4* palette) const;
+};
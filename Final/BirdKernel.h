@@ -0,0 +1,45 @@
+#ifndef CS5625_BIRDKERNEL_H
+#define CS5625_BIRDKERNEL_H
+
+#include <cstddef>
+
+// The AVX2 half of the boids integration in BirdFlock.cpp. It lives in its
+// own file because only that file is built with AVX2 enabled (see
+// CMakeLists.txt); BirdFlock checks at run time that the CPU has AVX2 before
+// calling it. The interface is plain pointers and floats so that the file
+// pulls in no inline code that the rest of the program could end up sharing.
+
+// The flock's arrays, see BirdFlockState, and the per-bird inputs of a step
+struct BirdKernelArrays {
+    float* px;
+    float* py;
+    float* pz;
+    float* vx;
+    float* vy;
+    float* vz;
+    float* deltaVx;
+    float* deltaVz;
+    const float* initSpeed;
+    const float* sx;
+    const float* sz;
+    const float* vdt;
+};
+
+// Flock-wide terms of a step
+struct BirdKernelConstants {
+    float sumPx, sumPz;
+    float sumVx, sumVz;
+    float centerX, centerY, centerZ;
+    float windX, windZ;
+    float inverseOtherBirds;
+    float deltaT;
+    bool scatter;
+};
+
+// Integrates birds [begin, end) eight at a time and returns the first bird
+// it left for the scalar code, i.e. begin plus a multiple of eight. Returns
+// begin when the build has no AVX2.
+size_t integrate_birds_avx2(const BirdKernelArrays& a, const BirdKernelConstants& c, size_t begin, size_t end);
+
+
+#endif //CS5625_BIRDKERNEL_H
@@ -0,0 +1,88 @@
+#include "BirdKernel.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+size_t integrate_birds_avx2(const BirdKernelArrays& a, const BirdKernelConstants& c, size_t begin, size_t end) {
+#if defined(__AVX2__)
+    const __m256 sumPx = _mm256_set1_ps(c.sumPx);
+    const __m256 sumPz = _mm256_set1_ps(c.sumPz);
+    const __m256 sumVx = _mm256_set1_ps(c.sumVx);
+    const __m256 sumVz = _mm256_set1_ps(c.sumVz);
+    const __m256 centerX = _mm256_set1_ps(c.centerX);
+    const __m256 centerY = _mm256_set1_ps(c.centerY);
+    const __m256 centerZ = _mm256_set1_ps(c.centerZ);
+    const __m256 windX = _mm256_set1_ps(c.windX);
+    const __m256 windZ = _mm256_set1_ps(c.windZ);
+    const __m256 inverseOthers = _mm256_set1_ps(c.inverseOtherBirds);
+    const __m256 dt = _mm256_set1_ps(c.deltaT);
+    const __m256 massScale = _mm256_set1_ps(150.f);
+    const __m256 velocityScale = _mm256_set1_ps(160.f);
+    const __m256 scatterScale = _mm256_set1_ps(250.f);
+    const __m256 gain = _mm256_set1_ps(51.14f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 damping = _mm256_set1_ps(0.99f);
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 px = _mm256_loadu_ps(a.px + i);
+        __m256 py = _mm256_loadu_ps(a.py + i);
+        __m256 pz = _mm256_loadu_ps(a.pz + i);
+        __m256 vx = _mm256_loadu_ps(a.vx + i);
+        __m256 vy = _mm256_loadu_ps(a.vy + i);
+        __m256 vz = _mm256_loadu_ps(a.vz + i);
+
+        // deltaV.y is dropped at the end, so only x and z are accumulated
+        __m256 dvx = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(sumPx, px), inverseOthers), px), massScale);
+        __m256 dvz = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(sumPz, pz), inverseOthers), pz), massScale);
+        dvx = _mm256_add_ps(dvx, _mm256_loadu_ps(a.sx + i));
+        dvz = _mm256_add_ps(dvz, _mm256_loadu_ps(a.sz + i));
+        dvx = _mm256_add_ps(dvx, _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(sumVx, vx), inverseOthers), vx), velocityScale));
+        dvz = _mm256_add_ps(dvz, _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(sumVz, vz), inverseOthers), vz), velocityScale));
+
+        if (c.scatter) {
+            __m256 dx = _mm256_sub_ps(px, centerX);
+            __m256 dy = _mm256_sub_ps(py, centerY);
+            __m256 dz = _mm256_sub_ps(pz, centerZ);
+            __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            __m256 k = _mm256_div_ps(scatterScale, d2);
+            dvx = _mm256_add_ps(dvx, _mm256_mul_ps(dx, k));
+            dvz = _mm256_add_ps(dvz, _mm256_mul_ps(dz, k));
+        }
+
+        dvx = _mm256_mul_ps(_mm256_add_ps(dvx, windX), gain);
+        dvz = _mm256_mul_ps(_mm256_add_ps(dvz, windZ), gain);
+
+        __m256 velocityDt = _mm256_loadu_ps(a.vdt + i);
+        vx = _mm256_add_ps(vx, _mm256_mul_ps(dvx, velocityDt));
+        vz = _mm256_add_ps(vz, _mm256_mul_ps(dvz, velocityDt));
+        px = _mm256_add_ps(px, _mm256_mul_ps(vx, dt));
+        py = _mm256_add_ps(py, _mm256_mul_ps(vy, dt));
+        pz = _mm256_add_ps(pz, _mm256_mul_ps(vz, dt));
+
+        __m256 speed2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+        __m256 initSpeed = _mm256_loadu_ps(a.initSpeed + i);
+        __m256 tooFast = _mm256_cmp_ps(speed2, _mm256_mul_ps(initSpeed, initSpeed), _CMP_GT_OQ);
+        __m256 factor = _mm256_blendv_ps(one, damping, tooFast);
+        vx = _mm256_mul_ps(vx, factor);
+        vy = _mm256_mul_ps(vy, factor);
+        vz = _mm256_mul_ps(vz, factor);
+
+        _mm256_storeu_ps(a.px + i, px);
+        _mm256_storeu_ps(a.py + i, py);
+        _mm256_storeu_ps(a.pz + i, pz);
+        _mm256_storeu_ps(a.vx + i, vx);
+        _mm256_storeu_ps(a.vy + i, vy);
+        _mm256_storeu_ps(a.vz + i, vz);
+        _mm256_storeu_ps(a.deltaVx + i, dvx);
+        _mm256_storeu_ps(a.deltaVz + i, dvz);
+    }
+    return i;
+#else
+    (void) a;
+    (void) c;
+    (void) end;
+    return begin;
+#endif
+}
@@ -3,139 +3,116 @@
 //
 
 #include "BirdNodeAnimator.h"
-#include <glm/gtx/transform.hpp>
+#include <map>
 
-bool BirdNodeAnimator::scatter = false;
-double BirdNodeAnimator::prevT = 0.0;
+BirdNodeAnimator::BirdNodeAnimator(std::shared_ptr<Scene> scene, uint64_t seed) : scene(scene) {
+    // Flocks in the order their first bird appears in the arena
+    std::vector<std::string> names;
+    std::map<std::string, std::vector<NodeHandle>> birds;
+    std::map<std::string, NodeHandle> bounds;
+    for (NodeHandle handle = 0; handle < scene->nodes.size(); handle++) {
+        const std::string& nodeName = scene->node(handle).name;
+        if (Bird::is_bounds(nodeName)) {
+            bounds[nodeName.substr(0, nodeName.size() - std::string("Bounds").size())] = handle;
+        } else if (Bird::is_bird(nodeName)) {
+            std::string flockName = Bird::flock_name(nodeName);
+            if (birds.find(flockName) == birds.end()) {
+                names.push_back(flockName);
+            }
+            birds[flockName].push_back(handle);
+        }
+    }
 
-BirdNodeAnimator::BirdNodeAnimator(std::shared_ptr<Scene> scene) {
-    add_birds(scene->root);
-}
+    for (size_t i = 0; i < names.size(); i++) {
+        BirdFlockParams params;
+        params.windSeed = seed + i;
+
+        auto bound = bounds.find(names[i]);
+        if (bound != bounds.end()) {
+            glm::mat4 boundsTransform = scene->worldTransform(bound->second);
+            params.center = glm::vec3(boundsTransform[3]);
+            params.halfExtent = glm::vec2(glm::length(glm::vec3(boundsTransform[0])), glm::length(glm::vec3(boundsTransform[2])));
+        }
+
+        this->birdFlocks.push_back(std::make_unique<BirdFlock>(scene, names[i], birds[names[i]], params, seed + i));
+    }
 
-void BirdNodeAnimator::add_birds(std::shared_ptr<Node> currNode) {
-    if (Bird::is_bird(currNode->name)) {
-        this->birds.emplace_back(currNode);
+    // Parents precede children in the arena, so one pass marks every subtree
+    // of an instanced flock
+    std::vector<bool> instancedBird(scene->nodes.size(), false);
+    for (const auto& flock : this->birdFlocks) {
+        if (flock->instancing().enabled()) {
+            for (NodeHandle handle : birds[flock->name()]) {
+                instancedBird[handle] = true;
+            }
+        }
     }
-    for (std::shared_ptr<Node> child : currNode->children) {
-        add_birds(child);
+    this->instanced.assign(scene->nodes.size(), false);
+    for (NodeHandle handle = 0; handle < scene->nodes.size(); handle++) {
+        const Node& node = scene->node(handle);
+        this->instanced[handle] = instancedBird[handle] || (node.parent != NullNode && this->instanced[node.parent]);
     }
+
+    // Instanced birds are posed from the clip by their flock, so the scene
+    // need not animate their skeletons or build their bone palettes
+    scene->unanimatedNodes = this->instanced;
 }
 
 void BirdNodeAnimator::speed_up_birds() {
-    for (auto& bird : this->birds) {
-        bird.velocity += (glm::vec3 { 0.2, 0, 0.2 }) * bird.velocity;
+    for (auto& flock : this->birdFlocks) {
+        flock->speed_up();
     }
 }
 
 void BirdNodeAnimator::slow_down_birds() {
-    for (auto& bird : this->birds) {
-        bird.velocity -= (glm::vec3 { 0.2, 0, 0.2 }) * bird.velocity;
+    for (auto& flock : this->birdFlocks) {
+        flock->slow_down();
     }
 }
 
-void BirdNodeAnimator::animate_birds(double time) {
-    double deltaT = time - BirdNodeAnimator::prevT;
-    BirdNodeAnimator::prevT = time;
-    /* returns the vector we need to add to the position of the current boid to move it
-     * 1% of the way to the center of mass of its neighbors
-     */
-    const auto center_of_mass = [&](const size_t currBoid) -> glm::vec3 {
-        glm::vec3 avgPosition(0);
-        for (size_t currNeighbor = 0; currNeighbor < this->birds.size(); currNeighbor++) {
-            if (currBoid != currNeighbor) avgPosition += this->birds[currNeighbor].position;
-        }
-        avgPosition /= glm::max((unsigned long)(this->birds.size() - 1), (unsigned long)1);
-        return (avgPosition - this->birds[currBoid].position) / 150.f;
-    };
-
-    /* returns the vector we need to add to the position of the current boid to prevent collision with
-     * other boids
-     */
-    const auto course_correction = [&](const size_t currBoid) -> glm::vec3 {
-        glm::vec3 correctionAmt(0);
-        for (size_t currNeighbor = 0; currNeighbor < this->birds.size(); currNeighbor++) {
-            if (currBoid != currNeighbor) {
-                float distance = glm::distance(this->birds[currBoid].position, this->birds[currNeighbor].position);
-                const float dist = 5.0f;
-                if (distance <= dist) {
-                    correctionAmt -=
-                            (this->birds[currNeighbor].position - this->birds[currBoid].position) *
-                            ((dist - distance) / dist) / 1.5f;
-                }
-            }
-        }
-
-        // if a bird is going to go out of bounds, make it turn hard
-        for (auto & wall : Bird::walls) {
-            float distance_to_wall = glm::dot(wall.normal, this->birds[currBoid].position - wall.point);
-            if (distance_to_wall <= 8.0) {
-                // Apply a force in the direction of the wall's normal.
-                float correction_magnitude = glm::clamp(exp(-distance_to_wall - 20.0f), 0.0f, 0.2f);
+void BirdNodeAnimator::scatter() {
+    for (auto& flock : this->birdFlocks) {
+        flock->scatter();
+    }
+}
 
-                glm::vec4 dir4;
-                switch (currBoid % 3) {
-                    case 0:
-                        dir4 = glm::rotate(
-                            glm::pi<float>() / 4,
-                            glm::vec3(0, 1, 0)
-                        ) * glm::vec4(wall.normal, 0);
-                        break;
-                    case 1:
-                        dir4 = glm::rotate(
-                            0.0f,
-                            glm::vec3(0, 1, 0)
-                        ) * glm::vec4(wall.normal, 0);
-                        break;
-                    default:
-                        dir4 = glm::rotate(
-                            -glm::pi<float>() / 6,
-                            glm::vec3(0, 1, 0)
-                        ) * glm::vec4(wall.normal, 0);
-                        break;
-                }
-                glm::vec3 dir = glm::normalize(glm::vec3(dir4.x, dir4.y, dir4.z));
-                correctionAmt += correction_magnitude * dir;
-            }
-        }
-        return correctionAmt;
-    };
+void BirdNodeAnimator::build_obstacles() {
+    // Birds steer around everything except other birds, which separation
+    // already handles
+    std::vector<bool> inBird(scene->nodes.size(), false);
+    for (NodeHandle handle = 0; handle < scene->nodes.size(); handle++) {
+        const Node& node = scene->node(handle);
+        inBird[handle] = Bird::is_bird(node.name) || (node.parent != NullNode && inBird[node.parent]);
+    }
+    this->obstacles = std::make_unique<ObstacleScene>(scene, [&](NodeHandle handle) {
+        return !inBird[handle] && !Bird::is_bounds(scene->node(handle).name);
+    });
+    for (auto& flock : this->birdFlocks) {
+        flock->set_obstacles(this->obstacles.get());
+    }
+}
 
-    /* returns the vector that we need to add to the velocity of the current boid to get the new velocity */
-    const auto center_of_velocity = [&](const size_t currBoid) -> glm::vec3 {
-        glm::vec3 avgVelocity(0);
-        for (size_t currNeighbor = 0; currNeighbor < this->birds.size(); currNeighbor++) {
-            if (currBoid != currNeighbor) avgVelocity += this->birds[currNeighbor].velocity;
-        }
-        avgVelocity /= glm::max((unsigned long)(this->birds.size() - 1), (unsigned long)1);
-        return (avgVelocity - this->birds[currBoid].velocity) / 160.f;
-    };
+void BirdNodeAnimator::update_obstacles() {
+    if (this->obstacles) {
+        this->obstacles->update();
+    }
+}
 
-    const auto calc_scatter = [&](const size_t currBoid) -> glm::vec3 {
-        glm::vec3 avgPosition(0);
-        for (const auto& bird : this->birds) {
-            avgPosition += bird.position;
+void BirdNodeAnimator::animate_birds(double time, double deltaT, const BirdLodView& view, TaskScheduler& scheduler) {
+    if (!this->obstacles && !this->birdFlocks.empty()) {
+        build_obstacles();
+    }
+    scheduler.parallelFor(this->birdFlocks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            this->birdFlocks[i]->animate(time, deltaT, view, scheduler);
         }
-        avgPosition /= glm::max((unsigned long)(this->birds.size()), (unsigned long)1);
-
-        glm::vec3 scatterVector =  this->birds[currBoid].position - avgPosition;
-        const auto scatterFactor = 1.f / glm::length(scatterVector);
-        return glm::normalize(scatterVector) * scatterFactor * 250.f;
-    };
+    });
+}
 
-    glm::vec3 currWind = Bird::wind.get_wind_dir(time);
-    for (size_t currBoid = 0; currBoid < this->birds.size(); currBoid++) {
-        glm::vec3 deltaV = center_of_mass(currBoid) +
-                           course_correction(currBoid)  +
-                           center_of_velocity(currBoid);
-        if (BirdNodeAnimator::scatter) {
-            deltaV += calc_scatter(currBoid);
+void BirdNodeAnimator::update_instances(double time, bool palettes, TaskScheduler& scheduler) {
+    scheduler.parallelFor(this->birdFlocks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            this->birdFlocks[i]->update_instances(time, palettes);
         }
-        deltaV += currWind / 200.f;
-        deltaV *= 51.14f;
-        deltaV.y = 0;
-        this->birds[currBoid].velocity += deltaV * (float) deltaT;
-        this->birds[currBoid].position += this->birds[currBoid].velocity * (float) deltaT;
-        this->birds[currBoid].update_self(deltaV);
-    }
-    if (BirdNodeAnimator::scatter) BirdNodeAnimator::scatter = false;
-}
\ No newline at end of file
+    });
+}
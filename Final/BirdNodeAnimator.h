@@ -6,20 +6,49 @@
 
 #include <vector>
 #include <memory>
-#include "Bird.hpp"
+#include "BirdFlock.h"
+#include "ObstacleScene.h"
 #include "Scene.h"
+#include "TaskScheduler.h"
 
+// Finds the flocks in a scene and steps them. Bird nodes are grouped into
+// flocks by name (see Bird::is_bird and Bird::flock_name), so "GullBird",
+// "GullBird.001", ... form one flock and "TernBird", "TernBird.001", ...
+// another; the scenes in resources use plain "Bird". A node named
+// "GullBirdBounds" sets the bounds of the "GullBird" flock from its world
+// transform, taken as a unit cube.
 class BirdNodeAnimator
 {
 public:
-    BirdNodeAnimator(std::shared_ptr<Scene> scene);
+    // Flock i is seeded with seed + i, so every run is reproducible
+    explicit BirdNodeAnimator(std::shared_ptr<Scene> scene, uint64_t seed = 5625);
     void speed_up_birds();
     void slow_down_birds();
-    void animate_birds(double time);
-    static bool scatter;
-    static double prevT;
+    void scatter();
+
+    // Step every flock; flocks run in parallel with each other, as well as
+    // within themselves. The first step builds the obstacle scene, so scenes
+    // without birds, or with birds off, never pay for it.
+    void animate_birds(double time, double deltaT, const BirdLodView& view, TaskScheduler& scheduler);
+
+    // Refit the obstacle scene, if built, to the current world transforms.
+    // Must not run while the flocks are being stepped.
+    void update_obstacles();
+
+    // See BirdFlock::update_instances
+    void update_instances(double time, bool palettes, TaskScheduler& scheduler);
+
+    // True for bird nodes and everything under them when their flock is
+    // drawn instanced; those nodes should not be drawn one by one.
+    bool is_instanced(NodeHandle handle) const { return !this->instanced.empty() && this->instanced[handle]; }
+
+    const std::vector<std::unique_ptr<BirdFlock>>& flocks() const { return this->birdFlocks; }
 
 private:
-    std::vector<Bird> birds;
-    void add_birds(std::shared_ptr<Node> currNode);
+    std::shared_ptr<Scene> scene;
+    std::unique_ptr<ObstacleScene> obstacles;
+    std::vector<std::unique_ptr<BirdFlock>> birdFlocks;
+    std::vector<bool> instanced;
+
+    void build_obstacles();
 };
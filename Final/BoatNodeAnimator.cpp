@@ -9,15 +9,16 @@
 #include "glm/gtx/quaternion.hpp"
 #include "RTUtil/output.hpp"
 
-BoatNodeAnimator::BoatNodeAnimator(std::shared_ptr<Node> boatNode) {
-    node = boatNode;
+BoatNodeAnimator::BoatNodeAnimator(std::shared_ptr<Scene> scene, NodeHandle boatNode) :
+    scene(std::move(scene)),
+    node(boatNode) {
 }
 
 void BoatNodeAnimator::update(
-        tessendorf::array2d<float> displacementMap,
-        tessendorf::array2d<float> gradXMap,
-        tessendorf::array2d<float> gradZMap,
-        glm::mat4 oceanTransform
+        const tessendorf::array2d<float>& displacementMap,
+        const tessendorf::array2d<float>& gradXMap,
+        const tessendorf::array2d<float>& gradZMap,
+        const glm::mat4& oceanTransform
 ) {
     glm::vec3 positionAcc(0);
     glm::vec3 normalAcc(0);
@@ -49,7 +50,7 @@ void BoatNodeAnimator::update(
 
     normalAcc = glm::normalize(normalAcc + glm::vec3(0, 10, 0));
 
-    node->transform =
+    scene->node(node).transform =
             glm::translate(positionAcc)
             * glm::mat4_cast(glm::rotation(glm::vec3(0, 1, 0), normalAcc));
 }
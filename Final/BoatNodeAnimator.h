@@ -11,19 +11,20 @@
 
 
 class BoatNodeAnimator {
-    std::shared_ptr<Node> node;
+    std::shared_ptr<Scene> scene;
+    NodeHandle node;
 
 public:
     static bool is_boat(const std::string& nodeName) {
         return nodeName == "paperboat";
     };
 
-    BoatNodeAnimator(std::shared_ptr<Node> boatNode);
+    BoatNodeAnimator(std::shared_ptr<Scene> scene, NodeHandle boatNode);
     void update(
-            tessendorf::array2d<float> displacementMap,
-            tessendorf::array2d<float> gradXMap,
-            tessendorf::array2d<float> gradZMap,
-            glm::mat4 oceanTransform
+            const tessendorf::array2d<float>& displacementMap,
+            const tessendorf::array2d<float>& gradXMap,
+            const tessendorf::array2d<float>& gradZMap,
+            const glm::mat4& oceanTransform
     );
 };
 
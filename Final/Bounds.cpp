@@ -0,0 +1,68 @@
+#include "Bounds.h"
+
+glm::vec3 Bounds::corner(int k) const {
+    return glm::vec3(k & 1 ? max.x : min.x, k & 2 ? max.y : min.y, k & 4 ? max.z : min.z);
+}
+
+void Bounds::extend(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void Bounds::extend(const Bounds& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+bool Bounds::intersects(const Bounds& other) const {
+    return min.x <= other.max.x && other.min.x <= max.x
+           && min.y <= other.max.y && other.min.y <= max.y
+           && min.z <= other.max.z && other.min.z <= max.z;
+}
+
+Bounds Bounds::transformed(const glm::mat4& transform) const {
+    Bounds result;
+    if (empty()) {
+        return result;
+    }
+    for (int k = 0; k < 8; k++) {
+        result.extend(glm::vec3(transform * glm::vec4(corner(k), 1)));
+    }
+    return result;
+}
+
+Bounds Bounds::projected(const glm::mat4& viewProjection) const {
+    Bounds result;
+    if (empty()) {
+        return result;
+    }
+
+    // Outside if all corners are beyond the same clip plane
+    glm::vec4 clip[8];
+    int outside[6] = {};
+    bool behind = false;
+    for (int k = 0; k < 8; k++) {
+        clip[k] = viewProjection * glm::vec4(corner(k), 1);
+        for (int axis = 0; axis < 3; axis++) {
+            outside[2 * axis] += clip[k][axis] < -clip[k].w ? 1 : 0;
+            outside[2 * axis + 1] += clip[k][axis] > clip[k].w ? 1 : 0;
+        }
+        behind = behind || clip[k].w <= 0;
+    }
+    for (int plane = 0; plane < 6; plane++) {
+        if (outside[plane] == 8) {
+            return result;
+        }
+    }
+
+    Bounds frustum(glm::vec3(-1), glm::vec3(1));
+    if (behind) {
+        return frustum;
+    }
+    for (int k = 0; k < 8; k++) {
+        result.extend(glm::vec3(clip[k]) / clip[k].w);
+    }
+    result.min = glm::max(result.min, frustum.min);
+    result.max = glm::min(result.max, frustum.max);
+    return result;
+}
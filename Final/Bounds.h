@@ -0,0 +1,32 @@
+#ifndef CS5625_BOUNDS_H
+#define CS5625_BOUNDS_H
+
+#include <limits>
+#include <glm/glm.hpp>
+
+// An axis-aligned box, empty until a point is added to it
+struct Bounds {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::infinity());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+
+    Bounds() = default;
+    Bounds(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    glm::vec3 corner(int k) const;
+
+    void extend(const glm::vec3& point);
+    void extend(const Bounds& other);
+    bool intersects(const Bounds& other) const;
+
+    // Bounds of the box's eight corners after a transform
+    Bounds transformed(const glm::mat4& transform) const;
+
+    // The part of the box inside the frustum of viewProjection, as bounds in
+    // its normalized device coordinates, or empty bounds if the box is
+    // outside. Conservative: a box reaching behind the eye covers all of it.
+    Bounds projected(const glm::mat4& viewProjection) const;
+};
+
+
+#endif //CS5625_BOUNDS_H
@@ -0,0 +1,104 @@
+#include "FrameJobs.h"
+
+#include <utility>
+
+FrameJobs::FrameJobs(std::shared_ptr<Scene> scene, Animators& animators) :
+    scene(std::move(scene)),
+    animators(animators) {
+    buildGraph();
+}
+
+void FrameJobs::run(const FrameJobInputs& frameInputs) {
+    inputs = frameInputs;
+    graph.run(scheduler);
+}
+
+void FrameJobs::buildGraph() {
+    // Each job below writes a disjoint set of node transforms, so they may run
+    // concurrently; propagation waits for all of them.
+    auto animate = graph.add("animate", [this] {
+        scene->animate(inputs.time);
+    });
+
+    auto ocean = graph.add("ocean", [this] {
+        if (inputs.ocean) {
+            animators.oceanAnimator.updateOceanBuffers(inputs.time);
+        }
+    });
+
+    // The normalized ocean textures are only read once the step is
+    // published, so nothing else depends on these
+    const OceanBuffers& buffers = animators.oceanAnimator.buffers;
+    graph.add("ocean displacement", [this, &buffers] {
+        if (inputs.ocean) {
+            animators.oceanAnimator.displacementData.prepare(buffers.displacementMap);
+        }
+    }, {ocean});
+    graph.add("ocean gradX", [this, &buffers] {
+        if (inputs.ocean) {
+            animators.oceanAnimator.gradXData.prepare(buffers.gradXMap);
+        }
+    }, {ocean});
+    graph.add("ocean gradZ", [this, &buffers] {
+        if (inputs.ocean) {
+            animators.oceanAnimator.gradZData.prepare(buffers.gradZMap);
+        }
+    }, {ocean});
+
+    auto boats = graph.add("boats", [this, &buffers] {
+        if (inputs.ocean) {
+            for (auto& animator : animators.boatAnimators) {
+                animator.update(
+                        buffers.displacementMap,
+                        buffers.gradXMap,
+                        buffers.gradZMap,
+                        inputs.oceanTransform
+                );
+            }
+        }
+    }, {ocean});
+
+    auto sun = graph.add("sun", [this] {
+        if (inputs.sunsky) {
+            for (auto& animator : animators.sunLightAnimators) {
+                animator.update(inputs.thetaSun, inputs.turbidity);
+            }
+        }
+    });
+
+    auto birds = graph.add("birds", [this] {
+        if (inputs.birds) {
+            animators.birdAnimator.animate_birds(inputs.time, inputs.deltaTime, inputs.birdView, scheduler);
+        }
+    });
+
+    auto transforms = graph.add("transforms", [this] {
+        scene->updateWorldTransforms();
+    }, {animate, boats, sun, birds});
+
+    graph.add("draw list", [this] {
+        drawList.clear();
+        for (NodeHandle handle = 0; handle < scene->nodes.size(); handle++) {
+            if (!scene->nodes[handle].meshIndices.empty() && !animators.birdAnimator.is_instanced(handle)) {
+                drawList.push_back(handle);
+            }
+        }
+    }, {transforms});
+
+    auto palettes = graph.add("bone palettes", [this] {
+        scene->updateBonePalettes();
+    }, {transforms});
+
+    // Birds next step steer around the scene as it stands at the end of this
+    // one, so the refit never overlaps the flocks' ray queries
+    graph.add("obstacles", [this] {
+        if (inputs.birds) {
+            animators.birdAnimator.update_obstacles();
+        }
+    }, {palettes});
+
+    graph.add("bird instances", [this] {
+        // The baked clip stands in for the bone palettes
+        animators.birdAnimator.update_instances(inputs.time, !inputs.birdVertexAnimation, scheduler);
+    }, {transforms});
+}
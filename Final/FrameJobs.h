@@ -0,0 +1,60 @@
+#ifndef CS5625_FRAMEJOBS_H
+#define CS5625_FRAMEJOBS_H
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Animators.h"
+#include "Scene.h"
+#include "TaskScheduler.h"
+
+// What a simulation step depends on.
+struct FrameJobInputs {
+    double time = 0;
+    double deltaTime = 0;
+    bool ocean = false;
+    bool sunsky = false;
+    bool birds = false;
+    bool birdVertexAnimation = false;
+    BirdLodView birdView;
+    float thetaSun = 0;
+    float turbidity = 0;
+    glm::mat4 oceanTransform = glm::mat4(1);
+};
+
+// The work of one simulation step as a task graph:
+//
+//   animate ------------+
+//   ocean -+-> boats ---+
+//          \-> textures |
+//   sun ----------------+--> transforms -+-> draw list
+//   birds --------------+                +-> bone palettes -> obstacles
+//                                        \-> bird instances
+//
+// Runs on the simulation thread; see Simulation.
+class FrameJobs {
+public:
+    FrameJobs(std::shared_ptr<Scene> scene, Animators& animators);
+
+    // Blocks until every job of the step has finished.
+    void run(const FrameJobInputs& inputs);
+
+    // Nodes that have meshes to draw, in arena order. Birds are left out when
+    // they are drawn instanced.
+    const std::vector<NodeHandle>& drawNodes() const { return drawList; }
+
+private:
+    std::shared_ptr<Scene> scene;
+    Animators& animators;
+
+    TaskScheduler scheduler;
+    TaskGraph graph;
+    FrameJobInputs inputs;
+
+    std::vector<NodeHandle> drawList;
+
+    void buildGraph();
+};
+
+
+#endif //CS5625_FRAMEJOBS_H
@@ -1,5 +1,6 @@
 #include "Import.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
@@ -44,7 +45,7 @@ Mesh importMesh(aiMesh* aiMesh) {
 
     for (int i = 0; i < aiMesh->mNumBones; i++) {
         aiBone* aiBone = aiMesh->mBones[i];
-        m.bones.emplace_back(std::string(aiBone->mName.C_Str()), RTUtil::a2g(aiBone->mOffsetMatrix));
+        m.bones.push_back({std::string(aiBone->mName.C_Str()), RTUtil::a2g(aiBone->mOffsetMatrix)});
 
         for (int j = 0; j < aiBone->mNumWeights; j++) {
             aiVertexWeight aiVertexWeight = aiBone->mWeights[j];
@@ -59,9 +60,30 @@ Mesh importMesh(aiMesh* aiMesh) {
         }
     }
 
+    for (const glm::vec3& vertex : m.vertices) {
+        m.bounds.extend(vertex);
+    }
+    m.boneBounds.resize(m.bones.size());
+    for (size_t v = 0; v < m.vertices.size(); v++) {
+        for (int k = 0; k < 4; k++) {
+            if (m.boneIndices[v][k] != -1 && m.boneWeights[v][k] > 0) {
+                m.boneBounds[m.boneIndices[v][k]].extend(m.vertices[v]);
+            }
+        }
+    }
+
+    // Skinned meshes change shape every frame, and big ones cost more to
+    // rasterize than they save
+    const size_t maxOccluderTriangles = 4096;
+    glm::vec3 extent = m.bounds.empty() ? glm::vec3(0) : m.bounds.max - m.bounds.min;
+    m.occluder = m.bones.empty()
+            && m.indices.size() / 3 <= maxOccluderTriangles
+            && std::max({extent.x * extent.y, extent.y * extent.z, extent.z * extent.x}) > 0;
+
     std::cout << "Imported mesh " << aiMesh->mName.C_Str() << std::endl;
     std::cout << "\tnvertices = " << aiMesh->mNumVertices << std::endl;
     std::cout << "\tnbones = " << aiMesh->mNumBones << std::endl;
+    std::cout << "\toccluder = " << m.occluder << std::endl;
 
     return m;
 }
@@ -144,28 +166,50 @@ std::vector<Material> importMaterials(const aiScene* aiScene) {
     return materials;
 }
 
-std::shared_ptr<Node> importNode(aiNode* aiNode) {
-    std::shared_ptr<Node> node = std::make_shared<Node>();
+size_t countNodes(const aiNode* aiNode) {
+    size_t count = 1;
+    for (int i = 0; i < aiNode->mNumChildren; i++) {
+        count += countNodes(aiNode->mChildren[i]);
+    }
+    return count;
+}
 
-    node->name = std::string(aiNode->mName.C_Str());
-    node->transform = RTUtil::a2g(aiNode->mTransformation);
+// Appends aiNode and its descendants to the arena in pre-order. Children are
+// linked directly rather than through Scene::addNode to avoid walking the
+// sibling list for every child.
+NodeHandle importNode(const aiNode* aiNode, NodeHandle parent, Scene& scene) {
+    auto handle = (NodeHandle) scene.nodes.size();
+
+    Node node;
+    node.name = std::string(aiNode->mName.C_Str());
+    node.transform = RTUtil::a2g(aiNode->mTransformation);
+    node.parent = parent;
 
     for (int i = 0; i < aiNode->mNumMeshes; i++) {
-        node->meshIndices.push_back(aiNode->mMeshes[i]);
+        node.meshIndices.push_back(aiNode->mMeshes[i]);
     }
 
-    for (int i = 0; i < aiNode->mNumChildren; i++) {
-        std::shared_ptr<Node> child = importNode(aiNode->mChildren[i]);
-        child->parent = node;
+    scene.nodes.push_back(std::move(node));
 
-        node->children.push_back(child);
+    NodeHandle prev = NullNode;
+    for (int i = 0; i < aiNode->mNumChildren; i++) {
+        NodeHandle child = importNode(aiNode->mChildren[i], handle, scene);
+        if (prev == NullNode) {
+            scene.nodes[handle].firstChild = child;
+        } else {
+            scene.nodes[prev].nextSibling = child;
+        }
+        prev = child;
     }
 
-    return node;
+    return handle;
 }
 
-std::shared_ptr<Node> importRoot(const aiScene* aiScene) {
-    return importNode(aiScene->mRootNode);
+void importNodes(const aiScene* aiScene, Scene& scene) {
+    scene.nodes.clear();
+    scene.nodes.reserve(countNodes(aiScene->mRootNode));
+    scene.root = importNode(aiScene->mRootNode, NullNode, scene);
+    scene.updateWorldTransforms();
 }
 
 void importLights(
@@ -230,26 +274,56 @@ void importLights(
     std::cout << "Imported " << aiScene->mNumLights << " lights" << std::endl;
 }
 
-Channel importChannel(const aiNodeAnim* aiChannel) {
-    Channel channel;
+Channel importChannel(
+        const aiNodeAnim* aiChannel,
+        double duration,
+        const AnimationCompressionSettings& settings,
+        AnimationCompressionStats& stats
+) {
+    RawChannel raw;
 
-    channel.nodeName = std::string(aiChannel->mNodeName.C_Str());
+    raw.nodeName = std::string(aiChannel->mNodeName.C_Str());
 
     for (int i = 0; i < aiChannel->mNumPositionKeys; i++) {
         aiVectorKey key = aiChannel->mPositionKeys[i];
-        channel.translation.insert({ key.mTime, RTUtil::a2g(key.mValue) });
+        raw.translation.insert({ key.mTime, RTUtil::a2g(key.mValue) });
     }
 
     for (int i = 0; i < aiChannel->mNumRotationKeys; i++) {
         aiQuatKey key = aiChannel->mRotationKeys[i];
-        channel.rotation.insert({ key.mTime, RTUtil::a2g(key.mValue) });
+        raw.rotation.insert({ key.mTime, RTUtil::a2g(key.mValue) });
     }
 
     for (int i = 0; i < aiChannel->mNumScalingKeys; i++) {
         aiVectorKey key = aiChannel->mScalingKeys[i];
-        channel.scale.insert({ key.mTime, RTUtil::a2g(key.mValue) });
+        raw.scale.insert({ key.mTime, RTUtil::a2g(key.mValue) });
     }
 
+    // Every track needs at least one key for the sampler
+    if (raw.translation.empty()) raw.translation.insert({ 0, glm::vec3(0) });
+    if (raw.rotation.empty()) raw.rotation.insert({ 0, glm::quat(1, 0, 0, 0) });
+    if (raw.scale.empty()) raw.scale.insert({ 0, glm::vec3(1) });
+
+    Channel channel;
+    channel.nodeName = raw.nodeName;
+    channel.translation = AnimationCompression::compressVec3Track(
+            raw.translation, duration, settings.translationTolerance, false, stats.maxTranslationError);
+    channel.rotation = AnimationCompression::compressQuatTrack(
+            raw.rotation, duration, settings.rotationTolerance, stats.maxRotationError);
+    channel.scale = AnimationCompression::compressVec3Track(
+            raw.scale, duration, settings.scaleTolerance, true, stats.maxScaleError);
+
+    stats.rawBytes = sizeof(raw) + raw.nodeName.size()
+            + AnimationCompression::rawTrackBytes(raw.translation)
+            + AnimationCompression::rawTrackBytes(raw.rotation)
+            + AnimationCompression::rawTrackBytes(raw.scale);
+    stats.compressedBytes = sizeof(channel) + channel.nodeName.size()
+            + channel.translation.bytes() - sizeof(channel.translation)
+            + channel.rotation.bytes() - sizeof(channel.rotation)
+            + channel.scale.bytes() - sizeof(channel.scale);
+    stats.rawKeys = raw.translation.size() + raw.rotation.size() + raw.scale.size();
+    stats.compressedKeys = channel.translation.times.size() + channel.rotation.times.size() + channel.scale.times.size();
+
     return channel;
 }
 
@@ -259,10 +333,23 @@ Animation importAnimation(const aiAnimation* aiAnimation) {
     animation.duration = aiAnimation->mDuration;
     animation.ticksPerSecond = aiAnimation->mTicksPerSecond;
 
+    AnimationCompressionSettings settings;
+    AnimationCompressionStats total;
+
     for (int i = 0; i < aiAnimation->mNumChannels; i++) {
-        animation.channels.push_back(importChannel(aiAnimation->mChannels[i]));
+        AnimationCompressionStats stats;
+        animation.channels.push_back(importChannel(aiAnimation->mChannels[i], animation.duration, settings, stats));
+        total.add(stats);
     }
 
+    std::cout << "Compressed animation with " << animation.channels.size() << " channels" << std::endl;
+    std::cout << "\tkeys = " << total.rawKeys << " -> " << total.compressedKeys << std::endl;
+    std::cout << "\tbytes = " << total.rawBytes << " -> " << total.compressedBytes
+              << " (" << (float) total.rawBytes / (float) std::max<size_t>(total.compressedBytes, 1) << "x)" << std::endl;
+    std::cout << "\tmax error = " << total.maxTranslationError << " (translation), "
+              << total.maxRotationError << " rad (rotation), "
+              << total.maxScaleError << " (relative scale)" << std::endl;
+
     return animation;
 }
 
@@ -274,14 +361,18 @@ void importAnimations(const aiScene* aiScene, std::vector<Animation>& animations
     std::cout << "Imported " << animations.size() << " animations" << std::endl;
 }
 
-void dumpNodeHierarchy(const std::shared_ptr<Node>& node, int indent) {
-    for (int i = 0; i < indent; i++) {
-        std::cout << " ";
-    }
-    std::cout << node->name << " " << node->transform << std::endl;
+void dumpNodeHierarchy(const Scene& scene) {
+    std::vector<int> depth(scene.nodes.size(), 0);
+    for (NodeHandle handle = 0; handle < scene.nodes.size(); handle++) {
+        const Node& node = scene.nodes[handle];
+        if (node.parent != NullNode) {
+            depth[handle] = depth[node.parent] + 1;
+        }
 
-    for (const auto& child : node->children) {
-        dumpNodeHierarchy(child, indent + 1);
+        for (int i = 0; i < depth[handle]; i++) {
+            std::cout << " ";
+        }
+        std::cout << node.name << " " << node.transform << std::endl;
     }
 }
 
@@ -290,10 +381,11 @@ std::shared_ptr<Scene> importScene(const aiScene* aiScene) {
     scene->meshes = importMeshes(aiScene);
     scene->camera = importCamera(aiScene);
     scene->materials = importMaterials(aiScene);
-    scene->root = importRoot(aiScene);
+    importNodes(aiScene, *scene);
     importLights(aiScene, scene->pointLights, scene->areaLights, scene->ambientLights);
     importAnimations(aiScene, scene->animations);
-    dumpNodeHierarchy(scene->root, 0);
+    scene->indexNodes();
+    dumpNodeHierarchy(*scene);
     return scene;
 }
 
@@ -0,0 +1,103 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+
+void LightClusters::build(const std::vector<glm::vec3>& positions,
+                          const std::vector<glm::vec3>& powers,
+                          const glm::mat4& projection,
+                          glm::ivec2 viewportSize,
+                          float cutoff) {
+    // Clip planes of a GL perspective projection
+    float near = projection[3][2] / (projection[2][2] - 1);
+    float far = projection[3][2] / (projection[2][2] + 1);
+
+    grid = glm::ivec3((viewportSize.x + tileSize - 1) / tileSize, (viewportSize.y + tileSize - 1) / tileSize, sliceCount);
+    scale = sliceCount / std::log(far / near);
+    bias = -sliceCount * std::log(near) / std::log(far / near);
+
+    size_t lightCount = positions.size();
+    lightData.resize(2 * lightCount);
+    rangeMin.resize(lightCount);
+    rangeMax.resize(lightCount);
+
+    std::vector<uint32_t> counts(size_t(grid.x) * grid.y * grid.z, 0);
+
+    for (size_t i = 0; i < lightCount; i++) {
+        const glm::vec3& c = positions[i];
+        const glm::vec3& power = powers[i];
+
+        // Irradiance at distance d is power / (4 pi d^2)
+        float strongest = std::max(power.x, std::max(power.y, power.z));
+        float range = std::sqrt(std::max(strongest, 0.0f) / (4 * glm::pi<float>() * cutoff));
+
+        lightData[2 * i] = glm::vec4(c, range);
+        lightData[2 * i + 1] = glm::vec4(power, 0);
+
+        // Empty range unless the sphere reaches the view volume
+        rangeMin[i] = glm::ivec3(0);
+        rangeMax[i] = glm::ivec3(-1);
+
+        float zNear = -c.z - range;
+        float zFar = -c.z + range;
+        if (range <= 0 || zFar < near || zNear > far) {
+            continue;
+        }
+
+        int sliceMin = std::max(0, (int) std::floor(std::log(std::max(zNear, near)) * scale + bias));
+        int sliceMax = std::min(grid.z - 1, (int) std::floor(std::log(std::min(zFar, far)) * scale + bias));
+
+        // Project the corners of the sphere's bounding box, unless it
+        // crosses the near plane, in which case it may cover any tile
+        glm::vec2 ndcMin(-1), ndcMax(1);
+        if (zNear > near) {
+            ndcMin = glm::vec2(1);
+            ndcMax = glm::vec2(-1);
+            for (int corner = 0; corner < 8; corner++) {
+                glm::vec3 p = c + range * glm::vec3(corner & 1 ? 1 : -1, corner & 2 ? 1 : -1, corner & 4 ? 1 : -1);
+                glm::vec4 clip = projection * glm::vec4(p, 1);
+                glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+                ndcMin = glm::min(ndcMin, ndc);
+                ndcMax = glm::max(ndcMax, ndc);
+            }
+            if (ndcMin.x > 1 || ndcMin.y > 1 || ndcMax.x < -1 || ndcMax.y < -1) {
+                continue;
+            }
+        }
+
+        glm::vec2 pixelsMin = (glm::clamp(ndcMin, -1.0f, 1.0f) * 0.5f + 0.5f) * glm::vec2(viewportSize);
+        glm::vec2 pixelsMax = (glm::clamp(ndcMax, -1.0f, 1.0f) * 0.5f + 0.5f) * glm::vec2(viewportSize);
+        rangeMin[i] = glm::ivec3(glm::ivec2(pixelsMin) / tileSize, sliceMin);
+        rangeMax[i] = glm::min(glm::ivec3(glm::ivec2(pixelsMax) / tileSize, sliceMax), grid - 1);
+
+        for (int z = rangeMin[i].z; z <= rangeMax[i].z; z++) {
+            for (int y = rangeMin[i].y; y <= rangeMax[i].y; y++) {
+                for (int x = rangeMin[i].x; x <= rangeMax[i].x; x++) {
+                    counts[(size_t(z) * grid.y + y) * grid.x + x]++;
+                }
+            }
+        }
+    }
+
+    // Counting sort: prefix sums give each froxel its first index, then the
+    // same traversal fills the lists
+    clusterData.resize(counts.size());
+    uint32_t total = 0;
+    for (size_t k = 0; k < counts.size(); k++) {
+        clusterData[k] = glm::uvec2(total, 0);
+        total += counts[k];
+    }
+    lightIndices.resize(total);
+
+    for (size_t i = 0; i < lightCount; i++) {
+        for (int z = rangeMin[i].z; z <= rangeMax[i].z; z++) {
+            for (int y = rangeMin[i].y; y <= rangeMax[i].y; y++) {
+                for (int x = rangeMin[i].x; x <= rangeMax[i].x; x++) {
+                    glm::uvec2& cluster = clusterData[(size_t(z) * grid.y + y) * grid.x + x];
+                    lightIndices[cluster.x + cluster.y++] = (uint32_t) i;
+                }
+            }
+        }
+    }
+}
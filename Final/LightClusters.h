@@ -0,0 +1,58 @@
+#ifndef CS5625_LIGHTCLUSTERS_H
+#define CS5625_LIGHTCLUSTERS_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Point lights binned into a froxel grid: screen tiles of tileSize pixels,
+// each split into depth slices spaced exponentially between the near and far
+// planes. Every light gets a range past which its irradiance drops below a
+// cutoff, and is listed in every froxel its range sphere may touch, so a
+// fragment only has to shade the lights of its own froxel.
+//
+// Everything is built on the CPU; deferred_clustered.fs reads the three
+// arrays from buffer textures.
+class LightClusters {
+public:
+    static constexpr int tileSize = 64;
+    static constexpr int sliceCount = 24;
+
+    // positions are in eye space and projection is a perspective projection,
+    // whose clip planes bound the slices. Irradiance below cutoff is dropped.
+    void build(const std::vector<glm::vec3>& positions,
+               const std::vector<glm::vec3>& powers,
+               const glm::mat4& projection,
+               glm::ivec2 viewportSize,
+               float cutoff);
+
+    // Two texels per light: (eye-space position, range), (power, 0)
+    const std::vector<glm::vec4>& lights() const { return lightData; }
+
+    // One texel per froxel, x fastest then y then slice: (first index, count)
+    const std::vector<glm::uvec2>& clusters() const { return clusterData; }
+
+    // Light indices, grouped by froxel
+    const std::vector<uint32_t>& indices() const { return lightIndices; }
+
+    glm::ivec3 gridSize() const { return grid; }
+
+    // slice = floor(log(-z) * sliceScale + sliceBias)
+    float sliceScale() const { return scale; }
+    float sliceBias() const { return bias; }
+
+private:
+    glm::ivec3 grid = glm::ivec3(0);
+    float scale = 0;
+    float bias = 0;
+
+    std::vector<glm::vec4> lightData;
+    std::vector<glm::uvec2> clusterData;
+    std::vector<uint32_t> lightIndices;
+
+    // Froxel range touched by each light, empty if it cannot be seen
+    std::vector<glm::ivec3> rangeMin, rangeMax;
+};
+
+
+#endif //CS5625_LIGHTCLUSTERS_H
@@ -30,7 +30,7 @@ const std::regex RAMP_ARG_REGEX("^--ramp=(.+)$");
 
 int main(int argc, char **argv) {
     std::shared_ptr<Scene> scene = std::make_shared<Scene>();
-    scene->root = std::make_shared<Node>();
+    scene->addNode("", glm::mat4(1), NullNode);
     scene->camera = std::make_shared<RTUtil::PerspectiveCamera>(
             glm::vec3(3, 4, 5),
             glm::vec3(0, 0, 0),
@@ -93,11 +93,7 @@ int main(int argc, char **argv) {
                 light->power = {1000, 1000, 1000};
                 scene->pointLights.push_back(light);
 
-                auto node = std::make_shared<Node>();
-                node->name = light->name;
-                node->transform = glm::mat4(1);
-                node->parent = scene->root;
-                scene->root->children.push_back(node);
+                scene->addNode(light->name, glm::mat4(1), scene->root);
             }
 
             {
@@ -107,11 +103,7 @@ int main(int argc, char **argv) {
                 light->distance = 0.2;
                 scene->ambientLights.push_back(light);
 
-                auto node = std::make_shared<Node>();
-                node->name = light->name;
-                node->transform = glm::mat4(1);
-                node->parent = scene->root;
-                scene->root->children.push_back(node);
+                scene->addNode(light->name, glm::mat4(1), scene->root);
             }
             continue;
         }
@@ -138,6 +130,9 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    // Resolve node names to handles now that the node graph is final
+    scene->indexNodes();
+
     nanogui::init();
 
     nanogui::ref<PLApp> app = new PLApp(scene, ocean, 700, rampFileName, config);
@@ -0,0 +1,157 @@
+#include "ObstacleScene.h"
+
+#include <iostream>
+#include <limits>
+#include <utility>
+
+namespace {
+
+    void reportError(void*, RTCError code, const char* message) {
+        std::cerr << "embree error " << code << ": " << (message ? message : "") << std::endl;
+    }
+
+}
+
+ObstacleScene::ObstacleScene(std::shared_ptr<Scene> scene, const std::function<bool(NodeHandle)>& include) :
+    scene(std::move(scene)),
+    device(rtcNewDevice(nullptr)),
+    rtcScene(nullptr) {
+    rtcSetDeviceErrorFunction(device, reportError, nullptr);
+
+    rtcScene = rtcNewScene(device);
+    rtcSetSceneFlags(rtcScene, RTC_SCENE_FLAG_DYNAMIC);
+    rtcSetSceneBuildQuality(rtcScene, RTC_BUILD_QUALITY_LOW);
+
+    for (NodeHandle handle = 0; handle < this->scene->nodes.size(); handle++) {
+        if (!include(handle)) {
+            continue;
+        }
+        for (unsigned int meshIndex : this->scene->node(handle).meshIndices) {
+            const Mesh& mesh = this->scene->meshes[meshIndex];
+            if (mesh.indices.size() < 3) {
+                continue;
+            }
+
+            Geometry g;
+            g.geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+            g.node = handle;
+            g.meshIndex = meshIndex;
+            g.vertices = (glm::vec3*) rtcSetNewGeometryBuffer(
+                    g.geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3,
+                    sizeof(glm::vec3), mesh.vertices.size()
+            );
+            auto* triangles = (uint32_t*) rtcSetNewGeometryBuffer(
+                    g.geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+                    3 * sizeof(uint32_t), mesh.indices.size() / 3
+            );
+            std::copy(mesh.indices.begin(), mesh.indices.begin() + mesh.indices.size() / 3 * 3, triangles);
+
+            // Moving nodes only have their bounds refit, never rebuilt
+            rtcSetGeometryBuildQuality(g.geometry, RTC_BUILD_QUALITY_REFIT);
+            transformVertices(g, true);
+            rtcCommitGeometry(g.geometry);
+            rtcAttachGeometry(rtcScene, g.geometry);
+            geometries.push_back(g);
+        }
+    }
+
+    rtcCommitScene(rtcScene);
+}
+
+ObstacleScene::~ObstacleScene() {
+    for (Geometry& g : geometries) {
+        rtcReleaseGeometry(g.geometry);
+    }
+    rtcReleaseScene(rtcScene);
+    rtcReleaseDevice(device);
+}
+
+bool ObstacleScene::transformVertices(Geometry& g, bool force) {
+    const Mesh& mesh = scene->meshes[g.meshIndex];
+    glm::mat4 transform = scene->worldTransform(g.node);
+
+    const std::vector<glm::mat4>* palette = g.meshIndex < scene->bonePalettes.size() ? &scene->bonePalettes[g.meshIndex] : nullptr;
+    bool skinned = !mesh.bones.empty() && palette && palette->size() == mesh.bones.size();
+
+    if (!skinned) {
+        if (!force && transform == g.transform) {
+            return false;
+        }
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+            g.vertices[v] = glm::vec3(transform * glm::vec4(mesh.vertices[v], 1));
+        }
+    } else {
+        // Skinned meshes can deform without their node moving, so they are
+        // redone whenever their pose changes; bone palettes are already in
+        // world space
+        if (!force && *palette == g.palette) {
+            return false;
+        }
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+            glm::mat4 skin(0);
+            for (int i = 0; i < 4; i++) {
+                if (mesh.boneIndices[v][i] != -1) {
+                    skin += mesh.boneWeights[v][i] * (*palette)[mesh.boneIndices[v][i]];
+                }
+            }
+            g.vertices[v] = glm::vec3(skin * glm::vec4(mesh.vertices[v], 1));
+        }
+        g.palette = *palette;
+    }
+
+    g.transform = transform;
+    return true;
+}
+
+void ObstacleScene::update() {
+    bool changed = false;
+    for (Geometry& g : geometries) {
+        if (transformVertices(g, false)) {
+            rtcUpdateGeometryBuffer(g.geometry, RTC_BUFFER_TYPE_VERTEX, 0);
+            rtcCommitGeometry(g.geometry);
+            changed = true;
+        }
+    }
+    if (changed) {
+        rtcCommitScene(rtcScene);
+    }
+}
+
+void ObstacleScene::intersect8(
+        int count,
+        const glm::vec3* origins,
+        const glm::vec3* directions,
+        const float* distances,
+        ObstacleHits& hits
+) const {
+    alignas(32) int valid[8];
+    alignas(32) RTCRayHit8 rayHit;
+    for (int i = 0; i < 8; i++) {
+        bool active = i < count;
+        valid[i] = active ? -1 : 0;
+        rayHit.ray.org_x[i] = active ? origins[i].x : 0;
+        rayHit.ray.org_y[i] = active ? origins[i].y : 0;
+        rayHit.ray.org_z[i] = active ? origins[i].z : 0;
+        rayHit.ray.dir_x[i] = active ? directions[i].x : 0;
+        rayHit.ray.dir_y[i] = active ? directions[i].y : 0;
+        rayHit.ray.dir_z[i] = active ? directions[i].z : 1;
+        rayHit.ray.tnear[i] = 0;
+        rayHit.ray.tfar[i] = active ? distances[i] : 0;
+        rayHit.ray.time[i] = 0;
+        rayHit.ray.mask[i] = 0xFFFFFFFF;
+        rayHit.ray.id[i] = i;
+        rayHit.ray.flags[i] = 0;
+        rayHit.hit.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+        rayHit.hit.instID[0][i] = RTC_INVALID_GEOMETRY_ID;
+    }
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    rtcIntersect8(valid, rtcScene, &context, &rayHit);
+
+    for (int i = 0; i < 8; i++) {
+        bool hit = i < count && rayHit.hit.geomID[i] != RTC_INVALID_GEOMETRY_ID;
+        hits.t[i] = hit ? rayHit.ray.tfar[i] : std::numeric_limits<float>::infinity();
+        hits.normal[i] = glm::vec3(rayHit.hit.Ng_x[i], rayHit.hit.Ng_y[i], rayHit.hit.Ng_z[i]);
+    }
+}
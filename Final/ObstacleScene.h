@@ -0,0 +1,68 @@
+#ifndef CS5625_OBSTACLESCENE_H
+#define CS5625_OBSTACLESCENE_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include <embree3/rtcore.h>
+#include "Scene.h"
+
+// Results of one packet of up to eight rays. t is infinite for rays that
+// miss (or were not cast); normal is the unnormalized geometric normal.
+struct ObstacleHits {
+    float t[8];
+    glm::vec3 normal[8];
+};
+
+// The scene's meshes in an Embree scene, for birds to look ahead against.
+// Each node's meshes are flattened into world space; update() re-transforms
+// the nodes that moved or were posed differently and refits the BVH instead
+// of rebuilding it.
+class ObstacleScene {
+public:
+    // Only nodes for which include(handle) is true become obstacles
+    ObstacleScene(std::shared_ptr<Scene> scene, const std::function<bool(NodeHandle)>& include);
+    ~ObstacleScene();
+
+    ObstacleScene(const ObstacleScene&) = delete;
+    ObstacleScene& operator=(const ObstacleScene&) = delete;
+
+    // Refit to the scene's current world transforms and bone palettes. Must
+    // not run concurrently with intersect8.
+    void update();
+
+    // Cast count (at most eight) rays from origins along unit directions, up
+    // to the given distances. Safe to call from several threads at once.
+    void intersect8(
+            int count,
+            const glm::vec3* origins,
+            const glm::vec3* directions,
+            const float* distances,
+            ObstacleHits& hits
+    ) const;
+
+    bool empty() const { return geometries.empty(); }
+
+private:
+    struct Geometry {
+        RTCGeometry geometry;
+        NodeHandle node;
+        unsigned int meshIndex;
+        glm::vec3* vertices;
+        glm::mat4 transform;
+        std::vector<glm::mat4> palette; // skinned meshes only
+    };
+
+    std::shared_ptr<Scene> scene;
+    RTCDevice device;
+    RTCScene rtcScene;
+    std::vector<Geometry> geometries;
+
+    // Write the world-space vertices of g; returns false if they have not
+    // changed since the last call
+    bool transformVertices(Geometry& g, bool force);
+};
+
+
+#endif //CS5625_OBSTACLESCENE_H
@@ -0,0 +1,308 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+    // Four floats, and masks of four lanes, with whatever SIMD the target
+    // has. Only what the rasterizer needs.
+#if defined(__SSE2__) || defined(_M_X64)
+    using Lanes = __m128;
+    using Mask = __m128;
+
+    inline Lanes splat(float x) { return _mm_set1_ps(x); }
+    inline Lanes lanes(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+    inline Lanes load(const float* p) { return _mm_loadu_ps(p); }
+    inline void store(float* p, Lanes v) { _mm_storeu_ps(p, v); }
+    inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+    inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+    inline Lanes min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+    inline Mask greater(Lanes a, Lanes b) { return _mm_cmpgt_ps(a, b); }
+    inline Mask both(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    inline bool any(Mask m) { return _mm_movemask_ps(m) != 0; }
+    inline Lanes select(Mask m, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+#elif defined(__ARM_NEON)
+    using Lanes = float32x4_t;
+    using Mask = uint32x4_t;
+
+    inline Lanes splat(float x) { return vdupq_n_f32(x); }
+    inline Lanes lanes(float a, float b, float c, float d) {
+        float values[4] = {a, b, c, d};
+        return vld1q_f32(values);
+    }
+    inline Lanes load(const float* p) { return vld1q_f32(p); }
+    inline void store(float* p, Lanes v) { vst1q_f32(p, v); }
+    inline Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+    inline Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+    inline Lanes min(Lanes a, Lanes b) { return vminq_f32(a, b); }
+    inline Mask greater(Lanes a, Lanes b) { return vcgtq_f32(a, b); }
+    inline Mask both(Mask a, Mask b) { return vandq_u32(a, b); }
+    inline bool any(Mask m) {
+        uint32x2_t halves = vorr_u32(vget_low_u32(m), vget_high_u32(m));
+        return (vget_lane_u32(halves, 0) | vget_lane_u32(halves, 1)) != 0;
+    }
+    inline Lanes select(Mask m, Lanes a, Lanes b) { return vbslq_f32(m, a, b); }
+#else
+    struct Lanes { float v[4]; };
+    struct Mask { bool v[4]; };
+
+    inline Lanes splat(float x) { return {{x, x, x, x}}; }
+    inline Lanes lanes(float a, float b, float c, float d) { return {{a, b, c, d}}; }
+    inline Lanes load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+    inline void store(float* p, Lanes v) { std::copy(v.v, v.v + 4, p); }
+    inline Lanes add(Lanes a, Lanes b) { return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; }
+    inline Lanes mul(Lanes a, Lanes b) { return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; }
+    inline Lanes min(Lanes a, Lanes b) {
+        return {{std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3])}};
+    }
+    inline Mask greater(Lanes a, Lanes b) { return {{a.v[0] > b.v[0], a.v[1] > b.v[1], a.v[2] > b.v[2], a.v[3] > b.v[3]}}; }
+    inline Mask both(Mask a, Mask b) { return {{a.v[0] && b.v[0], a.v[1] && b.v[1], a.v[2] && b.v[2], a.v[3] && b.v[3]}}; }
+    inline bool any(Mask m) { return m.v[0] || m.v[1] || m.v[2] || m.v[3]; }
+    inline Lanes select(Mask m, Lanes a, Lanes b) {
+        return {{m.v[0] ? a.v[0] : b.v[0], m.v[1] ? a.v[1] : b.v[1], m.v[2] ? a.v[2] : b.v[2], m.v[3] ? a.v[3] : b.v[3]}};
+    }
+#endif
+
+    // A point that is in front of the near plane, in window coordinates
+    bool toWindow(const glm::vec4& clip, glm::vec2 size, glm::vec3& window) {
+        if (clip.w <= 0 || clip.z < -clip.w) {
+            return false;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        window = glm::vec3((glm::vec2(ndc) * 0.5f + 0.5f) * size, ndc.z * 0.5f + 0.5f);
+        return true;
+    }
+
+}
+
+OcclusionCuller::OcclusionCuller(glm::ivec2 size) {
+    size = (size + tileSize - 1) / tileSize * tileSize;
+    levelSizes.push_back(size);
+    while (size.x > 1 || size.y > 1) {
+        size = glm::max((size + 1) / 2, glm::ivec2(1));
+        levelSizes.push_back(size);
+    }
+    levels.resize(levelSizes.size());
+    for (size_t level = 0; level < levels.size(); level++) {
+        levels[level].assign(levelSizes[level].x * levelSizes[level].y, 1.0f);
+    }
+}
+
+void OcclusionCuller::clear(const glm::mat4& viewProjection) {
+    this->viewProjection = viewProjection;
+    occluders.clear();
+    for (std::vector<float>& level : levels) {
+        std::fill(level.begin(), level.end(), 1.0f);
+    }
+}
+
+void OcclusionCuller::addOccluder(const std::vector<glm::vec3>& vertices,
+                                  const std::vector<uint32_t>& indices,
+                                  const glm::mat4& transform) {
+    occluders.push_back({&vertices, &indices, transform});
+}
+
+void OcclusionCuller::rasterize(TaskScheduler& scheduler) {
+    triangles.resize(occluders.size());
+    scheduler.parallelFor(occluders.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            setup(occluders[i], triangles[i]);
+        }
+    });
+
+    lastStats = Stats();
+    lastStats.occluders = occluders.size();
+    for (size_t i = 0; i < occluders.size(); i++) {
+        lastStats.triangles += triangles[i].size();
+    }
+
+    int bands = size().y / tileSize;
+    scheduler.parallelFor(bands, 1, [&](size_t begin, size_t end) {
+        rasterizeBand((int) begin * tileSize, (int) end * tileSize);
+    });
+
+    buildLevels();
+}
+
+void OcclusionCuller::setup(const Occluder& occluder, std::vector<Triangle>& out) const {
+    out.clear();
+    glm::vec2 size = this->size();
+    glm::mat4 transform = viewProjection * occluder.transform;
+
+    // Triangles that cross the near plane are dropped rather than clipped;
+    // that only loses occlusion
+    const std::vector<glm::vec3>& vertices = *occluder.vertices;
+    std::vector<glm::vec3> window(vertices.size());
+    std::vector<bool> inFront(vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++) {
+        glm::vec3 w;
+        inFront[v] = toWindow(transform * glm::vec4(vertices[v], 1), size, w);
+        window[v] = w;
+    }
+
+    const std::vector<uint32_t>& indices = *occluder.indices;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        if (!inFront[a] || !inFront[b] || !inFront[c]) {
+            continue;
+        }
+
+        // Occluders hide things from either side
+        Triangle triangle{{window[a], window[b], window[c]}, 0, 0};
+        glm::vec2 e1 = glm::vec2(triangle.v[1] - triangle.v[0]);
+        glm::vec2 e2 = glm::vec2(triangle.v[2] - triangle.v[0]);
+        float area = e1.x * e2.y - e1.y * e2.x;
+        if (std::abs(area) < 1e-6f) {
+            continue;
+        }
+        if (area < 0) {
+            std::swap(triangle.v[1], triangle.v[2]);
+        }
+
+        float yMin = std::min({triangle.v[0].y, triangle.v[1].y, triangle.v[2].y});
+        float yMax = std::max({triangle.v[0].y, triangle.v[1].y, triangle.v[2].y});
+        float xMin = std::min({triangle.v[0].x, triangle.v[1].x, triangle.v[2].x});
+        float xMax = std::max({triangle.v[0].x, triangle.v[1].x, triangle.v[2].x});
+        float zMin = std::min({triangle.v[0].z, triangle.v[1].z, triangle.v[2].z});
+        if (xMax < 0 || xMin > size.x || zMin > 1) {
+            continue;
+        }
+
+        // Rows whose pixel centers are within its extent
+        triangle.yMin = std::max(0, (int) std::ceil(yMin - 0.5f));
+        triangle.yMax = std::min((int) size.y - 1, (int) std::floor(yMax - 0.5f));
+        if (triangle.yMin <= triangle.yMax) {
+            out.push_back(triangle);
+        }
+    }
+}
+
+void OcclusionCuller::rasterizeBand(int yBegin, int yEnd) {
+    glm::ivec2 size = this->size();
+    std::vector<float>& depth = levels[0];
+    const Lanes offsets = lanes(0.5f, 1.5f, 2.5f, 3.5f);
+    const Lanes zero = splat(0);
+
+    for (const std::vector<Triangle>& occluderTriangles : triangles) {
+        for (const Triangle& triangle : occluderTriangles) {
+            int y0 = std::max(yBegin, triangle.yMin);
+            int y1 = std::min(yEnd - 1, triangle.yMax);
+            if (y0 > y1) {
+                continue;
+            }
+
+            const glm::vec3* v = triangle.v;
+            float xMin = std::min({v[0].x, v[1].x, v[2].x});
+            float xMax = std::max({v[0].x, v[1].x, v[2].x});
+            int x0 = std::max(0, (int) std::ceil(xMin - 0.5f)) & ~3;
+            int x1 = std::min(size.x - 1, (int) std::floor(xMax - 0.5f));
+
+            // Edge functions, positive inside, and the depth plane, as
+            // a x + b y + c at pixel centers
+            float edgeA[3], edgeB[3], edgeC[3];
+            for (int e = 0; e < 3; e++) {
+                const glm::vec3& from = v[e];
+                const glm::vec3& to = v[(e + 1) % 3];
+                edgeA[e] = from.y - to.y;
+                edgeB[e] = to.x - from.x;
+                edgeC[e] = -(edgeA[e] * from.x + edgeB[e] * from.y);
+            }
+            glm::vec3 d1 = v[1] - v[0];
+            glm::vec3 d2 = v[2] - v[0];
+            float area = d1.x * d2.y - d2.x * d1.y;
+            float dzdx = (d1.z * d2.y - d2.z * d1.y) / area;
+            float dzdy = (d2.z * d1.x - d1.z * d2.x) / area;
+            float dzc = v[0].z - dzdx * v[0].x - dzdy * v[0].y;
+
+            Lanes a0 = splat(edgeA[0]), a1 = splat(edgeA[1]), a2 = splat(edgeA[2]), az = splat(dzdx);
+            for (int y = y0; y <= y1; y++) {
+                float py = y + 0.5f;
+                Lanes c0 = splat(edgeB[0] * py + edgeC[0]);
+                Lanes c1 = splat(edgeB[1] * py + edgeC[1]);
+                Lanes c2 = splat(edgeB[2] * py + edgeC[2]);
+                Lanes cz = splat(dzdy * py + dzc);
+                float* row = &depth[y * size.x];
+
+                for (int x = x0; x <= x1; x += 4) {
+                    Lanes px = add(splat((float) x), offsets);
+                    Mask inside = both(both(greater(add(mul(a0, px), c0), zero), greater(add(mul(a1, px), c1), zero)),
+                                       greater(add(mul(a2, px), c2), zero));
+                    if (!any(inside)) {
+                        continue;
+                    }
+                    Lanes current = load(row + x);
+                    store(row + x, select(inside, min(current, add(mul(az, px), cz)), current));
+                }
+            }
+        }
+    }
+}
+
+void OcclusionCuller::buildLevels() {
+    for (size_t level = 1; level < levels.size(); level++) {
+        const std::vector<float>& below = levels[level - 1];
+        glm::ivec2 belowSize = levelSizes[level - 1];
+        glm::ivec2 levelSize = levelSizes[level];
+        for (int y = 0; y < levelSize.y; y++) {
+            int y0 = std::min(2 * y, belowSize.y - 1), y1 = std::min(2 * y + 1, belowSize.y - 1);
+            for (int x = 0; x < levelSize.x; x++) {
+                int x0 = std::min(2 * x, belowSize.x - 1), x1 = std::min(2 * x + 1, belowSize.x - 1);
+                levels[level][y * levelSize.x + x] = std::max(
+                        std::max(below[y0 * belowSize.x + x0], below[y0 * belowSize.x + x1]),
+                        std::max(below[y1 * belowSize.x + x0], below[y1 * belowSize.x + x1]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::visible(const Bounds& bounds) const {
+    if (bounds.empty()) {
+        return false;
+    }
+
+    glm::vec2 size = this->size();
+    glm::vec2 lo(std::numeric_limits<float>::infinity());
+    glm::vec2 hi(-std::numeric_limits<float>::infinity());
+    float nearest = std::numeric_limits<float>::infinity();
+    for (int k = 0; k < 8; k++) {
+        glm::vec3 window;
+        if (!toWindow(viewProjection * glm::vec4(bounds.corner(k), 1), size, window)) {
+            return true;
+        }
+        lo = glm::min(lo, glm::vec2(window));
+        hi = glm::max(hi, glm::vec2(window));
+        nearest = std::min(nearest, window.z);
+    }
+    if (hi.x < 0 || hi.y < 0 || lo.x > size.x || lo.y > size.y || nearest > 1) {
+        return false;
+    }
+
+    // Every pixel the rectangle touches
+    glm::ivec2 pMin = glm::clamp(glm::ivec2(glm::floor(lo)), glm::ivec2(0), glm::ivec2(size) - 1);
+    glm::ivec2 pMax = glm::clamp(glm::ivec2(glm::floor(hi)), glm::ivec2(0), glm::ivec2(size) - 1);
+
+    int level = 0;
+    while (level + 1 < levelCount()
+           && ((pMax.x >> level) - (pMin.x >> level) >= 4 || (pMax.y >> level) - (pMin.y >> level) >= 4)) {
+        level++;
+    }
+
+    const std::vector<float>& farthest = levels[level];
+    int width = levelSizes[level].x;
+    for (int y = pMin.y >> level; y <= pMax.y >> level; y++) {
+        for (int x = pMin.x >> level; x <= pMax.x >> level; x++) {
+            if (farthest[y * width + x] >= nearest) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
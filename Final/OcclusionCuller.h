@@ -0,0 +1,86 @@
+#ifndef CS5625_OCCLUSIONCULLER_H
+#define CS5625_OCCLUSIONCULLER_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "TaskScheduler.h"
+
+// Software occlusion culling. The triangles of a few large occluders are
+// rasterized on the CPU into a small depth buffer, four pixels at a time
+// with SIMD, one band of rows per task. A hierarchy of max-depth levels is
+// built on top, each texel holding the farthest depth of the 2x2 texels
+// below it, and a box is hidden if its nearest point is behind every texel
+// its screen rectangle covers, tested at the level where that rectangle is
+// at most four texels across.
+//
+// Depths are window depths in [0, 1], and levels are stored row by row from
+// the bottom of the screen. Nothing here touches GL, so the depth buffer can
+// be compared against a reference one without a window.
+class OcclusionCuller {
+public:
+    struct Stats {
+        size_t occluders = 0;
+        size_t triangles = 0; // rasterized, i.e. in front of the eye and on screen
+    };
+
+    // size is rounded up to whole tiles
+    explicit OcclusionCuller(glm::ivec2 size = glm::ivec2(256, 128));
+
+    // Start over with an empty depth buffer, seen through viewProjection
+    void clear(const glm::mat4& viewProjection);
+
+    // Add the triangles of an occluder, with vertices in object space. The
+    // vectors must live until rasterize() returns.
+    void addOccluder(const std::vector<glm::vec3>& vertices,
+                     const std::vector<uint32_t>& indices,
+                     const glm::mat4& transform);
+
+    // Rasterize the occluders added since clear() and build the hierarchy
+    void rasterize(TaskScheduler& scheduler);
+
+    // False if the world box is hidden behind the occluders or outside the
+    // view. Conservative: a box reaching behind the eye is visible.
+    bool visible(const Bounds& bounds) const;
+
+    glm::ivec2 size() const { return levelSizes[0]; }
+    int levelCount() const { return (int) levels.size(); }
+    glm::ivec2 levelSize(int level) const { return levelSizes[level]; }
+
+    // Level 0 is the depth buffer itself; 1 where nothing was drawn
+    const std::vector<float>& depth(int level = 0) const { return levels[level]; }
+
+    const Stats& stats() const { return lastStats; }
+
+private:
+    // Bands of rows rasterized by one task
+    static constexpr int tileSize = 8;
+
+    struct Occluder {
+        const std::vector<glm::vec3>* vertices;
+        const std::vector<uint32_t>* indices;
+        glm::mat4 transform;
+    };
+
+    // A triangle in window coordinates, counter-clockwise
+    struct Triangle {
+        glm::vec3 v[3];
+        int yMin, yMax; // rows it may cover
+    };
+
+    glm::mat4 viewProjection = glm::mat4(1);
+    std::vector<Occluder> occluders;
+    std::vector<std::vector<Triangle>> triangles; // per occluder
+
+    std::vector<std::vector<float>> levels;
+    std::vector<glm::ivec2> levelSizes;
+    Stats lastStats;
+
+    void setup(const Occluder& occluder, std::vector<Triangle>& out) const;
+    void rasterizeBand(int yBegin, int yEnd);
+    void buildLevels();
+};
+
+
+#endif //CS5625_OCCLUSIONCULLER_H
@@ -9,7 +9,10 @@ OceanAnimator::OceanAnimator(const std::shared_ptr<OceanScene>& scene) :
     buffers(scene->gridSize.x, scene->gridSize.y),
     displacement("displacement", scene->gridSize.x, scene->gridSize.y),
     gradX("gradX", scene->gridSize.x, scene->gridSize.y),
-    gradZ("gradZ", scene->gridSize.x, scene->gridSize.y) {
+    gradZ("gradZ", scene->gridSize.x, scene->gridSize.y),
+    displacementData(scene->gridSize.x, scene->gridSize.y),
+    gradXData(scene->gridSize.x, scene->gridSize.y),
+    gradZData(scene->gridSize.x, scene->gridSize.y) {
 }
 
 void OceanAnimator::updateOceanBuffers(double time) {
@@ -44,8 +47,7 @@ OceanTextureBuffer::OceanTextureBuffer(
         std::string name,
         size_t size_x,
         size_t size_y
-) : buffer(size_x, size_y),
-    a(1),
+) : a(1),
     b(0),
     texture(std::make_shared<GLWrap::Texture2D>(
         glm::ivec2(size_x, size_y),
@@ -58,7 +60,15 @@ OceanTextureBuffer::OceanTextureBuffer(
     texture->parameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
 }
 
-void OceanTextureBuffer::store(const tessendorf::array2d<float>& data) {
+OceanTextureData::OceanTextureData(
+        size_t size_x,
+        size_t size_y
+) : buffer(size_x, size_y),
+    a(1),
+    b(0) {
+}
+
+void OceanTextureData::prepare(const tessendorf::array2d<float>& data) {
     buffer.copyFrom(data);
 
     float min = buffer.min();
@@ -67,8 +77,20 @@ void OceanTextureBuffer::store(const tessendorf::array2d<float>& data) {
     buffer.times(1 / (max - min));
     a = max - min;
     b = min;
+}
+
+void OceanTextureData::copyFrom(const OceanTextureData& other) {
+    buffer.copyFrom(other.buffer);
+    a = other.a;
+    b = other.b;
+}
+
+void OceanTextureBuffer::upload(const OceanTextureData& data) {
+    a = data.a;
+    b = data.b;
 
-    glBindTexture(GL_TEXTURE_2D, texture->id());
+    const tessendorf::array2d<float>& buffer = data.buffer;
+    texture->bind();
     glTexImage2D(
             GL_TEXTURE_2D,
             0,
@@ -11,14 +11,28 @@
 #include "GLWrap/Texture2D.hpp"
 #include "GLWrap/Program.hpp"
 
-class OceanTextureBuffer {
+// A height or gradient map normalized to [0, 1], with value = a * x + b.
+// Produced on the simulation thread; does not touch GL.
+struct OceanTextureData {
     tessendorf::array2d<float> buffer;
     float a, b;
+
+    OceanTextureData(size_t x, size_t y);
+    void prepare(const tessendorf::array2d<float>& data);
+    void copyFrom(const OceanTextureData& other);
+};
+
+class OceanTextureBuffer {
+    float a, b;
     std::shared_ptr<GLWrap::Texture2D> texture;
 
 public:
     OceanTextureBuffer(std::string name, size_t x, size_t y);
-    void store(const tessendorf::array2d<float>& data);
+    // Must be called on the GL thread.
+    void upload(const OceanTextureData& data);
+    // Range of the values last uploaded
+    float minValue() const { return b; }
+    float maxValue() const { return a + b; }
     void bindTextureAndUniforms(
             const std::string& name,
             const std::shared_ptr<GLWrap::Program> &program,
@@ -39,6 +53,7 @@ struct OceanBuffers {
 };
 
 struct OceanAnimator {
+    // GL side, owned by the GL thread
     OceanTextureBuffer displacement;
     OceanTextureBuffer gradX;
     OceanTextureBuffer gradZ;
@@ -47,7 +62,11 @@ struct OceanAnimator {
 
     void updateOceanBuffers(double time);
 
+    // Simulation side
     OceanBuffers buffers;
+    OceanTextureData displacementData;
+    OceanTextureData gradXData;
+    OceanTextureData gradZData;
 
 private:
     std::shared_ptr<OceanScene> scene;
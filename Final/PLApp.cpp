@@ -2,6 +2,7 @@
 // Created by William Ma on 3/12/22.
 //
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include "PLApp.h"
@@ -16,6 +17,36 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+namespace {
+
+    std::shared_ptr<GLWrap::Mesh> makeMesh(const Mesh& mesh) {
+        std::shared_ptr<GLWrap::Mesh> glWrapMesh = std::make_shared<GLWrap::Mesh>();
+
+        glWrapMesh->setAttribute(0, mesh.vertices);
+        glWrapMesh->setAttribute(1, mesh.normals);
+        glWrapMesh->setAttribute(2, mesh.boneIndices);
+        glWrapMesh->setAttribute(3, mesh.boneWeights);
+        glWrapMesh->setAttribute(4, mesh.uvcoordinates);
+
+        glWrapMesh->setIndices(mesh.indices, GL_TRIANGLES);
+        return glWrapMesh;
+    }
+
+}
+
+MeshUniforms::MeshUniforms(const GLWrap::Program& prog) :
+    alpha(prog.uniformHandle<float>("alpha")),
+    eta(prog.uniformHandle<float>("eta")),
+    diffuseReflectance(prog.uniformHandle<glm::vec3>("diffuseReflectance")),
+    useBones(prog.uniformHandle<int>("useBones")),
+    boneTransforms(prog.uniformHandle<glm::mat4>("boneTransforms")),
+    useInstancing(prog.uniformHandle<int>("useInstancing")),
+    phaseCount(prog.uniformHandle<int>("phaseCount")),
+    boneCount(prog.uniformHandle<int>("boneCount")),
+    useVertexAnimation(prog.uniformHandle<int>("useVertexAnimation")),
+    vertexAnimationTime(prog.uniformHandle<float>("vertexAnimationTime")) {
+}
+
 PLApp::PLApp(
         const std::shared_ptr<Scene> &scene,
         const std::shared_ptr<OceanScene> &oceanScene,
@@ -32,9 +63,10 @@ PLApp::PLApp(
     rampFileName(rampFileName),
     shadingMode(ShadingMode_Deferred),
     config(config),
-    animators(scene, oceanScene) {
+    animators(scene, oceanScene),
+    simulation(scene, oceanScene, animators, timer, simulationInputs()) {
 
-    resetFramebuffers();
+    resetShadowMap();
     loadTextures();
     setUpPrograms();
     setUpCamera();
@@ -45,36 +77,9 @@ PLApp::PLApp(
     set_visible(true);
 }
 
-void PLApp::resetFramebuffers() {
-    geomBuffer = std::make_shared<GLWrap::Framebuffer>(getViewportSize(), 3);
-
-    std::vector<std::shared_ptr<GLWrap::Framebuffer> *> colorBuffers = {
-            &accBuffer, &temp1, &temp2, &toonBuffer, &outlineBuffer
-    };
-
-    for (auto &colorBufferPtr: colorBuffers) {
-        auto colorBuffer = std::shared_ptr<GLWrap::Framebuffer>(new GLWrap::Framebuffer(
-                getViewportSize(),
-                {{GL_RGBA32F, GL_RGBA}}
-        ));
-        colorBuffer->colorTexture().generateMipmap();
-
-        switch (config.textureFilteringMode) {
-            case TextureFilteringMode_Linear:
-                colorBuffer->colorTexture().parameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-                break;
-            case TextureFilteringMode_Nearest:
-                colorBuffer->colorTexture().parameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-                break;
-        }
-
-        *colorBufferPtr = colorBuffer;
-    }
-
-    shadowMap = std::shared_ptr<GLWrap::Framebuffer>(new GLWrap::Framebuffer(
-            config.shadowMapResolution,
-            0
-    ));
+void PLApp::resetShadowMap() {
+    shadowAtlas = std::make_unique<ShadowAtlas>(config.shadowMapResolution);
+    sunCascades = std::make_unique<SunCascades>(config.sunShadowResolution);
 }
 
 void PLApp::loadTextures() {
@@ -105,12 +110,15 @@ void PLApp::setUpPrograms() {
 
     programForward = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("forward", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/deferred.vs"},
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/shadow_layers.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/microfacet.fs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/forward.fs"}
     }));
 
     programDeferredGeom = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred geometry pass", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/deferred.vs"},
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/shadow_layers.vs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_geom.fs"}
     }));
 
@@ -128,11 +136,13 @@ void PLApp::setUpPrograms() {
 
     programToonOutline = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred toon outline pass", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/toon_outline.fs"}
     }));
 
     programDeferredShadow = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred shadow pass", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/deferred.vs"},
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/shadow_layers.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shadow.fs"}
     }));
 
@@ -140,14 +150,31 @@ void PLApp::setUpPrograms() {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/microfacet.fs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/evsm.fs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_point.fs"}
     }));
 
 	programTextureDeferred = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred Texture pass", {
 		{GL_VERTEX_SHADER,   resourcePath + "shaders/deferred_texture.vs"},
+		{GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
 		{GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_geom_texture.fs"}
 		}));
 
+    programDeferredClustered = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred clustered light pass", {
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/microfacet.fs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_clustered.fs"}
+    }));
+
+    programDeferredSun = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred sun pass", {
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/microfacet.fs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/evsm.fs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_sun.fs"}
+    }));
+
     programDeferredAmbient = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred ambient light pass", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
@@ -165,6 +192,17 @@ void PLApp::setUpPrograms() {
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/blur.fs"},
     }));
 
+    programShadowMoments = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("shadow moments pass", {
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/evsm.fs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/shadow_moments.fs"},
+    }));
+
+    programShadowBlur = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("shadow blur pass", {
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/shadow_blur.fs"},
+    }));
+
     programDeferredMerge = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("deferred merge pass", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_merge.fs"},
@@ -172,17 +210,21 @@ void PLApp::setUpPrograms() {
 
     programOceanForward = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("ocean forward", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/ocean.vs"},
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/shadow_layers.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/microfacet.fs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/normal.fs"}
     }));
 
     programOceanDeferredGeom = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("ocean deferred geometry pass", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/ocean.vs"},
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/shadow_layers.vs"},
+            {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shader_inputs.fs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_geom.fs"}
     }));
 
     programOceanDeferredShadow = std::shared_ptr<GLWrap::Program>(new GLWrap::Program("ocean deferred shadow pass", {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/ocean.vs"},
+            {GL_VERTEX_SHADER,   resourcePath + "shaders/shadow_layers.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/deferred_shadow.fs"}
     }));
 
@@ -197,6 +239,24 @@ void PLApp::setUpPrograms() {
             {GL_VERTEX_SHADER,   resourcePath + "shaders/fsq.vs"},
             {GL_FRAGMENT_SHADER, resourcePath + "shaders/srgb.fs"}
     }));
+
+    for (auto* prog : {
+            &programFlat, &programForward, &programTextureDeferred, &programDeferredGeom, &programToonPoint,
+            &programToonMerge, &programToonOutline, &programDeferredShadow, &programDeferredPoint, &programDeferredClustered, &programDeferredSun,
+            &programDeferredAmbient, &programDeferredSky, &programDeferredBlur, &programDeferredMerge,
+            &programSrgb, &programOceanForward, &programOceanDeferredGeom, &programOceanDeferredShadow,
+            &programOceanDeferredDirectional
+    }) {
+        (*prog)->bindUniformBlock("Frame", UniformBinding_Frame);
+        (*prog)->bindUniformBlock("Light", UniformBinding_Light);
+        (*prog)->bindUniformBlock("Object", UniformBinding_Object);
+    }
+
+    flatUniforms = MeshUniforms(*programFlat);
+    forwardUniforms = MeshUniforms(*programForward);
+    textureDeferredUniforms = MeshUniforms(*programTextureDeferred);
+    deferredGeomUniforms = MeshUniforms(*programDeferredGeom);
+    deferredShadowUniforms = MeshUniforms(*programDeferredShadow);
 }
 
 void PLApp::setUpCamera() {
@@ -206,17 +266,32 @@ void PLApp::setUpCamera() {
 
 void PLApp::setUpMeshes() {
     for (const Mesh &mesh: scene->meshes) {
-        std::unique_ptr<GLWrap::Mesh> glWrapMesh = std::make_unique<GLWrap::Mesh>();
+        meshes.push_back(makeMesh(mesh));
+    }
 
-        glWrapMesh->setAttribute(0, mesh.vertices);
-        glWrapMesh->setAttribute(1, mesh.normals);
-        glWrapMesh->setAttribute(2, mesh.boneIndices);
-        glWrapMesh->setAttribute(3, mesh.boneWeights);
-		glWrapMesh->setAttribute(4, mesh.uvcoordinates);
+    GLint maxTextureSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
 
-        glWrapMesh->setIndices(mesh.indices, GL_TRIANGLES);
+    for (const auto& flock : animators.birdAnimator.flocks()) {
+        // Per-bird phase offsets never change; the transforms are uploaded every frame
+        const BirdInstancing& instancing = flock->instancing();
+        FlockDrawData drawData;
+        for (unsigned int i : instancing.meshIndices) {
+            drawData.meshes.push_back(makeMesh(scene->meshes[i]));
+            drawData.meshes.back()->setInstanceAttribute(5, instancing.phases);
+        }
 
-        meshes.push_back(std::move(glWrapMesh));
+        bool fits = !instancing.vertexAnimations.empty();
+        for (const VertexAnimationData& data : instancing.vertexAnimations) {
+            fits = fits && data.vertexCount <= maxTextureSize && data.frameCount <= maxTextureSize;
+        }
+        if (fits) {
+            for (const VertexAnimationData& data : instancing.vertexAnimations) {
+                drawData.vertexAnimations.emplace_back(data);
+            }
+        }
+
+        flockDrawData.push_back(std::move(drawData));
     }
 
     {   // Add FSQ Mesh
@@ -260,13 +335,21 @@ void PLApp::setUpNanoguiControls() {
 
         gui->add_variable("Convert area to point", config.convertAreaToPoint);
 
+        auto casters = gui->add_variable("Shadow Casters", config.shadowCasterBudget);
+        casters->set_spinnable(true);
+        casters->set_min_max_values(0, 64);
+
+        auto cutoff = gui->add_variable("Light Cutoff", config.lightCutoff);
+        cutoff->set_spinnable(true);
+        cutoff->set_min_max_values(1e-6, 1);
+
         auto resolutionX = gui->add_variable("Resolution X", config.shadowMapResolution.x);
         resolutionX->set_spinnable(true);
         resolutionX->set_min_max_values(1, 10000);
         resolutionX->set_value_increment(1000);
         resolutionX->set_callback([&](int x) {
             config.shadowMapResolution.x = x;
-            resetFramebuffers();
+            resetShadowMap();
         });
 
         auto resolutionY = gui->add_variable("Resolution Y", config.shadowMapResolution.y);
@@ -275,7 +358,7 @@ void PLApp::setUpNanoguiControls() {
         resolutionY->set_value_increment(1000);
         resolutionY->set_callback([&](int y) {
             config.shadowMapResolution.y = y;
-            resetFramebuffers();
+            resetShadowMap();
         });
 
         auto bias = gui->add_variable("Bias", config.shadowBias);
@@ -295,6 +378,27 @@ void PLApp::setUpNanoguiControls() {
         fov->set_min_max_values(1e-5, glm::pi<float>());
 
         gui->add_variable("PCF", config.pcfEnabled);
+        gui->add_variable("EVSM", config.evsmEnabled);
+
+        auto evsmBlur = gui->add_variable("EVSM Blur", config.evsmBlur);
+        evsmBlur->set_spinnable(true);
+        evsmBlur->set_min_max_values(0, 8);
+        evsmBlur->set_value_increment(0.5);
+
+        gui->add_variable("Sun Cascades", config.sunCascades);
+
+        auto sunResolution = gui->add_variable("Sun Resolution", config.sunShadowResolution);
+        sunResolution->set_spinnable(true);
+        sunResolution->set_min_max_values(1, 8192);
+        sunResolution->set_value_increment(512);
+        sunResolution->set_callback([&](int resolution) {
+            config.sunShadowResolution = resolution;
+            resetShadowMap();
+        });
+
+        auto sunDistance = gui->add_variable("Sun Distance", config.sunShadowDistance);
+        sunDistance->set_spinnable(true);
+        sunDistance->set_min_max_values(1, 10000);
 
         gui->add_group("Ambient");
         gui->add_variable("Enabled", config.ambientLightsEnabled);
@@ -315,15 +419,15 @@ void PLApp::setUpNanoguiControls() {
         turb->set_spinnable(true);
         turb->set_min_max_values(1, 10);
 
+        gui->add_group("Birds");
+        gui->add_variable("Baked wings", config.birdVertexAnimation);
+        gui->add_variable("Simulation LOD", config.birdLod);
+
         gui->add_group("Bloom");
         gui->add_variable("Enabled", config.bloomFilterEnabled);
 
         auto filtMode = gui->add_variable("Filtering Mode", config.textureFilteringMode);
         filtMode->set_items({"Nearest", "Linear"});
-        filtMode->set_callback([&](const TextureFilteringMode &m) {
-            config.textureFilteringMode = m;
-            resetFramebuffers();
-        });
     }
     {
         perform_layout();
@@ -400,6 +504,23 @@ void PLApp::setUpNanoguiControls() {
         AAIntensity->set_spinnable(true);
         AAIntensity->set_min_max_values(0, 10);
     }
+    {
+        perform_layout();
+        int x = nanoguiWindows.toon->position().x() + nanoguiWindows.toon->size().x() + 10;
+
+        // A form of its own, refreshed every frame
+        statsForm = new nanogui::FormHelper(this);
+        nanoguiWindows.stats = statsForm->add_window(nanogui::Vector2i(x, 10), "Stats");
+        statsForm->add_group("Culling");
+        statsForm->add_variable("Frustum Culling", config.frustumCulling);
+        statsForm->add_variable("Visible Nodes", cullingStats.visible, false);
+        statsForm->add_variable("Culled Nodes", cullingStats.culled, false);
+        statsForm->add_variable("BVH Nodes Visited", cullingStats.nodesVisited, false);
+        statsForm->add_variable("BVH Rebuilds", cullingStats.rebuilds, false);
+        statsForm->add_variable("Occlusion Culling", config.occlusionCulling);
+        statsForm->add_variable("Occluded Nodes", cullingStats.occluded, false);
+        statsForm->add_variable("Occluder Triangles", cullingStats.occluderTriangles, false);
+    }
 
     perform_layout();
 }
@@ -436,6 +557,7 @@ bool PLApp::keyboard_event(int key, int scancode, int action, int modifiers) {
                 nanoguiWindows.deferred->set_visible(visible);
                 nanoguiWindows.ocean->set_visible(visible);
                 nanoguiWindows.toon->set_visible(visible);
+                nanoguiWindows.stats->set_visible(visible);
                 return true;
             }
             case GLFW_KEY_SPACE:
@@ -460,16 +582,34 @@ bool PLApp::keyboard_event(int key, int scancode, int action, int modifiers) {
                 return true;
             case GLFW_KEY_UP:
                 timer.setRate(timer.rate() + 0.25);
-                animators.birdAnimator.speed_up_birds();
+                simulation.post([this] { animators.birdAnimator.speed_up_birds(); });
                 std::cout << "[↑] Set rate: " << timer.rate() << "x" << std::endl;
                 return true;
             case GLFW_KEY_DOWN:
                 timer.setRate(timer.rate() - 0.25);
-                animators.birdAnimator.slow_down_birds();
+                simulation.post([this] { animators.birdAnimator.slow_down_birds(); });
                 std::cout << "[↓] Set rate: " << timer.rate() << "x" << std::endl;
                 return true;
             case GLFW_KEY_S:
-                BirdNodeAnimator::scatter = true;
+                simulation.post([this] { animators.birdAnimator.scatter(); });
+                return true;
+            case GLFW_KEY_G:
+                std::cout << "[G] Render graph: " << renderGraph.passCount() - renderGraph.culledPassCount() << " passes run, "
+                          << renderGraph.culledPassCount() << " culled; " << renderTargets.targetCount() << " render targets, "
+                          << renderTargets.bytes() / (1024 * 1024) << " MiB" << std::endl;
+                std::cout << "[G] Light clusters: " << lightClusters.lights().size() / 2 << " lights, "
+                          << lightClusters.indices().size() << " froxel entries" << std::endl;
+                std::cout << "[G] Shadow atlas: " << shadowAtlas->cacheMisses()
+                          << " static caches redrawn since the last report" << std::endl;
+                shadowAtlas->resetStats();
+                std::cout << "[G] Shadow culling: " << shadowCullStats.drawn << " caster draws, "
+                          << shadowCullStats.culled << " culled, " << shadowCullStats.lightsSkipped
+                          << " light frames skipped without receivers since the last report" << std::endl;
+                shadowCullStats = ShadowCullStats();
+#ifndef NDEBUG
+                std::cout << "[G] GL state calls last frame: " << lastFrameGLCounters.issued << " issued, "
+                          << lastFrameGLCounters.skipped << " skipped" << std::endl;
+#endif
                 return true;
             default:
                 break;
@@ -492,11 +632,73 @@ bool PLApp::scroll_event(const nanogui::Vector2i &p, const nanogui::Vector2f &re
 }
 
 bool PLApp::resize_event(const nanogui::Vector2i &size) {
-    resetFramebuffers();
+    // Render targets follow the viewport size from the next frame on
     cam->setAspectRatio(((float) size.x()) / ((float) size.y()));
     return Screen::resize_event(size);
 }
 
+void PLApp::draw_bird_instances(
+        const std::shared_ptr<GLWrap::Program>& prog,
+        const MeshUniforms& u,
+        bool skinning,
+        bool material,
+        int layers
+) {
+    const auto& flocks = animators.birdAnimator.flocks();
+    for (size_t f = 0; f < flocks.size() && f < birdTransforms.size(); f++) {
+        const BirdInstancing& instancing = flocks[f]->instancing();
+        const FlockDrawData& drawData = flockDrawData[f];
+        if (!instancing.enabled() || birdTransforms[f].empty()) {
+            continue;
+        }
+
+        // Fall back on the baked clip while the simulation has not posed the
+        // palettes yet, e.g. just after it was switched off
+        bool vertexAnimation = skinning && !drawData.vertexAnimations.empty()
+                && (config.birdVertexAnimation || birdPalettes[f].empty());
+
+        prog->uniform(u.useInstancing, true);
+        objectBlocks.bind(birdObjectBase + 2 * f + (vertexAnimation ? 1 : 0));
+        if (skinning) {
+            prog->uniform(u.useVertexAnimation, vertexAnimation);
+            if (vertexAnimation) {
+                double clipFraction = instancing.clipSeconds > 0
+                        ? std::fmod(simulation.renderTime() / instancing.clipSeconds, 1.0)
+                        : 0.0;
+                prog->uniform(u.vertexAnimationTime, (float) clipFraction);
+            } else {
+                prog->uniform(u.phaseCount, instancing.phaseCount);
+                prog->uniform(u.boneCount, instancing.boneCount);
+                prog->uniform(u.boneTransforms, birdPalettes[f].data(), (int) birdPalettes[f].size());
+            }
+        }
+
+        for (size_t k = 0; k < instancing.meshIndices.size(); k++) {
+            const Mesh& mesh = scene->meshes[instancing.meshIndices[k]];
+            if (material) {
+                const Material& meshMaterial = scene->materials[mesh.materialIndex];
+                prog->uniform(u.alpha, meshMaterial.roughnessFactor);
+                prog->uniform(u.eta, 1.5f);
+                prog->uniform(u.diffuseReflectance, meshMaterial.color);
+            }
+            if (skinning) {
+                prog->uniform(u.useBones, !vertexAnimation && !mesh.bones.empty());
+            }
+            if (vertexAnimation) {
+                drawData.vertexAnimations[k].bindTextureAndUniforms("vertexAnimation", prog, 3, 4);
+            }
+            drawData.meshes[k]->setInstanceDivisor(layers);
+            drawData.meshes[k]->drawElementsInstanced((int) birdTransforms[f].size() * layers);
+        }
+
+        prog->uniform(u.useInstancing, false);
+        if (skinning) {
+            prog->uniform(u.useVertexAnimation, false);
+        }
+    }
+}
+
+
 /*****************************************************************************
  * FLAT SHADING                                                              *
  *****************************************************************************/
@@ -505,34 +707,28 @@ void PLApp::draw_contents_flat() {
     glClearColor(backgroundColor.r(), backgroundColor.g(), backgroundColor.b(), backgroundColor.w());
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glEnable(GL_DEPTH_TEST);
+    GLWrap::StateCache::get().setEnabled(GL_DEPTH_TEST, true);
 
     std::shared_ptr<GLWrap::Program> prog = programFlat;
+    const MeshUniforms& u = flatUniforms;
 
     prog->use();
-    prog->uniform("mV", cam->getViewMatrix());
-    prog->uniform("mP", cam->getProjectionMatrix());
+    frameBlocks.bind(0);
     prog->uniform("k_a", glm::vec3(0.1, 0.1, 0.1));
     prog->uniform("k_d", glm::vec3(0.9, 0.9, 0.9));
     prog->uniform("lightDir", glm::normalize(glm::vec3(1.0, 1.0, 1.0)));
 
-    std::vector<std::shared_ptr<Node>> nodes = {scene->root};
-    while (!nodes.empty()) {
-        std::shared_ptr<Node> node = nodes.back();
-        nodes.pop_back();
+    const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+    for (size_t k : visibleDrawNodes) {
+        const Node& node = scene->nodes[drawNodes[k]];
 
-        for (const std::shared_ptr<Node> &child: node->children) {
-            nodes.push_back(child);
-        }
-
-        prog->uniform("mM", node->getTransformTo(nullptr));
+        objectBlocks.bind(k);
 
-        for (unsigned int i: node->meshIndices) {
+        for (unsigned int i: node.meshIndices) {
             meshes[i]->drawElements();
         }
     }
-
-    prog->unuse();
+    draw_bird_instances(prog, u, false, false);
 }
 
 /*****************************************************************************
@@ -543,85 +739,44 @@ void PLApp::draw_contents_forward() {
     glClearColor(backgroundColor.r(), backgroundColor.g(), backgroundColor.b(), backgroundColor.w());
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glEnable(GL_DEPTH_TEST);
+    GLWrap::StateCache::get().setEnabled(GL_DEPTH_TEST, true);
 
-    PointLight light;
-    glm::mat4 lightTransform;
-    if (scene->pointLights.empty()) {
-        lightTransform = glm::mat4(1);
-        light.position = glm::vec3(3, 4, 5);
-        light.power = glm::vec3(1000, 1000, 1000);
-    } else {
-        light = *scene->pointLights.front();
-    }
+    frameBlocks.bind(0);
+    lightBlocks.bind(forwardLight);
 
     {
         std::shared_ptr<GLWrap::Program> prog = programForward;
+        const MeshUniforms& u = forwardUniforms;
         prog->use();
 
-        prog->uniform("mV", cam->getViewMatrix());
-        prog->uniform("mP", cam->getProjectionMatrix());
-
-        prog->uniform("lightPower", light.power);
-        prog->uniform("vLightPos", MulUtil::mulh(
-                cam->getViewMatrix() * lightTransform,
-                light.position,
-                1
-        ));
-
-        std::vector<std::shared_ptr<Node>> nodes = {scene->root};
-        while (!nodes.empty()) {
-            std::shared_ptr<Node> node = nodes.back();
-            nodes.pop_back();
-
-            for (const std::shared_ptr<Node> &child: node->children) {
-                nodes.push_back(child);
-            }
+        const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+        for (size_t k : visibleDrawNodes) {
+            const Node& node = scene->nodes[drawNodes[k]];
 
-            prog->uniform("mM", node->getTransformTo(nullptr));
+            objectBlocks.bind(k);
 
-            for (unsigned int i: node->meshIndices) {
-                Mesh mesh = scene->meshes[i];
-                Material material = scene->materials[mesh.materialIndex];
-                prog->uniform("alpha", material.roughnessFactor);
-                prog->uniform("eta", 1.5f);
-                prog->uniform("diffuseReflectance", material.color);
+            for (unsigned int i: node.meshIndices) {
+                const Mesh& mesh = scene->meshes[i];
+                const Material& material = scene->materials[mesh.materialIndex];
+                prog->uniform(u.alpha, material.roughnessFactor);
+                prog->uniform(u.eta, 1.5f);
+                prog->uniform(u.diffuseReflectance, material.color);
 
-                prog->uniform("useBones", !mesh.bones.empty());
+                prog->uniform(u.useBones, !mesh.bones.empty());
                 if (!mesh.bones.empty()) {
-                    for (int j = 0; j < mesh.bones.size(); j++) {
-                        auto bone = mesh.bones[j];
-                        std::shared_ptr<Node> boneNode = scene->findNode(bone.first);
-                        glm::mat4 boneTransform = boneNode->getTransformTo(nullptr) * bone.second;
-
-                        prog->uniform(
-                                "boneTransforms[" + std::to_string(j) + "]",
-                                boneTransform
-                        );
-                    }
+                    prog->uniform(u.boneTransforms, bonePalettes[i].data(), (int) mesh.bones.size());
                 }
 
                 meshes[i]->drawElements();
             }
         }
-
-        prog->unuse();
+        draw_bird_instances(prog, u, true, true);
     }
 
     if (config.ocean) {
         std::shared_ptr<GLWrap::Program> prog = programOceanForward;
         prog->use();
 
-        prog->uniform("mV", cam->getViewMatrix());
-        prog->uniform("mP", cam->getProjectionMatrix());
-
-        prog->uniform("lightPower", light.power);
-        prog->uniform("vLightPos", MulUtil::mulh(
-                cam->getViewMatrix() * scene->findNode(light.name)->getTransformTo(nullptr),
-                light.position,
-                1
-        ));
-
         prog->uniform("alpha", 0.5f);
         prog->uniform("eta", 1.5f);
         prog->uniform("diffuseReflectance", glm::vec3(0.2, 0.3, 0.5));
@@ -630,17 +785,10 @@ void PLApp::draw_contents_forward() {
         animators.oceanAnimator.gradX.bindTextureAndUniforms("gradX", prog, 1);
         animators.oceanAnimator.gradZ.bindTextureAndUniforms("gradZ", prog, 2);
 
-        std::vector<glm::vec2> visibleGrid = oceanScene->visibleGridLocations(
-                cam->getViewProjectionMatrix(),
-                -1,
-                (int) (2.0f * config.renderDistance / sqrt(oceanScene->sizeMeters.x * oceanScene->sizeMeters.y) + 1.0f)
-        );
-        for (auto & gridLocation : visibleGrid) {
-            prog->uniform("mM", oceanScene->transform(gridLocation));
+        for (size_t t = 0; t < oceanTiles.size(); t++) {
+            objectBlocks.bind(oceanObjectBase + t);
             oceanMesh->drawElements();
         }
-
-        prog->unuse();
     }
 }
 
@@ -649,106 +797,76 @@ void PLApp::draw_contents_forward() {
  *****************************************************************************/
 void PLApp::deferred_texture_pass() {
 	std::shared_ptr<GLWrap::Program> prog = programTextureDeferred;
+	const MeshUniforms& u = textureDeferredUniforms;
 	prog->use();
 
-	prog->uniform("mV", cam->getViewMatrix());
-	prog->uniform("mP", cam->getProjectionMatrix());
+	frameBlocks.bind(0);
 
 	//stbi_image_free(textureData);
 	//texturemap->generateMipmap();
 	texturemap->bindToTextureUnit(0);
-	// Perform a depth-first traversal of the scene graph and draw all the nodes.
-	std::vector<std::shared_ptr<Node>> nodes = { scene->root };
-	while (!nodes.empty()) {
-		std::shared_ptr<Node> node = nodes.back();
-		nodes.pop_back();
-
-		for (const std::shared_ptr<Node> &child : node->children) {
-			nodes.push_back(child);
-		}
-
-		prog->uniform("mM", node->getTransformTo(nullptr));
-
-		for (unsigned int i : node->meshIndices) {
-			Mesh mesh = scene->meshes[i];
-			Material material = scene->materials[mesh.materialIndex];
-			prog->uniform("alpha", material.roughnessFactor);
-			prog->uniform("eta", 1.5f);
-			prog->uniform("diffuseReflectance", material.color);
-			prog->uniform("image", 0);
-			prog->uniform("useBones", !mesh.bones.empty());
+	prog->uniform("image", 0);
+	// Draw the visible nodes in arena order, which visits parents before children.
+	const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+	for (size_t k : visibleDrawNodes) {
+		const Node& node = scene->nodes[drawNodes[k]];
+
+		objectBlocks.bind(k);
+
+		for (unsigned int i : node.meshIndices) {
+			const Mesh& mesh = scene->meshes[i];
+			const Material& material = scene->materials[mesh.materialIndex];
+			prog->uniform(u.alpha, material.roughnessFactor);
+			prog->uniform(u.eta, 1.5f);
+			prog->uniform(u.diffuseReflectance, material.color);
+			prog->uniform(u.useBones, !mesh.bones.empty());
 			if (!mesh.bones.empty()) {
-				for (int j = 0; j < mesh.bones.size(); j++) {
-					auto bone = mesh.bones[j];
-					std::shared_ptr<Node> boneNode = scene->findNode(bone.first);
-					glm::mat4 boneTransform = boneNode->getTransformTo(nullptr) * bone.second;
-
-					prog->uniform(
-						"boneTransforms[" + std::to_string(j) + "]",
-						boneTransform
-					);
-				}
+				prog->uniform(u.boneTransforms, bonePalettes[i].data(), (int) mesh.bones.size());
 			}
 
 			meshes[i]->drawElements();
 		}
 	}
-	prog->unuse();
+	draw_bird_instances(prog, u, true, true);
 }
 
 void PLApp::deferred_geometry_pass() {
     std::shared_ptr<GLWrap::Program> prog = programDeferredGeom;
+    const MeshUniforms& u = deferredGeomUniforms;
     prog->use();
 
-    prog->uniform("mV", cam->getViewMatrix());
-    prog->uniform("mP", cam->getProjectionMatrix());
-
-    // Perform a depth-first traversal of the scene graph and draw all the nodes.
-    std::vector<std::shared_ptr<Node>> nodes = {scene->root};
-    while (!nodes.empty()) {
-        std::shared_ptr<Node> node = nodes.back();
-        nodes.pop_back();
+    frameBlocks.bind(0);
 
-        for (const std::shared_ptr<Node> &child: node->children) {
-            nodes.push_back(child);
-        }
+    // Draw the visible nodes in arena order, which visits parents before children.
+    const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+    for (size_t k : visibleDrawNodes) {
+        const Node& node = scene->nodes[drawNodes[k]];
 
-        prog->uniform("mM", node->getTransformTo(nullptr));
+        objectBlocks.bind(k);
 
-        for (unsigned int i: node->meshIndices) {
-            Mesh mesh = scene->meshes[i];
-            Material material = scene->materials[mesh.materialIndex];
-            prog->uniform("alpha", material.roughnessFactor);
-            prog->uniform("eta", 1.5f);
-            prog->uniform("diffuseReflectance", material.color);
+        for (unsigned int i: node.meshIndices) {
+            const Mesh& mesh = scene->meshes[i];
+            const Material& material = scene->materials[mesh.materialIndex];
+            prog->uniform(u.alpha, material.roughnessFactor);
+            prog->uniform(u.eta, 1.5f);
+            prog->uniform(u.diffuseReflectance, material.color);
 
-            prog->uniform("useBones", !mesh.bones.empty());
+            prog->uniform(u.useBones, !mesh.bones.empty());
             if (!mesh.bones.empty()) {
-                for (int j = 0; j < mesh.bones.size(); j++) {
-                    auto bone = mesh.bones[j];
-                    std::shared_ptr<Node> boneNode = scene->findNode(bone.first);
-                    glm::mat4 boneTransform = boneNode->getTransformTo(nullptr) * bone.second;
-
-                    prog->uniform(
-                            "boneTransforms[" + std::to_string(j) + "]",
-                            boneTransform
-                    );
-                }
+                prog->uniform(u.boneTransforms, bonePalettes[i].data(), (int) mesh.bones.size());
             }
 
             meshes[i]->drawElements();
         }
     }
-
-    prog->unuse();
+    draw_bird_instances(prog, u, true, true);
 }
 
 void PLApp::deferred_ocean_geometry_pass() {
     std::shared_ptr<GLWrap::Program> prog = programOceanDeferredGeom;
     prog->use();
 
-    prog->uniform("mV", cam->getViewMatrix());
-    prog->uniform("mP", cam->getProjectionMatrix());
+    frameBlocks.bind(0);
     prog->uniform("isOcean", true);
 
     prog->uniform("alpha", 0.5f);
@@ -759,22 +877,15 @@ void PLApp::deferred_ocean_geometry_pass() {
     animators.oceanAnimator.gradX.bindTextureAndUniforms("gradX", prog, 1);
     animators.oceanAnimator.gradZ.bindTextureAndUniforms("gradZ", prog, 2);
 
-    std::vector<glm::vec2> visibleGrid = oceanScene->visibleGridLocations(
-            cam->getViewProjectionMatrix(),
-            -1,
-            (int) (2.0f * config.renderDistance / sqrt(oceanScene->sizeMeters.x * oceanScene->sizeMeters.y) + 1.0f)
-    );
-    for (auto & gridLocation : visibleGrid) {
-        prog->uniform("mM", oceanScene->transform(gridLocation));
+    for (size_t t = 0; t < oceanTiles.size(); t++) {
+        objectBlocks.bind(oceanObjectBase + t);
         oceanMesh->drawElements();
     }
-
-    prog->unuse();
 }
 
 RTUtil::PerspectiveCamera PLApp::get_light_camera(const PointLight &light) const {
     return {
-            MulUtil::mulh(scene->findNode(light.name)->getTransformTo(nullptr), light.position, 1),
+            MulUtil::mulh(worldTransform(light.node), light.position, 1),
             glm::vec3(0, 0, 0),
             glm::vec3(0, 1, 0),
             1,
@@ -784,75 +895,280 @@ RTUtil::PerspectiveCamera PLApp::get_light_camera(const PointLight &light) const
     };
 }
 
-void PLApp::deferred_shadow_pass(
-        const PointLight &light
+void PLApp::deferred_shadow_atlas_pass() {
+    GLWrap::StateCache& gl = GLWrap::StateCache::get();
+    gl.setEnabled(GL_BLEND, false);
+    gl.setEnabled(GL_DEPTH_TEST, true);
+    for (int plane = 0; plane < 4; plane++) {
+        glEnable(GL_CLIP_DISTANCE0 + plane);
+    }
+
+    // Lights that shine on nothing the camera sees draw no shadows; their
+    // tiles are cleared, so they light whatever their lookups land on
+    std::vector<size_t> tiled;
+    std::vector<size_t> stale;
+    std::vector<size_t> skipped;
+    for (size_t light = 0; light < deferredLightCount; light++) {
+        if (shadowAtlas->hasTile(light) && shadowReceivers[light].empty()) {
+            skipped.push_back(light);
+            shadowCullStats.lightsSkipped++;
+        } else if (shadowAtlas->hasTile(light)) {
+            tiled.push_back(light);
+            if (!shadowAtlas->cached(light, lightBlocks.records[light].mP_light * lightBlocks.records[light].mV_light)) {
+                stale.push_back(light);
+            }
+        }
+    }
+
+    // Redraw the stale static caches together, then start every tile from its
+    // cache and draw the dynamic casters of all lights on top
+    if (!stale.empty()) {
+        shadowAtlas->bindStatic();
+        for (size_t light : stale) {
+            shadowAtlas->clearTile(light);
+        }
+        deferred_shadow_pass(stale, false);
+        for (size_t light : stale) {
+            shadowAtlas->markCached(light, lightBlocks.records[light].mP_light * lightBlocks.records[light].mV_light);
+        }
+    }
+
+    for (size_t light : tiled) {
+        shadowAtlas->copyStatic(light);
+    }
+    shadowAtlas->bind();
+    for (size_t light : skipped) {
+        shadowAtlas->clearTile(light);
+    }
+    deferred_shadow_pass(tiled, true);
+    if (config.ocean) {
+        deferred_ocean_shadow_pass(tiled);
+    }
+
+    for (int plane = 0; plane < 4; plane++) {
+        glDisable(GL_CLIP_DISTANCE0 + plane);
+    }
+}
+
+void PLApp::set_shadow_layers(
+        const std::shared_ptr<GLWrap::Program>& prog,
+        const glm::mat4* viewProjections,
+        const glm::vec4* rects,
+        int count
 ) {
-    std::shared_ptr<GLWrap::Program> prog = programDeferredShadow;
-    prog->use();
+    prog->uniform("shadowLayered", true);
+    prog->uniform("shadowLayerFirst", 0);
+    prog->uniform("shadowLayerCount", count);
+    prog->uniform(prog->uniformHandle<glm::mat4>("shadowViewProjections"), viewProjections, count);
+    prog->uniform(prog->uniformHandle<glm::vec4>("shadowRects"), rects, count);
+}
 
-    RTUtil::PerspectiveCamera lightCamera = get_light_camera(light);
-    prog->uniform("mV", lightCamera.getViewMatrix());
-    prog->uniform("mP", lightCamera.getProjectionMatrix());
+void PLApp::set_light_shadow_layers(const std::shared_ptr<GLWrap::Program>& prog, const size_t* lights, int count) {
+    glm::mat4 viewProjections[maxShadowLayers];
+    glm::vec4 rects[maxShadowLayers];
+    for (int layer = 0; layer < count; layer++) {
+        const LightBlock& block = lightBlocks.records[lights[layer]];
+        viewProjections[layer] = block.mP_light * block.mV_light;
+        rects[layer] = block.shadowRect;
+    }
+    set_shadow_layers(prog, viewProjections, rects, count);
+}
 
-    std::vector<std::shared_ptr<Node>> nodes = {scene->root};
-    while (!nodes.empty()) {
-        std::shared_ptr<Node> node = nodes.back();
-        nodes.pop_back();
+bool PLApp::shadow_layer_range(
+        const size_t* lights,
+        int count,
+        const Bounds& caster,
+        bool useReceivers,
+        int& first,
+        int& last
+) {
+    first = count;
+    last = -1;
+    for (int layer = 0; layer < count; layer++) {
+        const LightBlock& block = lightBlocks.records[lights[layer]];
+        Bounds ndc = caster.projected(block.mP_light * block.mV_light);
+        if (ndc.empty()) {
+            continue;
+        }
 
-        for (const std::shared_ptr<Node> &child: node->children) {
-            nodes.push_back(child);
+        // Overlapping the receivers as seen from the light, and not entirely
+        // behind all of them
+        const Bounds& receivers = shadowReceivers[lights[layer]];
+        if (useReceivers && !(ndc.min.x <= receivers.max.x && receivers.min.x <= ndc.max.x
+                              && ndc.min.y <= receivers.max.y && receivers.min.y <= ndc.max.y
+                              && ndc.min.z <= receivers.max.z)) {
+            continue;
         }
+        first = std::min(first, layer);
+        last = std::max(last, layer);
+    }
 
-        prog->uniform("mM", node->getTransformTo(nullptr));
+    bool any = first <= last;
+    shadowCullStats.drawn += any ? 1 : 0;
+    shadowCullStats.culled += any ? 0 : 1;
+    return any;
+}
 
-        for (unsigned int i: node->meshIndices) {
-            Mesh mesh = scene->meshes[i];
+void PLApp::deferred_shadow_pass(const std::vector<size_t>& lights, bool dynamicCasters) {
+    std::shared_ptr<GLWrap::Program> prog = programDeferredShadow;
+    const MeshUniforms& u = deferredShadowUniforms;
+    prog->use();
+    GLWrap::UniformHandle<int> layerFirst = prog->uniformHandle<int>("shadowLayerFirst");
+    GLWrap::UniformHandle<int> layerCount = prog->uniformHandle<int>("shadowLayerCount");
+
+    // Every mesh is drawn once per light by instancing, so the scene is
+    // walked once per maxShadowLayers lights. A mesh is only drawn for the
+    // run of lights it may cast into. The static casters are culled against
+    // the light frustums alone, since their caches outlive the camera.
+    const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+    for (size_t base = 0; base < lights.size(); base += maxShadowLayers) {
+        int layers = (int) std::min<size_t>(lights.size() - base, maxShadowLayers);
+        set_light_shadow_layers(prog, &lights[base], layers);
+
+        for (size_t k = 0; k < drawNodes.size(); k++) {
+            if (dynamicCaster[drawNodes[k]] != dynamicCasters) {
+                continue;
+            }
+            const Node& node = scene->nodes[drawNodes[k]];
+            glm::mat4 transform = worldTransform(drawNodes[k]);
 
-            prog->uniform("useBones", !mesh.bones.empty());
-            if (!mesh.bones.empty()) {
-                for (int j = 0; j < mesh.bones.size(); j++) {
-                    auto bone = mesh.bones[j];
-                    std::shared_ptr<Node> boneNode = scene->findNode(bone.first);
-                    glm::mat4 boneTransform = boneNode->getTransformTo(nullptr) * bone.second;
-
-                    prog->uniform(
-                            "boneTransforms[" + std::to_string(j) + "]",
-                            boneTransform
-                    );
+            objectBlocks.bind(k);
+
+            for (unsigned int i: node.meshIndices) {
+                const Mesh& mesh = scene->meshes[i];
+
+                int first, last;
+                if (!shadow_layer_range(&lights[base], layers, mesh.worldBounds(transform, bonePalettes[i]), dynamicCasters, first, last)) {
+                    continue;
+                }
+
+                prog->uniform(layerFirst, first);
+                prog->uniform(layerCount, last - first + 1);
+                prog->uniform(u.useBones, !mesh.bones.empty());
+                if (!mesh.bones.empty()) {
+                    prog->uniform(u.boneTransforms, bonePalettes[i].data(), (int) mesh.bones.size());
                 }
+                meshes[i]->drawElementsInstanced(last - first + 1);
             }
-            meshes[i]->drawElements();
+        }
+        if (dynamicCasters) {
+            prog->uniform(layerFirst, 0);
+            prog->uniform(layerCount, layers);
+            draw_bird_instances(prog, u, true, false, layers);
         }
     }
-
-    prog->unuse();
 }
 
-void PLApp::deferred_ocean_shadow_pass(
-        const PointLight &light
-) {
+void PLApp::deferred_ocean_shadow_pass(const std::vector<size_t>& lights) {
     std::shared_ptr<GLWrap::Program> prog = programOceanDeferredShadow;
     prog->use();
 
-    RTUtil::PerspectiveCamera lightCamera = get_light_camera(light);
-    prog->uniform("mV", lightCamera.getViewMatrix());
-    prog->uniform("mP", lightCamera.getProjectionMatrix());
-
     animators.oceanAnimator.displacement.bindTextureAndUniforms("displacement", prog, 0);
     animators.oceanAnimator.gradX.bindTextureAndUniforms("gradX", prog, 1);
     animators.oceanAnimator.gradZ.bindTextureAndUniforms("gradZ", prog, 2);
 
-    std::vector<glm::vec2> visibleGrid = oceanScene->visibleGridLocations(
-            cam->getViewProjectionMatrix(),
-            -1,
-            (int) (2.0f * config.renderDistance / sqrt(oceanScene->sizeMeters.x * oceanScene->sizeMeters.y) + 1.0f)
-    );
-    for (auto & gridLocation : visibleGrid) {
-        prog->uniform("mM", oceanScene->transform(gridLocation));
-        oceanMesh->drawElements();
+    GLWrap::UniformHandle<int> layerFirst = prog->uniformHandle<int>("shadowLayerFirst");
+    GLWrap::UniformHandle<int> layerCount = prog->uniformHandle<int>("shadowLayerCount");
+
+    // Only the tiles the camera sees are drawn, each for the lights it may
+    // cast into
+    for (size_t base = 0; base < lights.size(); base += maxShadowLayers) {
+        int layers = (int) std::min<size_t>(lights.size() - base, maxShadowLayers);
+        set_light_shadow_layers(prog, &lights[base], layers);
+
+        for (size_t t = 0; t < oceanTiles.size(); t++) {
+            int first, last;
+            if (!shadow_layer_range(&lights[base], layers, oceanTileBounds[t], true, first, last)) {
+                continue;
+            }
+            prog->uniform(layerFirst, first);
+            prog->uniform(layerCount, last - first + 1);
+            objectBlocks.bind(oceanObjectBase + t);
+            oceanMesh->drawElementsInstanced(last - first + 1);
+        }
+    }
+}
+
+void PLApp::deferred_sun_shadow_pass() {
+    GLWrap::StateCache& gl = GLWrap::StateCache::get();
+    gl.setEnabled(GL_BLEND, false);
+    gl.setEnabled(GL_DEPTH_TEST, true);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    for (int plane = 0; plane < 4; plane++) {
+        glEnable(GL_CLIP_DISTANCE0 + plane);
+    }
+
+    const int cascadeCount = SunCascades::cascadeCount;
+    glm::mat4 viewProjections[cascadeCount];
+    glm::vec4 rects[cascadeCount];
+    for (int c = 0; c < cascadeCount; c++) {
+        viewProjections[c] = sunCascades->viewProjection(c);
+        rects[c] = sunCascades->rect(c);
+    }
+
+    std::shared_ptr<GLWrap::Program> prog = programDeferredShadow;
+    const MeshUniforms& u = deferredShadowUniforms;
+    prog->use();
+    set_shadow_layers(prog, viewProjections, rects, cascadeCount);
+    GLWrap::UniformHandle<int> layerFirst = prog->uniformHandle<int>("shadowLayerFirst");
+    GLWrap::UniformHandle<int> layerCount = prog->uniformHandle<int>("shadowLayerCount");
+
+    // Each mesh is drawn into the run of cascades its bounds overlap
+    const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+    for (size_t k = 0; k < drawNodes.size(); k++) {
+        const Node& node = scene->nodes[drawNodes[k]];
+        glm::mat4 transform = worldTransform(drawNodes[k]);
+
+        objectBlocks.bind(k);
+
+        for (unsigned int i: node.meshIndices) {
+            const Mesh& mesh = scene->meshes[i];
+
+            Bounds bounds = mesh.worldBounds(transform, bonePalettes[i]);
+            int first = cascadeCount;
+            int last = -1;
+            for (int c = 0; c < cascadeCount; c++) {
+                if (sunCascades->overlaps(c, bounds)) {
+                    first = std::min(first, c);
+                    last = std::max(last, c);
+                }
+            }
+            if (last < first) {
+                continue;
+            }
+
+            prog->uniform(layerFirst, first);
+            prog->uniform(layerCount, last - first + 1);
+            prog->uniform(u.useBones, !mesh.bones.empty());
+            if (!mesh.bones.empty()) {
+                prog->uniform(u.boneTransforms, bonePalettes[i].data(), (int) mesh.bones.size());
+            }
+            meshes[i]->drawElementsInstanced(last - first + 1);
+        }
+    }
+
+    prog->uniform(layerFirst, 0);
+    prog->uniform(layerCount, cascadeCount);
+    draw_bird_instances(prog, u, true, false, cascadeCount);
+
+    if (config.ocean) {
+        std::shared_ptr<GLWrap::Program> oceanProg = programOceanDeferredShadow;
+        oceanProg->use();
+        set_shadow_layers(oceanProg, viewProjections, rects, cascadeCount);
+
+        animators.oceanAnimator.displacement.bindTextureAndUniforms("displacement", oceanProg, 0);
+        animators.oceanAnimator.gradX.bindTextureAndUniforms("gradX", oceanProg, 1);
+        animators.oceanAnimator.gradZ.bindTextureAndUniforms("gradZ", oceanProg, 2);
+
+        for (size_t t = 0; t < oceanTiles.size(); t++) {
+            objectBlocks.bind(oceanObjectBase + t);
+            oceanMesh->drawElementsInstanced(cascadeCount);
+        }
     }
 
-    prog->unuse();
+    for (int plane = 0; plane < 4; plane++) {
+        glDisable(GL_CLIP_DISTANCE0 + plane);
+    }
 }
 
 glm::ivec2 PLApp::getViewportSize() {
@@ -865,7 +1181,7 @@ glm::ivec2 PLApp::getViewportSize() {
 void PLApp::toon_lighting_pass(
     const std::shared_ptr<GLWrap::Framebuffer>& geomBuffer,
     const GLWrap::Texture2D& shadowTexture,
-    const PointLight& light
+    size_t lightIndex
 ) {
     geomBuffer->colorTexture(0).bindToTextureUnit(0);
     geomBuffer->colorTexture(1).bindToTextureUnit(1);
@@ -876,9 +1192,10 @@ void PLApp::toon_lighting_pass(
     std::shared_ptr<GLWrap::Program> prog = programToonPoint;
     prog->use();
     prog->uniform("viewportSize", glm::vec2(getViewportSize().x, getViewportSize().y));
-    prog->uniform("mV", cam->getViewMatrix());
-    prog->uniform("mP", cam->getProjectionMatrix());
+    frameBlocks.bind(0);
+    lightBlocks.bind(lightIndex);
     prog->uniform("shadowBias", config.shadowBias);
+    prog->uniform("shadowMapRes", shadowAtlas->size());
     prog->uniform("shadeOcean", config.oceanShadingMode == OceanShadingMode_Toon);
     prog->uniform("diffuseReflectanceTex", 0);
     prog->uniform("materialTex", 1);
@@ -886,18 +1203,7 @@ void PLApp::toon_lighting_pass(
     prog->uniform("depthTex", 3);
     prog->uniform("shadowTex", 4);
 
-    RTUtil::PerspectiveCamera lightCamera = get_light_camera(light);
-    prog->uniform("mV_light", lightCamera.getViewMatrix());
-    prog->uniform("mP_light", lightCamera.getProjectionMatrix());
-    prog->uniform("wLightPos", MulUtil::mulh(
-            scene->findNode(light.name)->getTransformTo(nullptr),
-            light.position,
-            1
-    ));
-    prog->uniform("wCamPos", cam->getEye());
-
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::toon_merge_pass(
@@ -950,7 +1256,6 @@ void PLApp::toon_merge_pass(
     prog->uniform("edgeIntensity", config.edgeIntensity);
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::toon_outline_pass(
@@ -968,7 +1273,7 @@ void PLApp::toon_outline_pass(
     prog->uniform("imageTex", 0);
     prog->uniform("normalsTex", 1);
     prog->uniform("depthTex", 2);
-    prog->uniform("materialsTex", 3);
+    prog->uniform("materialTex", 3);
     prog->uniform("shadeOcean", config.oceanShadingMode == OceanShadingMode_Toon);
     prog->uniform("fxaaEnabled", config.fxaaEnabled);
 
@@ -980,13 +1285,12 @@ void PLApp::toon_outline_pass(
     prog->uniform("AAIntensity", config.AAIntensity);
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::deferred_lighting_pass(
         const std::shared_ptr<GLWrap::Framebuffer> &geomBuffer,
         const GLWrap::Texture2D &shadowTexture,
-        const PointLight &light
+        size_t lightIndex
 ) {
     geomBuffer->colorTexture(0).bindToTextureUnit(0);
     geomBuffer->colorTexture(1).bindToTextureUnit(1);
@@ -997,34 +1301,170 @@ void PLApp::deferred_lighting_pass(
     std::shared_ptr<GLWrap::Program> prog = programDeferredPoint;
     prog->use();
     prog->uniform("viewportSize", getViewportSize());
-    prog->uniform("mV", cam->getViewMatrix());
-    prog->uniform("mP", cam->getProjectionMatrix());
+    frameBlocks.bind(0);
+    lightBlocks.bind(lightIndex);
+    prog->uniform("shadowBias", config.shadowBias);
+    prog->uniform("shadowMapRes", shadowAtlas->size());
+    prog->uniform("pcfEnabled", config.pcfEnabled);
+    prog->uniform("evsmEnabled", config.evsmEnabled);
+    set_evsm_uniforms(prog, true);
+    prog->uniform("diffuseReflectanceTex", 0);
+    prog->uniform("materialTex", 1);
+    prog->uniform("normalsTex", 2);
+    prog->uniform("depthTex", 3);
+    prog->uniform("shadowTex", 4);
+    prog->uniform("shadeOcean", config.oceanShadingMode == OceanShadingMode_Plastic);
+
+    fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+void PLApp::deferred_clustered_pass(const std::shared_ptr<GLWrap::Framebuffer> &geomBuffer) {
+    geomBuffer->colorTexture(0).bindToTextureUnit(0);
+    geomBuffer->colorTexture(1).bindToTextureUnit(1);
+    geomBuffer->colorTexture(2).bindToTextureUnit(2);
+    geomBuffer->depthTexture().bindToTextureUnit(3);
+    clusterLightBuffer.bindToTextureUnit(4);
+    clusterBuffer.bindToTextureUnit(5);
+    clusterIndexBuffer.bindToTextureUnit(6);
+
+    glm::ivec3 grid = lightClusters.gridSize();
+
+    std::shared_ptr<GLWrap::Program> prog = programDeferredClustered;
+    prog->use();
+    prog->uniform("viewportSize", getViewportSize());
+    frameBlocks.bind(0);
+    prog->uniform("diffuseReflectanceTex", 0);
+    prog->uniform("materialTex", 1);
+    prog->uniform("normalsTex", 2);
+    prog->uniform("depthTex", 3);
+    prog->uniform("lightData", 4);
+    prog->uniform("clusterData", 5);
+    prog->uniform("lightIndices", 6);
+    prog->uniform("tileSize", LightClusters::tileSize);
+    prog->uniform("clustersX", grid.x);
+    prog->uniform("clustersY", grid.y);
+    prog->uniform("slices", grid.z);
+    prog->uniform("sliceScale", lightClusters.sliceScale());
+    prog->uniform("sliceBias", lightClusters.sliceBias());
+    prog->uniform("shadeOcean", config.oceanShadingMode == OceanShadingMode_Plastic);
+
+    fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+void PLApp::deferred_sun_pass(
+        const std::shared_ptr<GLWrap::Framebuffer> &geomBuffer,
+        const GLWrap::Texture2D &shadowTexture
+) {
+    geomBuffer->colorTexture(0).bindToTextureUnit(0);
+    geomBuffer->colorTexture(1).bindToTextureUnit(1);
+    geomBuffer->colorTexture(2).bindToTextureUnit(2);
+    geomBuffer->depthTexture().bindToTextureUnit(3);
+    shadowTexture.bindToTextureUnit(4);
+
+    const int cascadeCount = SunCascades::cascadeCount;
+    glm::mat4 viewProjections[cascadeCount];
+    glm::vec4 rects[cascadeCount];
+    glm::vec4 splits;
+    for (int c = 0; c < cascadeCount; c++) {
+        viewProjections[c] = sunCascades->viewProjection(c);
+        rects[c] = sunCascades->rect(c);
+        splits[c] = sunCascades->split(c);
+    }
+
+    // The sun is a point light far away; keep the irradiance it would give
+    // at the origin
+    glm::vec3 wSunPos = glm::vec3(lightBlocks.records[sunLight].wLightPos);
+    glm::vec3 irradiance = frameLights[sunLight].power / (4 * glm::pi<float>() * glm::dot(wSunPos, wSunPos));
+
+    std::shared_ptr<GLWrap::Program> prog = programDeferredSun;
+    prog->use();
+    prog->uniform("viewportSize", getViewportSize());
+    frameBlocks.bind(0);
     prog->uniform("shadowBias", config.shadowBias);
-    prog->uniform("shadowMapRes", config.shadowMapResolution);
+    prog->uniform("shadowMapRes", sunCascades->size());
     prog->uniform("pcfEnabled", config.pcfEnabled);
+    prog->uniform("evsmEnabled", config.evsmEnabled);
+    set_evsm_uniforms(prog, false);
     prog->uniform("diffuseReflectanceTex", 0);
     prog->uniform("materialTex", 1);
     prog->uniform("normalsTex", 2);
     prog->uniform("depthTex", 3);
     prog->uniform("shadowTex", 4);
     prog->uniform("shadeOcean", config.oceanShadingMode == OceanShadingMode_Plastic);
+    prog->uniform("vToSun", glm::normalize(glm::mat3(cam->getViewMatrix()) * sunDirection));
+    prog->uniform("sunIrradiance", irradiance);
+    prog->uniform(prog->uniformHandle<glm::mat4>("cascadeViewProjections"), viewProjections, cascadeCount);
+    prog->uniform(prog->uniformHandle<glm::vec4>("cascadeRects"), rects, cascadeCount);
+    prog->uniform("cascadeSplits", splits);
+
+    fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
 
-    RTUtil::PerspectiveCamera lightCamera = get_light_camera(light);
-    prog->uniform("mV_light", lightCamera.getViewMatrix());
-    prog->uniform("mP_light", lightCamera.getProjectionMatrix());
-    prog->uniform("lightPower", light.power);
-    prog->uniform("vLightPos", MulUtil::mulh(
-            cam->getViewMatrix() * scene->findNode(light.name)->getTransformTo(nullptr),
-            light.position,
-            1
-    ));
+void PLApp::set_evsm_uniforms(const std::shared_ptr<GLWrap::Program>& prog, bool perspective) {
+    // The atlas holds perspective depth from get_light_camera; the sun
+    // cascades are orthographic, so their depth is already linear
+    prog->uniform("evsmPerspective", perspective);
+    prog->uniform("evsmNear", config.shadowNear);
+    prog->uniform("evsmFar", config.shadowFar);
+}
 
+void PLApp::shadow_moments_pass(
+        const GLWrap::Texture2D &depthTexture,
+        const std::shared_ptr<GLWrap::Framebuffer> &moments,
+        const std::shared_ptr<GLWrap::Framebuffer> &scratch,
+        glm::ivec2 size,
+        const std::vector<glm::vec4> &tiles,
+        bool perspective
+) {
+    GLWrap::StateCache& gl = GLWrap::StateCache::get();
+    gl.setEnabled(GL_BLEND, false);
+    gl.setEnabled(GL_DEPTH_TEST, false);
+
+    depthTexture.bindToTextureUnit(0);
+
+    std::shared_ptr<GLWrap::Program> prog = programShadowMoments;
+    prog->use();
+    prog->uniform("depthTex", 0);
+    set_evsm_uniforms(prog, perspective);
+
+    moments->bind();
+    gl.viewport(0, 0, size.x, size.y);
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
+
+    if (config.evsmBlur <= 0) {
+        return;
+    }
+    scratch->bind();
+    for (const glm::vec4& tile : tiles) {
+        shadow_blur_pass(moments->colorTexture(), {1.0, 0.0}, tile, size);
+    }
+    moments->bind();
+    for (const glm::vec4& tile : tiles) {
+        shadow_blur_pass(scratch->colorTexture(), {0.0, 1.0}, tile, size);
+    }
 }
 
-void PLApp::deferred_draw_pass(const std::shared_ptr<GLWrap::Framebuffer> &accBuffer) {
-    accBuffer->colorTexture(0).bindToTextureUnit(0);
+void PLApp::shadow_blur_pass(const GLWrap::Texture2D &image, glm::vec2 dir, glm::vec4 tile, glm::ivec2 size) {
+    image.bindToTextureUnit(0);
+
+    std::shared_ptr<GLWrap::Program> prog = programShadowBlur;
+    prog->use();
+
+    // Bind uniforms in shadow_blur.fs
+    prog->uniform("image", 0);
+    prog->uniform("dir", dir);
+    prog->uniform("stdev", config.evsmBlur);
+    prog->uniform("radius", (int) (3 * config.evsmBlur + 1));
+    prog->uniform("tileRect", tile);
+
+    glm::ivec2 offset = glm::ivec2(glm::round(glm::vec2(tile.x * size.x, tile.y * size.y)));
+    glm::ivec2 extent = glm::ivec2(glm::round(glm::vec2(tile.z * size.x, tile.w * size.y)));
+    GLWrap::StateCache::get().viewport(offset.x, offset.y, extent.x, extent.y);
+    fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+void PLApp::deferred_draw_pass(const std::shared_ptr<GLWrap::Framebuffer> &colorBuffer) {
+    colorBuffer->colorTexture(0).bindToTextureUnit(0);
 
     std::shared_ptr<GLWrap::Program> prog = programSrgb;
     prog->use();
@@ -1032,7 +1472,6 @@ void PLApp::deferred_draw_pass(const std::shared_ptr<GLWrap::Framebuffer> &accBu
     prog->uniform("exposure", config.exposure);
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::deferred_ambient_pass(
@@ -1047,8 +1486,9 @@ void PLApp::deferred_ambient_pass(
     std::shared_ptr<GLWrap::Program> prog = programDeferredAmbient;
     prog->use();
 
+    frameBlocks.bind(0);
+
     // Set uniforms in deferred_shader_inputs.fs
-    prog->uniform("mP", cam->getProjectionMatrix());
     prog->uniform("viewportSize", getViewportSize());
     prog->uniform("diffuseReflectanceTex", 0);
     prog->uniform("materialTex", 1);
@@ -1062,7 +1502,6 @@ void PLApp::deferred_ambient_pass(
     prog->uniform("numSamples", config.ssaoNumSamples);
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::deferred_ocean_directional_pass(const std::shared_ptr<GLWrap::Framebuffer> &geomBuffer) {
@@ -1074,25 +1513,21 @@ void PLApp::deferred_ocean_directional_pass(const std::shared_ptr<GLWrap::Frameb
     std::shared_ptr<GLWrap::Program> prog = programOceanDeferredDirectional;
     prog->use();
 
+    // The camera and sky come from the Frame block
+    frameBlocks.bind(0);
+
     // Set uniforms in deferred_shader_inputs.fs
-    prog->uniform("mP", cam->getProjectionMatrix());
     prog->uniform("viewportSize", getViewportSize());
     prog->uniform("diffuseReflectanceTex", 0);
     prog->uniform("materialTex", 1);
     prog->uniform("normalsTex", 2);
     prog->uniform("depthTex", 3);
 
-    // Bind uniforms in sunsky.fs
-    RTUtil::Sky sky(config.thetaSun, config.turbidity);
-    sky.setUniforms(*prog);
-
     // Bind uniforms in deferred_ocean.fs
-    prog->uniform("mV", cam->getViewMatrix());
     prog->uniform("upwelling", oceanScene->upwelling);
     prog->uniform("renderDistance", config.renderDistance);
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::deferred_sky_pass(
@@ -1103,14 +1538,11 @@ void PLApp::deferred_sky_pass(
     std::shared_ptr<GLWrap::Program> prog = programDeferredSky;
     prog->use();
 
-    // Bind uniforms in sunsky.fs
-    RTUtil::Sky sky(config.thetaSun, config.turbidity);
-    sky.setUniforms(*prog);
+    // The camera and sky come from the Frame block
+    frameBlocks.bind(0);
 
     // Bind uniforms in deferred_sky.fs
     prog->uniform("image", 0);
-    prog->uniform("mP", cam->getProjectionMatrix());
-    prog->uniform("mV", cam->getViewMatrix());
 
     if (config.ocean) {
         prog->uniform("background", oceanScene->upwelling);
@@ -1119,7 +1551,6 @@ void PLApp::deferred_sky_pass(
     }
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::deferred_blur_pass(
@@ -1143,7 +1574,6 @@ void PLApp::deferred_blur_pass(
     prog->uniform("level", level);
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
 void PLApp::deferred_merge_pass(
@@ -1160,218 +1590,646 @@ void PLApp::deferred_merge_pass(
     prog->uniform("blurred", 1);
 
     fsqMesh->drawArrays(GL_TRIANGLE_FAN, 0, 4);
-    prog->unuse();
 }
 
-void PLApp::draw_contents_deferred() {
-    geomBuffer->bind();
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
+void PLApp::update_shadow_casters() {
+    const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+    // The simulation's own transforms rather than the interpolated ones, so
+    // that a node that stays put compares exactly equal from frame to frame
+    const std::vector<glm::mat4>& transforms = simulation.snapshot().worldTransforms;
+    if (casterTransforms.size() != transforms.size()) {
+        casterTransforms = transforms;
+        casterFramesStill.assign(transforms.size(), shadowSettleFrames);
+        dynamicCaster.assign(transforms.size(), false);
+        shadowAtlas->invalidate();
+    }
+    if (drawNodes != casterNodes) {
+        casterNodes = drawNodes;
+        shadowAtlas->invalidate();
+    }
+    for (NodeHandle handle = 0; handle < transforms.size(); handle++) {
+        if (transforms[handle] != casterTransforms[handle]) {
+            casterTransforms[handle] = transforms[handle];
+            casterFramesStill[handle] = 0;
+        } else if (casterFramesStill[handle] < shadowSettleFrames) {
+            casterFramesStill[handle]++;
+        }
+    }
+    for (NodeHandle handle : drawNodes) {
+        bool skinned = false;
+        for (unsigned int i : scene->nodes[handle].meshIndices) {
+            skinned = skinned || !scene->meshes[i].bones.empty();
+        }
+        bool dynamic = skinned || casterFramesStill[handle] < shadowSettleFrames;
+        if (dynamic != dynamicCaster[handle]) {
+            dynamicCaster[handle] = dynamic;
+            shadowAtlas->invalidate();
+        }
+    }
 
-    const GLenum buffers[] = {
-            GL_COLOR_ATTACHMENT0,
-            GL_COLOR_ATTACHMENT1,
-            GL_COLOR_ATTACHMENT2,
-    };
-    glDrawBuffers(3, buffers);
-    deferred_texture_pass();
-	//deferred_geometry_pass();
-    if (config.ocean) {
-        deferred_ocean_geometry_pass();
+    // The lights that matter most to the view cast shadows: rank by peak
+    // irradiance at the camera, clamped so that a light next to the eye does
+    // not outrank everything else forever.
+    glm::mat4 projection = cam->getProjectionMatrix();
+    float near = projection[3][2] / (projection[2][2] - 1);
+    glm::vec3 eye = cam->getEye();
+
+    // A directional sun has its own cascades, except in the toon passes
+    bool sunDirectional = sun_is_directional() && !config.toonEnabled;
+
+    std::vector<std::pair<float, size_t>> ranked;
+    ranked.reserve(deferredLightCount);
+    for (size_t light = 0; light < deferredLightCount; light++) {
+        if (sunDirectional && light == sunLight) {
+            continue;
+        }
+        glm::vec3 d = glm::vec3(lightBlocks.records[light].wLightPos) - eye;
+        const glm::vec3& power = frameLights[light].power;
+        float peak = std::max(power.x, std::max(power.y, power.z));
+        ranked.emplace_back(peak / std::max(glm::dot(d, d), near * near), light);
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    size_t casterCount = std::min<size_t>(std::max(config.shadowCasterBudget, 0), ranked.size());
+    castsShadow.assign(deferredLightCount, false);
+    for (size_t i = 0; i < casterCount; i++) {
+        castsShadow[ranked[i].second] = true;
     }
-    geomBuffer->unbind();
+    toonLightCount = config.multipleLightsEnabled ? deferredLightCount : std::min<size_t>(deferredLightCount, 1);
+
+    // Atlas tiers: a light gets a tier 0 tile only if it is among the most
+    // important and the sphere it lights covers much of the screen.
+    std::vector<int> tiers(deferredLightCount, -1);
+    std::vector<size_t> order;
+    for (size_t rank = 0; rank < ranked.size(); rank++) {
+        size_t light = ranked[rank].second;
+        bool shadowed = config.toonEnabled ? light < toonLightCount : config.pointLightsEnabled && castsShadow[light];
+        if (!shadowed) {
+            continue;
+        }
 
-    accBuffer->bind();
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    accBuffer->unbind();
+        const glm::vec3& power = frameLights[light].power;
+        float peak = std::max(power.x, std::max(power.y, power.z));
+        float range = std::sqrt(peak / (4 * glm::pi<float>() * config.lightCutoff));
+        float distance = glm::length(glm::vec3(lightBlocks.records[light].wLightPos) - eye);
+        float coverage = distance > range ? range * projection[1][1] / distance : 1;
 
-    std::vector<PointLight> lights;
-    for (auto& light : scene->pointLights) {
-        lights.push_back(*light);
+        int coverageTier = coverage >= 0.5f ? 0 : coverage >= 0.125f ? 1 : 2;
+        int importanceTier = std::min<int>(rank / ShadowAtlas::gridSize, ShadowAtlas::tierCount - 1);
+        tiers[light] = std::max(coverageTier, importanceTier);
+        order.push_back(light);
     }
+    shadowAtlas->allocate(order, tiers);
 
-    if (config.convertAreaToPoint) {
-        for (auto& light : scene->areaLights) {
-            PointLight p;
-            p.name = light->name;
-            p.position = light->center;
-            p.power = light->power;
-            lights.push_back(p);
+    // Physically based lights that got no tile are clustered instead; toon
+    // lights without one go unshadowed
+    for (size_t light = 0; light < deferredLightCount; light++) {
+        castsShadow[light] = castsShadow[light] && shadowAtlas->hasTile(light);
+        lightBlocks.records[light].shadowRect = shadowAtlas->rect(light);
+    }
+
+    if (sun_is_directional()) {
+        sunDirection = glm::normalize(glm::vec3(lightBlocks.records[sunLight].wLightPos));
+        sunCascades->update(cam->getViewMatrix(), projection, sunDirection,
+                            config.sunShadowDistance, config.sunCasterDistance);
+    }
+}
+
+void PLApp::update_scene_bvh() {
+    const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+    drawNodeBounds.assign(drawNodes.size(), Bounds());
+    for (size_t k = 0; k < drawNodes.size(); k++) {
+        glm::mat4 transform = worldTransform(drawNodes[k]);
+        for (unsigned int i : scene->nodes[drawNodes[k]].meshIndices) {
+            drawNodeBounds[k].extend(scene->meshes[i].worldBounds(transform, bonePalettes[i]));
         }
     }
+    sceneBVH.update(drawNodeBounds);
 
-    if (config.toonEnabled) {
-        for (const PointLight& light : lights) {
-            shadowMap->bind();
-            glClear(GL_DEPTH_BUFFER_BIT);
-            glEnable(GL_DEPTH_TEST);
-            glViewport(0, 0, config.shadowMapResolution.x, config.shadowMapResolution.y);
-            deferred_shadow_pass(light);
-            if (config.ocean) {
-                deferred_ocean_shadow_pass(light);
-            }
-            shadowMap->unbind();
-
-            accBuffer->bind();
-            glEnable(GL_BLEND);
-            glBlendEquationSeparate(GL_FUNC_ADD, GL_MAX);
-            glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
-            glViewport(0, 0, getViewportSize().x, getViewportSize().y);
-            toon_lighting_pass(geomBuffer, shadowMap->depthTexture(), light);
-            glDisable(GL_BLEND);
-            accBuffer->unbind();
-
-            if (!config.multipleLightsEnabled) {
-                break;
+    if (config.frustumCulling) {
+        sceneBVH.cull(cam->getViewProjectionMatrix(), visibleDrawNodes);
+    } else {
+        visibleDrawNodes.resize(drawNodes.size());
+        for (size_t k = 0; k < drawNodes.size(); k++) {
+            visibleDrawNodes[k] = k;
+        }
+    }
+
+    cullingStats.culled = (int) (drawNodes.size() - visibleDrawNodes.size());
+    cullingStats.occluded = 0;
+    cullingStats.occluderTriangles = 0;
+    if (config.occlusionCulling) {
+        cull_occluded_draw_nodes();
+    }
+
+    cullingStats.visible = (int) visibleDrawNodes.size();
+    cullingStats.nodesVisited = config.frustumCulling ? (int) sceneBVH.stats().nodesVisited : 0;
+    cullingStats.rebuilds = (int) sceneBVH.stats().rebuilds;
+}
+
+void PLApp::cull_occluded_draw_nodes() {
+    const std::vector<NodeHandle>& drawNodes = simulation.snapshot().drawNodes;
+    occlusionCuller.clear(cam->getViewProjectionMatrix());
+    for (size_t k : visibleDrawNodes) {
+        glm::mat4 transform = worldTransform(drawNodes[k]);
+        for (unsigned int i : scene->nodes[drawNodes[k]].meshIndices) {
+            const Mesh& mesh = scene->meshes[i];
+            if (mesh.occluder) {
+                occlusionCuller.addOccluder(mesh.vertices, mesh.indices, transform);
             }
         }
+    }
+    occlusionCuller.rasterize(cullingScheduler);
 
-        std::swap(accBuffer, toonBuffer);
-        accBuffer->bind();
-        if (int(scene->ambientLights.size()) > 0 && config.ambientLightsEnabled) {
-            toon_merge_pass(geomBuffer, toonBuffer->colorTexture(),
-                scene->ambientLights[0]->radiance, (int)lights.size());
+    // An occluder's own box is never behind its surface, so it stays
+    size_t kept = 0;
+    for (size_t k : visibleDrawNodes) {
+        if (occlusionCuller.visible(drawNodeBounds[k])) {
+            visibleDrawNodes[kept++] = k;
+        }
+    }
+    cullingStats.occluded = (int) (visibleDrawNodes.size() - kept);
+    cullingStats.occluderTriangles = (int) occlusionCuller.stats().triangles;
+    visibleDrawNodes.resize(kept);
+}
+
+void PLApp::update_shadow_receivers() {
+    // World bounds of everything the camera sees
+    std::vector<Bounds> receivers;
+    for (size_t k : visibleDrawNodes) {
+        receivers.push_back(drawNodeBounds[k]);
+    }
+
+    // Instanced birds are not draw nodes; each flock receives as a whole
+    const auto& flocks = animators.birdAnimator.flocks();
+    glm::mat4 viewProjection = cam->getViewProjectionMatrix();
+    for (size_t f = 0; f < flocks.size() && f < birdTransforms.size(); f++) {
+        const BirdInstancing& instancing = flocks[f]->instancing();
+        if (!instancing.enabled()) {
+            continue;
+        }
+        Bounds flock;
+        for (const glm::mat4& transform : birdTransforms[f]) {
+            flock.extend(instancing.bounds.transformed(transform));
+        }
+        if (!flock.empty() && !flock.projected(viewProjection).empty()) {
+            receivers.push_back(flock);
+        }
+    }
+
+    // The tiles are displaced vertically within the height map's range
+    oceanTileBounds.clear();
+    if (config.ocean) {
+        const OceanTextureBuffer& displacement = animators.oceanAnimator.displacement;
+        Bounds tile(glm::vec3(0, displacement.minValue(), 0), glm::vec3(1, displacement.maxValue(), 1));
+        for (const glm::vec2& location : oceanTiles) {
+            oceanTileBounds.push_back(tile.transformed(oceanScene->transform(location)));
+            receivers.push_back(oceanTileBounds.back());
+        }
+    }
+
+    shadowReceivers.assign(deferredLightCount, Bounds());
+    for (size_t light = 0; light < deferredLightCount; light++) {
+        if (!shadowAtlas->hasTile(light)) {
+            continue;
         }
-        else {
-            toon_merge_pass(geomBuffer, toonBuffer->colorTexture(),
-                glm::vec3(0), (int)lights.size());
+        const LightBlock& block = lightBlocks.records[light];
+        glm::mat4 lightViewProjection = block.mP_light * block.mV_light;
+        for (const Bounds& receiver : receivers) {
+            shadowReceivers[light].extend(receiver.projected(lightViewProjection));
+        }
+    }
+}
+
+void PLApp::update_light_clusters() {
+    glm::mat4 projection = cam->getProjectionMatrix();
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> powers;
+    for (size_t light = 0; light < deferredLightCount; light++) {
+        if (!castsShadow[light] && !(sun_is_directional() && light == sunLight)) {
+            positions.emplace_back(lightBlocks.records[light].vLightPos);
+            powers.push_back(frameLights[light].power);
         }
-        accBuffer->unbind();
+    }
+
+    lightClusters.build(positions, powers, projection, getViewportSize(), config.lightCutoff);
+
+    const auto& lights = lightClusters.lights();
+    const auto& clusters = lightClusters.clusters();
+    const auto& indices = lightClusters.indices();
+    clusterLightBuffer.upload(lights.data(), lights.size() * sizeof(glm::vec4));
+    clusterBuffer.upload(clusters.data(), clusters.size() * sizeof(glm::uvec2));
+    clusterIndexBuffer.upload(indices.data(), indices.size() * sizeof(uint32_t));
+}
+
+void PLApp::draw_contents_deferred() {
+    GLWrap::StateCache& gl = GLWrap::StateCache::get();
+    glm::ivec2 viewportSize = getViewportSize();
+    update_light_clusters();
+    using Id = RenderGraph::ResourceId;
+
+    // Layout in deferred_shader_inputs.fs
+    RenderTargetDesc gBufferDesc;
+    gBufferDesc.size = viewportSize;
+    gBufferDesc.colorFormats = {{GL_RGBA8, GL_RGBA}, {GL_R8, GL_RED}, {GL_RG16, GL_RG}};
+    gBufferDesc.depth = true;
+
+    // Any color target may be the input of the bloom, which samples its mipmaps
+    bool linear = config.textureFilteringMode == TextureFilteringMode_Linear;
+    RenderTargetDesc colorDesc;
+    colorDesc.size = viewportSize;
+    colorDesc.colorFormats = {{GL_RGBA32F, GL_RGBA}};
+    colorDesc.mipmaps = config.bloomFilterEnabled;
+    if (colorDesc.mipmaps) {
+        colorDesc.minFilter = linear ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_NEAREST;
     } else {
-        if (config.pointLightsEnabled) {
-            for (const PointLight& light : lights) {
-                shadowMap->bind();
-                glClear(GL_DEPTH_BUFFER_BIT);
-                glEnable(GL_DEPTH_TEST);
-                glViewport(0, 0, config.shadowMapResolution.x, config.shadowMapResolution.y);
-                deferred_shadow_pass(light);
-                if (config.ocean) {
-                    deferred_ocean_shadow_pass(light);
-                }
-                shadowMap->unbind();
-
-                accBuffer->bind();
-                glEnable(GL_BLEND);
-                glBlendFunc(GL_ONE, GL_ONE);
-                glViewport(0, 0, getViewportSize().x, getViewportSize().y);
-                deferred_lighting_pass(geomBuffer, shadowMap->depthTexture(), light);
-                glDisable(GL_BLEND);
-                accBuffer->unbind();
+        colorDesc.minFilter = linear ? GL_LINEAR : GL_NEAREST;
+    }
+
+    // EVSM moments, sampled with one bilinear fetch per fragment
+    const auto momentsDesc = [](glm::ivec2 shadowSize) {
+        RenderTargetDesc desc;
+        desc.size = glm::max(shadowSize / 2, glm::ivec2(1));
+        desc.colorFormats = {{GL_RGBA32F, GL_RGBA}};
+        desc.minFilter = GL_LINEAR;
+        desc.magFilter = GL_LINEAR;
+        return desc;
+    };
+
+    RenderGraph& graph = renderGraph;
+    graph.reset();
+    Id gBuffer = graph.create("G-buffer", gBufferDesc);
+    Id shadow = graph.import("shadow atlas", shadowAtlas->framebuffer(), shadowAtlas->size());
+    Id sunShadow = graph.import("sun cascades", sunCascades->framebuffer(), sunCascades->size());
+    Id moments = graph.create("shadow moments", momentsDesc(shadowAtlas->size()));
+    Id momentsX = graph.create("shadow moments x", momentsDesc(shadowAtlas->size()));
+    Id sunMoments = graph.create("sun moments", momentsDesc(sunCascades->size()));
+    Id sunMomentsX = graph.create("sun moments x", momentsDesc(sunCascades->size()));
+    Id screen = graph.import("screen", nullptr, viewportSize);
+    Id lit = graph.create("lit", colorDesc);
+    Id toonLights = graph.create("toon lights", colorDesc);
+    Id toonLit = graph.create("toon lit", colorDesc);
+    Id sky = graph.create("sky", colorDesc);
+    Id outlined = graph.create("outlined", colorDesc);
+    Id blurX = graph.create("blur x", colorDesc);
+    Id blurXY = graph.create("blur xy", colorDesc);
+    Id bloomed = graph.create("bloomed", colorDesc);
+
+    graph.addPass("geometry", {}, {gBuffer}, [&] {
+        gl.setEnabled(GL_DEPTH_TEST, true);
+        const GLenum buffers[] = {
+                GL_COLOR_ATTACHMENT0,
+                GL_COLOR_ATTACHMENT1,
+                GL_COLOR_ATTACHMENT2,
+        };
+        glDrawBuffers(3, buffers);
+        deferred_texture_pass();
+        //deferred_geometry_pass();
+        if (config.ocean) {
+            deferred_ocean_geometry_pass();
+        }
+    });
+
+    // The shadow maps of every shadowed light are brought up to date in the
+    // atlas first. Each light then adds its contribution with blending. Both
+    // the toon and the physically based lights are declared; the chain that
+    // is not shown gets culled. The physically based lights without a shadow
+    // are added by one clustered pass instead.
+    graph.addPass("shadow atlas", {}, {shadow}, [&] {
+        deferred_shadow_atlas_pass();
+    });
+
+    // With EVSM the physically based lights read prefiltered moments of the
+    // shadow maps instead of their depth; the toon lights keep the depth
+    graph.addPass("shadow moments", {shadow}, {moments, momentsX}, [&] {
+        std::vector<glm::vec4> tiles;
+        for (size_t light = 0; light < deferredLightCount; light++) {
+            if (shadowAtlas->hasTile(light)) {
+                tiles.push_back(shadowAtlas->rect(light));
             }
         }
+        shadow_moments_pass(graph.target(shadow)->depthTexture(), graph.target(moments), graph.target(momentsX),
+                            momentsDesc(shadowAtlas->size()).size, tiles, true);
+    });
+    Id pointShadow = config.evsmEnabled ? moments : shadow;
+    Id sunShadowInput = config.evsmEnabled ? sunMoments : sunShadow;
+    const auto shadowTexture = [&](Id id) -> const GLWrap::Texture2D& {
+        return config.evsmEnabled ? graph.target(id)->colorTexture() : graph.target(id)->depthTexture();
+    };
+
+    size_t clusteredLightCount = 0;
+    for (size_t light = 0; light < deferredLightCount; light++) {
+        bool sun = sun_is_directional() && light == sunLight;
+        bool toon = light < toonLightCount;
+        bool point = config.pointLightsEnabled && castsShadow[light] && !sun;
+        clusteredLightCount += castsShadow[light] || sun ? 0 : 1;
+
+        if (toon) {
+            graph.addPass("toon light", {gBuffer, shadow, toonLights}, {toonLights}, [&, light] {
+                gl.setEnabled(GL_BLEND, true);
+                gl.blendEquationSeparate(GL_FUNC_ADD, GL_MAX);
+                gl.blendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
+                toon_lighting_pass(graph.target(gBuffer), graph.target(shadow)->depthTexture(), light);
+            });
+        }
+
+        if (point) {
+            graph.addPass("point light", {gBuffer, pointShadow, lit}, {lit}, [&, light] {
+                gl.setEnabled(GL_BLEND, true);
+                gl.blendEquation(GL_FUNC_ADD);
+                gl.blendFunc(GL_ONE, GL_ONE);
+                deferred_lighting_pass(graph.target(gBuffer), shadowTexture(pointShadow), light);
+            });
+        }
+    }
 
-        if (config.ambientLightsEnabled) {
-            for (auto& light : scene->ambientLights) {
-                accBuffer->bind();
-                glEnable(GL_BLEND);
-                glBlendFunc(GL_ONE, GL_ONE);
-                glViewport(0, 0, getViewportSize().x, getViewportSize().y);
-                deferred_ambient_pass(geomBuffer, *light);
-                glDisable(GL_BLEND);
-                accBuffer->unbind();
+    // A directional sun renders its cascades every frame; they follow the camera
+    if (config.pointLightsEnabled && sun_is_directional()) {
+        graph.addPass("sun cascades", {}, {sunShadow}, [&] {
+            deferred_sun_shadow_pass();
+        });
+        graph.addPass("sun moments", {sunShadow}, {sunMoments, sunMomentsX}, [&] {
+            std::vector<glm::vec4> tiles;
+            for (int c = 0; c < SunCascades::cascadeCount; c++) {
+                tiles.push_back(sunCascades->rect(c));
             }
+            shadow_moments_pass(graph.target(sunShadow)->depthTexture(), graph.target(sunMoments), graph.target(sunMomentsX),
+                                momentsDesc(sunCascades->size()).size, tiles, false);
+        });
+        graph.addPass("sun light", {gBuffer, sunShadowInput, lit}, {lit}, [&] {
+            gl.setEnabled(GL_BLEND, true);
+            gl.blendEquation(GL_FUNC_ADD);
+            gl.blendFunc(GL_ONE, GL_ONE);
+            deferred_sun_pass(graph.target(gBuffer), shadowTexture(sunShadowInput));
+        });
+    }
+
+    if (config.pointLightsEnabled && clusteredLightCount > 0) {
+        graph.addPass("clustered lights", {gBuffer, lit}, {lit}, [&] {
+            gl.setEnabled(GL_BLEND, true);
+            gl.blendEquation(GL_FUNC_ADD);
+            gl.blendFunc(GL_ONE, GL_ONE);
+            deferred_clustered_pass(graph.target(gBuffer));
+        });
+    }
+
+    if (config.ambientLightsEnabled) {
+        for (auto& light : scene->ambientLights) {
+            graph.addPass("ambient light", {gBuffer, lit}, {lit}, [&, light] {
+                gl.setEnabled(GL_BLEND, true);
+                gl.blendEquation(GL_FUNC_ADD);
+                gl.blendFunc(GL_ONE, GL_ONE);
+                deferred_ambient_pass(graph.target(gBuffer), *light);
+            });
         }
     }
 
+    graph.addPass("toon merge", {gBuffer, toonLights}, {toonLit}, [&] {
+        gl.setEnabled(GL_BLEND, false);
+        glm::vec3 ambient(0);
+        if (int(scene->ambientLights.size()) > 0 && config.ambientLightsEnabled) {
+            ambient = scene->ambientLights[0]->radiance;
+        }
+        toon_merge_pass(graph.target(gBuffer), graph.target(toonLights)->colorTexture(), ambient, (int) deferredLightCount);
+    });
+
+    // From here on, each stage either adds a pass reading the current color
+    // or leaves it alone, which culls that pass
+    Id color = config.toonEnabled ? toonLit : lit;
+
     if (config.ocean && config.oceanShadingMode == OceanShadingMode_Tessendorf) {
-        accBuffer->bind();
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE);
-        glViewport(0, 0, getViewportSize().x, getViewportSize().y);
-        deferred_ocean_directional_pass(geomBuffer);
-        glDisable(GL_BLEND);
-        accBuffer->unbind();
+        graph.addPass("ocean directional", {gBuffer, color}, {color}, [&] {
+            gl.setEnabled(GL_BLEND, true);
+            gl.blendEquation(GL_FUNC_ADD);
+            gl.blendFunc(GL_ONE, GL_ONE);
+            deferred_ocean_directional_pass(graph.target(gBuffer));
+        });
     }
 
+    graph.addPass("sky", {color}, {sky}, [&, color] {
+        gl.setEnabled(GL_BLEND, false);
+        deferred_sky_pass(graph.target(color)->colorTexture());
+    });
     if (config.sunskyEnabled) {
-        // Use temp1 to hold the result of the sky pass
-
-        temp1->bind();
-        glViewport(0, 0, getViewportSize().x, getViewportSize().y);
-        deferred_sky_pass(accBuffer->colorTexture());
-        temp1->unbind();
-
-        // Swap temp1 and accBuffer
-        std::swap(accBuffer, temp1);
+        color = sky;
     }
 
+    graph.addPass("toon outline", {gBuffer, color}, {outlined}, [&, color] {
+        gl.setEnabled(GL_BLEND, false);
+        toon_outline_pass(graph.target(gBuffer), graph.target(color)->colorTexture());
+    });
     if (config.toonEnabled) {
-        std::swap(accBuffer, outlineBuffer);
-        accBuffer->bind();
-        toon_outline_pass(geomBuffer, outlineBuffer->colorTexture());
-        accBuffer->unbind();
+        color = outlined;
     }
 
-    if (config.bloomFilterEnabled) {
-        // Use temp1 to hold blur in the x direction
-        // Use temp2 to hold blur in both directions
-
-        accBuffer->colorTexture().generateMipmap();
+    graph.addPass("bloom blur", {color}, {blurX, blurXY}, [&, color] {
+        gl.setEnabled(GL_BLEND, false);
+        const GLWrap::Texture2D& image = graph.target(color)->colorTexture();
+        image.generateMipmap();
 
         for (const std::pair<float, int> &blurLevel: blurLevels) {
             float stdev = blurLevel.first;
             int level = blurLevel.second;
 
-            glViewport(0, 0, getViewportSize().x / (1 << level), getViewportSize().y / (1 << level));
-
-            temp1->bind(level);
+            graph.bind(blurX, level);
             glClear(GL_COLOR_BUFFER_BIT);
-            deferred_blur_pass(accBuffer->colorTexture(), {1.0, 0.0}, stdev, level);
-            temp1->unbind();
+            deferred_blur_pass(image, {1.0, 0.0}, stdev, level);
 
-            temp2->bind(level);
+            graph.bind(blurXY, level);
             glClear(GL_COLOR_BUFFER_BIT);
-            deferred_blur_pass(temp1->colorTexture(), {0.0, 1.0}, stdev, level);
-            temp2->unbind();
+            deferred_blur_pass(graph.target(blurX)->colorTexture(), {0.0, 1.0}, stdev, level);
         }
+    });
+    graph.addPass("bloom merge", {color, blurXY}, {bloomed}, [&, color] {
+        deferred_merge_pass(graph.target(color)->colorTexture(), graph.target(blurXY)->colorTexture());
+    });
+    if (config.bloomFilterEnabled) {
+        color = bloomed;
+    }
 
-        // Use temp1 to hold the temporary result of merging the accBuffer and the full blur (temp2)
-        temp1->bind();
-        glViewport(0, 0, getViewportSize().x, getViewportSize().y);
+    graph.addPass("display", {color}, {screen}, [&, color] {
+        gl.setEnabled(GL_BLEND, false);
+        gl.setEnabled(GL_DEPTH_TEST, false);
         glClear(GL_COLOR_BUFFER_BIT);
-        deferred_merge_pass(accBuffer->colorTexture(), temp2->colorTexture());
-        temp1->unbind();
+        deferred_draw_pass(graph.target(color));
+    });
+
+    graph.execute(screen, renderTargets);
+}
 
-        // Swap temp1 and accBuffer
-        std::swap(accBuffer, temp1);
+void PLApp::update_uniform_blocks() {
+    // Lights, in the order the deferred passes visit them
+    frameLights.clear();
+    for (auto& light : scene->pointLights) {
+        frameLights.push_back(*light);
+    }
+    if (config.convertAreaToPoint) {
+        for (auto& light : scene->areaLights) {
+            PointLight p;
+            p.name = light->name;
+            p.node = light->node;
+            p.position = light->center;
+            p.power = light->power;
+            frameLights.push_back(p);
+        }
+    }
+    deferredLightCount = frameLights.size();
+
+    // Named like the light SunLightNodeAnimator drives
+    sunLight = SIZE_MAX;
+    for (size_t light = 0; light < deferredLightCount && sunLight == SIZE_MAX; light++) {
+        if (frameLights[light].name.find("SunLight") != std::string::npos) {
+            sunLight = light;
+        }
+    }
+
+    // The forward pass shades with the first point light, or a default one
+    if (scene->pointLights.empty()) {
+        PointLight light;
+        light.position = glm::vec3(3, 4, 5);
+        light.power = glm::vec3(1000, 1000, 1000);
+        forwardLight = frameLights.size();
+        frameLights.push_back(light);
+    } else {
+        forwardLight = 0;
+    }
+
+    glm::mat4 mV = cam->getViewMatrix();
+    RTUtil::Sky::Coefficients sky = RTUtil::Sky(config.thetaSun, config.turbidity).coefficients();
+
+    const auto frame = [](const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eye) {
+        FrameBlock block{};
+        block.mV = view;
+        block.mP = projection;
+        block.mV_inv = glm::inverse(view);
+        block.mP_inv = glm::inverse(projection);
+        block.wCamPos = glm::vec4(eye, 1);
+        return block;
+    };
+
+    frameBlocks.records.clear();
+    FrameBlock camera = frame(mV, cam->getProjectionMatrix(), cam->getEye());
+    camera.skyA = glm::vec4(sky.A, 0);
+    camera.skyB = glm::vec4(sky.B, 0);
+    camera.skyC = glm::vec4(sky.C, 0);
+    camera.skyD = glm::vec4(sky.D, 0);
+    camera.skyE = glm::vec4(sky.E, 0);
+    camera.skyZenith = glm::vec4(sky.zenith, 0);
+    camera.sunAngles = glm::vec4(sky.thetaSun, glm::pi<float>(), 0, 0);
+    frameBlocks.records.push_back(camera);
+
+    lightBlocks.records.clear();
+    for (const PointLight& light : frameLights) {
+        RTUtil::PerspectiveCamera lightCamera = get_light_camera(light);
+
+        glm::vec3 wLightPos = MulUtil::mulh(worldTransform(light.node), light.position, 1);
+        LightBlock block{};
+        block.mV_light = lightCamera.getViewMatrix();
+        block.mP_light = lightCamera.getProjectionMatrix();
+        block.wLightPos = glm::vec4(wLightPos, 1);
+        block.vLightPos = mV * glm::vec4(wLightPos, 1);
+        block.lightPower = glm::vec4(light.power, 0);
+        lightBlocks.records.push_back(block);
+    }
+
+    const auto object = [](const glm::mat4& mM) {
+        return ObjectBlock{mM, glm::transpose(glm::inverse(mM))};
+    };
+
+    objectBlocks.records.clear();
+    for (NodeHandle handle : simulation.snapshot().drawNodes) {
+        objectBlocks.records.push_back(object(worldTransform(handle)));
+    }
+
+    oceanObjectBase = objectBlocks.records.size();
+    oceanTiles.clear();
+    if (config.ocean) {
+        oceanTiles = oceanScene->visibleGridLocations(
+                cam->getViewProjectionMatrix(),
+                -1,
+                (int) (2.0f * config.renderDistance / sqrt(oceanScene->sizeMeters.x * oceanScene->sizeMeters.y) + 1.0f)
+        );
+        for (const glm::vec2& tile : oceanTiles) {
+            objectBlocks.records.push_back(object(oceanScene->transform(tile)));
+        }
     }
 
-    glViewport(0, 0, getViewportSize().x, getViewportSize().y);
-    glDisable(GL_DEPTH_TEST);
-    glClear(GL_COLOR_BUFFER_BIT);
-    deferred_draw_pass(accBuffer);
+    // Skinned birds are drawn relative to the mesh transform; baked ones are
+    // already in bird space
+    birdObjectBase = objectBlocks.records.size();
+    for (const auto& flock : animators.birdAnimator.flocks()) {
+        objectBlocks.records.push_back(object(flock->instancing().meshTransform));
+        objectBlocks.records.push_back(object(glm::mat4(1)));
+    }
+
+    update_scene_bvh();
+    update_shadow_casters();
+    update_shadow_receivers();
+
+    frameBlocks.upload();
+    lightBlocks.upload();
+    objectBlocks.upload();
+}
+
+glm::mat4 PLApp::worldTransform(NodeHandle handle) const {
+    if (handle == NullNode) {
+        return glm::identity<glm::mat4>();
+    }
+    return worldTransforms[handle];
+}
+
+FrameJobInputs PLApp::simulationInputs() const {
+    FrameJobInputs inputs;
+    inputs.ocean = config.ocean;
+    inputs.sunsky = config.sunskyEnabled;
+    inputs.birds = config.birds;
+    // Only skip the palettes if every flock that needs them has a baked clip
+    bool allBaked = true;
+    const auto& flocks = animators.birdAnimator.flocks();
+    for (size_t f = 0; f < flocks.size(); f++) {
+        bool baked = f < flockDrawData.size() && !flockDrawData[f].vertexAnimations.empty();
+        allBaked = allBaked && (baked || flocks[f]->instancing().boneCount == 0);
+    }
+    inputs.birdVertexAnimation = config.birdVertexAnimation && allBaked;
+    inputs.birdView.enabled = config.birdLod && cam;
+    if (cam) {
+        inputs.birdView.cameraPosition = cam->getEye();
+        inputs.birdView.viewProjection = cam->getViewProjectionMatrix();
+    }
+    inputs.thetaSun = config.thetaSun;
+    inputs.turbidity = config.turbidity;
+    inputs.oceanTransform = oceanScene->transform();
+    return inputs;
 }
 
 void PLApp::draw_contents() {
     GLWrap::checkGLError("drawContents start");
 
-    scene->animate(timer.time());
-    if (config.ocean) {
-        animators.oceanAnimator.updateOceanBuffers(timer.time());
-
-        animators.oceanAnimator.displacement.store(animators.oceanAnimator.buffers.displacementMap);
-        animators.oceanAnimator.gradX.store(animators.oceanAnimator.buffers.gradXMap);
-        animators.oceanAnimator.gradZ.store(animators.oceanAnimator.buffers.gradZMap);
-
-        for (auto & animator : animators.boatAnimators) {
-            animator.update(
-                    animators.oceanAnimator.buffers.displacementMap,
-                    animators.oceanAnimator.buffers.gradXMap,
-                    animators.oceanAnimator.buffers.gradZMap,
-                    oceanScene->transform()
-            );
-        }
+    // nanogui changed GL state behind the cache's back while drawing the
+    // GUI, and may have changed the viewport since the last frame
+    GLWrap::StateCache::get().invalidate();
+    GLWrap::StateCache::get().resetCounters();
+
+    simulation.setInputs(simulationInputs());
+
+    // update() switches buffers, so only take the reference after it
+    bool updated = simulation.update();
+    const SimulationSnapshot& snapshot = simulation.snapshot();
+    if (updated && snapshot.ocean) {
+        animators.oceanAnimator.displacement.upload(snapshot.displacement);
+        animators.oceanAnimator.gradX.upload(snapshot.gradX);
+        animators.oceanAnimator.gradZ.upload(snapshot.gradZ);
     }
-    if (config.sunskyEnabled) {
-        for (auto & animator : animators.sunLightAnimators) {
-            animator.update(config.thetaSun, config.turbidity);
+    snapshot.interpolate(simulation.renderTime(), worldTransforms, bonePalettes, birdTransforms, birdPalettes);
+
+    for (size_t f = 0; f < flockDrawData.size() && f < birdTransforms.size(); f++) {
+        for (const auto& mesh : flockDrawData[f].meshes) {
+            mesh->setInstanceAttribute(6, birdTransforms[f]);
         }
     }
-    if (config.birds && timer.playing()) {
-        animators.birdAnimator.animate_birds(timer.time());
-    }
+
+    update_uniform_blocks();
 
     switch (shadingMode) {
         case ShadingMode_Flat:
@@ -1385,5 +2243,9 @@ void PLApp::draw_contents() {
             break;
     }
 
+    statsForm->refresh();
+    lastFrameGLCounters = GLWrap::StateCache::get().counters();
+    renderTargets.endFrame();
+
     GLWrap::checkGLError("drawContents end");
 }
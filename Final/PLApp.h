@@ -5,18 +5,31 @@
 
 #include "Scene.h"
 #include "OceanScene.h"
+#include "LightClusters.h"
+#include "RenderGraph.h"
+#include "Bounds.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include "ShadowAtlas.h"
+#include "SunCascades.h"
 
 #include <nanogui/screen.h>
+#include <nanogui/formhelper.h>
 
 #include <GLWrap/Program.hpp>
 #include <GLWrap/Mesh.hpp>
 #include <RTUtil/Camera.hpp>
 #include <RTUtil/CameraController.hpp>
 #include <GLWrap/Framebuffer.hpp>
+#include <GLWrap/StateCache.hpp>
+#include <GLWrap/TextureBuffer.hpp>
 #include "Animators.h"
+#include "Simulation.h"
 #include "Tessendorf.h"
 #include "Timer.h"
 #include "Bird.hpp"
+#include "UniformBlocks.h"
+#include "VertexAnimation.h"
 
 enum ShadingMode {
     ShadingMode_Flat,
@@ -41,6 +54,10 @@ struct PLAppConfig {
     float shadowNear = 1e-5;
     float shadowFar = 100;
     float shadowFov = 1;
+    bool sunCascades = true;        // shade the sun as a directional light with cascaded shadows
+    int sunShadowResolution = 2048; // per cascade
+    float sunShadowDistance = 300;  // from the camera
+    float sunCasterDistance = 100;  // beyond a cascade, towards the sun
     float exposure = 1;
     float thetaSun = glm::pi<float>() / 6;
     float turbidity = 4;
@@ -62,8 +79,14 @@ struct PLAppConfig {
     bool strokeEnabled = true;
     bool multipleLightsEnabled = false;
     bool pcfEnabled = true;
+    bool frustumCulling = true;
+    bool occlusionCulling = true;
+    bool evsmEnabled = false;       // prefiltered shadows for the physically based lights
+    float evsmBlur = 1.5f;          // stdev in moment texels
     bool pointLightsEnabled = true;
     bool convertAreaToPoint = true;
+    int shadowCasterBudget = 4;   // point lights past this are shaded unshadowed, clustered
+    float lightCutoff = 1e-3f;    // irradiance below which a clustered light is ignored
     bool ambientLightsEnabled = true;
     bool sunskyEnabled = true;
     bool bloomFilterEnabled = false;
@@ -75,6 +98,27 @@ struct PLAppConfig {
     float renderDistance = 100;
 
     bool birds = false;
+    bool birdVertexAnimation = true;
+    bool birdLod = true;
+};
+
+// Uniforms that the mesh passes set per mesh or per instance batch,
+// resolved once per program. Uniforms a program lacks get invalid handles,
+// which are skipped when set. Transforms come from the Object block.
+struct MeshUniforms {
+    GLWrap::UniformHandle<float> alpha;
+    GLWrap::UniformHandle<float> eta;
+    GLWrap::UniformHandle<glm::vec3> diffuseReflectance;
+    GLWrap::UniformHandle<int> useBones;
+    GLWrap::UniformHandle<glm::mat4> boneTransforms;
+    GLWrap::UniformHandle<int> useInstancing;
+    GLWrap::UniformHandle<int> phaseCount;
+    GLWrap::UniformHandle<int> boneCount;
+    GLWrap::UniformHandle<int> useVertexAnimation;
+    GLWrap::UniformHandle<float> vertexAnimationTime;
+
+    MeshUniforms() = default;
+    explicit MeshUniforms(const GLWrap::Program& prog);
 };
 
 class PLApp : nanogui::Screen {
@@ -100,6 +144,7 @@ private:
         nanogui::Window* deferred;
         nanogui::Window* ocean;
         nanogui::Window* toon;
+        nanogui::Window* stats;
     } nanoguiWindows;
 
     void setUpNanoguiControls();
@@ -107,7 +152,7 @@ private:
     void setUpCamera();
     void setUpPrograms();
     void setUpTextures();
-    void resetFramebuffers();
+    void resetShadowMap();
     void loadTextures();
 
     std::shared_ptr<Scene> scene;
@@ -124,9 +169,13 @@ private:
     std::shared_ptr<GLWrap::Program> programToonOutline;
     std::shared_ptr<GLWrap::Program> programDeferredShadow;
     std::shared_ptr<GLWrap::Program> programDeferredPoint;
+    std::shared_ptr<GLWrap::Program> programDeferredClustered;
+    std::shared_ptr<GLWrap::Program> programDeferredSun;
     std::shared_ptr<GLWrap::Program> programDeferredAmbient;
     std::shared_ptr<GLWrap::Program> programDeferredSky;
     std::shared_ptr<GLWrap::Program> programDeferredBlur;
+    std::shared_ptr<GLWrap::Program> programShadowMoments;
+    std::shared_ptr<GLWrap::Program> programShadowBlur;
     std::shared_ptr<GLWrap::Program> programDeferredMerge;
     std::shared_ptr<GLWrap::Program> programSrgb;
     std::shared_ptr<GLWrap::Program> programOceanForward;
@@ -134,21 +183,128 @@ private:
     std::shared_ptr<GLWrap::Program> programOceanDeferredShadow;
     std::shared_ptr<GLWrap::Program> programOceanDeferredDirectional;
 
+    MeshUniforms flatUniforms;
+    MeshUniforms forwardUniforms;
+    MeshUniforms textureDeferredUniforms;
+    MeshUniforms deferredGeomUniforms;
+    MeshUniforms deferredShadowUniforms;
+
+    // Uniform blocks, rewritten once per frame by update_uniform_blocks.
+    // frameBlocks holds the camera, then the shadow view of each light in
+    // frameLights; lightBlocks holds frameLights; objectBlocks holds the draw
+    // nodes in order, then the ocean tiles, then two records per flock.
+    UniformBlockArray<FrameBlock> frameBlocks{UniformBinding_Frame};
+    UniformBlockArray<LightBlock> lightBlocks{UniformBinding_Light};
+    UniformBlockArray<ObjectBlock> objectBlocks{UniformBinding_Object};
+    std::vector<PointLight> frameLights;
+    size_t deferredLightCount = 0; // lights past this only serve the forward pass
+    size_t forwardLight = 0;
+    std::vector<glm::vec2> oceanTiles;
+    size_t oceanObjectBase = 0;
+    size_t birdObjectBase = 0;
+
+    void update_uniform_blocks();
+
+    // The lights within the shadow caster budget that get a tile in the
+    // shadow atlas keep their own lighting passes; the rest are binned by
+    // update_light_clusters and shaded together by deferred_clustered_pass.
+    std::vector<bool> castsShadow; // parallel to frameLights, up to deferredLightCount
+    size_t toonLightCount = 0;
+    LightClusters lightClusters;
+    GLWrap::TextureBuffer clusterLightBuffer{GL_RGBA32F};
+    GLWrap::TextureBuffer clusterBuffer{GL_RG32UI};
+    GLWrap::TextureBuffer clusterIndexBuffer{GL_R32UI};
+
+    void update_light_clusters();
+
+    // Picks the shadowed lights, assigns their atlas tiles and sorts the draw
+    // nodes into static and dynamic casters. A node is a dynamic caster if it
+    // is skinned or moved within the last shadowSettleFrames frames; whenever
+    // a node changes sides, the static caches of the atlas are dropped.
+    static constexpr int shadowSettleFrames = 30;
+    std::vector<NodeHandle> casterNodes;     // last frame's draw nodes
+    std::vector<glm::mat4> casterTransforms; // per node, as of last frame, uninterpolated
+    std::vector<int> casterFramesStill;      // per node
+    std::vector<bool> dynamicCaster;         // per node
+
+    void update_shadow_casters();
+
     std::vector<std::shared_ptr<GLWrap::Mesh>> meshes;
     std::shared_ptr<GLWrap::Mesh> oceanMesh;
     std::shared_ptr<GLWrap::Mesh> fsqMesh;
 
+    // GL side of each flock: its own copies of the bird meshes, which hold
+    // that flock's instance buffers, and their baked clips (both parallel to
+    // BirdInstancing::meshIndices). vertexAnimations is empty if the birds
+    // are not skinned or a clip does not fit a texture.
+    struct FlockDrawData {
+        std::vector<std::shared_ptr<GLWrap::Mesh>> meshes;
+        std::vector<VertexAnimationTexture> vertexAnimations;
+    };
+    std::vector<FlockDrawData> flockDrawData;
+
     std::shared_ptr<RTUtil::PerspectiveCamera> cam;
     std::unique_ptr<RTUtil::DefaultCC> cc;
 
-    // size = viewport, color attachments = 3, depth attachment = yes
-    std::shared_ptr<GLWrap::Framebuffer> geomBuffer;
+    // Viewport-sized targets come from the pool, through the render graph
+    // that draw_contents_deferred declares every frame
+    RenderTargetPool renderTargets;
+    RenderGraph renderGraph;
+
+    // Tier 0 tiles are the shadow map resolution
+    std::unique_ptr<ShadowAtlas> shadowAtlas;
+
+    // The point light named like "SunLight", if any. With config.sunCascades
+    // the physically based passes shade it as a directional light from
+    // sunDirection (towards the sun) instead of as a point light.
+    size_t sunLight = SIZE_MAX;
+    glm::vec3 sunDirection = glm::vec3(0, 1, 0);
+    std::unique_ptr<SunCascades> sunCascades;
+    bool sun_is_directional() const { return config.sunCascades && sunLight < deferredLightCount; }
+
+    // World bounds of the draw nodes, parallel to drawNodes, and the
+    // indices of the ones the camera may see, in order. The camera passes
+    // only walk the visible ones.
+    SceneBVH sceneBVH;
+    std::vector<Bounds> drawNodeBounds;
+    std::vector<size_t> visibleDrawNodes;
+    void update_scene_bvh();
+
+    // Of the nodes in the frustum, those hidden behind the occluder meshes
+    // are dropped from visibleDrawNodes as well. The occluders are
+    // rasterized on cullingScheduler's threads while the GL thread waits.
+    // It is a pool of its own: waiting on the simulation's would have the GL
+    // thread run simulation tasks mid-frame.
+    OcclusionCuller occlusionCuller;
+    TaskScheduler cullingScheduler;
+    void cull_occluded_draw_nodes();
 
-    // size = viewport, color attachments = 1, depth attachment = no, with mipmaps
-    std::shared_ptr<GLWrap::Framebuffer> accBuffer, temp1, temp2, toonBuffer, outlineBuffer;
+    // Of the last frame, shown in the Stats window
+    struct CullingStats {
+        int visible = 0;
+        int culled = 0;
+        int nodesVisited = 0;
+        int rebuilds = 0;
+        int occluded = 0;
+        int occluderTriangles = 0;
+    } cullingStats;
+    nanogui::FormHelper* statsForm = nullptr;
 
-    // size = shadow map resolution, color attachments = 0, depth attachment = yes
-    std::shared_ptr<GLWrap::Framebuffer> shadowMap;
+    // Shadow caster culling. The receivers of a light are the bounds of what
+    // the camera sees, in the light's normalized device coordinates; a
+    // caster only matters if it lies in front of them, and a light without
+    // receivers draws no shadows at all. Each instanced flock the camera
+    // sees receives as one box around its birds; as casters, instanced
+    // birds are never culled.
+    std::vector<Bounds> shadowReceivers; // per light
+    std::vector<Bounds> oceanTileBounds; // per oceanTiles entry, world space
+    struct ShadowCullStats {
+        size_t drawn = 0;
+        size_t culled = 0;
+        size_t lightsSkipped = 0;
+    } shadowCullStats;
+    void update_shadow_receivers();
+    bool shadow_layer_range(const size_t* lights, int count, const Bounds& caster, bool useReceivers, int& first, int& last);
 
 	// texturmap for seagulls
 	std::shared_ptr<GLWrap::Texture2D> texturemap;
@@ -164,6 +320,19 @@ private:
     PLAppConfig config;
 
     Timer timer;
+    Simulation simulation;
+
+    // GL state calls the cache issued and skipped while drawing the last
+    // frame (debug builds only; printed with G)
+    GLWrap::StateCache::Counters lastFrameGLCounters;
+
+    // Interpolated from the simulation's last two steps, once per frame
+    std::vector<glm::mat4> worldTransforms;
+    std::vector<std::vector<glm::mat4>> bonePalettes;
+    std::vector<std::vector<glm::mat4>> birdTransforms;
+    std::vector<std::vector<glm::mat4>> birdPalettes;
+    glm::mat4 worldTransform(NodeHandle handle) const;
+    FrameJobInputs simulationInputs() const;
 
     const std::vector<std::pair<float, int>> blurLevels = {
             {6.2, 2},
@@ -179,17 +348,51 @@ private:
     RTUtil::PerspectiveCamera get_light_camera(const PointLight &light) const;
     glm::ivec2 getViewportSize();
 
+    // Draw every flock with one instanced call per bird mesh. prog must be in
+    // use and u resolved from it; skinning and material say whether it takes
+    // bone and material uniforms. layers > 1 draws every bird once per
+    // shadow layer (see set_shadow_layers).
+    void draw_bird_instances(
+            const std::shared_ptr<GLWrap::Program>& prog,
+            const MeshUniforms& u,
+            bool skinning,
+            bool material,
+            int layers = 1
+    );
+
     void deferred_geometry_pass();
 	void deferred_texture_pass();
     void deferred_ocean_geometry_pass();
     void draw_contents_deferred();
-    void deferred_draw_pass(const std::shared_ptr<GLWrap::Framebuffer>& accBuffer);
-    void deferred_shadow_pass(const PointLight &light);
-    void deferred_ocean_shadow_pass(const PointLight &light);
+    void deferred_draw_pass(const std::shared_ptr<GLWrap::Framebuffer>& colorBuffer);
+    // The shadow passes draw all the given lights at once, each into its
+    // atlas tile, maxShadowLayers at a time (MAX_SHADOW_LAYERS in
+    // shadow_layers.vs)
+    static constexpr size_t maxShadowLayers = 16;
+    void set_shadow_layers(const std::shared_ptr<GLWrap::Program>& prog,
+                           const glm::mat4* viewProjections, const glm::vec4* rects, int count);
+    void set_light_shadow_layers(const std::shared_ptr<GLWrap::Program>& prog, const size_t* lights, int count);
+    void deferred_shadow_atlas_pass();
+    void deferred_shadow_pass(const std::vector<size_t>& lights, bool dynamicCasters);
+    void deferred_ocean_shadow_pass(const std::vector<size_t>& lights);
+    void deferred_sun_shadow_pass();
+    void deferred_sun_pass(const std::shared_ptr<GLWrap::Framebuffer>& geomBuffer, const GLWrap::Texture2D& shadowTexture);
+    // EVSM: the moments are at half the shadow map's resolution, and each
+    // tile, given as (offset, scale), is blurred on its own
+    void set_evsm_uniforms(const std::shared_ptr<GLWrap::Program>& prog, bool perspective);
+    void shadow_moments_pass(
+            const GLWrap::Texture2D& depthTexture,
+            const std::shared_ptr<GLWrap::Framebuffer>& moments,
+            const std::shared_ptr<GLWrap::Framebuffer>& scratch,
+            glm::ivec2 size,
+            const std::vector<glm::vec4>& tiles,
+            bool perspective
+    );
+    void shadow_blur_pass(const GLWrap::Texture2D& image, glm::vec2 dir, glm::vec4 tile, glm::ivec2 size);
     void toon_lighting_pass(
             const std::shared_ptr<GLWrap::Framebuffer>& geomBuffer,
             const GLWrap::Texture2D& shadowTexture,
-            const PointLight& light
+            size_t lightIndex
     );
     void toon_merge_pass(
         const std::shared_ptr<GLWrap::Framebuffer>& geomBuffer,
@@ -204,8 +407,9 @@ private:
     void deferred_lighting_pass(
             const std::shared_ptr<GLWrap::Framebuffer> &geomBuffer,
             const GLWrap::Texture2D &shadowTexture,
-            const PointLight &light
+            size_t lightIndex
     );
+    void deferred_clustered_pass(const std::shared_ptr<GLWrap::Framebuffer> &geomBuffer);
     void deferred_ambient_pass(
             const std::shared_ptr<GLWrap::Framebuffer> &geomBuffer,
             const AmbientLight &light
@@ -0,0 +1,220 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <GLWrap/StateCache.hpp>
+
+namespace {
+
+    size_t bytesPerPixel(GLenum internalFormat) {
+        switch (internalFormat) {
+            case GL_RGBA32F:
+                return 16;
+            case GL_RGBA16F:
+            case GL_RG32F:
+                return 8;
+            case GL_R8:
+                return 1;
+            case GL_RG8:
+            case GL_R16F:
+                return 2;
+            default:
+                // RGBA8, RG16(F), R32F, RGB10_A2 and the depth formats
+                return 4;
+        }
+    }
+
+    bool contains(const std::vector<RenderGraph::ResourceId>& ids, RenderGraph::ResourceId id) {
+        return std::find(ids.begin(), ids.end(), id) != ids.end();
+    }
+
+}
+
+bool RenderTargetDesc::compatible(const RenderTargetDesc& other) const {
+    return size == other.size && colorFormats == other.colorFormats && depth == other.depth && mipmaps == other.mipmaps;
+}
+
+size_t RenderTargetDesc::bytes() const {
+    size_t pixels = size_t(size.x) * size_t(size.y);
+    size_t color = 0;
+    for (const auto& format : colorFormats) {
+        color += pixels * bytesPerPixel(format.first);
+    }
+    if (mipmaps) {
+        color += color / 3;
+    }
+    return color + (depth ? pixels * 4 : 0);
+}
+
+std::shared_ptr<GLWrap::Framebuffer> RenderTargetPool::acquire(const RenderTargetDesc& desc) {
+    auto entry = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) {
+        return !e.inUse && e.desc.compatible(desc);
+    });
+
+    if (entry == entries.end()) {
+        Entry e;
+        e.desc = desc;
+        if (desc.depth) {
+            e.target = std::make_shared<GLWrap::Framebuffer>(desc.size, desc.colorFormats,
+                                                             std::make_pair<GLenum, GLenum>(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT));
+        } else {
+            e.target = std::make_shared<GLWrap::Framebuffer>(desc.size, desc.colorFormats);
+        }
+        if (desc.mipmaps) {
+            // Allocates the rest of the chain
+            for (size_t i = 0; i < desc.colorFormats.size(); i++) {
+                e.target->colorTexture(i).generateMipmap();
+            }
+        }
+        entries.push_back(std::move(e));
+        entry = entries.end() - 1;
+    }
+
+    entry->inUse = true;
+    entry->lastUsed = frame;
+    if (std::find(frameSizes.begin(), frameSizes.end(), desc.size) == frameSizes.end()) {
+        frameSizes.push_back(desc.size);
+    }
+    for (size_t i = 0; i < desc.colorFormats.size(); i++) {
+        entry->target->colorTexture(i).parameter(GL_TEXTURE_MIN_FILTER, desc.minFilter);
+        entry->target->colorTexture(i).parameter(GL_TEXTURE_MAG_FILTER, desc.magFilter);
+    }
+    return entry->target;
+}
+
+void RenderTargetPool::release(const std::shared_ptr<GLWrap::Framebuffer>& target) {
+    for (Entry& e : entries) {
+        if (e.target == target) {
+            e.inUse = false;
+        }
+    }
+}
+
+void RenderTargetPool::endFrame() {
+    frame++;
+    // A frame that acquired nothing, e.g. while minimized, says nothing
+    // about which sizes are stale
+    bool checkSizes = !frameSizes.empty();
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const Entry& e) {
+        if (e.inUse) {
+            return false;
+        }
+        if (checkSizes && std::find(frameSizes.begin(), frameSizes.end(), e.desc.size) == frameSizes.end()) {
+            return true;
+        }
+        return frame - e.lastUsed > maxIdleFrames;
+    }), entries.end());
+    frameSizes.clear();
+}
+
+size_t RenderTargetPool::bytes() const {
+    size_t total = 0;
+    for (const Entry& e : entries) {
+        total += e.desc.bytes();
+    }
+    return total;
+}
+
+void RenderGraph::reset() {
+    resources.clear();
+    passes.clear();
+    culled = 0;
+}
+
+RenderGraph::ResourceId RenderGraph::create(const std::string& name, const RenderTargetDesc& desc) {
+    Resource r;
+    r.name = name;
+    r.desc = desc;
+    resources.push_back(std::move(r));
+    return resources.size() - 1;
+}
+
+RenderGraph::ResourceId RenderGraph::import(const std::string& name, std::shared_ptr<GLWrap::Framebuffer> framebuffer, glm::ivec2 size) {
+    Resource r;
+    r.name = name;
+    r.desc.size = size;
+    r.imported = true;
+    r.framebuffer = std::move(framebuffer);
+    resources.push_back(std::move(r));
+    return resources.size() - 1;
+}
+
+void RenderGraph::addPass(const std::string& name,
+                          std::vector<ResourceId> reads,
+                          std::vector<ResourceId> writes,
+                          std::function<void()> fn) {
+    passes.push_back({name, std::move(reads), std::move(writes), std::move(fn)});
+}
+
+void RenderGraph::bind(ResourceId id, int mipmapLevel) const {
+    const Resource& r = resources[id];
+    if (r.framebuffer) {
+        r.framebuffer->bind(mipmapLevel);
+    } else {
+        GLWrap::StateCache::get().bindFramebuffer(0);
+    }
+    GLWrap::StateCache::get().viewport(0, 0, std::max(1, r.desc.size.x >> mipmapLevel), std::max(1, r.desc.size.y >> mipmapLevel));
+}
+
+void RenderGraph::execute(ResourceId output, RenderTargetPool& pool) {
+    // Walk backwards from the output, keeping passes that write something a
+    // later kept pass needs
+    std::vector<bool> needed(resources.size(), false);
+    std::vector<bool> live(passes.size(), false);
+    needed[output] = true;
+    for (size_t i = passes.size(); i-- > 0;) {
+        const Pass& pass = passes[i];
+        live[i] = std::any_of(pass.writes.begin(), pass.writes.end(), [&](ResourceId w) { return needed[w]; });
+        if (!live[i]) {
+            culled++;
+            continue;
+        }
+        for (ResourceId w : pass.writes) {
+            if (!contains(pass.reads, w)) {
+                needed[w] = false;
+            }
+        }
+        for (ResourceId r : pass.reads) {
+            needed[r] = true;
+        }
+    }
+
+    // Lifetimes of the transient targets, in kept passes
+    const size_t none = passes.size();
+    std::vector<size_t> first(resources.size(), none), last(resources.size(), none);
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (!live[i]) continue;
+        for (const auto* ids : {&passes[i].reads, &passes[i].writes}) {
+            for (ResourceId id : *ids) {
+                if (first[id] == none) first[id] = i;
+                last[id] = i;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (!live[i]) continue;
+        const Pass& pass = passes[i];
+
+        for (ResourceId id = 0; id < resources.size(); id++) {
+            Resource& r = resources[id];
+            if (!r.imported && first[id] == i) {
+                r.framebuffer = pool.acquire(r.desc);
+                bind(id);
+                glClearColor(0, 0, 0, 0);
+                glClear(GL_COLOR_BUFFER_BIT | (r.desc.depth ? GL_DEPTH_BUFFER_BIT : 0));
+            }
+        }
+
+        if (!pass.writes.empty()) {
+            bind(pass.writes[0]);
+        }
+        pass.fn();
+
+        for (ResourceId id = 0; id < resources.size(); id++) {
+            Resource& r = resources[id];
+            if (!r.imported && last[id] == i) {
+                pool.release(r.framebuffer);
+            }
+        }
+    }
+}
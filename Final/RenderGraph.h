@@ -0,0 +1,129 @@
+#ifndef CS5625_RENDERGRAPH_H
+#define CS5625_RENDERGRAPH_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GLWrap/Framebuffer.hpp>
+
+// What a render target is made of. Targets with the same size, formats,
+// depth and mipmaps are interchangeable, so the pool may hand out the same
+// framebuffer for both.
+struct RenderTargetDesc {
+    glm::ivec2 size = glm::ivec2(0);
+    std::vector<std::pair<GLenum, GLenum>> colorFormats;
+    bool depth = false;   // GL_DEPTH_COMPONENT24
+    bool mipmaps = false; // full chain on every color attachment
+
+    // Set on the color attachments every time the target is handed out, so
+    // changing them never reallocates anything
+    GLint minFilter = GL_LINEAR;
+    GLint magFilter = GL_NEAREST;
+
+    bool compatible(const RenderTargetDesc& other) const;
+
+    // Estimated GPU memory, including mipmaps
+    size_t bytes() const;
+};
+
+// Framebuffers for transient render targets, kept from frame to frame. A
+// target released by one pass is handed to the next pass that needs a
+// compatible one, so targets whose lifetimes do not overlap share memory.
+// Targets of a size no longer asked for, e.g. after the window was resized,
+// are deleted at the end of the frame; targets of a size still in use that
+// go unused for a while, e.g. because a feature was turned off, are deleted
+// after maxIdleFrames.
+class RenderTargetPool {
+public:
+    std::shared_ptr<GLWrap::Framebuffer> acquire(const RenderTargetDesc& desc);
+    void release(const std::shared_ptr<GLWrap::Framebuffer>& target);
+
+    // Delete unused targets whose size was not acquired this frame, and
+    // those that have not been acquired for maxIdleFrames frames
+    void endFrame();
+
+    size_t targetCount() const { return entries.size(); }
+    size_t bytes() const;
+
+private:
+    static constexpr uint64_t maxIdleFrames = 60;
+
+    struct Entry {
+        RenderTargetDesc desc;
+        std::shared_ptr<GLWrap::Framebuffer> target;
+        bool inUse = false;
+        uint64_t lastUsed = 0;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<glm::ivec2> frameSizes; // acquired this frame
+    uint64_t frame = 0;
+};
+
+// The passes of one frame and the render targets they read and write. The
+// graph is declared anew every frame; executing it culls the passes whose
+// results never reach the output, then runs the others in order, taking each
+// transient target from the pool just before its first use and returning it
+// right after its last.
+class RenderGraph {
+public:
+    using ResourceId = size_t;
+
+    // Forget the passes and resources of the last frame
+    void reset();
+
+    // A transient target, cleared to zero (color and depth) when it is
+    // first used
+    ResourceId create(const std::string& name, const RenderTargetDesc& desc);
+
+    // A target that lives outside the graph and is not cleared. A null
+    // framebuffer stands for the default framebuffer.
+    ResourceId import(const std::string& name, std::shared_ptr<GLWrap::Framebuffer> framebuffer, glm::ivec2 size);
+
+    // Passes run in the order they are added. A pass that writes a resource
+    // without reading it replaces its contents, so earlier writers are only
+    // kept if something in between reads them. Before a pass runs, the first
+    // resource it writes is bound at mipmap level 0 with a viewport covering
+    // it.
+    void addPass(const std::string& name,
+                 std::vector<ResourceId> reads,
+                 std::vector<ResourceId> writes,
+                 std::function<void()> fn);
+
+    void execute(ResourceId output, RenderTargetPool& pool);
+
+    // Only valid while the passes run
+    const std::shared_ptr<GLWrap::Framebuffer>& target(ResourceId id) const { return resources[id].framebuffer; }
+
+    // Bind a resource with a viewport covering the given mipmap level
+    void bind(ResourceId id, int mipmapLevel = 0) const;
+
+    size_t passCount() const { return passes.size(); }
+    size_t culledPassCount() const { return culled; }
+
+private:
+    struct Resource {
+        std::string name;
+        RenderTargetDesc desc;
+        bool imported = false;
+        std::shared_ptr<GLWrap::Framebuffer> framebuffer;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<ResourceId> reads;
+        std::vector<ResourceId> writes;
+        std::function<void()> fn;
+    };
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    size_t culled = 0;
+};
+
+
+#endif //CS5625_RENDERGRAPH_H
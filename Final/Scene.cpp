@@ -1,92 +1,180 @@
 #include "Scene.h"
 #include <memory>
 #include <functional>
+#include <string>
 
-glm::mat4 Node::getTransformTo(const std::shared_ptr<Node>& other) {
-    if (other == nullptr) {
-        auto acc = glm::identity<glm::mat4>();
+double fmodulus(double x, double y) {
+    return x - y * floor(x / y);
+}
 
-        for (Node* node = this; node != nullptr; node = node->parent.get()) {
-            acc = node->transform * acc;
+void Scene::animate(double time, unsigned int animationIdx) {
+    if (animationIdx >= animations.size()) {
+        return;
+    }
+    const Animation& animation = animations[animationIdx];
+    for (size_t i = 0; i < animation.channels.size(); i++) {
+        NodeHandle handle = animation.channels[i].node;
+        if (handle == NullNode || !animated(handle)) {
+            continue;
         }
+        node(handle).transform = sampleChannel(animationIdx, i, time);
+    }
+}
 
-        return acc;
+glm::mat4 Scene::sampleChannel(unsigned int animationIdx, size_t channelIdx, double time) const {
+    const Animation& animation = animations[animationIdx];
+    const Channel& channel = animation.channels[channelIdx];
+    double tick = fmodulus(animation.ticksPerSecond * time, animation.duration);
+    float normalizedTime = animation.duration > 0 ? (float) (tick / animation.duration) : 0.0f;
+
+    auto position = channel.translation.sample(normalizedTime);
+    auto rotation = channel.rotation.sample(normalizedTime);
+    auto scale = channel.scale.sample(normalizedTime);
 
+    const auto I = glm::identity<glm::mat4>();
+    return glm::translate(I, position)
+            * glm::mat4_cast(rotation)
+            * glm::scale(I, scale);
+}
+
+NodeHandle Scene::addNode(const std::string& name, const glm::mat4& transform, NodeHandle parent) {
+    auto handle = (NodeHandle) nodes.size();
+
+    Node node;
+    node.name = name;
+    node.transform = transform;
+    node.parent = parent;
+    nodes.push_back(std::move(node));
+    worldTransforms.push_back(parent == NullNode ? transform : worldTransforms[parent] * transform);
+
+    if (parent == NullNode) {
+        root = handle;
+    } else if (nodes[parent].firstChild == NullNode) {
+        nodes[parent].firstChild = handle;
     } else {
-        return glm::inverse(other->getTransformTo(nullptr)) * getTransformTo(nullptr);
+        NodeHandle sibling = nodes[parent].firstChild;
+        while (nodes[sibling].nextSibling != NullNode) {
+            sibling = nodes[sibling].nextSibling;
+        }
+        nodes[sibling].nextSibling = handle;
     }
+
+    return handle;
 }
 
-template <class T>
-T interpNoWrap(double tick, std::map<double, T> keyframes, std::function<T(T, T, double)> mix) {
-    auto upper = keyframes.upper_bound(tick);
-    auto lower = upper; // assign lower to have the same type as upper
-    double alpha;
+void Scene::updateWorldTransforms() {
+    worldTransforms.resize(nodes.size());
 
-    if (upper == keyframes.end()) {
-        return (--upper)->second;
-    } else if (upper == keyframes.begin()) {
-        return upper->second;
-    } else {
-        lower = --keyframes.upper_bound(tick);
-        alpha = (tick - lower->first) / (upper->first - lower->first);
-        return mix(lower->second, upper->second, (float) alpha);
+    // Parents precede their children, so one forward pass is enough
+    for (NodeHandle handle = 0; handle < nodes.size(); handle++) {
+        const Node& node = nodes[handle];
+        worldTransforms[handle] = node.parent == NullNode
+                ? node.transform
+                : worldTransforms[node.parent] * node.transform;
     }
 }
 
-double fmodulus(double x, double y) {
-    return x - y * floor(x / y);
+Bounds Mesh::worldBounds(const glm::mat4& transform, const std::vector<glm::mat4>& bonePalette) const {
+    if (bones.empty()) {
+        return bounds.transformed(transform);
+    }
+    Bounds result;
+    for (size_t j = 0; j < bones.size() && j < bonePalette.size(); j++) {
+        result.extend(boneBounds[j].transformed(bonePalette[j]));
+    }
+    return result;
 }
 
-void Scene::animate(double time, unsigned int animationIdx) {
-    if (animationIdx >= animations.size()) {
-        return;
+void Scene::updateBonePalettes() {
+    bonePalettes.resize(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const std::vector<Bone>& bones = meshes[i].bones;
+        bool posed = false;
+        for (const Bone& bone : bones) {
+            posed = posed || animated(bone.node);
+        }
+        if (!posed) {
+            bonePalettes[i].clear();
+            continue;
+        }
+        bonePalettes[i].resize(bones.size());
+        for (size_t j = 0; j < bones.size(); j++) {
+            bonePalettes[i][j] = worldTransform(bones[j].node) * bones[j].offset;
+        }
     }
-    Animation animation = animations[animationIdx];
-    double tick = fmodulus(animation.ticksPerSecond * time, animation.duration);
+}
 
-    for (const auto& channel : animation.channels) {
-        std::function<glm::vec3(glm::vec3, glm::vec3, double)> mix = [](glm::vec3 lhs, glm::vec3 rhs, double alpha) {
-            return glm::mix(lhs, rhs, alpha);
-        };
+void Scene::indexNodes() {
+    // Keep the load factor at or below 1/2
+    size_t capacity = 16;
+    while (capacity < 2 * nodes.size()) {
+        capacity *= 2;
+    }
+    nameIndex.assign(capacity, {0, NullNode});
+    for (NodeHandle handle = 0; handle < nodes.size(); handle++) {
+        insertName(handle);
+    }
 
-        std::function<glm::quat(glm::quat, glm::quat, double)> slerp = [](glm::quat lhs, glm::quat rhs, double alpha) {
-            return glm::slerp(lhs, rhs, (float) alpha);
-        };
+    for (auto& animation : animations) {
+        for (auto& channel : animation.channels) {
+            channel.node = findNode(channel.nodeName);
+        }
+    }
+    for (auto& mesh : meshes) {
+        for (auto& bone : mesh.bones) {
+            bone.node = findNode(bone.name);
+        }
+    }
+    for (auto& light : pointLights) {
+        light->node = findNode(light->name);
+    }
+    for (auto& light : areaLights) {
+        light->node = findNode(light->name);
+    }
+    for (auto& light : ambientLights) {
+        light->node = findNode(light->name);
+    }
+}
 
-        auto position = interpNoWrap(tick, channel.translation,  mix);
-        auto rotation = interpNoWrap(tick, channel.rotation, slerp);
-        auto scale = interpNoWrap(tick, channel.scale, mix);
+void Scene::insertName(NodeHandle handle) {
+    size_t hash = std::hash<std::string>()(nodes[handle].name);
+    size_t mask = nameIndex.size() - 1;
 
-        std::shared_ptr<Node> node = findNode(channel.nodeName);
-        const auto I = glm::identity<glm::mat4>();
-        node->transform =
-                glm::translate(I, position)
-                * glm::mat4_cast(rotation)
-                * glm::scale(I, scale);
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        NameIndexSlot& slot = nameIndex[i];
+        if (slot.handle == NullNode) {
+            slot = {hash, handle};
+            return;
+        }
+        if (slot.hash == hash && nodes[slot.handle].name == nodes[handle].name) {
+            // Duplicate name: the node that comes first in the arena wins
+            return;
+        }
     }
 }
 
-std::shared_ptr<Node> Scene::findNode(const std::string& name) {
-    if (nameToNode[name] != nullptr) {
-        return nameToNode[name];
+NodeHandle Scene::findNode(const std::string& name) const {
+    if (nameIndex.empty()) {
+        return NullNode;
     }
 
-    std::vector<std::shared_ptr<Node>> stack{root};
-
-    while (!stack.empty()) {
-        std::shared_ptr<Node> node = stack.back();
-        stack.pop_back();
+    size_t hash = std::hash<std::string>()(name);
+    size_t mask = nameIndex.size() - 1;
 
-        if (node->name == name) {
-            nameToNode[node->name] = node;
-            return node;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const NameIndexSlot& slot = nameIndex[i];
+        if (slot.handle == NullNode) {
+            return NullNode;
         }
-
-        for (auto & child : node->children) {
-            stack.push_back(child);
+        if (slot.hash == hash && nodes[slot.handle].name == name) {
+            return slot.handle;
         }
     }
+}
 
-    return nullptr;
+glm::mat4 Scene::worldTransform(NodeHandle handle) const {
+    if (handle == NullNode) {
+        return glm::identity<glm::mat4>();
+    }
+    return worldTransforms[handle];
 }
@@ -1,6 +1,8 @@
 #ifndef CS5625_SCENE_H
 #define CS5625_SCENE_H
 
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -8,8 +10,15 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include "RTUtil/Camera.hpp"
+#include "AnimationCompression.h"
+#include "Bounds.h"
 #include <functional>
 
+// Index of a node in Scene::nodes. Nodes are never removed, so handles stay
+// valid for the lifetime of the scene.
+using NodeHandle = uint32_t;
+const NodeHandle NullNode = std::numeric_limits<NodeHandle>::max();
+
 struct Material {
     glm::vec3 color;
     float roughnessFactor;
@@ -17,12 +26,14 @@ struct Material {
 
 struct AmbientLight {
     std::string name;
+    NodeHandle node = NullNode;
     glm::vec3 radiance;
     float distance;
 };
 
 struct AreaLight {
     std::string name;
+    NodeHandle node = NullNode;
     float width;
     float height;
     glm::vec3 center;
@@ -31,18 +42,26 @@ struct AreaLight {
 
 struct PointLight {
     std::string name;
+    NodeHandle node = NullNode;
     glm::vec3 position;
     glm::vec3 power;
 };
 
+// Nodes live in a contiguous arena (Scene::nodes) and link to each other by
+// handle. A parent always comes before its children in the arena.
 struct Node {
     std::string name;
     glm::mat4 transform;
     std::vector<unsigned int> meshIndices;
-    std::vector<std::shared_ptr<Node>> children;
-    std::shared_ptr<Node> parent;
+    NodeHandle parent = NullNode;
+    NodeHandle firstChild = NullNode;
+    NodeHandle nextSibling = NullNode;
+};
 
-    glm::mat4 getTransformTo(const std::shared_ptr<Node>& other);
+struct Bone {
+    std::string name;
+    glm::mat4 offset;
+    NodeHandle node = NullNode;
 };
 
 struct Mesh {
@@ -52,16 +71,32 @@ struct Mesh {
     std::vector<uint32_t> indices;
     uint32_t materialIndex;
 
-    std::vector<std::pair<std::string, glm::mat4>> bones;
+    std::vector<Bone> bones;
     std::vector<glm::vec4> boneWeights;
     std::vector<glm::ivec4> boneIndices;
+
+    // Filled in at import: the bind-pose bounds, and parallel to bones, the
+    // bind-pose bounds of the vertices each bone influences
+    Bounds bounds;
+    std::vector<Bounds> boneBounds;
+
+    // Chosen at import: rigid meshes with few enough triangles to rasterize
+    // on the CPU hide what is behind them, see OcclusionCuller
+    bool occluder = false;
+
+    // Conservative world bounds. A skinned vertex blends its bones' skinning
+    // matrices, so it lies within the union of each bone's bounds moved by
+    // its matrix in bonePalette; other meshes just move by the transform.
+    Bounds worldBounds(const glm::mat4& transform, const std::vector<glm::mat4>& bonePalette) const;
 };
 
+// Compressed at import time, see AnimationCompression.h
 struct Channel {
     std::string nodeName;
-    std::map<double, glm::vec3> translation;
-    std::map<double, glm::quat> rotation;
-    std::map<double, glm::vec3> scale;
+    NodeHandle node = NullNode;
+    QuantizedVec3Track translation;
+    QuantizedQuatTrack rotation;
+    QuantizedVec3Track scale;
 };
 
 struct Animation {
@@ -77,14 +112,70 @@ struct Scene {
     std::vector<std::shared_ptr<PointLight>> pointLights;
     std::vector<std::shared_ptr<AreaLight>> areaLights;
     std::vector<std::shared_ptr<AmbientLight>> ambientLights;
-    std::shared_ptr<Node> root;
     std::vector<Animation> animations;
 
+    // Node arena, indexed by NodeHandle. Iterating it in order visits parents
+    // before children, which is also the order nodes are drawn in.
+    std::vector<Node> nodes;
+    NodeHandle root = NullNode;
+
+    // Node-to-world transforms, parallel to nodes. Refreshed by
+    // updateWorldTransforms.
+    std::vector<glm::mat4> worldTransforms;
+
+    // Skinning matrices (bone-to-world times offset), parallel to meshes and
+    // their bones. Refreshed by updateBonePalettes.
+    std::vector<std::vector<glm::mat4>> bonePalettes;
+
+    // Nodes that animate() leaves alone, parallel to nodes (empty for none),
+    // e.g. the skeletons of birds that are drawn instanced and pose
+    // themselves from the clip. Skinned meshes whose bones are all such
+    // nodes get an empty bone palette.
+    std::vector<bool> unanimatedNodes;
+    bool animated(NodeHandle handle) const {
+        return handle >= unanimatedNodes.size() || !unanimatedNodes[handle];
+    }
+
     void animate(double time, unsigned int animationIdx = 0);
 
-    std::shared_ptr<Node> findNode(const std::string& name);
+    // The local transform that animate would give the channel's node at the
+    // given time, without touching the node.
+    glm::mat4 sampleChannel(unsigned int animationIdx, size_t channelIdx, double time) const;
+
+    // Append a node as the last child of parent. Passing NullNode as the parent
+    // makes the node the scene root.
+    NodeHandle addNode(const std::string& name, const glm::mat4& transform, NodeHandle parent);
+
+    // Rebuild the name index and resolve the node handles of channels, bones
+    // and lights. Call this once after the node graph is built or modified.
+    void indexNodes();
+
+    // Recompute worldTransforms in a single pass over the arena. Call this
+    // after animating and before drawing.
+    void updateWorldTransforms();
+
+    // Recompute bonePalettes from worldTransforms.
+    void updateBonePalettes();
+
+    // Returns NullNode if there is no node with the given name.
+    NodeHandle findNode(const std::string& name) const;
+
+    Node& node(NodeHandle handle) { return nodes[handle]; }
+    const Node& node(NodeHandle handle) const { return nodes[handle]; }
+
+    // Node-to-world transform as of the last updateWorldTransforms, or the
+    // identity for NullNode.
+    glm::mat4 worldTransform(NodeHandle handle) const;
 
 private:
-    std::map<std::string, std::shared_ptr<Node>> nameToNode;
+    // Open-addressing hash table of handles keyed by node name. Collisions are
+    // resolved by linear probing; the empty slot marker is NullNode.
+    struct NameIndexSlot {
+        size_t hash;
+        NodeHandle handle;
+    };
+    std::vector<NameIndexSlot> nameIndex;
+
+    void insertName(NodeHandle handle);
 };
 #endif //CS5625_SCENE_H
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "SceneBVH.h"
+
+#include <algorithm>
+
+namespace {
+
+    float surfaceArea(const Bounds& bounds) {
+        if (bounds.empty()) {
+            return 0;
+        }
+        glm::vec3 d = bounds.max - bounds.min;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    glm::vec3 centroid(const Bounds& bounds) {
+        return bounds.empty() ? glm::vec3(0) : (bounds.min + bounds.max) / 2.0f;
+    }
+
+    enum class Containment { Outside, Intersecting, Inside };
+
+    // The six planes of a frustum as (normal, offset), pointing inwards,
+    // from the rows of its view-projection matrix
+    struct Frustum {
+        glm::vec4 planes[6];
+
+        explicit Frustum(const glm::mat4& m) {
+            glm::vec4 row[4];
+            for (int r = 0; r < 4; r++) {
+                row[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                planes[2 * axis] = row[3] + row[axis];
+                planes[2 * axis + 1] = row[3] - row[axis];
+            }
+        }
+
+        Containment classify(const Bounds& bounds) const {
+            if (bounds.empty()) {
+                return Containment::Outside;
+            }
+            Containment result = Containment::Inside;
+            for (const glm::vec4& plane : planes) {
+                glm::vec3 n(plane);
+
+                // The corners furthest along and against the normal
+                glm::vec3 positive(n.x >= 0 ? bounds.max.x : bounds.min.x,
+                                   n.y >= 0 ? bounds.max.y : bounds.min.y,
+                                   n.z >= 0 ? bounds.max.z : bounds.min.z);
+                glm::vec3 negative(n.x >= 0 ? bounds.min.x : bounds.max.x,
+                                   n.y >= 0 ? bounds.min.y : bounds.max.y,
+                                   n.z >= 0 ? bounds.min.z : bounds.max.z);
+                if (glm::dot(n, positive) + plane.w < 0) {
+                    return Containment::Outside;
+                }
+                if (glm::dot(n, negative) + plane.w < 0) {
+                    result = Containment::Intersecting;
+                }
+            }
+            return result;
+        }
+    };
+
+}
+
+void SceneBVH::update(const std::vector<Bounds>& bounds) {
+    bool rebuild = bounds.size() != itemBounds.size();
+    itemBounds = bounds;
+    if (rebuild) {
+        build();
+        return;
+    }
+
+    // Refitting keeps the tree valid however things move, but the boxes of
+    // things that moved apart overlap more and more
+    if (refit() > 2 * builtArea) {
+        build();
+    }
+}
+
+void SceneBVH::build() {
+    lastStats.rebuilds++;
+    items.resize(itemBounds.size());
+    for (uint32_t i = 0; i < items.size(); i++) {
+        items[i] = i;
+    }
+    nodes.clear();
+    if (!items.empty()) {
+        nodes.reserve(2 * items.size());
+        nodes.emplace_back();
+        buildNode(0, 0, (uint32_t) items.size());
+    }
+    builtArea = refit();
+}
+
+void SceneBVH::buildNode(uint32_t index, uint32_t first, uint32_t count) {
+    nodes[index].first = first;
+    nodes[index].count = count;
+    if (count <= leafSize) {
+        return;
+    }
+
+    Bounds centroids;
+    for (uint32_t i = first; i < first + count; i++) {
+        centroids.extend(centroid(itemBounds[items[i]]));
+    }
+    glm::vec3 extent = centroids.max - centroids.min;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+
+    uint32_t half = count / 2;
+    std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+                     [&](uint32_t a, uint32_t b) {
+                         return centroid(itemBounds[a])[axis] < centroid(itemBounds[b])[axis];
+                     });
+
+    // Both children are allocated before either subtree, so they sit side
+    // by side
+    uint32_t left = (uint32_t) nodes.size();
+    nodes.emplace_back();
+    nodes.emplace_back();
+    nodes[index].left = left;
+    buildNode(left, first, half);
+    buildNode(left + 1, first + half, count - half);
+}
+
+float SceneBVH::refit() {
+    // Children always come after their parents
+    float area = 0;
+    for (size_t n = nodes.size(); n-- > 0;) {
+        Node& node = nodes[n];
+        node.bounds = Bounds();
+        if (node.leaf()) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                node.bounds.extend(itemBounds[items[i]]);
+            }
+        } else {
+            node.bounds.extend(nodes[node.left].bounds);
+            node.bounds.extend(nodes[node.left + 1].bounds);
+        }
+        area += surfaceArea(node.bounds);
+    }
+    return area;
+}
+
+void SceneBVH::cull(const glm::mat4& viewProjection, std::vector<size_t>& visible) {
+    visible.clear();
+    size_t rebuilds = lastStats.rebuilds;
+    lastStats = Stats();
+    lastStats.items = itemBounds.size();
+    lastStats.rebuilds = rebuilds;
+    if (nodes.empty()) {
+        return;
+    }
+
+    Frustum frustum(viewProjection);
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        lastStats.nodesVisited++;
+
+        Containment containment = frustum.classify(node.bounds);
+        if (containment == Containment::Outside) {
+            continue;
+        }
+        if (containment == Containment::Inside) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                if (!itemBounds[items[i]].empty()) {
+                    visible.push_back(items[i]);
+                }
+            }
+        } else if (node.leaf()) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                lastStats.itemsTested++;
+                if (frustum.classify(itemBounds[items[i]]) != Containment::Outside) {
+                    visible.push_back(items[i]);
+                }
+            }
+        } else {
+            stack.push_back(node.left + 1);
+            stack.push_back(node.left);
+        }
+    }
+
+    std::sort(visible.begin(), visible.end());
+    lastStats.visible = visible.size();
+}
@@ -0,0 +1,65 @@
+#ifndef CS5625_SCENEBVH_H
+#define CS5625_SCENEBVH_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Bounds.h"
+
+// Bounding volume hierarchy over the world bounds of a list of items, e.g.
+// the draw nodes. The tree is built top-down, splitting each node at the
+// median centroid along its longest axis. While the items just move, the
+// tree is only refit: the boxes are recomputed bottom-up and the structure
+// is kept. It is rebuilt when the item count changes or refitting has
+// loosened it too much.
+//
+// cull() walks the tree against a frustum; a subtree entirely inside it is
+// accepted without testing its items, so the cost follows what is visible
+// rather than the size of the scene.
+class SceneBVH {
+public:
+    struct Stats {
+        size_t items = 0;
+        size_t visible = 0;
+        size_t nodesVisited = 0;
+        size_t itemsTested = 0;
+        size_t rebuilds = 0;
+    };
+
+    // bounds[i] is item i's world box; items with empty bounds are never
+    // visible
+    void update(const std::vector<Bounds>& bounds);
+
+    // The items that may be inside the frustum of viewProjection, in
+    // ascending order
+    void cull(const glm::mat4& viewProjection, std::vector<size_t>& visible);
+
+    // Of the last cull(), except for rebuilds, which count up
+    const Stats& stats() const { return lastStats; }
+
+private:
+    static constexpr uint32_t leafSize = 4;
+
+    // A node's items are items[first, first + count). Interior nodes have
+    // their children at left and left + 1.
+    struct Node {
+        Bounds bounds;
+        uint32_t first = 0;
+        uint32_t count = 0;
+        uint32_t left = 0;
+        bool leaf() const { return left == 0; }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> items;
+    std::vector<Bounds> itemBounds;
+    float builtArea = 0;
+    Stats lastStats;
+
+    void build();
+    void buildNode(uint32_t index, uint32_t first, uint32_t count);
+    float refit();
+};
+
+
+#endif //CS5625_SCENEBVH_H
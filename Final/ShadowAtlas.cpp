@@ -0,0 +1,127 @@
+#include "ShadowAtlas.h"
+
+#include <GLWrap/StateCache.hpp>
+
+ShadowAtlas::ShadowAtlas(glm::ivec2 tileSize) :
+        // Every tier's tiles must line up with the smallest ones
+        tileSize(tileSize / (1 << (tierCount - 1)) * (1 << (tierCount - 1))) {
+    atlas = std::make_shared<GLWrap::Framebuffer>(size(), 0);
+    staticAtlas = std::make_unique<GLWrap::Framebuffer>(size(), 0);
+}
+
+void ShadowAtlas::allocate(const std::vector<size_t>& order, std::vector<int>& tiers) {
+    if (tiles.size() < tiers.size()) {
+        tiles.resize(tiers.size());
+    }
+
+    // Free the tiles of lights that now want another tier (or none), so that
+    // they are free for the lights below
+    for (size_t light = 0; light < tiles.size(); light++) {
+        int wanted = light < tiers.size() ? tiers[light] : -1;
+        if (tiles[light].requested != wanted) {
+            tiles[light] = Tile();
+        }
+    }
+
+    for (size_t light : order) {
+        if (tiers[light] < 0) {
+            continue;
+        }
+        if (tiles[light].tier >= 0) {
+            tiers[light] = tiles[light].tier;
+            continue;
+        }
+
+        Tile& tile = tiles[light];
+        for (int tier = tiers[light]; tier < tierCount && tile.tier < 0; tier++) {
+            int cells = gridSize << tier;
+            for (int y = 0; y < cells && tile.tier < 0; y++) {
+                for (int x = 0; x < cells && tile.tier < 0; x++) {
+                    if (!overlaps(tier, glm::ivec2(x, y), light)) {
+                        tile.requested = tiers[light];
+                        tile.tier = tier;
+                        tile.cell = glm::ivec2(x, y);
+                    }
+                }
+            }
+        }
+        tiers[light] = tile.tier;
+    }
+}
+
+bool ShadowAtlas::overlaps(int tier, glm::ivec2 cell, size_t except) const {
+    // Compare in units of the smallest tile
+    int scale = 1 << (tierCount - 1 - tier);
+    glm::ivec2 lo = cell * scale;
+    glm::ivec2 hi = lo + scale;
+    for (size_t light = 0; light < tiles.size(); light++) {
+        const Tile& other = tiles[light];
+        if (light == except || other.tier < 0) {
+            continue;
+        }
+        int otherScale = 1 << (tierCount - 1 - other.tier);
+        glm::ivec2 otherLo = other.cell * otherScale;
+        glm::ivec2 otherHi = otherLo + otherScale;
+        if (lo.x < otherHi.x && otherLo.x < hi.x && lo.y < otherHi.y && otherLo.y < hi.y) {
+            return true;
+        }
+    }
+    return false;
+}
+
+glm::ivec4 ShadowAtlas::viewport(size_t light) const {
+    const Tile& tile = tiles[light];
+    glm::ivec2 extent = tileSize / (1 << tile.tier);
+    glm::ivec2 offset = tile.cell * extent;
+    return glm::ivec4(offset.x, offset.y, extent.x, extent.y);
+}
+
+glm::vec4 ShadowAtlas::rect(size_t light) const {
+    if (!hasTile(light)) {
+        return glm::vec4(0);
+    }
+    glm::vec4 v = viewport(light);
+    glm::vec2 atlasSize = size();
+    return glm::vec4(v.x / atlasSize.x, v.y / atlasSize.y, v.z / atlasSize.x, v.w / atlasSize.y);
+}
+
+bool ShadowAtlas::cached(size_t light, const glm::mat4& viewProjection) const {
+    return hasTile(light) && tiles[light].valid && tiles[light].viewProjection == viewProjection;
+}
+
+void ShadowAtlas::markCached(size_t light, const glm::mat4& viewProjection) {
+    tiles[light].valid = true;
+    tiles[light].viewProjection = viewProjection;
+    misses++;
+}
+
+void ShadowAtlas::invalidate() {
+    for (Tile& tile : tiles) {
+        tile.valid = false;
+    }
+}
+
+void ShadowAtlas::bindStatic() const {
+    staticAtlas->bind();
+    GLWrap::StateCache::get().viewport(0, 0, size().x, size().y);
+}
+
+void ShadowAtlas::bind() const {
+    atlas->bind();
+    GLWrap::StateCache::get().viewport(0, 0, size().x, size().y);
+}
+
+void ShadowAtlas::clearTile(size_t light) const {
+    glm::ivec4 v = viewport(light);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(v.x, v.y, v.z, v.w);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+void ShadowAtlas::copyStatic(size_t light) const {
+    glm::ivec4 v = viewport(light);
+    GLWrap::StateCache::get().bindReadFramebuffer(staticAtlas->id());
+    GLWrap::StateCache::get().bindDrawFramebuffer(atlas->id());
+    glBlitFramebuffer(v.x, v.y, v.x + v.z, v.y + v.w, v.x, v.y, v.x + v.z, v.y + v.w, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+}
@@ -0,0 +1,83 @@
+#ifndef CS5625_SHADOWATLAS_H
+#define CS5625_SHADOWATLAS_H
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GLWrap/Framebuffer.hpp>
+
+// The shadow maps of every shadowed light, packed into one depth texture.
+// The atlas is a gridSize x gridSize grid of tier 0 tiles; each further tier
+// halves the tile size, and smaller tiles are carved out of larger ones the
+// way a buddy allocator would, so tiles never straddle each other. A light
+// keeps its tile for as long as it asks for the same tier.
+//
+// A second atlas of the same layout caches the depth of the static casters.
+// A light's cache stays valid until its shadow camera changes, it moves to
+// another tile, or invalidate() is called because static geometry moved, so
+// most frames only copy the cache and draw the casters that move.
+class ShadowAtlas {
+public:
+    static constexpr int gridSize = 4;
+    static constexpr int tierCount = 3;
+
+    // tileSize is the size of a tier 0 tile
+    explicit ShadowAtlas(glm::ivec2 tileSize);
+
+    // Assign tiles for this frame. tiers[light] < 0 means the light needs no
+    // tile. Lights are served in the given order; a light that does not fit
+    // at its tier is moved down a tier, and its tier becomes -1 if no tile is
+    // free at all. Lights that lose their tile lose their cache.
+    void allocate(const std::vector<size_t>& order, std::vector<int>& tiers);
+
+    bool hasTile(size_t light) const { return light < tiles.size() && tiles[light].tier >= 0; }
+
+    // Where the light's tile is, as (offset, scale) in texture coordinates
+    // of the atlas, or 0 if it has none
+    glm::vec4 rect(size_t light) const;
+
+    // True if the static cache of the light was drawn with viewProjection
+    bool cached(size_t light, const glm::mat4& viewProjection) const;
+    void markCached(size_t light, const glm::mat4& viewProjection);
+
+    // Drop every cache, e.g. because a static caster moved
+    void invalidate();
+
+    // Bind the static cache or the atlas, with the viewport covering all of
+    // it; draws place themselves in their tiles (see shadow_layers.vs).
+    // clearTile() clears the depth of one tile of the bound one.
+    void bindStatic() const;
+    void bind() const;
+    void clearTile(size_t light) const;
+
+    // Copy the light's static cache into its tile of the atlas
+    void copyStatic(size_t light) const;
+
+    const std::shared_ptr<GLWrap::Framebuffer>& framebuffer() const { return atlas; }
+    glm::ivec2 size() const { return tileSize * gridSize; }
+
+    // Tiles whose static casters were drawn since the last resetStats()
+    size_t cacheMisses() const { return misses; }
+    void resetStats() { misses = 0; }
+
+private:
+    struct Tile {
+        int requested = -1;              // may be above tier if it did not fit
+        int tier = -1;
+        glm::ivec2 cell = glm::ivec2(0); // in tiles of its tier
+        bool valid = false;
+        glm::mat4 viewProjection = glm::mat4(1);
+    };
+
+    glm::ivec2 tileSize;
+    std::shared_ptr<GLWrap::Framebuffer> atlas;
+    std::unique_ptr<GLWrap::Framebuffer> staticAtlas;
+    std::vector<Tile> tiles;
+    size_t misses = 0;
+
+    glm::ivec4 viewport(size_t light) const;
+    bool overlaps(int tier, glm::ivec2 cell, size_t except) const;
+};
+
+
+#endif //CS5625_SHADOWATLAS_H
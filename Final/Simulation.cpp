@@ -0,0 +1,233 @@
+#include "Simulation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace {
+
+    // Upper bound on catch-up steps per wake-up, so that a stall does not
+    // snowball into ever longer steps
+    const int MAX_STEPS_PER_WAKE = 8;
+
+    // Exactly a when a and b are equal, whatever alpha is
+    glm::mat4 lerp(const glm::mat4& a, const glm::mat4& b, float alpha) {
+        return a + (b - a) * alpha;
+    }
+
+    void lerp(
+            const std::vector<glm::mat4>& a,
+            const std::vector<glm::mat4>& b,
+            float alpha,
+            std::vector<glm::mat4>& out
+    ) {
+        out.resize(b.size());
+        for (size_t i = 0; i < b.size(); i++) {
+            out[i] = lerp(a[i], b[i], alpha);
+        }
+    }
+
+    void lerp(
+            const std::vector<std::vector<glm::mat4>>& a,
+            const std::vector<std::vector<glm::mat4>>& b,
+            float alpha,
+            std::vector<std::vector<glm::mat4>>& out
+    ) {
+        out.resize(b.size());
+        for (size_t i = 0; i < b.size(); i++) {
+            lerp(a[i], b[i], alpha, out[i]);
+        }
+    }
+
+    // Same shape as a and b, so they can be blended
+    bool sameShape(const std::vector<std::vector<glm::mat4>>& a, const std::vector<std::vector<glm::mat4>>& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].size() != b[i].size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+SimulationSnapshot::SimulationSnapshot(glm::ivec2 oceanGridSize) :
+    displacement(oceanGridSize.x, oceanGridSize.y),
+    gradX(oceanGridSize.x, oceanGridSize.y),
+    gradZ(oceanGridSize.x, oceanGridSize.y) {
+}
+
+void SimulationSnapshot::interpolate(
+        double renderTime,
+        std::vector<glm::mat4>& outWorldTransforms,
+        std::vector<std::vector<glm::mat4>>& outBonePalettes,
+        std::vector<std::vector<glm::mat4>>& outBirdTransforms,
+        std::vector<std::vector<glm::mat4>>& outBirdPalettes
+) const {
+    float alpha = 1;
+    if (time > previousTime) {
+        alpha = (float) glm::clamp((renderTime - previousTime) / (time - previousTime), 0.0, 1.0);
+    }
+
+    // Steps are short, so blending the matrices linearly is close enough to
+    // blending the decomposed transforms
+    lerp(previousWorldTransforms, worldTransforms, alpha, outWorldTransforms);
+
+    lerp(previousBonePalettes, bonePalettes, alpha, outBonePalettes);
+    lerp(previousBirdTransforms, birdTransforms, alpha, outBirdTransforms);
+    lerp(previousBirdPalettes, birdPalettes, alpha, outBirdPalettes);
+}
+
+Simulation::Simulation(
+        std::shared_ptr<Scene> scene,
+        const std::shared_ptr<OceanScene>& oceanScene,
+        Animators& animators,
+        Timer& timer,
+        const FrameJobInputs& initialInputs
+) : scene(std::move(scene)),
+    animators(animators),
+    timer(timer),
+    frameJobs(this->scene, animators),
+    snapshots(oceanScene->gridSize),
+    pendingInputs(initialInputs),
+    stopping(false) {
+
+    // Publish an initial step so the renderer always has something to draw
+    advance(timer.time(), 0);
+    publish();
+
+    thread = std::thread(&Simulation::run, this);
+}
+
+Simulation::~Simulation() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void Simulation::setInputs(const FrameJobInputs& newInputs) {
+    std::lock_guard<std::mutex> lock(inputsMutex);
+    pendingInputs = newInputs;
+}
+
+void Simulation::post(std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(inputsMutex);
+    pendingCommands.push_back(std::move(fn));
+}
+
+bool Simulation::update() {
+    return snapshots.update();
+}
+
+double Simulation::renderTime() {
+    return timer.time() - STEP;
+}
+
+void Simulation::run() {
+    while (!stopping) {
+        double target = timer.time();
+
+        if (target < time) {
+            // The clock was rewound: restart from there without blending
+            // across the jump
+            time = target - STEP;
+            lastWorldTransforms.clear();
+            lastBonePalettes.clear();
+            lastBirdTransforms.clear();
+            lastBirdPalettes.clear();
+        }
+
+        int steps = 0;
+        while (time + STEP <= target && steps < MAX_STEPS_PER_WAKE) {
+            advance(time + STEP, STEP);
+            publish();
+            steps++;
+        }
+        if (time + STEP <= target) {
+            // Too far behind; drop the backlog
+            time = target;
+        }
+
+        double rate = timer.rate();
+        double wait = timer.playing() && rate > 0 ? (time + STEP - target) / rate : STEP;
+        wait = glm::clamp(wait, 0.0, STEP);
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait_for(lock, std::chrono::duration<double>(wait), [this] { return stopping.load(); });
+    }
+}
+
+void Simulation::advance(double stepTime, double deltaTime) {
+    std::vector<std::function<void()>> commands;
+    {
+        std::lock_guard<std::mutex> lock(inputsMutex);
+        inputs = pendingInputs;
+        commands.swap(pendingCommands);
+    }
+
+    for (auto& command : commands) {
+        command();
+    }
+
+    inputs.time = stepTime;
+    inputs.deltaTime = deltaTime;
+    frameJobs.run(inputs);
+
+    time = stepTime;
+    step++;
+}
+
+void Simulation::publish() {
+    SimulationSnapshot& snapshot = snapshots.writeBuffer();
+
+    snapshot.step = step;
+    snapshot.time = time;
+    snapshot.worldTransforms = scene->worldTransforms;
+    snapshot.bonePalettes = scene->bonePalettes;
+    snapshot.drawNodes = frameJobs.drawNodes();
+    const auto& flocks = animators.birdAnimator.flocks();
+    snapshot.birdTransforms.resize(flocks.size());
+    snapshot.birdPalettes.resize(flocks.size());
+    for (size_t i = 0; i < flocks.size(); i++) {
+        snapshot.birdTransforms[i] = flocks[i]->instanceTransforms;
+        snapshot.birdPalettes[i] = flocks[i]->phasePalettes;
+    }
+
+    if (lastWorldTransforms.size() == scene->worldTransforms.size()
+            && sameShape(lastBonePalettes, scene->bonePalettes)
+            && sameShape(lastBirdTransforms, snapshot.birdTransforms)
+            && sameShape(lastBirdPalettes, snapshot.birdPalettes)) {
+        snapshot.previousTime = lastTime;
+        snapshot.previousWorldTransforms = lastWorldTransforms;
+        snapshot.previousBonePalettes = lastBonePalettes;
+        snapshot.previousBirdTransforms = lastBirdTransforms;
+        snapshot.previousBirdPalettes = lastBirdPalettes;
+    } else {
+        snapshot.previousTime = time;
+        snapshot.previousWorldTransforms = scene->worldTransforms;
+        snapshot.previousBonePalettes = scene->bonePalettes;
+        snapshot.previousBirdTransforms = snapshot.birdTransforms;
+        snapshot.previousBirdPalettes = snapshot.birdPalettes;
+    }
+
+    snapshot.ocean = inputs.ocean;
+    if (inputs.ocean) {
+        snapshot.displacement.copyFrom(animators.oceanAnimator.displacementData);
+        snapshot.gradX.copyFrom(animators.oceanAnimator.gradXData);
+        snapshot.gradZ.copyFrom(animators.oceanAnimator.gradZData);
+    }
+
+    snapshots.publish();
+
+    lastTime = time;
+    lastWorldTransforms = scene->worldTransforms;
+    lastBonePalettes = scene->bonePalettes;
+    lastBirdTransforms = snapshot.birdTransforms;
+    lastBirdPalettes = snapshot.birdPalettes;
+}
@@ -0,0 +1,120 @@
+#ifndef CS5625_SIMULATION_H
+#define CS5625_SIMULATION_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Animators.h"
+#include "FrameJobs.h"
+#include "OceanAnimator.h"
+#include "Scene.h"
+#include "Timer.h"
+#include "TripleBuffer.h"
+
+// Everything the renderer needs from one simulation step, plus the transforms
+// of the step before it so the renderer can interpolate between the two.
+struct SimulationSnapshot {
+    uint64_t step = 0;
+    double previousTime = 0;
+    double time = 0;
+
+    std::vector<glm::mat4> previousWorldTransforms;
+    std::vector<glm::mat4> worldTransforms;
+    std::vector<std::vector<glm::mat4>> previousBonePalettes;
+    std::vector<std::vector<glm::mat4>> bonePalettes;
+    std::vector<NodeHandle> drawNodes;
+
+    // Instance data per flock, see BirdFlock::update_instances
+    std::vector<std::vector<glm::mat4>> previousBirdTransforms;
+    std::vector<std::vector<glm::mat4>> birdTransforms;
+    std::vector<std::vector<glm::mat4>> previousBirdPalettes;
+    std::vector<std::vector<glm::mat4>> birdPalettes;
+
+    bool ocean = false;
+    OceanTextureData displacement;
+    OceanTextureData gradX;
+    OceanTextureData gradZ;
+
+    explicit SimulationSnapshot(glm::ivec2 oceanGridSize);
+
+    // Blend between the previous and current step at the given time.
+    void interpolate(
+            double time,
+            std::vector<glm::mat4>& worldTransforms,
+            std::vector<std::vector<glm::mat4>>& bonePalettes,
+            std::vector<std::vector<glm::mat4>>& birdTransforms,
+            std::vector<std::vector<glm::mat4>>& birdPalettes
+    ) const;
+};
+
+// Ticks animation, ocean, boats, sun and birds at a fixed rate on its own
+// thread, following the (thread safe) Timer. Each step is published through a
+// triple buffer, so the GL thread never waits on the simulation and vice versa.
+class Simulation {
+public:
+    static constexpr double STEP = 1.0 / 60.0;
+
+    Simulation(
+            std::shared_ptr<Scene> scene,
+            const std::shared_ptr<OceanScene>& oceanScene,
+            Animators& animators,
+            Timer& timer,
+            const FrameJobInputs& initialInputs
+    );
+    ~Simulation();
+
+    // Inputs that the GL thread controls (config flags, sun angle, ...).
+    // Picked up at the start of the next step.
+    void setInputs(const FrameJobInputs& inputs);
+
+    // Run fn on the simulation thread before the next step. Use this to poke
+    // simulation state (e.g. the birds) from the GL thread.
+    void post(std::function<void()> fn);
+
+    // Pick up the latest published step. Returns true if it is new.
+    bool update();
+    const SimulationSnapshot& snapshot() const { return snapshots.readBuffer(); }
+
+    // The time to render at: one step behind the clock, so that there is
+    // always a published step on either side of it.
+    double renderTime();
+
+private:
+    std::shared_ptr<Scene> scene;
+    Animators& animators;
+    Timer& timer;
+    FrameJobs frameJobs;
+
+    TripleBuffer<SimulationSnapshot> snapshots;
+
+    std::mutex inputsMutex;
+    FrameJobInputs pendingInputs;
+    std::vector<std::function<void()>> pendingCommands;
+
+    // Simulation thread state
+    FrameJobInputs inputs;
+    uint64_t step = 0;
+    double time = 0;
+    double lastTime = 0;
+    std::vector<glm::mat4> lastWorldTransforms;
+    std::vector<std::vector<glm::mat4>> lastBonePalettes;
+    std::vector<std::vector<glm::mat4>> lastBirdTransforms;
+    std::vector<std::vector<glm::mat4>> lastBirdPalettes;
+
+    std::atomic<bool> stopping;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::thread thread;
+
+    void run();
+    void advance(double stepTime, double deltaTime);
+    void publish();
+};
+
+
+#endif //CS5625_SIMULATION_H
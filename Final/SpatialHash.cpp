@@ -0,0 +1,34 @@
+#include "SpatialHash.h"
+
+void SpatialHash::build(const std::vector<glm::vec3>& newPoints, float cellSize) {
+    points = &newPoints;
+    inverseCellSize = 1 / cellSize;
+
+    // About two buckets per point keeps collisions rare
+    uint32_t bucketCount = 64;
+    while (bucketCount < 2 * newPoints.size()) {
+        bucketCount *= 2;
+    }
+    bucketMask = bucketCount - 1;
+
+    bucketStart.assign(bucketCount + 1, 0);
+    pointBuckets.resize(newPoints.size());
+    sortedIndices.resize(newPoints.size());
+
+    for (size_t i = 0; i < newPoints.size(); i++) {
+        pointBuckets[i] = bucketOf(cellOf(newPoints[i]));
+        bucketStart[pointBuckets[i] + 1]++;
+    }
+    for (uint32_t b = 0; b < bucketCount; b++) {
+        bucketStart[b + 1] += bucketStart[b];
+    }
+
+    // Scatter, using the bucket starts as write cursors, then shift them back
+    for (size_t i = 0; i < newPoints.size(); i++) {
+        sortedIndices[bucketStart[pointBuckets[i]]++] = (uint32_t) i;
+    }
+    for (uint32_t b = bucketCount; b > 0; b--) {
+        bucketStart[b] = bucketStart[b - 1];
+    }
+    bucketStart[0] = 0;
+}
@@ -0,0 +1,75 @@
+#ifndef CS5625_SPATIALHASH_H
+#define CS5625_SPATIALHASH_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Uniform grid over points, hashed into a fixed number of buckets and stored
+// as one sorted index array (counting sort), so a rebuild is two linear
+// passes with no per-cell allocation. Queries visit the 3x3x3 block of cells
+// around a point, so the cell size should be at least the query radius.
+class SpatialHash {
+public:
+    void build(const std::vector<glm::vec3>& points, float cellSize);
+
+    // Calls f(index) for every point within radius of p (p itself included
+    // if it is one of the points). radius must not exceed the cell size.
+    template<class F>
+    void forEachNeighbor(const glm::vec3& p, float radius, F&& f) const {
+        uint32_t visited[27];
+        int visitedCount = 0;
+
+        glm::ivec3 center = cellOf(p);
+        float radius2 = radius * radius;
+
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dz = -1; dz <= 1; dz++) {
+                    uint32_t bucket = bucketOf(center + glm::ivec3(dx, dy, dz));
+
+                    // Different cells can share a bucket; visit each once
+                    bool seen = false;
+                    for (int i = 0; i < visitedCount && !seen; i++) {
+                        seen = visited[i] == bucket;
+                    }
+                    if (seen) {
+                        continue;
+                    }
+                    visited[visitedCount++] = bucket;
+
+                    for (uint32_t k = bucketStart[bucket]; k < bucketStart[bucket + 1]; k++) {
+                        uint32_t index = sortedIndices[k];
+                        glm::vec3 d = (*points)[index] - p;
+                        if (glm::dot(d, d) <= radius2) {
+                            f(index);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    const std::vector<glm::vec3>* points = nullptr;
+    float inverseCellSize = 1;
+    uint32_t bucketMask = 0;
+
+    std::vector<uint32_t> bucketStart;   // bucketMask + 2 entries
+    std::vector<uint32_t> sortedIndices; // point indices grouped by bucket
+    std::vector<uint32_t> pointBuckets;
+
+    glm::ivec3 cellOf(const glm::vec3& p) const {
+        return glm::ivec3(glm::floor(p * inverseCellSize));
+    }
+
+    uint32_t bucketOf(const glm::ivec3& cell) const {
+        // Teschner et al., "Optimized Spatial Hashing for Collision Detection
+        // of Deformable Objects"
+        auto h = ((uint32_t) cell.x * 73856093u) ^ ((uint32_t) cell.y * 19349663u) ^ ((uint32_t) cell.z * 83492791u);
+        return h & bucketMask;
+    }
+};
+
+
+#endif //CS5625_SPATIALHASH_H
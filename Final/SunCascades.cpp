@@ -0,0 +1,75 @@
+#include "SunCascades.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+SunCascades::SunCascades(int resolution) : resolution(resolution) {
+    depth = std::make_shared<GLWrap::Framebuffer>(size(), 0);
+}
+
+void SunCascades::update(const glm::mat4& view,
+                         const glm::mat4& projection,
+                         const glm::vec3& toSun,
+                         float shadowDistance,
+                         float casterDistance) {
+    // Clip planes and half extents per unit depth of a GL perspective projection
+    float near = projection[3][2] / (projection[2][2] - 1);
+    float far = std::min(projection[3][2] / (projection[2][2] + 1), shadowDistance);
+    glm::vec2 slope(1 / projection[0][0], 1 / projection[1][1]);
+    glm::mat4 viewInverse = glm::inverse(view);
+
+    // Only the direction of the view matters, so it is a rotation
+    glm::vec3 up = std::abs(toSun.z) < 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+    lightView = glm::lookAt(glm::vec3(0), -toSun, up);
+
+    float start = near;
+    for (int c = 0; c < cascadeCount; c++) {
+        // Halfway between logarithmic and uniform splits, leaning logarithmic
+        float t = float(c + 1) / cascadeCount;
+        float logSplit = near * std::pow(far / near, t);
+        float uniformSplit = near + (far - near) * t;
+        float end = 0.75f * logSplit + 0.25f * uniformSplit;
+        splits[c] = end;
+
+        // Bounding sphere of the slice's corners. The corners are symmetric
+        // about the view axis, so the sphere only depends on the distances,
+        // not on where the camera looks.
+        glm::vec3 center(0);
+        glm::vec3 corners[8];
+        for (int k = 0; k < 8; k++) {
+            float d = k & 4 ? end : start;
+            glm::vec3 corner(d * slope.x * (k & 1 ? 1 : -1), d * slope.y * (k & 2 ? 1 : -1), -d);
+            corners[k] = glm::vec3(viewInverse * glm::vec4(corner, 1));
+            center += corners[k] / 8.0f;
+        }
+        float radius = 0;
+        for (const glm::vec3& corner : corners) {
+            radius = std::max(radius, glm::length(corner - center));
+        }
+        radius = std::ceil(radius * 16) / 16;
+
+        // Move the center in whole texels of the cascade
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1));
+        float texel = 2 * radius / resolution;
+        lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+        lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+
+        const Bounds& box = boxes[c] = Bounds(lightCenter - glm::vec3(radius, radius, radius),
+                                              lightCenter + glm::vec3(radius, radius, radius + casterDistance));
+
+        // The light looks down -z, so distances are negated z
+        glm::mat4 lightProjection = glm::ortho(box.min.x, box.max.x, box.min.y, box.max.y, -box.max.z, -box.min.z);
+        viewProjections[c] = lightProjection * lightView;
+
+        start = end;
+    }
+}
+
+glm::vec4 SunCascades::rect(int cascade) const {
+    return glm::vec4(0.5f * (cascade % 2), 0.5f * (cascade / 2), 0.5f, 0.5f);
+}
+
+bool SunCascades::overlaps(int cascade, const Bounds& bounds) const {
+    return bounds.transformed(lightView).intersects(boxes[cascade]);
+}
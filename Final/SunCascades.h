@@ -0,0 +1,59 @@
+#ifndef CS5625_SUNCASCADES_H
+#define CS5625_SUNCASCADES_H
+
+#include <memory>
+#include <glm/glm.hpp>
+#include <GLWrap/Framebuffer.hpp>
+#include "Bounds.h"
+
+// Cascaded shadow maps for the sun. The camera frustum, up to a shadow
+// distance, is split into cascadeCount slices that grow with distance, and
+// each slice gets an orthographic view along the sun that encloses the
+// slice's bounding sphere. The sphere does not change as the camera turns,
+// and the view's origin is snapped to whole texels, so shadows of things
+// that stand still do not shimmer as the camera moves.
+//
+// The cascades share one depth texture, as a 2x2 grid of tiles.
+class SunCascades {
+public:
+    static constexpr int cascadeCount = 4;
+
+    // resolution is per cascade
+    explicit SunCascades(int resolution);
+
+    // toSun is the unit direction towards the sun. Casters up to
+    // casterDistance beyond a cascade, towards the sun, still cast into it.
+    void update(const glm::mat4& view,
+                const glm::mat4& projection,
+                const glm::vec3& toSun,
+                float shadowDistance,
+                float casterDistance);
+
+    const glm::mat4& viewProjection(int cascade) const { return viewProjections[cascade]; }
+
+    // Tile of the cascade as (offset, scale) in texture coordinates
+    glm::vec4 rect(int cascade) const;
+
+    // Distance from the camera, along its view direction, where the cascade ends
+    float split(int cascade) const { return splits[cascade]; }
+
+    // True if a world-space box may cast into the cascade
+    bool overlaps(int cascade, const Bounds& bounds) const;
+
+    const std::shared_ptr<GLWrap::Framebuffer>& framebuffer() const { return depth; }
+    glm::ivec2 size() const { return glm::ivec2(2 * resolution); }
+
+private:
+    int resolution;
+    std::shared_ptr<GLWrap::Framebuffer> depth;
+
+    glm::mat4 lightView = glm::mat4(1);
+    glm::mat4 viewProjections[cascadeCount];
+    float splits[cascadeCount] = {};
+
+    // Each cascade's box in the light's view space
+    Bounds boxes[cascadeCount];
+};
+
+
+#endif //CS5625_SUNCASCADES_H
@@ -11,11 +11,13 @@
 
 SunLightNodeAnimator::SunLightNodeAnimator(
         std::shared_ptr<PointLight> light,
-        std::shared_ptr<Node> node
-) : node(std::move(node)),
-    light(std::move(light)) {
+        std::shared_ptr<Scene> scene,
+        NodeHandle node
+) : light(std::move(light)),
+    scene(std::move(scene)),
+    node(node) {
 }
 
 void SunLightNodeAnimator::update(float thetaSun, float turbidity) {
-    node->transform = glm::rotate(thetaSun, glm::vec3(0, 0, 1));
+    scene->node(node).transform = glm::rotate(thetaSun, glm::vec3(0, 0, 1));
 }
@@ -10,10 +10,11 @@
 
 class SunLightNodeAnimator {
     std::shared_ptr<PointLight> light;
-    std::shared_ptr<Node> node;
+    std::shared_ptr<Scene> scene;
+    NodeHandle node;
 
 public:
-    explicit SunLightNodeAnimator(std::shared_ptr<PointLight> light, std::shared_ptr<Node> node);
+    explicit SunLightNodeAnimator(std::shared_ptr<PointLight> light, std::shared_ptr<Scene> scene, NodeHandle node);
     void update(float thetaSun, float turbidity);
 };
 
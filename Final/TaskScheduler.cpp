@@ -0,0 +1,189 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+    // Index of the calling thread's own queue, or 0 (the injector) for
+    // threads that do not belong to a scheduler
+    thread_local size_t currentQueue = 0;
+    thread_local const TaskScheduler* currentScheduler = nullptr;
+
+}
+
+TaskScheduler::TaskScheduler(unsigned int threadCount) : queuedTasks(0), stopping(false) {
+    if (threadCount == 0) {
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = std::max(1u, hardwareThreads > 1 ? hardwareThreads - 1 : 1u);
+    }
+
+    for (unsigned int i = 0; i < threadCount + 1; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned int i = 0; i < threadCount; i++) {
+        threads.emplace_back(&TaskScheduler::workerLoop, this, i + 1);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void TaskScheduler::submit(Task task) {
+    size_t queueIndex = currentScheduler == this ? currentQueue : 0;
+
+    // Count before pushing so that queuedTasks never underflows
+    queuedTasks++;
+    {
+        std::lock_guard<std::mutex> lock(queues[queueIndex]->mutex);
+        queues[queueIndex]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+void TaskScheduler::runUntil(const std::function<bool()>& done) {
+    size_t queueIndex = currentScheduler == this ? currentQueue : 0;
+    while (!done()) {
+        if (!tryRunOne(queueIndex)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void TaskScheduler::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    grain = std::max(grain, (size_t) 1);
+
+    size_t chunks = (count + grain - 1) / grain;
+    std::atomic<size_t> remaining(chunks);
+
+    for (size_t c = 1; c < chunks; c++) {
+        submit([&fn, &remaining, c, grain, count] {
+            fn(c * grain, std::min(count, (c + 1) * grain));
+            remaining--;
+        });
+    }
+
+    // Take the first chunk ourselves, then help with the rest
+    fn(0, std::min(count, grain));
+    remaining--;
+
+    runUntil([&remaining] { return remaining == 0; });
+}
+
+void TaskScheduler::workerLoop(size_t queueIndex) {
+    currentQueue = queueIndex;
+    currentScheduler = this;
+
+    while (true) {
+        if (tryRunOne(queueIndex)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queuedTasks > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+bool TaskScheduler::tryRunOne(size_t queueIndex) {
+    Task task;
+    if (popBack(queueIndex, task) || stealFront(queueIndex, task)) {
+        queuedTasks--;
+        task();
+        return true;
+    }
+    return false;
+}
+
+bool TaskScheduler::popBack(size_t queueIndex, Task& task) {
+    Queue& queue = *queues[queueIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool TaskScheduler::stealFront(size_t queueIndex, Task& task) {
+    // Start with the neighbour so that thieves spread out over the victims
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& victim = *queues[(queueIndex + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+TaskGraph::TaskId TaskGraph::add(
+        const std::string& name,
+        std::function<void()> fn,
+        const std::vector<TaskId>& dependencies
+) {
+    TaskId id = nodes.size();
+    nodes.emplace_back();
+    nodes.back().name = name;
+    nodes.back().fn = std::move(fn);
+    nodes.back().dependencyCount = (int) dependencies.size();
+
+    for (TaskId dependency : dependencies) {
+        nodes[dependency].dependents.push_back(id);
+    }
+
+    return id;
+}
+
+void TaskGraph::run(TaskScheduler& scheduler) {
+    if (nodes.empty()) {
+        return;
+    }
+
+    remaining = nodes.size();
+    for (auto& node : nodes) {
+        node.pendingDependencies = node.dependencyCount;
+    }
+
+    for (TaskId id = 0; id < nodes.size(); id++) {
+        if (nodes[id].dependencyCount == 0) {
+            schedule(scheduler, id);
+        }
+    }
+
+    scheduler.runUntil([this] { return remaining == 0; });
+}
+
+void TaskGraph::schedule(TaskScheduler& scheduler, TaskId id) {
+    scheduler.submit([this, &scheduler, id] {
+        Node& node = nodes[id];
+        node.fn();
+
+        for (TaskId dependent : node.dependents) {
+            if (--nodes[dependent].pendingDependencies == 0) {
+                schedule(scheduler, dependent);
+            }
+        }
+        remaining--;
+    });
+}
@@ -0,0 +1,92 @@
+#ifndef CS5625_TASKSCHEDULER_H
+#define CS5625_TASKSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A small work-stealing thread pool. Every worker owns a deque: it pushes and
+// pops its own tasks at the back and steals from the front of other workers'
+// deques when it runs dry. Threads that are not workers (e.g. the GL thread)
+// submit into a shared injector queue and help run tasks while they wait.
+class TaskScheduler {
+public:
+    using Task = std::function<void()>;
+
+    // threadCount = 0 picks one worker per hardware thread, minus the calling
+    // thread.
+    explicit TaskScheduler(unsigned int threadCount = 0);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    void submit(Task task);
+
+    // Run queued tasks on the calling thread until done() returns true.
+    void runUntil(const std::function<bool()>& done);
+
+    // Split [0, count) into chunks of at most grain elements, call
+    // fn(begin, end) for each chunk in parallel and wait for all of them.
+    // May be called from inside a task.
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+    size_t threadCount() const { return threads.size(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // queues[0] is the injector, queues[i + 1] belongs to threads[i]
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> queuedTasks;
+    std::atomic<bool> stopping;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    void workerLoop(size_t queueIndex);
+    bool tryRunOne(size_t queueIndex);
+    bool popBack(size_t queueIndex, Task& task);
+    bool stealFront(size_t queueIndex, Task& task);
+};
+
+// A dependency graph of tasks that is built once and run every frame. A task
+// becomes ready when all tasks it depends on have finished.
+class TaskGraph {
+public:
+    using TaskId = size_t;
+
+    TaskId add(const std::string& name, std::function<void()> fn, const std::vector<TaskId>& dependencies = {});
+
+    // Run every task once, respecting dependencies, and return when all of
+    // them have finished. The calling thread helps run tasks.
+    void run(TaskScheduler& scheduler);
+
+private:
+    struct Node {
+        std::string name;
+        std::function<void()> fn;
+        std::vector<TaskId> dependents;
+        int dependencyCount = 0;
+        std::atomic<int> pendingDependencies{0};
+    };
+
+    // std::deque so that nodes (which hold atomics) never move
+    std::deque<Node> nodes;
+    std::atomic<size_t> remaining{0};
+
+    void schedule(TaskScheduler& scheduler, TaskId id);
+};
+
+
+#endif //CS5625_TASKSCHEDULER_H
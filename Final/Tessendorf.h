@@ -48,7 +48,7 @@ namespace tessendorf {
                 data((T *) malloc(sizeof(T) * size_x * size_y)) {
         }
 
-        T get(size_t x, size_t y) {
+        T get(size_t x, size_t y) const {
             return data[x * size_y + y];
         }
 
@@ -56,13 +56,13 @@ namespace tessendorf {
             data[x * size_y + y] = v;
         }
 
-        void copyFrom(array2d<T> other) {
+        void copyFrom(const array2d<T>& other) {
             assert(other.size_x == size_x);
             assert(other.size_y == size_y);
             memcpy(data.get(), other.data.get(), sizeof(T) * size_x * size_y);
         }
 
-        float min() {
+        float min() const {
             float min = data[0];
             for (int i = 0; i < size_x; i++) {
                 for (int j = 0; j < size_y; j++) {
@@ -72,7 +72,7 @@ namespace tessendorf {
             return min;
         }
 
-        float max() {
+        float max() const {
             float max = data[0];
             for (int i = 0; i < size_x; i++) {
                 for (int j = 0; j < size_y; j++) {
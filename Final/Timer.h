@@ -1,58 +1,71 @@
 #ifndef CS5625_TIMER_H
 #define CS5625_TIMER_H
 
+#include <mutex>
+
+// Thread safe: the GL thread controls playback while the simulation thread
+// reads the time.
 class Timer {
 public:
     Timer() : _lastTime(0), _playing(true), _rate(1), _lastRealtime(0) {
-        time();
+        advance();
     }
 
     double time() {
-        double t = (_playing ? 1 : 0) * _rate * timedelta() + _lastTime;
-        _lastTime = t;
-        return t;
+        std::lock_guard<std::mutex> lock(_mutex);
+        return advance();
     }
 
     void pause() {
-        time();
-        _playing = false;
+        setPlaying(false);
     }
 
     void play() {
-        time();
-        _playing = true;
+        setPlaying(true);
     }
 
     bool playing() const {
+        std::lock_guard<std::mutex> lock(_mutex);
         return _playing;
     }
 
     void setPlaying(bool playing) {
-        time();
+        std::lock_guard<std::mutex> lock(_mutex);
+        advance();
         _playing = playing;
     }
 
     double rate() const {
+        std::lock_guard<std::mutex> lock(_mutex);
         return _rate;
     }
 
     void setRate(double rate) {
-        time();
+        std::lock_guard<std::mutex> lock(_mutex);
+        advance();
         _rate = rate;
     }
 
     void offset(double timedelta) {
-        time();
+        std::lock_guard<std::mutex> lock(_mutex);
+        advance();
         _lastTime += timedelta;
     }
 
 private:
+    mutable std::mutex _mutex;
     double _lastTime;
     bool _playing;
     double _rate;
 
     double _lastRealtime;
 
+    double advance() {
+        double t = (_playing ? 1 : 0) * _rate * timedelta() + _lastTime;
+        _lastTime = t;
+        return t;
+    }
+
     double timedelta() {
         double now = realtime();
         double td = now - _lastRealtime;
@@ -0,0 +1,54 @@
+#ifndef CS5625_TRIPLEBUFFER_H
+#define CS5625_TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer single-consumer triple buffer. The writer fills
+// writeBuffer() and publishes it; the reader picks up the most recently
+// published buffer with update(). Neither side ever waits for the other, and
+// slots are reused so buffers keep their allocations.
+template<class T>
+class TripleBuffer {
+    static const uint8_t INDEX_MASK = 0x3;
+    static const uint8_t FRESH = 0x4;
+
+    T slots[3];
+
+    uint8_t back = 0;  // owned by the writer
+    uint8_t front = 1; // owned by the reader
+    std::atomic<uint8_t> middle{2};
+
+public:
+    TripleBuffer() = default;
+
+    template<class Init>
+    explicit TripleBuffer(const Init& init) : slots{T(init), T(init), T(init)} {
+    }
+
+    T& writeBuffer() {
+        return slots[back];
+    }
+
+    void publish() {
+        uint8_t previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & INDEX_MASK;
+    }
+
+    // Returns true if a newer buffer was published since the last call.
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        uint8_t previous = middle.exchange(front, std::memory_order_acq_rel);
+        front = previous & INDEX_MASK;
+        return true;
+    }
+
+    const T& readBuffer() const {
+        return slots[front];
+    }
+};
+
+
+#endif //CS5625_TRIPLEBUFFER_H
@@ -0,0 +1,81 @@
+#ifndef CS5625_UNIFORMBLOCKS_H
+#define CS5625_UNIFORMBLOCKS_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <GLWrap/UniformBuffer.hpp>
+
+// Binding points of the uniform blocks shared by the shaders; every program
+// is told these in PLApp::setUpPrograms.
+enum UniformBinding {
+    UniformBinding_Frame = 0,
+    UniformBinding_Light = 1,
+    UniformBinding_Object = 2
+};
+
+// C++ mirrors of the std140 blocks declared in the shaders. They hold only
+// vec4s and mat4s, whose std140 layout is the same as glm's, so the structs
+// can be copied into the buffers as they are.
+
+// "Frame": a camera, plus the sky. Record 0 is the main camera. The shadow
+// passes draw from the lights' LightBlocks instead (see shadow_layers.vs).
+struct FrameBlock {
+    glm::mat4 mV;
+    glm::mat4 mP;
+    glm::mat4 mV_inv;
+    glm::mat4 mP_inv;
+    glm::vec4 wCamPos;
+    glm::vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    glm::vec4 sunAngles; // thetaSun, phiSun
+};
+
+// "Light": one point light, as seen from the main camera
+struct LightBlock {
+    glm::mat4 mV_light;
+    glm::mat4 mP_light;
+    glm::vec4 wLightPos;
+    glm::vec4 vLightPos;
+    glm::vec4 lightPower;
+    glm::vec4 shadowRect; // atlas tile as (offset, scale), 0 if unshadowed
+};
+
+// "Object": one draw's model matrix and the matching normal matrix
+struct ObjectBlock {
+    glm::mat4 mM;
+    glm::mat4 mN; // transpose(inverse(mM))
+};
+
+// An array of one kind of block, rewritten once per frame, whose records are
+// bound one at a time. Records are padded to the UBO offset alignment so that
+// switching records is a single glBindBufferRange.
+template<class Block>
+class UniformBlockArray {
+public:
+    explicit UniformBlockArray(GLuint binding) : binding(binding) {}
+
+    // Fill this in, then upload
+    std::vector<Block> records;
+
+    void upload() {
+        size_t alignment = GLWrap::UniformBuffer::offsetAlignment();
+        stride = (sizeof(Block) + alignment - 1) / alignment * alignment;
+        staging.resize(stride * records.size());
+        for (size_t i = 0; i < records.size(); i++) {
+            *reinterpret_cast<Block*>(&staging[i * stride]) = records[i];
+        }
+        buffer.upload(staging.data(), staging.size());
+    }
+
+    void bind(size_t index) const {
+        buffer.bindRange(binding, index * stride, sizeof(Block));
+    }
+
+private:
+    GLuint binding;
+    GLWrap::UniformBuffer buffer;
+    size_t stride = sizeof(Block);
+    std::vector<char> staging;
+};
+
+
+#endif //CS5625_UNIFORMBLOCKS_H
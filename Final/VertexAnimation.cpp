@@ -0,0 +1,66 @@
+#include "VertexAnimation.h"
+
+namespace {
+
+    std::shared_ptr<GLWrap::Texture2D> makeTexture(const std::vector<glm::vec4>& texels, int width, int height) {
+        auto texture = std::make_shared<GLWrap::Texture2D>(glm::ivec2(width, height), GL_RGBA32F, GL_RGBA);
+        texture->bind();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, texels.data());
+
+        // Texels are sampled at their centers along a row, so linear
+        // filtering only ever blends between frames
+        texture->setParameters(GL_CLAMP_TO_EDGE, GL_REPEAT, GL_LINEAR, GL_LINEAR);
+        return texture;
+    }
+
+}
+
+VertexAnimationData bakeVertexAnimation(
+        const Mesh& mesh,
+        int frameCount,
+        const std::function<void(double, std::vector<glm::mat4>&)>& pose
+) {
+    VertexAnimationData data;
+    data.vertexCount = (int) mesh.vertices.size();
+    data.frameCount = frameCount;
+    data.positions.resize(data.vertexCount * frameCount);
+    data.normals.resize(data.vertexCount * frameCount);
+
+    std::vector<glm::mat4> palette(mesh.bones.size());
+    for (int frame = 0; frame < frameCount; frame++) {
+        pose((double) frame / frameCount, palette);
+
+        for (int v = 0; v < data.vertexCount; v++) {
+            // Same blend as the skinning in deferred.vs
+            glm::mat4 skin(0);
+            for (int i = 0; i < 4; i++) {
+                if (mesh.boneIndices[v][i] != -1) {
+                    skin += mesh.boneWeights[v][i] * palette[mesh.boneIndices[v][i]];
+                }
+            }
+
+            glm::vec3 normal = glm::transpose(glm::inverse(glm::mat3(skin))) * mesh.normals[v];
+            data.positions[frame * data.vertexCount + v] = skin * glm::vec4(mesh.vertices[v], 1);
+            data.normals[frame * data.vertexCount + v] = glm::vec4(glm::normalize(normal), 0);
+        }
+    }
+
+    return data;
+}
+
+VertexAnimationTexture::VertexAnimationTexture(const VertexAnimationData& data) :
+    positions(makeTexture(data.positions, data.vertexCount, data.frameCount)),
+    normals(makeTexture(data.normals, data.vertexCount, data.frameCount)) {
+}
+
+void VertexAnimationTexture::bindTextureAndUniforms(
+        const std::string& name,
+        const std::shared_ptr<GLWrap::Program>& program,
+        int positionUnit,
+        int normalUnit
+) const {
+    positions->bindToTextureUnit(positionUnit);
+    normals->bindToTextureUnit(normalUnit);
+    program->uniform(name + "Positions", positionUnit);
+    program->uniform(name + "Normals", normalUnit);
+}
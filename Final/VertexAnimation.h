@@ -0,0 +1,50 @@
+#ifndef CS5625_VERTEXANIMATION_H
+#define CS5625_VERTEXANIMATION_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Scene.h"
+#include "GLWrap/Texture2D.hpp"
+#include "GLWrap/Program.hpp"
+
+// A looping skinned clip baked into per-vertex positions and normals, one row
+// of vertexCount texels per frame. Produced without touching GL.
+struct VertexAnimationData {
+    int vertexCount = 0;
+    int frameCount = 0;
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec4> normals;
+};
+
+// Skin mesh at frameCount evenly spaced points of one loop of the clip.
+// pose(fraction, palette) fills the skinning matrices, one per bone of the
+// mesh, for that fraction of the clip.
+VertexAnimationData bakeVertexAnimation(
+        const Mesh& mesh,
+        int frameCount,
+        const std::function<void(double, std::vector<glm::mat4>&)>& pose
+);
+
+// The GL side of VertexAnimationData: two RGBA32F textures that repeat (and
+// filter linearly) along the frame axis, so a vertex shader can play the clip
+// back at any time with one fetch per attribute.
+class VertexAnimationTexture {
+    std::shared_ptr<GLWrap::Texture2D> positions;
+    std::shared_ptr<GLWrap::Texture2D> normals;
+
+public:
+    // Must be called on the GL thread.
+    explicit VertexAnimationTexture(const VertexAnimationData& data);
+    void bindTextureAndUniforms(
+            const std::string& name,
+            const std::shared_ptr<GLWrap::Program>& program,
+            int positionUnit,
+            int normalUnit
+    ) const;
+};
+
+
+#endif //CS5625_VERTEXANIMATION_H
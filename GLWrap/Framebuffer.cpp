@@ -59,7 +59,8 @@ Framebuffer::Framebuffer(const glm::ivec2& size,
 
 
 void Framebuffer::bind(int mipmapLevel) const {
-  glBindFramebuffer(GL_FRAMEBUFFER, mFramebufferId);
+  StateCache::get().bindFramebuffer(mFramebufferId);
+  if (mAttachedLevel == mipmapLevel) return;
   for (int colorAttachment = 0; colorAttachment < mColor.size(); colorAttachment++) {
     const Texture2D& tex = mColor[colorAttachment];
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + colorAttachment,
@@ -68,17 +69,11 @@ void Framebuffer::bind(int mipmapLevel) const {
   if (mDepth) {
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mDepth->id(), mipmapLevel);
   }
+  mAttachedLevel = mipmapLevel;
 }
 
 void Framebuffer::unbind() const {
-  for (int colorAttachment = 0; colorAttachment < mColor.size(); colorAttachment++) {
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + colorAttachment,
-                           GL_TEXTURE_2D, 0, 0);
-  }
-  if (mDepth) {
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
-  }
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  StateCache::get().bindFramebuffer(0);
 }
 
 bool Framebuffer::complete() const {
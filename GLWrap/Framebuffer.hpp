@@ -76,13 +76,15 @@ public:
   /// Delete this framebuffer and its associated textures.
   ~Framebuffer() noexcept;
 
-  /// Bind the framebuffer object and attach all relevent textures.
+  /// Bind the framebuffer object, attaching all relevent textures at the given level if they are
+  /// not attached at that level already.
   /// This must be called before modifying or drawing to the framebuffer.
   /// @arg mipmapLevel The level of the mipmap of the attachments to bind.
   ///   Note that any value besides 0 assumes that mipmap space has been allocated.
   void bind(int mipmapLevel = 0) const;
 
-  /// Unbind the framebuffer object and unbind all relevent textures.
+  /// Bind the default framebuffer. The textures stay attached, so binding this framebuffer again
+  /// at the same level is cheap.
   void unbind() const;
 
   /// Returns true if the FBO is complete.
@@ -112,6 +114,8 @@ protected:
   std::vector<Texture2D> mColor;
   /// The depth texture (if any) associated with this FBO.
   std::unique_ptr<Texture2D> mDepth;
+  /// The mipmap level the textures are attached at, or -1 if they are not attached.
+  mutable int mAttachedLevel = -1;
 };
 
 
@@ -121,21 +125,28 @@ inline
 Framebuffer::Framebuffer(Framebuffer&& other)
 : mFramebufferId(other.mFramebufferId),
   mColor(std::move(other.mColor)),
-  mDepth(std::move(other.mDepth)) {
+  mDepth(std::move(other.mDepth)),
+  mAttachedLevel(other.mAttachedLevel) {
     other.mFramebufferId = 0;
+    other.mAttachedLevel = -1;
   }
 
 inline
 Framebuffer& Framebuffer::operator=(Framebuffer&& other) {
+  StateCache::get().forgetFramebuffer(mFramebufferId);
   glDeleteFramebuffers(1, &mFramebufferId);
   mFramebufferId = other.mFramebufferId;
   mColor = std::move(other.mColor);
   mDepth = std::move(other.mDepth);
+  mAttachedLevel = other.mAttachedLevel;
+  other.mFramebufferId = 0;
+  other.mAttachedLevel = -1;
   return *this;
 }
 
 inline
 Framebuffer::~Framebuffer() noexcept {
+  StateCache::get().forgetFramebuffer(mFramebufferId);
   glDeleteFramebuffers(1, &mFramebufferId);
 }
 
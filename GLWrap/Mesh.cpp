@@ -1,6 +1,10 @@
 // Mesh.cpp
 
 #include "Mesh.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include "StateCache.hpp"
 #include "Util.hpp"
 
 using namespace GLWrap;
@@ -14,7 +18,10 @@ Mesh::Mesh() {
 
 Mesh::~Mesh() {
     // Delete the VAO and any buffers owned by this mesh
-    if (vao) glDeleteVertexArrays(1, &vao);
+    if (vao) {
+        StateCache::get().forgetVertexArray(vao);
+        glDeleteVertexArrays(1, &vao);
+    }
     if (indexBuffer) glDeleteBuffers(1, &indexBuffer);
     glDeleteBuffers(vertexBuffers.size(), vertexBuffers.data());
 }
@@ -23,7 +30,9 @@ Mesh::~Mesh() {
 
 // Move-constructing a mesh leaves the source mesh empty
 Mesh::Mesh(Mesh &&other) noexcept :
-    vertexBuffers(std::move(other.vertexBuffers)) {
+    vertexBuffers(std::move(other.vertexBuffers)),
+    instanceAttributes(std::move(other.instanceAttributes)),
+    instanceDivisor(other.instanceDivisor) {
     vao = other.vao;
     other.vao = 0;
     indexBuffer = other.indexBuffer;
@@ -39,7 +48,10 @@ Mesh::Mesh(Mesh &&other) noexcept :
 Mesh &Mesh::operator=(Mesh &&other) {
     if (&other == this) return *this;
 
-    if (vao) glDeleteVertexArrays(1, &vao);
+    if (vao) {
+        StateCache::get().forgetVertexArray(vao);
+        glDeleteVertexArrays(1, &vao);
+    }
     if (indexBuffer) glDeleteBuffers(1, &indexBuffer);
     glDeleteBuffers(vertexBuffers.size(), vertexBuffers.data());
 
@@ -51,6 +63,8 @@ Mesh &Mesh::operator=(Mesh &&other) {
     other.indexMode = 0;
     indexLength = other.indexLength;
     other.indexLength = 0;
+    instanceAttributes = std::move(other.instanceAttributes);
+    instanceDivisor = other.instanceDivisor;
 
     vertexBuffers = std::move(other.vertexBuffers);
 
@@ -74,10 +88,9 @@ void Mesh::_setAttribute(int index, const std::vector<T>& data) {
     glBufferData(GL_ARRAY_BUFFER, sizeof(T) * data.size(), data.data(), GL_STATIC_DRAW);
 
     // Attach the buffer to our VAO at the desired index and enable it
-    glBindVertexArray(vao);
+    StateCache::get().bindVertexArray(vao);
     glVertexAttribPointer(index, sizeof(T) / 4, std::is_same<T, glm::ivec4>::value ? GL_INT : GL_FLOAT, GL_TRUE, 0, 0);
     glEnableVertexAttribArray(index);
-    glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     checkGLError("Mesh::_setAttribute end");
@@ -104,6 +117,67 @@ void Mesh::setAttribute(int index, const std::vector<glm::ivec4>& data) {
 }
 
 
+template <class T>
+void Mesh::_uploadInstanceBuffer(int index, const std::vector<T>& data) {
+
+    if (index < 0)
+        throw std::invalid_argument("Mesh::setInstanceAttribute: negative attribute index");
+    if (vertexBuffers.size() <= (size_t) index)
+        vertexBuffers.resize((size_t) index + 1);
+    GLuint &buf = vertexBuffers[index];
+    if (!buf)
+        glGenBuffers(1, &buf);
+
+    // Orphan the old storage so the driver does not stall on draws still reading it
+    glBindBuffer(GL_ARRAY_BUFFER, buf);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(T) * data.size(), data.data(), GL_STREAM_DRAW);
+}
+
+void Mesh::setInstanceAttribute(int index, const std::vector<float>& data) {
+    _uploadInstanceBuffer(index, data);
+
+    StateCache::get().bindVertexArray(vao);
+    glVertexAttribPointer(index, 1, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribDivisor(index, instanceDivisor);
+    glEnableVertexAttribArray(index);
+    if (std::find(instanceAttributes.begin(), instanceAttributes.end(), index) == instanceAttributes.end())
+        instanceAttributes.push_back(index);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    checkGLError("Mesh::setInstanceAttribute end");
+}
+
+void Mesh::setInstanceAttribute(int index, const std::vector<glm::mat4>& data) {
+    _uploadInstanceBuffer(index, data);
+
+    // One vec4 attribute per column
+    StateCache::get().bindVertexArray(vao);
+    for (int column = 0; column < 4; column++) {
+        glVertexAttribPointer(index + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (const void *) (sizeof(glm::vec4) * column));
+        glVertexAttribDivisor(index + column, instanceDivisor);
+        glEnableVertexAttribArray(index + column);
+        if (std::find(instanceAttributes.begin(), instanceAttributes.end(), index + column) == instanceAttributes.end())
+            instanceAttributes.push_back(index + column);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    checkGLError("Mesh::setInstanceAttribute end");
+}
+
+void Mesh::setInstanceDivisor(GLuint divisor) {
+    if (divisor == instanceDivisor)
+        return;
+    instanceDivisor = divisor;
+
+    StateCache::get().bindVertexArray(vao);
+    for (int index : instanceAttributes)
+        glVertexAttribDivisor(index, divisor);
+
+    checkGLError("Mesh::setInstanceDivisor end");
+}
+
+
 void Mesh::setIndices(const std::vector<uint32_t>& data, GLenum mode) {
 
     if (indexBuffer)
@@ -111,10 +185,9 @@ void Mesh::setIndices(const std::vector<uint32_t>& data, GLenum mode) {
 
     // Create an index buffer, attach it to the VAO, and copy the data into it
     glGenBuffers(1, &indexBuffer);
-    glBindVertexArray(vao);
+    StateCache::get().bindVertexArray(vao);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.size() * sizeof(uint32_t), data.data(), GL_STATIC_DRAW);
-    glBindVertexArray(0);
 
     // Remember the info that will be needed to draw this
     indexMode = mode;
@@ -126,21 +199,29 @@ void Mesh::setIndices(const std::vector<uint32_t>& data, GLenum mode) {
 
 void Mesh::drawElements() const {
 
-    // Bind the VAO and draw
-    glBindVertexArray(vao);
+    // Bind the VAO and draw, leaving it bound for the next draw of this mesh
+    StateCache::get().bindVertexArray(vao);
     glDrawElements(indexMode, indexLength, GL_UNSIGNED_INT, nullptr);
-    glBindVertexArray(0);
 
     checkGLError("Mesh::drawElements end");
 }
 
 
+void Mesh::drawElementsInstanced(int instanceCount) const {
+
+    // Bind the VAO and draw, leaving it bound for the next draw of this mesh
+    StateCache::get().bindVertexArray(vao);
+    glDrawElementsInstanced(indexMode, indexLength, GL_UNSIGNED_INT, nullptr, instanceCount);
+
+    checkGLError("Mesh::drawElementsInstanced end");
+}
+
+
 void Mesh::drawArrays(GLenum mode, int first, int count) const {
 
-    // Bind the VAO and draw
-    glBindVertexArray(vao);
+    // Bind the VAO and draw, leaving it bound for the next draw of this mesh
+    StateCache::get().bindVertexArray(vao);
     glDrawArrays(mode, first, count);
-    glBindVertexArray(0);
 
     checkGLError("Mesh::drawArrays end");
 }
@@ -24,7 +24,7 @@ namespace GLWrap {
  * The setup is deliberately limited in some ways:
  *  * 32-bit floats and 32-bit ints are the only supported datatypes
  *  * only scalar and vec[234] attribute types are supported
- *  * indexed meshes are always drawn in full
+ *  * indexed meshes are always drawn in full (possibly instanced)
  *  * each attribute comes contiguously from a separate buffer
  *  * buffers are owned by meshes and will not be shared between them
  *
@@ -65,6 +65,20 @@ public:
     void setAttribute(int index, const std::vector<glm::vec4>& data);
     void setAttribute(int index, const std::vector<glm::ivec4>& data);
 
+    // Provide values for a per-instance attribute at a particular index.
+    // These work like setAttribute, except that the attribute advances once
+    // per instance rather than once per vertex. A mat4 attribute occupies
+    // four consecutive indices, one per column. Instance data is expected to
+    // change every frame, so the buffer at this index is reused (and its
+    // storage orphaned) rather than recreated.
+    void setInstanceAttribute(int index, const std::vector<float>& data);
+    void setInstanceAttribute(int index, const std::vector<glm::mat4>& data);
+
+    // Advance the per-instance attributes once every divisor instances
+    // instead of every instance, e.g. to draw each instance into several
+    // shadow maps in one call.  Also applies to attributes set later.
+    void setInstanceDivisor(GLuint divisor);
+
     // Provide indices that define primitives, 
     // and the drawing mode (GL_TRIANGLES, etc.) that will be used by drawElements.
     void setIndices(const std::vector<uint32_t>& data, GLenum mode);
@@ -72,6 +86,10 @@ public:
     // Draw the entire mesh using glDrawElements (using index buffer)
     void drawElements() const;
 
+    // Draw the entire mesh instanceCount times with a single
+    // glDrawElementsInstanced call
+    void drawElementsInstanced(int instanceCount) const;
+
     // Draw the mesh using glDrawArrays (using just the attribute buffers)
     void drawArrays(GLuint mode, int first, int count) const;
 
@@ -81,6 +99,10 @@ private:
     template<class T>
     void _setAttribute(int index, const std::vector<T>& data);
 
+    // Create the buffer at index if needed and upload data to it
+    template<class T>
+    void _uploadInstanceBuffer(int index, const std::vector<T>& data);
+
     // OpenGL identifiers for the owned resources
     GLuint vao;
     GLuint indexBuffer;
@@ -89,6 +111,10 @@ private:
     // Mode and length of index buffer
     GLenum indexMode;
     GLuint indexLength;
+
+    // Attribute indices that advance per instance (one per mat4 column)
+    std::vector<int> instanceAttributes;
+    GLuint instanceDivisor = 1;
 };
 
 } // namespace
@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <iostream>
 
 #include <glm/gtc/type_ptr.hpp>
 
 #include "Program.hpp"
 #include "Shader.hpp"
+#include "StateCache.hpp"
 
 using namespace GLWrap;
 
@@ -30,23 +32,29 @@ Program::Program(std::string name, std::vector<std::pair<GLenum, std::string>> s
 }
 
 Program::~Program() {
+    StateCache::get().forgetProgram(program);
     glDeleteProgram(program);
 }
 
 // Move-constructing a Program leaves the other Program empty
 Program::Program(Program &&other) {
 
+    name = std::move(other.name);
     program = other.program;
     other.program = 0;
+    ownedShaders = std::move(other.ownedShaders);
+    uniforms = std::move(other.uniforms);
 }
 
 // Move-assigning a Program deletes any owned program and shaders
 // and leaves the other Program empty
 Program &Program::operator =(Program &&other) {
+    StateCache::get().forgetProgram(program);
     glDeleteProgram(program);
     program = other.program;
     other.program = 0;
     ownedShaders = std::move(other.ownedShaders);
+    uniforms = std::move(other.uniforms);
     return *this;
 }
 
@@ -69,95 +77,235 @@ void Program::link() {
         std::cerr << infoLog << std::endl;
         std::exit(1);
     }    
+
+    reflectUniforms();
+}
+
+void Program::reflectUniforms() {
+    uniforms.clear();
+
+    int count = 0;
+    int maxNameLength = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    std::vector<char> nameBuffer(std::max(maxNameLength, 1));
+
+    for (int i = 0; i < count; i++) {
+        int length = 0;
+        int size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program, (GLuint) i, (GLsizei) nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+        std::string uniformName(nameBuffer.data(), length);
+
+        // Uniforms in blocks have no location
+        int location = glGetUniformLocation(program, uniformName.c_str());
+        if (location == -1) {
+            continue;
+        }
+
+        // Arrays are reported as "name[0]"; their elements need not have
+        // consecutive locations, so look each one up now
+        const std::string arraySuffix = "[0]";
+        if (uniformName.size() > arraySuffix.size()
+                && uniformName.compare(uniformName.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0) {
+            std::string baseName = uniformName.substr(0, uniformName.size() - arraySuffix.size());
+            uniforms[baseName] = {location, size, type};
+            for (int j = 0; j < size; j++) {
+                std::string elementName = baseName + "[" + std::to_string(j) + "]";
+                int elementLocation = j == 0 ? location : glGetUniformLocation(program, elementName.c_str());
+                uniforms[elementName] = {elementLocation, size - j, type};
+            }
+        } else {
+            uniforms[uniformName] = {location, size, type};
+        }
+    }
+}
+
+const Program::ActiveUniform *Program::findUniform(const std::string &varName) const {
+    auto it = uniforms.find(varName);
+    return it == uniforms.end() ? nullptr : &it->second;
+}
+
+void Program::checkUniformType(const std::string &varName, GLenum actual, GLenum expected) const {
+    bool floatType = actual == GL_FLOAT || actual == GL_FLOAT_VEC2 || actual == GL_FLOAT_VEC3
+            || actual == GL_FLOAT_VEC4 || actual == GL_FLOAT_MAT2 || actual == GL_FLOAT_MAT3
+            || actual == GL_FLOAT_MAT4;
+    bool matches = expected == GL_INT ? !floatType : actual == expected;
+    if (!matches) {
+        std::cerr << "Warning: uniform '" << varName
+            << "' in program '" << name
+            << "' is set with a value of the wrong type." << std::endl;
+    }
 }
 
-static int getUniformLocationWithWarning(GLuint program, const std::string &progName, const std::string &varName) {
-    int loc = glGetUniformLocation(program, varName.c_str());
-    if (loc == -1) {
+int Program::getUniformLocationWithWarning(const std::string &varName) const {
+    const ActiveUniform *u = findUniform(varName);
+    if (!u) {
         std::cerr << "Warning: '" << varName 
-            << "' is not an active uniform in program '" << progName 
+            << "' is not an active uniform in program '" << name 
             << "'." << std::endl;
+        return -1;
     }
-    return loc;
+    return u->location;
 }
 
 void Program::uniform(const std::string &varName, int i) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniform1i(loc, i);
     }
 }
 
 void Program::uniform(const std::string &varName, float f) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniform1f(loc, f);
     }
 }
 
 void Program::uniform(const std::string &varName, const glm::vec2& v) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniform2fv(loc, 1, glm::value_ptr(v));
     }
 }
 
 void Program::uniform(const std::string &varName, const glm::vec3& v) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniform3fv(loc, 1, glm::value_ptr(v));
     }
 }
 
 void Program::uniform(const std::string &varName, const glm::vec4& v) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniform4fv(loc, 1, glm::value_ptr(v));
     }
 }
 
 void Program::uniform(const std::string &varName, const glm::mat2& m) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniformMatrix2fv(loc, 1, false, glm::value_ptr(m));
     }
 }
 
 void Program::uniform(const std::string &varName, const glm::mat3& m) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniformMatrix3fv(loc, 1, false, glm::value_ptr(m));
     }
 }
 
 void Program::uniform(const std::string &varName, const glm::mat4& m) {
-    int loc = getUniformLocationWithWarning(program, name, varName);
+    int loc = getUniformLocationWithWarning(varName);
     if (loc != -1) {
-        glUseProgram(program);
+        StateCache::get().useProgram(program);
         glUniformMatrix4fv(loc, 1, false, glm::value_ptr(m));
     }
 }
 
+void Program::uniform(UniformHandle<int> h, int i) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniform1i(h.location, i);
+    }
+}
+
+void Program::uniform(UniformHandle<float> h, float f) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniform1f(h.location, f);
+    }
+}
+
+void Program::uniform(UniformHandle<glm::vec2> h, const glm::vec2& v) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniform2fv(h.location, 1, glm::value_ptr(v));
+    }
+}
+
+void Program::uniform(UniformHandle<glm::vec3> h, const glm::vec3& v) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniform3fv(h.location, 1, glm::value_ptr(v));
+    }
+}
+
+void Program::uniform(UniformHandle<glm::vec4> h, const glm::vec4& v) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniform4fv(h.location, 1, glm::value_ptr(v));
+    }
+}
+
+void Program::uniform(UniformHandle<glm::mat2> h, const glm::mat2& m) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniformMatrix2fv(h.location, 1, false, glm::value_ptr(m));
+    }
+}
+
+void Program::uniform(UniformHandle<glm::mat3> h, const glm::mat3& m) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniformMatrix3fv(h.location, 1, false, glm::value_ptr(m));
+    }
+}
+
+void Program::uniform(UniformHandle<glm::mat4> h, const glm::mat4& m) {
+    if (h.valid()) {
+        StateCache::get().useProgram(program);
+        glUniformMatrix4fv(h.location, 1, false, glm::value_ptr(m));
+    }
+}
+
+void Program::uniform(UniformHandle<glm::vec4> h, const glm::vec4* v, int count) {
+    count = std::min(count, h.size);
+    if (h.valid() && count > 0) {
+        StateCache::get().useProgram(program);
+        glUniform4fv(h.location, count, glm::value_ptr(v[0]));
+    }
+}
+
+void Program::uniform(UniformHandle<glm::mat4> h, const glm::mat4* m, int count) {
+    count = std::min(count, h.size);
+    if (h.valid() && count > 0) {
+        StateCache::get().useProgram(program);
+        glUniformMatrix4fv(h.location, count, false, glm::value_ptr(m[0]));
+    }
+}
+
+void Program::bindUniformBlock(const std::string &blockName, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(program, blockName.c_str());
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, index, binding);
+    }
+}
+
 int Program::getAttribLocation(const std::string& name) {
     return glGetAttribLocation(program, name.c_str());
 }
 
 int Program::getUniformLocation(const std::string& name) {
-    return glGetUniformLocation(program, name.c_str());
+    const ActiveUniform *u = findUniform(name);
+    return u ? u->location : -1;
 }
 
 
 void Program::use() {
-    glUseProgram(program);
+    StateCache::get().useProgram(program);
 }
 
 void Program::unuse() {
-    glUseProgram(0);
+    StateCache::get().useProgram(0);
 }
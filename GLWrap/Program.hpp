@@ -2,6 +2,10 @@
 
 #pragma once
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <glm/glm.hpp>
 
 #include <nanogui/opengl.h>
@@ -12,6 +16,21 @@ namespace GLWrap {
 
 class Shader;
 
+/*
+ * A uniform location resolved once, ahead of time, by Program::uniformHandle.
+ * Setting a value through a handle does no name lookup.  A default-constructed
+ * handle, or one for a uniform the program does not have, is invalid, and
+ * setting it does nothing.
+ */
+template<class T>
+struct UniformHandle {
+    int location = -1;
+    // Number of elements for arrays, 1 otherwise
+    int size = 0;
+
+    bool valid() const { return location != -1; }
+};
+
 /*
  * A class to represent an OpenGL shader program.
  *
@@ -65,6 +84,44 @@ public:
     void uniform(const std::string &varName, const glm::mat3& v);  // GLSL type mat3
     void uniform(const std::string &varName, const glm::mat4& v);  // GLSL type mat4
 
+    // Set a uniform through a handle from uniformHandle.  Does nothing if the
+    // handle is invalid.
+    void uniform(UniformHandle<int> h, int i);
+    void uniform(UniformHandle<float> h, float f);
+    void uniform(UniformHandle<glm::vec2> h, const glm::vec2& v);
+    void uniform(UniformHandle<glm::vec3> h, const glm::vec3& v);
+    void uniform(UniformHandle<glm::vec4> h, const glm::vec4& v);
+    void uniform(UniformHandle<glm::mat2> h, const glm::mat2& m);
+    void uniform(UniformHandle<glm::mat3> h, const glm::mat3& m);
+    void uniform(UniformHandle<glm::mat4> h, const glm::mat4& m);
+
+    // Set the first count elements of an array uniform in one call; count is
+    // clamped to the size of the array.
+    void uniform(UniformHandle<glm::vec4> h, const glm::vec4* v, int count);
+    void uniform(UniformHandle<glm::mat4> h, const glm::mat4* m, int count);
+
+    // Resolve a uniform for setting later.  For arrays, name the array
+    // ("bones" or "bones[0]") to get a handle to its first element.  Returns
+    // an invalid handle, without a warning, if there is no active uniform
+    // with that name, since a handle is often resolved for every program a
+    // pass might use; warns if the uniform is not of type T.
+    template<class T>
+    UniformHandle<T> uniformHandle(const std::string &varName) const {
+        UniformHandle<T> h;
+        const ActiveUniform *u = findUniform(varName);
+        if (u) {
+            checkUniformType(varName, u->type, glslTypeOf((T *) nullptr));
+            h.location = u->location;
+            h.size = u->size;
+        }
+        return h;
+    }
+
+    // Read the named uniform block from the given binding point (see
+    // UniformBuffer::bindRange).  Does nothing if the program does not use
+    // the block.
+    void bindUniformBlock(const std::string &blockName, GLuint binding);
+
     // Find the location in the linked program of a uniform by name
     // -1 means there is no active uniform with that name
     int getUniformLocation(const std::string &name);
@@ -87,9 +144,35 @@ public:
 
 private:
 
+    struct ActiveUniform {
+        int location;
+        int size;
+        GLenum type;
+    };
+
     std::string name;
     GLuint program;
     std::vector<Shader> ownedShaders;
+
+    // Every active uniform, filled in by link().  Arrays are listed under
+    // their bare name and under the name of each element.
+    std::unordered_map<std::string, ActiveUniform> uniforms;
+
+    void reflectUniforms();
+    const ActiveUniform *findUniform(const std::string &varName) const;
+    int getUniformLocationWithWarning(const std::string &varName) const;
+    void checkUniformType(const std::string &varName, GLenum actual, GLenum expected) const;
+
+    // The GLSL type each C++ type stands for; GL_INT also covers bools and
+    // samplers
+    static GLenum glslTypeOf(int *) { return GL_INT; }
+    static GLenum glslTypeOf(float *) { return GL_FLOAT; }
+    static GLenum glslTypeOf(glm::vec2 *) { return GL_FLOAT_VEC2; }
+    static GLenum glslTypeOf(glm::vec3 *) { return GL_FLOAT_VEC3; }
+    static GLenum glslTypeOf(glm::vec4 *) { return GL_FLOAT_VEC4; }
+    static GLenum glslTypeOf(glm::mat2 *) { return GL_FLOAT_MAT2; }
+    static GLenum glslTypeOf(glm::mat3 *) { return GL_FLOAT_MAT3; }
+    static GLenum glslTypeOf(glm::mat4 *) { return GL_FLOAT_MAT4; }
 };
 
 } // namespace
\ No newline at end of file
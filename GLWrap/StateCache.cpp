@@ -0,0 +1,173 @@
+// StateCache.cpp
+
+#include "StateCache.hpp"
+
+using namespace GLWrap;
+
+
+namespace {
+
+    // Never a valid object name, enum or viewport coordinate, so the first
+    // call after invalidate() always differs from the cached value
+    const GLuint unknown = ~0u;
+
+    int targetIndex(GLenum target) {
+        switch (target) {
+            case GL_TEXTURE_2D: return 0;
+            case GL_TEXTURE_2D_ARRAY: return 1;
+            default: return -1;
+        }
+    }
+
+}
+
+StateCache &StateCache::get() {
+    static StateCache cache;
+    return cache;
+}
+
+bool StateCache::issue(bool needed) {
+#ifndef NDEBUG
+    if (needed) count.issued++; else count.skipped++;
+#endif
+    return needed;
+}
+
+void StateCache::useProgram(GLuint p) {
+    if (issue(program != p)) {
+        glUseProgram(p);
+        program = p;
+    }
+}
+
+void StateCache::bindFramebuffer(GLuint f) {
+    if (issue(drawFramebuffer != f || readFramebuffer != f)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, f);
+        drawFramebuffer = f;
+        readFramebuffer = f;
+    }
+}
+
+void StateCache::bindDrawFramebuffer(GLuint f) {
+    if (issue(drawFramebuffer != f)) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, f);
+        drawFramebuffer = f;
+    }
+}
+
+void StateCache::bindReadFramebuffer(GLuint f) {
+    if (issue(readFramebuffer != f)) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, f);
+        readFramebuffer = f;
+    }
+}
+
+void StateCache::bindVertexArray(GLuint v) {
+    if (issue(vao != v)) {
+        glBindVertexArray(v);
+        vao = v;
+    }
+}
+
+void StateCache::setActiveUnit(int unit) {
+    if (issue(activeUnit != unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+    }
+}
+
+void StateCache::bindTexture(int unit, GLenum target, GLuint texture) {
+    setActiveUnit(unit);
+    bindTexture(target, texture);
+}
+
+void StateCache::bindTexture(GLenum target, GLuint texture) {
+    int t = targetIndex(target);
+    if (t < 0 || activeUnit < 0 || activeUnit >= trackedUnits) {
+        issue(true);
+        glBindTexture(target, texture);
+        return;
+    }
+    GLuint &bound = textures[activeUnit][t];
+    if (issue(bound != texture)) {
+        glBindTexture(target, texture);
+        bound = texture;
+    }
+}
+
+void StateCache::setEnabled(GLenum capability, bool enabled) {
+    int *state = capability == GL_BLEND ? &blend : capability == GL_DEPTH_TEST ? &depthTest : nullptr;
+    if (!state || issue(*state != int(enabled))) {
+        if (enabled) glEnable(capability); else glDisable(capability);
+        if (state) *state = enabled;
+    }
+}
+
+void StateCache::blendEquationSeparate(GLenum modeRGB, GLenum modeAlpha) {
+    if (issue(blendModes[0] != modeRGB || blendModes[1] != modeAlpha)) {
+        glBlendEquationSeparate(modeRGB, modeAlpha);
+        blendModes[0] = modeRGB;
+        blendModes[1] = modeAlpha;
+    }
+}
+
+void StateCache::blendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) {
+    if (issue(blendFactors[0] != srcRGB || blendFactors[1] != dstRGB ||
+              blendFactors[2] != srcAlpha || blendFactors[3] != dstAlpha)) {
+        glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+        blendFactors[0] = srcRGB;
+        blendFactors[1] = dstRGB;
+        blendFactors[2] = srcAlpha;
+        blendFactors[3] = dstAlpha;
+    }
+}
+
+void StateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    if (issue(viewportRect[0] != x || viewportRect[1] != y ||
+              viewportRect[2] != width || viewportRect[3] != height)) {
+        glViewport(x, y, width, height);
+        viewportRect[0] = x;
+        viewportRect[1] = y;
+        viewportRect[2] = width;
+        viewportRect[3] = height;
+    }
+}
+
+void StateCache::forgetProgram(GLuint p) {
+    if (program == p) program = unknown;
+}
+
+void StateCache::forgetFramebuffer(GLuint f) {
+    if (drawFramebuffer == f) drawFramebuffer = unknown;
+    if (readFramebuffer == f) readFramebuffer = unknown;
+}
+
+void StateCache::forgetVertexArray(GLuint v) {
+    if (vao == v) vao = unknown;
+}
+
+void StateCache::forgetTexture(GLuint texture) {
+    for (auto &unit : textures) {
+        for (GLuint &bound : unit) {
+            if (bound == texture) bound = unknown;
+        }
+    }
+}
+
+void StateCache::invalidate() {
+    program = unknown;
+    drawFramebuffer = unknown;
+    readFramebuffer = unknown;
+    vao = unknown;
+    activeUnit = -1;
+    for (auto &unit : textures) {
+        for (GLuint &bound : unit) {
+            bound = unknown;
+        }
+    }
+    blend = -1;
+    depthTest = -1;
+    for (GLenum &mode : blendModes) mode = unknown;
+    for (GLenum &factor : blendFactors) factor = unknown;
+    for (GLint &v : viewportRect) v = -1;
+}
@@ -0,0 +1,110 @@
+// StateCache.hpp
+
+#pragma once
+
+#include <cstddef>
+
+#include <nanogui/opengl.h>
+
+#include "Util.hpp"
+
+namespace GLWrap {
+
+/*
+ * A shadow copy of the OpenGL state that the renderer changes most often:
+ * the current program, draw and read framebuffers, vertex array, texture bindings,
+ * blending, depth test and viewport.  Every GLWrap class sets this state
+ * through the cache, which only calls into OpenGL when the value actually
+ * changes, so passes can state what they need without worrying about
+ * redundant binds.
+ *
+ * Code that changes this state behind the cache's back (e.g. nanogui drawing
+ * the GUI) must be followed by invalidate().  Debug builds count the calls
+ * that were issued and skipped.
+ */
+class GLWRAP_EXPORT StateCache {
+public:
+
+    // Number of texture units whose bindings are tracked; bindings to
+    // higher units always go through to OpenGL
+    static const int trackedUnits = 32;
+
+    struct Counters {
+        size_t issued = 0;
+        size_t skipped = 0;
+    };
+
+    // The cache for the current OpenGL context.  GLWrap assumes a single
+    // context, used from a single thread.
+    static StateCache &get();
+
+    void useProgram(GLuint program);
+    // Binds GL_FRAMEBUFFER, i.e. both the draw and the read framebuffer
+    void bindFramebuffer(GLuint framebuffer);
+    void bindDrawFramebuffer(GLuint framebuffer);
+    void bindReadFramebuffer(GLuint framebuffer);
+    void bindVertexArray(GLuint vao);
+
+    // Bind a texture to the given unit, making that unit active
+    void bindTexture(int unit, GLenum target, GLuint texture);
+
+    // Bind a texture to the active unit, e.g. to upload to it
+    void bindTexture(GLenum target, GLuint texture);
+
+    // Only GL_BLEND and GL_DEPTH_TEST are tracked; other capabilities
+    // always go through to OpenGL
+    void setEnabled(GLenum capability, bool enabled);
+
+    void blendEquation(GLenum mode) { blendEquationSeparate(mode, mode); }
+    void blendEquationSeparate(GLenum modeRGB, GLenum modeAlpha);
+    void blendFunc(GLenum src, GLenum dst) { blendFuncSeparate(src, dst, src, dst); }
+    void blendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    // OpenGL implicitly unbinds objects when they are deleted, and their
+    // names may be reused, so owners call these before deleting them
+    void forgetProgram(GLuint program);
+    void forgetFramebuffer(GLuint framebuffer);
+    void forgetVertexArray(GLuint vao);
+    void forgetTexture(GLuint texture);
+
+    // Forget all tracked state, so that the next call of every kind is issued
+    void invalidate();
+
+    // Calls issued and skipped since the last resetCounters().  Always zero
+    // when NDEBUG is defined.
+    const Counters &counters() const { return count; }
+    void resetCounters() { count = Counters(); }
+
+private:
+
+    StateCache() { invalidate(); }
+
+    // GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY bindings are tracked; other
+    // targets always go through
+    static const int trackedTargets = 2;
+
+    GLuint program;
+    GLuint drawFramebuffer;
+    GLuint readFramebuffer;
+    GLuint vao;
+    int activeUnit;
+    GLuint textures[trackedUnits][trackedTargets];
+
+    // 0 or 1 when known, -1 after invalidate()
+    int blend;
+    int depthTest;
+    GLenum blendModes[2];
+    GLenum blendFactors[4];
+    GLint viewportRect[4];
+
+    Counters count;
+
+    void setActiveUnit(int unit);
+
+    // Record whether a call is needed, counting it either way
+    bool issue(bool needed);
+};
+
+} // namespace
@@ -25,7 +25,7 @@ Texture2D::Texture2D(const std::string& fileName, bool srgb, bool flipVertically
   if (!textureData)
     throw std::invalid_argument("Could not load texture data from file " + fileName);
   glGenTextures(1, &mTextureId);
-  glBindTexture(GL_TEXTURE_2D, mTextureId);
+  bind();
   GLint internalFormat;
   GLint format;
   switch (n) {
@@ -45,7 +45,7 @@ Texture2D::Texture2D(const std::string& fileName, bool srgb, bool flipVertically
 
 Texture2D::Texture2D(const glm::ivec2& size, GLint internalFormat, GLint format) {
   glGenTextures(1, &mTextureId);
-  glBindTexture(GL_TEXTURE_2D, mTextureId);
+  bind();
   glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0, format, GL_UNSIGNED_BYTE, nullptr);
   setParameters();
 }
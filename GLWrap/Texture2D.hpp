@@ -10,6 +10,7 @@
 
 #include <glm/glm.hpp>
 
+#include "StateCache.hpp"
 #include "Util.hpp"
 
 #include <memory>
@@ -55,6 +56,7 @@ public:
   /// Moves tracked GPU resources into this instance. The other instance is left in an invalid state
   /// but may be safely destroyed.
   Texture2D& operator=(Texture2D&& other) {
+    StateCache::get().forgetTexture(mTextureId);
     glDeleteTextures(1, &mTextureId);
     other.mTextureId = mTextureId;
     mTextureId = 0;
@@ -63,6 +65,7 @@ public:
 
   /// Deletes this texture.
   ~Texture2D() noexcept {
+    StateCache::get().forgetTexture(mTextureId);
     glDeleteTextures(1, &mTextureId);
   }
 
@@ -76,7 +79,7 @@ public:
                      GLint textureMagFilter = GL_NEAREST,
                      GLint textureMinFilter = GL_LINEAR) const {
     if (mTextureId == 0) return;
-    glBindTexture(GL_TEXTURE_2D, mTextureId);
+    bind();
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, textureWrapS);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, textureWrapT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, textureMagFilter);
@@ -85,13 +88,13 @@ public:
 
   void parameter(GLenum pname, GLint value) const {
     if (mTextureId == 0) return;
-    glBindTexture(GL_TEXTURE_2D, mTextureId);
+    bind();
     glTexParameteri(GL_TEXTURE_2D, pname, value);
   }
 
   void parameter(GLenum pname, GLfloat value) const {
     if (mTextureId == 0) return;
-    glBindTexture(GL_TEXTURE_2D, mTextureId);
+    bind();
     glTexParameterf(GL_TEXTURE_2D, pname, value);
   }
 
@@ -99,13 +102,17 @@ public:
   /// @warning The specified texture unit must be in the range [0, GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS).
   /// @arg textureUnit The index of the texture unit. For instance, `0` would bind to `GL_TEXTURE0`.
   void bindToTextureUnit(int textureUnit) const {
-    glActiveTexture(GL_TEXTURE0 + textureUnit);
-    glBindTexture(GL_TEXTURE_2D, id());
+    StateCache::get().bindTexture(textureUnit, GL_TEXTURE_2D, id());
+  }
+
+  /// Binds this texture to the active texture unit, e.g. to upload image data with glTexImage2D.
+  void bind() const {
+    StateCache::get().bindTexture(GL_TEXTURE_2D, id());
   }
 
   /// Creates a mipmap for the texture.
   void generateMipmap() const {
-    glBindTexture(GL_TEXTURE_2D, id());
+    bind();
     glGenerateMipmap(GL_TEXTURE_2D);
   }
 
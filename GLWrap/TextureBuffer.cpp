@@ -0,0 +1,64 @@
+// TextureBuffer.cpp
+
+#include "TextureBuffer.hpp"
+#include "StateCache.hpp"
+
+using namespace GLWrap;
+
+
+TextureBuffer::TextureBuffer(GLenum internalFormat) {
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &texture);
+
+    // A texture over an empty buffer is valid, but give it one texel anyway
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    StateCache::get().bindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, buffer);
+
+    checkGLError("TextureBuffer::TextureBuffer end");
+}
+
+TextureBuffer::~TextureBuffer() {
+    StateCache::get().forgetTexture(texture);
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &buffer);
+}
+
+// Move-constructing a buffer leaves the source buffer empty
+TextureBuffer::TextureBuffer(TextureBuffer &&other) noexcept :
+    buffer(other.buffer),
+    texture(other.texture) {
+    other.buffer = 0;
+    other.texture = 0;
+}
+
+// Move-assigning a buffer deletes any owned buffer and leaves the source buffer empty
+TextureBuffer &TextureBuffer::operator=(TextureBuffer &&other) {
+    StateCache::get().forgetTexture(texture);
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &buffer);
+    buffer = other.buffer;
+    texture = other.texture;
+    other.buffer = 0;
+    other.texture = 0;
+    return *this;
+}
+
+void TextureBuffer::upload(const void *data, size_t size) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (size == 0) {
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    } else {
+        glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    checkGLError("TextureBuffer::upload end");
+}
+
+void TextureBuffer::bindToTextureUnit(int textureUnit) const {
+    StateCache::get().bindTexture(textureUnit, GL_TEXTURE_BUFFER, texture);
+}
@@ -0,0 +1,55 @@
+// TextureBuffer.hpp
+
+#pragma once
+
+#include <cstddef>
+
+#include <nanogui/opengl.h>
+
+#include "Util.hpp"
+
+namespace GLWrap {
+
+/*
+ * A class to represent an OpenGL buffer texture: a buffer that shaders read
+ * with texelFetch through a samplerBuffer (or isamplerBuffer/usamplerBuffer
+ * for integer formats).  Used for per-frame arrays that are too large for a
+ * uniform block, and rewritten with upload every frame.
+ */
+class GLWRAP_EXPORT TextureBuffer {
+public:
+
+    // Create an empty buffer whose texels have the given internal format,
+    // e.g. GL_RGBA32F or GL_R32UI
+    explicit TextureBuffer(GLenum internalFormat);
+
+    // Deletes the OpenGL buffer and texture
+    ~TextureBuffer();
+
+    // Copying is not allowed because a TextureBuffer owns GPU resources
+    TextureBuffer(const TextureBuffer &) = delete;
+    TextureBuffer &operator=(const TextureBuffer &) = delete;
+
+    // Moving is allowed, and transfers ownership of the GPU resources
+    TextureBuffer(TextureBuffer &&other) noexcept;
+    TextureBuffer &operator=(TextureBuffer &&other);
+
+    // Replace the contents with size bytes from data, orphaning the old
+    // storage so draws still reading it do not stall the upload
+    void upload(const void *data, size_t size);
+
+    // Bind the buffer texture to the given texture unit
+    void bindToTextureUnit(int textureUnit) const;
+
+    // The OpenGL buffer and texture ids are available for making calls
+    // that are not supported by this class.
+    GLuint bufferId() const { return buffer; }
+    GLuint textureId() const { return texture; }
+
+private:
+
+    GLuint buffer;
+    GLuint texture;
+};
+
+} // namespace
@@ -0,0 +1,124 @@
+// UniformBuffer.cpp
+
+#include <cstring>
+#include <utility>
+
+#include "UniformBuffer.hpp"
+
+using namespace GLWrap;
+
+
+UniformBuffer::UniformBuffer(int segmentCount) :
+    segmentCount(segmentCount),
+    segment(0),
+    segmentSize(0),
+    fences(segmentCount, nullptr) {
+    glGenBuffers(1, &buffer);
+}
+
+UniformBuffer::~UniformBuffer() {
+    deleteFences();
+    glDeleteBuffers(1, &buffer);
+}
+
+// Move-constructing a buffer leaves the source buffer empty
+UniformBuffer::UniformBuffer(UniformBuffer &&other) noexcept :
+    buffer(other.buffer),
+    segmentCount(other.segmentCount),
+    segment(other.segment),
+    segmentSize(other.segmentSize),
+    fences(std::move(other.fences)) {
+    other.buffer = 0;
+    other.segmentSize = 0;
+    other.fences.assign(other.segmentCount, nullptr);
+}
+
+// Move-assigning a buffer deletes any owned buffer and leaves the source buffer empty
+UniformBuffer &UniformBuffer::operator=(UniformBuffer &&other) {
+    deleteFences();
+    glDeleteBuffers(1, &buffer);
+    buffer = other.buffer;
+    other.buffer = 0;
+    segmentCount = other.segmentCount;
+    segment = other.segment;
+    segmentSize = other.segmentSize;
+    other.segmentSize = 0;
+    fences = std::move(other.fences);
+    other.fences.assign(other.segmentCount, nullptr);
+    return *this;
+}
+
+void UniformBuffer::deleteFences() {
+    for (GLsync &fence : fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+}
+
+void UniformBuffer::waitForSegment(int index) {
+    GLsync &fence = fences[index];
+    if (!fence) {
+        return;
+    }
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (status == GL_TIMEOUT_EXPIRED) {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+size_t UniformBuffer::offsetAlignment() {
+    static size_t alignment = 0;
+    if (alignment == 0) {
+        GLint value = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &value);
+        alignment = value > 0 ? (size_t) value : 256;
+    }
+    return alignment;
+}
+
+void UniformBuffer::upload(const void *data, size_t size) {
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+
+    if (size > segmentSize) {
+        // Grow by half again, so that a slowly growing scene does not
+        // reallocate every frame. The old storage is orphaned, so draws
+        // still reading it need no fences.
+        size_t alignment = offsetAlignment();
+        segmentSize = (size + size / 2 + alignment - 1) / alignment * alignment;
+        glBufferData(GL_UNIFORM_BUFFER, segmentSize * segmentCount, nullptr, GL_DYNAMIC_DRAW);
+        deleteFences();
+        segment = 0;
+    } else {
+        // Every draw that reads the current segment has been issued by now
+        if (fences[segment]) {
+            glDeleteSync(fences[segment]);
+        }
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % segmentCount;
+        waitForSegment(segment);
+    }
+
+    if (size > 0) {
+        // The GPU is done with the segment (see the fence above), so the
+        // write need not be synchronized by the driver
+        void *dst = glMapBufferRange(
+                GL_UNIFORM_BUFFER, segment * segmentSize, size,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+        );
+        if (dst) {
+            std::memcpy(dst, data, size);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    checkGLError("UniformBuffer::upload end");
+}
+
+void UniformBuffer::bindRange(GLuint binding, size_t offset, size_t size) const {
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, segment * segmentSize + offset, size);
+}
@@ -0,0 +1,72 @@
+// UniformBuffer.hpp
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <nanogui/opengl.h>
+
+#include "Util.hpp"
+
+namespace GLWrap {
+
+/*
+ * A class to represent an OpenGL uniform buffer that is rewritten every frame.
+ *
+ * The buffer is split into a few equal segments used in turn, as a ring:
+ * each upload goes to the segment after the previous one.  When the ring
+ * moves past a segment, every draw that reads it has been issued, so a fence
+ * is placed there; an upload that comes back around to the segment waits on
+ * that fence, which normally signaled long ago, instead of stalling on the
+ * whole buffer.  Ranges of the current segment are bound to uniform block
+ * binding points with bindRange.
+ */
+class GLWRAP_EXPORT UniformBuffer {
+public:
+
+    // Create an empty buffer with the given number of segments
+    explicit UniformBuffer(int segmentCount = 3);
+
+    // Deletes the OpenGL buffer
+    ~UniformBuffer();
+
+    // Copying is not allowed because a UniformBuffer owns GPU resources
+    UniformBuffer(const UniformBuffer &) = delete;
+    UniformBuffer &operator=(const UniformBuffer &) = delete;
+
+    // Moving is allowed, and transfers ownership of the GPU resources
+    UniformBuffer(UniformBuffer &&other) noexcept;
+    UniformBuffer &operator=(UniformBuffer &&other);
+
+    // Write size bytes to the start of the next segment, making it current.
+    // If the segments are too small, all of them are reallocated (orphaning
+    // the old storage) with room to spare.
+    void upload(const void *data, size_t size);
+
+    // Bind size bytes at offset into the current segment to a uniform block
+    // binding point.  offset must be a multiple of offsetAlignment().
+    void bindRange(GLuint binding, size_t offset, size_t size) const;
+
+    // The implementation's GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    static size_t offsetAlignment();
+
+    // The OpenGL buffer id is available for making calls
+    // that are not supported by this class.
+    GLuint id() const { return buffer; }
+
+private:
+
+    GLuint buffer;
+    int segmentCount;
+    int segment;
+    size_t segmentSize;
+
+    // Per segment, signaled once the GPU is done with it (or null)
+    std::vector<GLsync> fences;
+
+    void waitForSegment(int index);
+    void deleteFences();
+};
+
+} // namespace
@@ -49,7 +49,7 @@ static float __z(float theta, float T, const glm::mat4x3& M) {
     return glm::dot(vT * M, vth);
 }
 
-void Sky::setUniforms(GLWrap::Program &prog) {
+Sky::Coefficients Sky::coefficients() const {
 
     // Compute the parameters A, ..., E to the Perez model.  There is
     // a separate set of parameters for each of the three color 
@@ -64,12 +64,26 @@ void Sky::setUniforms(GLWrap::Program &prog) {
     float xz = __z(theta_sun, turbidity, Mx);
     float yz = __z(theta_sun, turbidity, My);
 
+    Coefficients c;
+    c.A = glm::vec3(pY.x, px.x, py.x);
+    c.B = glm::vec3(pY.y, px.y, py.y);
+    c.C = glm::vec3(pY.z, px.z, py.z);
+    c.D = glm::vec3(pY.w, px.w, py.w);
+    c.E = glm::vec3(pY.v, px.v, py.v);
+    c.zenith = glm::vec3(Yz, xz, yz);
+    c.thetaSun = theta_sun;
+    return c;
+}
+
+void Sky::setUniforms(GLWrap::Program &prog) {
+    Coefficients c = coefficients();
+
     // Pass these results to the fragment shader
-    prog.uniform("A", glm::vec3(pY.x, px.x, py.x));
-    prog.uniform("B", glm::vec3(pY.y, px.y, py.y));
-    prog.uniform("C", glm::vec3(pY.z, px.z, py.z));
-    prog.uniform("D", glm::vec3(pY.w, px.w, py.w));
-    prog.uniform("E", glm::vec3(pY.v, px.v, py.v));
-    prog.uniform("zenith", glm::vec3(Yz, xz, yz));
-    prog.uniform("thetaSun", theta_sun);
-}
\ No newline at end of file
+    prog.uniform("A", c.A);
+    prog.uniform("B", c.B);
+    prog.uniform("C", c.C);
+    prog.uniform("D", c.D);
+    prog.uniform("E", c.E);
+    prog.uniform("zenith", c.zenith);
+    prog.uniform("thetaSun", c.thetaSun);
+}
@@ -43,6 +43,16 @@ namespace RTUtil {
             this->turbidity = turbidity;
         }
 
+        // The parameters of the sky model that sunsky.fs needs.
+        struct Coefficients {
+            glm::vec3 A, B, C, D, E, zenith;
+            float thetaSun;
+        };
+
+        // Computes the values setUniforms sets, for passing them
+        // some other way (e.g. in a uniform buffer).
+        Coefficients coefficients() const;
+
         // Sets the uniforms that are required for 
         // the sunskyRadiance shader function to operate.
         void setUniforms(GLWrap::Program &);
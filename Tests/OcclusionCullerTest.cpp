@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "OcclusionCuller.h"
+
+// Rasterizes a few occluders seen by a fixed camera and checks the depth
+// buffer, its hierarchy and visible() against values worked out by hand.
+// Needs no window or GL context; returns nonzero if any check fails.
+
+namespace {
+
+    const glm::ivec2 SIZE(256, 128);
+    const float EPSILON = 1e-5f;
+
+    int failures = 0;
+
+    void check(bool ok, const char* what) {
+        if (!ok) {
+            std::printf("FAILED: %s\n", what);
+            failures++;
+        }
+    }
+
+    // Camera at the origin looking down -z, as OcclusionCuller sees it
+    glm::mat4 viewProjection() {
+        return glm::perspective(1.0f, float(SIZE.x) / float(SIZE.y), 0.1f, 100.0f);
+    }
+
+    glm::vec3 toWindow(const glm::vec3& point) {
+        glm::vec4 clip = viewProjection() * glm::vec4(point, 1);
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3((glm::vec2(ndc) * 0.5f + 0.5f) * glm::vec2(SIZE), ndc.z * 0.5f + 0.5f);
+    }
+
+    float depthAt(const OcclusionCuller& culler, int level, int x, int y) {
+        return culler.depth(level)[y * culler.levelSize(level).x + x];
+    }
+
+    // A quad facing the camera at distance -z, as two triangles
+    void wall(float x0, float y0, float x1, float y1, float z,
+              std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices) {
+        auto base = (uint32_t) vertices.size();
+        vertices.insert(vertices.end(), {{x0, y0, z}, {x1, y0, z}, {x1, y1, z}, {x0, y1, z}});
+        indices.insert(indices.end(), {base, base + 1, base + 2, base, base + 2, base + 3});
+    }
+
+    // The far wall covers the middle of the screen at one depth
+    void testDepth(const OcclusionCuller& culler, float wallZ) {
+        check(culler.size() == SIZE, "size is a whole number of tiles");
+        check(culler.stats().occluders == 2, "occluder count");
+        check(culler.stats().triangles == 4, "triangle count");
+
+        glm::vec3 lo = toWindow(glm::vec3(-2, -1, wallZ));
+        glm::vec3 hi = toWindow(glm::vec3(2, 1, wallZ));
+        bool inside = true, outside = true;
+        for (int y = 0; y < SIZE.y; y++) {
+            for (int x = 0; x < SIZE.x; x++) {
+                float px = x + 0.5f, py = y + 0.5f;
+                float depth = depthAt(culler, 0, x, y);
+                bool inWall = px > lo.x + 1 && px < hi.x - 1 && py > lo.y + 1 && py < hi.y - 1;
+                bool offWall = px < lo.x - 1 || px > hi.x + 1 || py < lo.y - 1 || py > hi.y + 1;
+                // The near wall is in the upper right quarter of the far one
+                bool inNear = px > (lo.x + hi.x) / 2 && py > (lo.y + hi.y) / 2;
+                if (inWall && !inNear) {
+                    inside = inside && std::abs(depth - lo.z) < EPSILON;
+                }
+                if (offWall) {
+                    outside = outside && depth == 1.0f;
+                }
+            }
+        }
+        check(inside, "depth of the far wall");
+        check(outside, "depth around the far wall");
+    }
+
+    // The near wall is closer, so it wins where the two overlap
+    void testNearest(const OcclusionCuller& culler, float nearZ) {
+        glm::vec3 center = toWindow(glm::vec3(0.8f, 0.4f, nearZ));
+        check(std::abs(depthAt(culler, 0, (int) center.x, (int) center.y) - center.z) < EPSILON,
+              "depth of the nearer of two occluders");
+    }
+
+    // Every texel is the farthest of the 2x2 below it, and the last level is
+    // a single texel holding the farthest depth of all
+    void testLevels(const OcclusionCuller& culler) {
+        bool farthest = true;
+        for (int level = 1; level < culler.levelCount(); level++) {
+            glm::ivec2 size = culler.levelSize(level);
+            glm::ivec2 below = culler.levelSize(level - 1);
+            check(size == glm::max((below + 1) / 2, glm::ivec2(1)), "level size halves");
+            for (int y = 0; y < size.y; y++) {
+                for (int x = 0; x < size.x; x++) {
+                    int x0 = std::min(2 * x, below.x - 1), x1 = std::min(2 * x + 1, below.x - 1);
+                    int y0 = std::min(2 * y, below.y - 1), y1 = std::min(2 * y + 1, below.y - 1);
+                    float expected = std::max(
+                            std::max(depthAt(culler, level - 1, x0, y0), depthAt(culler, level - 1, x1, y0)),
+                            std::max(depthAt(culler, level - 1, x0, y1), depthAt(culler, level - 1, x1, y1)));
+                    farthest = farthest && depthAt(culler, level, x, y) == expected;
+                }
+            }
+        }
+        check(farthest, "levels hold the farthest depth below them");
+        int top = culler.levelCount() - 1;
+        check(culler.levelSize(top) == glm::ivec2(1), "last level is one texel");
+        check(depthAt(culler, top, 0, 0) == 1.0f, "last level sees past the walls");
+    }
+
+    void testVisible(const OcclusionCuller& culler) {
+        check(!culler.visible(Bounds()), "empty box is hidden");
+        check(!culler.visible(Bounds({-0.5f, -0.3f, -9}, {0.5f, 0.3f, -8})), "box behind the far wall is hidden");
+        check(!culler.visible(Bounds({0.6f, 0.35f, -4.5f}, {1.0f, 0.5f, -4.2f})),
+              "box between the walls, behind the near one, is hidden");
+        check(culler.visible(Bounds({-0.5f, -0.5f, -4.5f}, {-0.2f, -0.2f, -4.2f})),
+              "box between the walls, in front of the far one, is visible");
+        check(culler.visible(Bounds({-0.3f, -0.3f, -2.5f}, {0.3f, 0.3f, -2})), "box in front of the walls is visible");
+        check(culler.visible(Bounds({-4, -0.3f, -9}, {-3, 0.3f, -8})), "box beside the walls is visible");
+        check(culler.visible(Bounds({-12, -1, -30}, {12, 1, -20})), "box sticking out from behind the far wall is visible");
+        check(culler.visible(Bounds({-1, -1, -9}, {1, 1, 1})), "box reaching behind the eye is visible");
+        check(!culler.visible(Bounds({50, -1, -9}, {51, 1, -8})), "box outside the view is hidden");
+    }
+
+}
+
+int main() {
+    TaskScheduler scheduler(2);
+    OcclusionCuller culler(glm::ivec2(250, 125));
+
+    const float farZ = -5, nearZ = -4;
+    std::vector<glm::vec3> farVertices, nearVertices;
+    std::vector<uint32_t> farIndices, nearIndices;
+    wall(-2, -1, 2, 1, farZ, farVertices, farIndices);
+    // Given in object space, moved into the upper right of the far wall
+    wall(-0.4f, -0.25f, 0.4f, 0.25f, 0, nearVertices, nearIndices);
+    glm::mat4 nearTransform = glm::translate(glm::mat4(1), glm::vec3(0.8f, 0.4f, nearZ));
+
+    // Twice, so that clear() is known to start over
+    for (int pass = 0; pass < 2; pass++) {
+        culler.clear(viewProjection());
+        culler.addOccluder(farVertices, farIndices, glm::mat4(1));
+        culler.addOccluder(nearVertices, nearIndices, nearTransform);
+        culler.rasterize(scheduler);
+    }
+
+    testDepth(culler, farZ);
+    testNearest(culler, nearZ);
+    testLevels(culler);
+    testVisible(culler);
+
+    if (failures == 0) {
+        std::printf("OcclusionCuller: all checks passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -3,9 +3,22 @@
  */
 #version 330
 
-uniform mat4 mM;  // Model matrix
-uniform mat4 mV;  // View matrix
-uniform mat4 mP;  // Projection matrix
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
+
+// Per-draw transforms (ObjectBlock in UniformBlocks.h)
+layout (std140) uniform Object {
+    mat4 mM;  // Model matrix
+    mat4 mN;  // Normal matrix, transpose(inverse(mM))
+};
 
 
 layout (location = 0) in vec3 position;
@@ -16,6 +29,28 @@ uniform mat4 boneTransforms[100];
 layout (location = 2) in ivec4 boneIds;
 layout (location = 3) in vec4 boneWts;
 
+// Instanced drawing: mM is then relative to the instance, and the bone
+// transforms come in phaseCount blocks of boneCount, one per phase offset
+uniform bool useInstancing = false;
+uniform int phaseCount = 1;
+uniform int boneCount = 0;
+layout (location = 5) in float instancePhase;
+layout (location = 6) in mat4 instanceTransform;
+
+// Baked vertex animation: bird-local position and normal of every vertex, one
+// row per frame of the clip. Replaces skinning for instances.
+uniform bool useVertexAnimation = false;
+uniform sampler2D vertexAnimationPositions;
+uniform sampler2D vertexAnimationNormals;
+uniform float vertexAnimationTime; // fraction of the clip
+
+// Layered shadow pass: draw into the shadow atlas instead of the Frame's view
+uniform bool shadowLayered = false;
+out float gl_ClipDistance[4];
+
+// HEADERS: shadow_layers.vs
+vec4 shadowLayerPosition(vec4 wPosition, out vec4 clipDistances);
+
 out vec3 vPosition; // vertex position in eye space
 out vec3 vNormal;   // vertex normal in eye space
 
@@ -23,21 +58,57 @@ void main()
 {
     mat4 modelMatrix = mat4(0);
 
+    int boneBase = 0;
+    if (useInstancing) {
+        boneBase = (int(instancePhase * phaseCount) % phaseCount) * boneCount;
+    }
+
     if (useBones) {
         for (int i = 0; i < 4; i++) {
             if (boneIds[i] != -1) {
-                modelMatrix += boneWts[i] * boneTransforms[boneIds[i]];
+                modelMatrix += boneWts[i] * boneTransforms[boneBase + boneIds[i]];
             }
         }
     } else {
         modelMatrix = mM;
     }
 
-    vec4 position4 = vec4(position, 1);
+    if (useInstancing) {
+        modelMatrix = instanceTransform * modelMatrix;
+    }
+
+    vec3 animatedPosition = position;
+    vec3 animatedNormal = normal;
+    if (useVertexAnimation) {
+        // Rows repeat and filter linearly, so this blends between frames
+        ivec2 size = textureSize(vertexAnimationPositions, 0);
+        vec2 uv = vec2(
+                (gl_VertexID + 0.5) / size.x,
+                fract(vertexAnimationTime + instancePhase) + 0.5 / size.y
+        );
+        animatedPosition = texture(vertexAnimationPositions, uv).xyz;
+        animatedNormal = texture(vertexAnimationNormals, uv).xyz;
+    }
+
+    vec4 position4 = vec4(animatedPosition, 1);
     position4 = mV * modelMatrix * position4;
     position4 /= position4.w;
     vPosition = position4.xyz;
 
-    vNormal = (transpose(inverse(mV * modelMatrix)) * vec4(normal, 0.0)).xyz;
+    // Views are rigid, so only the model matrix needs an inverse transpose,
+    // and for plain draws that is mN
+    mat4 normalMatrix = mN;
+    if (useBones || useInstancing) {
+        normalMatrix = transpose(inverse(modelMatrix));
+    }
+    vNormal = (mV * normalMatrix * vec4(animatedNormal, 0.0)).xyz;
     gl_Position = mP * vec4(vPosition, 1.0);
+
+    if (shadowLayered) {
+        vec4 clipDistances;
+        gl_Position = shadowLayerPosition(modelMatrix * vec4(animatedPosition, 1), clipDistances);
+        for (int i = 0; i < 4; i++) {
+            gl_ClipDistance[i] = clipDistances[i];
+        }
+    }
 }
@@ -11,12 +11,21 @@ struct ShaderInput {
     vec3 normal;
     float eta;
     float alpha;
-    vec3 fragPosNDC;
+    vec3 positionView;
 };
 ShaderInput getShaderInputs(vec2 texCoord);
 
 // Uniforms
-uniform mat4 mP;
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
 uniform vec2 viewportSize;
 uniform sampler2D depthTex;
 uniform int numSamples;
@@ -75,7 +84,7 @@ bool isOccluded(Frame f, vec3 pFrame) {
 
     // Transform q from screen space to eye space
     vec4 qNDC4 = vec4(pNDC4.xy, 2 * qDepthScreen - 1, 1);
-    vec4 qEye4 = inverse(mP) * qNDC4;
+    vec4 qEye4 = mP_inv * qNDC4;
     qEye4 /= qEye4.w;
     vec3 qEye = qEye4.xyz;
     float distCamToQ = length(qEye - vec3(0, 0, 0));
@@ -127,10 +136,7 @@ void main() {
         return;
     }
 
-    vec4 fragPosNDC4 = vec4(inputs.fragPosNDC, 1);
-    vec4 fragPosEye4 = inverse(mP) * fragPosNDC4;
-    fragPosEye4 /= fragPosEye4.w;
-    vec3 fragPosEye = fragPosEye4.xyz;
+    vec3 fragPosEye = inputs.positionView;
 
     Frame f = makeFrame(fragPosEye, inputs.normal);
     vec2 randomSeed = geom_texCoord;
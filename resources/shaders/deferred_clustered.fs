@@ -0,0 +1,88 @@
+/**
+ * Shade the unshadowed point lights in one pass, using the microfacet brdf
+ * in microfacet.fs. Each fragment only visits the lights listed for its
+ * froxel (see LightClusters.h).
+ */
+#version 330
+
+// Uniforms
+uniform bool shadeOcean = false;
+
+uniform samplerBuffer lightData;     // (eye-space position, range), (power, 0)
+uniform usamplerBuffer clusterData;  // (first index, count) per froxel
+uniform usamplerBuffer lightIndices;
+
+uniform int tileSize;
+uniform int clustersX;
+uniform int clustersY;
+uniform int slices;
+uniform float sliceScale;
+uniform float sliceBias;
+
+// Inputs
+in vec2 geom_texCoord;
+
+// Outputs
+out vec4 fragColor;
+
+// HEADERS: microfacet.fs
+const float PI = 3.14159265358979323846264;
+float isotropicMicrofacet(vec3 i, vec3 o, vec3 n, float eta, float alpha);
+
+// HEADERS: deferred_shader_inputs.fs
+struct ShaderInput {
+    bool foreground;
+    bool ocean;
+    vec3 diffuseReflectance;
+    vec3 normal;
+    float eta;
+    float alpha;
+    vec3 positionView;
+};
+ShaderInput getShaderInputs(vec2 texCoord);
+
+void main() {
+    ShaderInput inputs = getShaderInputs(geom_texCoord);
+    if (!inputs.foreground || (!shadeOcean && inputs.ocean)) {
+        fragColor = vec4(0, 0, 0, 0);
+        return;
+    }
+
+    vec3 vPosition = inputs.positionView;
+    vec3 outgoingDirection = normalize(-vPosition);
+
+    ivec2 tile = min(ivec2(gl_FragCoord.xy) / tileSize, ivec2(clustersX, clustersY) - 1);
+    int slice = clamp(int(floor(log(-vPosition.z) * sliceScale + sliceBias)), 0, slices - 1);
+    uvec2 cluster = texelFetch(clusterData, (slice * clustersY + tile.y) * clustersX + tile.x).xy;
+
+    vec3 fragColor3 = vec3(0);
+    for (uint k = 0u; k < cluster.y; k++) {
+        int light = int(texelFetch(lightIndices, int(cluster.x + k)).x);
+        vec4 positionRange = texelFetch(lightData, 2 * light);
+        vec3 power = texelFetch(lightData, 2 * light + 1).xyz;
+
+        vec3 positionToLight = positionRange.xyz - vPosition;
+        float distance2 = dot(positionToLight, positionToLight);
+        vec3 incomingDirection = positionToLight * inversesqrt(distance2);
+
+        // Fade to zero at the light's range instead of cutting off
+        float fade = clamp(1 - distance2 * distance2 / pow(positionRange.w, 4), 0, 1);
+
+        float specular = isotropicMicrofacet(
+            incomingDirection,
+            outgoingDirection,
+            inputs.normal,
+            inputs.eta,
+            inputs.alpha
+        );
+
+        vec3 brdf = inputs.diffuseReflectance / PI + specular * vec3(1, 1, 1);
+
+        fragColor3 += fade * fade *
+            power / (4 * PI)
+            * brdf
+            * max(0.0, dot(inputs.normal, incomingDirection))
+            / distance2;
+    }
+    fragColor = vec4(fragColor3, 1.0);
+}
@@ -1,7 +1,7 @@
 /**
  * Fragment shader for the geometry pass.
  *   - Encodes the diffuse reflectance, eta, alpha, and normal of the geometry.
- *   - deferred_shader_inputs.fs extracts the encoded geometry properties.
+ *   - deferred_shader_inputs.fs defines the encoding and extracts the encoded geometry properties.
  */
 #version 330
 
@@ -17,13 +17,17 @@ in vec3 vNormal;
 
 // Outputs
 layout (location = 0) out vec4 outDiffuseReflectance;
-layout (location = 1) out vec4 outMaterial;
-layout (location = 2) out vec4 outNormal;
+layout (location = 1) out float outMaterial;
+layout (location = 2) out vec2 outNormal;
+
+// HEADERS: deferred_shader_inputs.fs
+vec2 encodeNormal(vec3 n);
+float encodeMaterial(float eta, bool ocean);
 
 void main() {
     vec3 normal = normalize((gl_FrontFacing) ? vNormal : -vNormal);
 
-    outDiffuseReflectance = vec4(diffuseReflectance, 1);
-    outMaterial = vec4(eta / 10, alpha, isOcean ? 1 : 0, 1);
-    outNormal = vec4(normal / 2 + 0.5, 1);
-}
\ No newline at end of file
+    outDiffuseReflectance = vec4(diffuseReflectance, alpha);
+    outMaterial = encodeMaterial(eta, isOcean);
+    outNormal = encodeNormal(normal);
+}
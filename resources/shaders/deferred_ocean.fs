@@ -11,7 +11,7 @@ struct ShaderInput {
     vec3 normal;
     float eta;
     float alpha;
-    vec3 fragPosNDC;
+    vec3 positionView;
 };
 ShaderInput getShaderInputs(vec2 texCoord);
 
@@ -20,8 +20,16 @@ uniform vec3 upwelling;
 uniform float renderDistance = 150;
 const float nSnell = 1.34;
 
-uniform mat4 mP;
-uniform mat4 mV;
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
 
 // Inputs
 in vec2 geom_texCoord;
@@ -39,12 +47,8 @@ void main() {
         return;
     }
 
-    vec4 fragNDC4 = vec4(inputs.fragPosNDC, 1);
-
     // Position of the fragment in eye space
-    vec4 vPosition4 = inverse(mP) * fragNDC4;
-    vPosition4 /= vPosition4.w;
-    vec3 vPosition = vPosition4.xyz;
+    vec3 vPosition = inputs.positionView;
 
     vec3 nN = normalize(inputs.normal);
     vec3 nI = normalize(vPosition);
@@ -68,7 +72,7 @@ void main() {
     reflectivity = min(exp(-length(vPosition) / renderDistance), reflectivity);
 
     vec4 vReflectedDirection = vec4(normalize(-nI - 2 * nN * dot(-nI, nN)), 0);
-    vec3 sky = sunskyRadiance((inverse(mV) * vReflectedDirection).xyz);
+    vec3 sky = sunskyRadiance((mV_inv * vReflectedDirection).xyz);
 
     vec3 fragColor3 = (reflectivity * sky + (1 - reflectivity) * upwelling);
     fragColor = vec4(fragColor3, 1);
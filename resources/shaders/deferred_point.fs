@@ -5,17 +5,31 @@
 
 // Uniforms
 uniform float shadowBias = 1e-3;
-uniform mat4 mV;
-uniform mat4 mP;
-uniform vec2 shadowMapRes;
+uniform vec2 shadowMapRes; // of the whole atlas
 uniform bool pcfEnabled;
+uniform bool evsmEnabled = false; // shadowTex holds EVSM moments instead of depth
 uniform bool shadeOcean = false;
 
-// Light Properties
-uniform vec3 vLightPos; // light position in view space
-uniform vec3 lightPower;
-uniform mat4 mV_light;
-uniform mat4 mP_light;
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
+
+// Per-light parameters (LightBlock in UniformBlocks.h)
+layout (std140) uniform Light {
+    mat4 mV_light;
+    mat4 mP_light;
+    vec4 wLightPos;
+    vec4 vLightPos; // light position in view space
+    vec4 lightPower;
+    vec4 shadowRect; // atlas tile as (offset, scale), 0 if unshadowed
+};
 uniform sampler2D shadowTex;
 
 // Inputs
@@ -36,15 +50,31 @@ struct ShaderInput {
     vec3 normal;
     float eta;
     float alpha;
-    vec3 fragPosNDC;
+    vec3 positionView;
 };
 ShaderInput getShaderInputs(vec2 texCoord);
 
+// HEADERS: evsm.fs
+float evsmDepth(float windowDepth);
+float evsmVisibility(vec4 moments, float depth);
+
+// Takes atlas coordinates, kept half a texel inside the light's tile so that
+// the filter taps never land in a neighbouring tile
 float shadowTest(vec2 shadowTexCoords, float shadowFragDepth) {
+   vec2 halfTexel = 0.5 / shadowMapRes;
+   shadowTexCoords = clamp(shadowTexCoords, shadowRect.xy + halfTexel, shadowRect.xy + shadowRect.zw - halfTexel);
    float shadowDepth = texture(shadowTex, shadowTexCoords).x;
    return shadowDepth + shadowBias < shadowFragDepth ? 0 : 1;
 }
 
+// One bilinear fetch of the prefiltered moments, which may be smaller than
+// the atlas
+float momentShadowTest(vec2 shadowTexCoords, float shadowFragDepth) {
+    vec2 halfTexel = 0.5 / textureSize(shadowTex, 0);
+    shadowTexCoords = clamp(shadowTexCoords, shadowRect.xy + halfTexel, shadowRect.xy + shadowRect.zw - halfTexel);
+    return evsmVisibility(texture(shadowTex, shadowTexCoords), evsmDepth(shadowFragDepth));
+}
+
 float percentCloserFiltering(vec2 shadowTexCoords, float shadowFragDepth) {
     float dx = 1 / (4 * shadowMapRes.x);
     float dy = 1 / (4 * shadowMapRes.y);
@@ -63,33 +93,33 @@ void main() {
         return;
     }
 
-    vec4 fragNDC4 = vec4(inputs.fragPosNDC, 1);
-
     // Position of the fragment in eye space
-    vec4 vPosition4 = inverse(mP) * fragNDC4;
-    vPosition4 /= vPosition4.w;
-    vec3 vPosition = vPosition4.xyz;
+    vec3 vPosition = inputs.positionView;
+    vec4 vPosition4 = vec4(vPosition, 1);
 
     // Position of the fragment in world space
-    vec4 wPosition4 = inverse(mV) * vPosition4;
+    vec4 wPosition4 = mV_inv * vPosition4;
     wPosition4 /= wPosition4.w;
 
     // Position of the fragment in light space
     vec4 lPosition4 = mP_light * mV_light * wPosition4;
     lPosition4 /= lPosition4.w;
 
-    vec2 shadowTexCoords = lPosition4.xy / 2 + 0.5;
+    vec2 shadowTexCoords = shadowRect.xy + (lPosition4.xy / 2 + 0.5) * shadowRect.zw;
     float shadowFragDepth = lPosition4.z / 2 + 0.5;
 
     float shadowFactor;
-    if (pcfEnabled) {
+    if (shadowRect.z == 0) {
+        shadowFactor = 1;
+    } else if (evsmEnabled) {
+        shadowFactor = momentShadowTest(shadowTexCoords, shadowFragDepth);
+    } else if (pcfEnabled) {
         shadowFactor = percentCloserFiltering(shadowTexCoords, shadowFragDepth);
     } else {
-        float shadowDepth = texture(shadowTex, shadowTexCoords).x;
-        shadowFactor = shadowDepth + shadowBias < shadowFragDepth ? 0 : 1;
+        shadowFactor = shadowTest(shadowTexCoords, shadowFragDepth);
     }
 
-    vec3 positionToLight = vLightPos - vPosition;
+    vec3 positionToLight = vLightPos.xyz - vPosition;
     vec3 incomingDirection = normalize(positionToLight);
     vec3 positionToEye = vec3(0, 0, 0) - vPosition;
     vec3 outgoingDirection = normalize(positionToEye);
@@ -105,7 +135,7 @@ void main() {
     vec3 brdf = inputs.diffuseReflectance / PI + specular * vec3(1, 1, 1);
 
     vec3 fragColor3 = shadowFactor *
-        lightPower / (4 * PI)
+        lightPower.xyz / (4 * PI)
         * brdf
         * max(0.0, dot(inputs.normal, incomingDirection))
         / dot(positionToLight, positionToLight);
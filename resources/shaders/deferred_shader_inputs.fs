@@ -1,6 +1,13 @@
 /**
- * Library shader that includes functions to extract material properties from the geometry pass.
- *   - This shader is the complement of deferred_geom.fs
+ * Library shader that defines the G-buffer layout.
+ *   - The geometry pass (deferred_geom.fs, deferred_geom_texture.fs) writes it with the encode functions.
+ *   - Every pass that reads the G-buffer decodes it here, with getShaderInputs or the helpers below.
+ *
+ * Layout:
+ *   0  RGBA8  diffuse reflectance, microfacet alpha
+ *   1  R8     ocean flag (high bit), eta in [1, 3] (low 7 bits)
+ *   2  RG16   eye-space normal, octahedral encoding
+ *   depth     background where it is still 1; eye-space position is reconstructed from it
  */
 #version 330
 
@@ -11,7 +18,18 @@ struct ShaderInput {
     vec3 normal; // Fragment normal in eye-space
     float eta;
     float alpha;
-    vec3 fragPosNDC; // Fragment coordinates in NDC
+    vec3 positionView; // Fragment position in eye-space
+};
+
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
 };
 
 uniform vec2 viewportSize;
@@ -20,35 +38,64 @@ uniform sampler2D diffuseReflectanceTex;
 uniform sampler2D materialTex;
 uniform sampler2D normalsTex;
 
-vec3 getFragPosNDC(vec2 texCoord) {
-    float depthSS = texture(depthTex, texCoord).x;
+const float etaMin = 1;
+const float etaMax = 3;
+
+// Octahedral normal encoding (Cigolle et al., "A Survey of Efficient
+// Representations for Independent Unit Vectors"), remapped to [0, 1]
+vec2 encodeNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0) {
+        e = (1 - abs(n.yx)) * vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+    }
+    return e * 0.5 + 0.5;
+}
+
+vec3 decodeNormal(vec2 e) {
+    e = e * 2 - 1;
+    vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0);
+    n.x += n.x >= 0 ? -t : t;
+    n.y += n.y >= 0 ? -t : t;
+    return normalize(n);
+}
 
-    // [0, viewportSize.x] x [0, viewportSize.y] x [0, 1]
-    vec3 fragPos = vec3(gl_FragCoord.x, gl_FragCoord.y, depthSS);
+float encodeMaterial(float eta, bool ocean) {
+    float etaBits = round(127 * clamp((eta - etaMin) / (etaMax - etaMin), 0, 1));
+    return ((ocean ? 128 : 0) + etaBits) / 255;
+}
 
-    // [0, 1] x [0, 1] x [0, 1]
-    fragPos.x /= viewportSize.x;
-    fragPos.y /= viewportSize.y;
+vec3 getNormal(vec2 texCoord) {
+    return decodeNormal(texture(normalsTex, texCoord).xy);
+}
 
-    // [-1, 1] x [-1, 1] x [-1, 1]
-    fragPos = 2 * fragPos - 1;
+bool isOcean(vec2 texCoord) {
+    return texture(materialTex, texCoord).x >= 127.5 / 255;
+}
 
-    return fragPos;
+vec3 getPositionView(float depth) {
+    vec3 ndc = 2 * vec3(gl_FragCoord.xy / viewportSize, depth) - 1;
+    vec4 position = mP_inv * vec4(ndc, 1);
+    return position.xyz / position.w;
 }
 
 ShaderInput getShaderInputs(vec2 texCoord) {
     ShaderInput result;
 
-    result.foreground = texture(normalsTex, texCoord).w != 0;
-    result.diffuseReflectance = texture(diffuseReflectanceTex, texCoord).xyz;
-    result.normal = normalize(2 * texture(normalsTex, texCoord).xyz - 1);
+    float depth = texture(depthTex, texCoord).x;
+    result.foreground = depth < 1;
+
+    vec4 diffuse = texture(diffuseReflectanceTex, texCoord);
+    result.diffuseReflectance = diffuse.rgb;
+    result.alpha = diffuse.a;
 
-    vec4 material = texture(materialTex, texCoord);
-    result.eta = 10 * material.x;
-    result.alpha = material.y;
-    result.ocean = material.z == 1;
+    float material = round(255 * texture(materialTex, texCoord).x);
+    result.ocean = material >= 128;
+    result.eta = etaMin + (etaMax - etaMin) * mod(material, 128) / 127;
 
-    result.fragPosNDC = getFragPosNDC(texCoord);
+    result.normal = getNormal(texCoord);
+    result.positionView = getPositionView(depth);
 
     return result;
 }
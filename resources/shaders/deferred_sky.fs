@@ -9,8 +9,16 @@ vec3 sunskyRadiance(vec3 dir);
 // Uniforms
 uniform vec3 background;
 uniform sampler2D image;
-uniform mat4 mP;
-uniform mat4 mV;
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
 
 // Inputs
 in vec2 geom_texCoord;
@@ -19,7 +27,6 @@ in vec2 geom_texCoord;
 out vec4 fragColor;
 
 vec3 eyeDirection(vec2 xyNDC) {
-    mat4 mP_inv = inverse(mP);
     vec4 near = mP_inv * vec4(xyNDC, -1, 1);
     near /= near.w;
     vec4 far = mP_inv * vec4(xyNDC, 1, 1);
@@ -36,7 +43,7 @@ void main() {
 
     vec2 xyNDC = 2 * geom_texCoord - 1;
     vec4 eyeDirection4 = vec4(eyeDirection(xyNDC), 0);
-    vec4 worldDirection4 = inverse(mV) * eyeDirection4;
+    vec4 worldDirection4 = mV_inv * eyeDirection4;
     vec3 worldDirection = normalize(worldDirection4.xyz);
 
     if (worldDirection.y > 0) {
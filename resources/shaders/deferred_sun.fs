@@ -0,0 +1,126 @@
+/**
+ * The sun as a directional light, shadowed by the cascades of SunCascades
+ */
+#version 330
+
+// Uniforms
+uniform float shadowBias = 1e-3;
+uniform vec2 shadowMapRes; // of all the cascades together
+uniform bool pcfEnabled;
+uniform bool evsmEnabled = false; // shadowTex holds EVSM moments instead of depth
+uniform bool shadeOcean = false;
+
+uniform vec3 vToSun;        // unit direction towards the sun, in eye space
+uniform vec3 sunIrradiance; // on a surface facing the sun
+
+const int CASCADE_COUNT = 4;
+uniform mat4 cascadeViewProjections[CASCADE_COUNT];
+uniform vec4 cascadeRects[CASCADE_COUNT]; // tile as (offset, scale)
+uniform vec4 cascadeSplits; // distance where each cascade ends
+uniform sampler2D shadowTex;
+
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
+
+// Inputs
+in vec2 geom_texCoord;
+
+// Outputs
+out vec4 fragColor;
+
+// HEADERS: microfacet.fs
+const float PI = 3.14159265358979323846264;
+float isotropicMicrofacet(vec3 i, vec3 o, vec3 n, float eta, float alpha);
+
+// HEADERS: deferred_shader_inputs.fs
+struct ShaderInput {
+    bool foreground;
+    bool ocean;
+    vec3 diffuseReflectance;
+    vec3 normal;
+    float eta;
+    float alpha;
+    vec3 positionView;
+};
+ShaderInput getShaderInputs(vec2 texCoord);
+
+// HEADERS: evsm.fs
+float evsmDepth(float windowDepth);
+float evsmVisibility(vec4 moments, float depth);
+
+// Takes texture coordinates, kept half a texel inside the tile so that the
+// filter taps never land in a neighbouring cascade
+float shadowTest(vec4 rect, vec2 shadowTexCoords, float shadowFragDepth) {
+    vec2 halfTexel = 0.5 / shadowMapRes;
+    shadowTexCoords = clamp(shadowTexCoords, rect.xy + halfTexel, rect.xy + rect.zw - halfTexel);
+    float shadowDepth = texture(shadowTex, shadowTexCoords).x;
+    return shadowDepth + shadowBias < shadowFragDepth ? 0 : 1;
+}
+
+float shadowFactor(vec3 wPosition, float distance) {
+    int cascade = 0;
+    while (cascade < CASCADE_COUNT && distance > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade == CASCADE_COUNT) {
+        return 1;
+    }
+
+    // Orthographic, so no divide by w
+    vec4 lPosition4 = cascadeViewProjections[cascade] * vec4(wPosition, 1);
+    vec4 rect = cascadeRects[cascade];
+    vec2 shadowTexCoords = rect.xy + (lPosition4.xy / 2 + 0.5) * rect.zw;
+    float shadowFragDepth = lPosition4.z / 2 + 0.5;
+
+    if (evsmEnabled) {
+        vec2 halfTexel = 0.5 / textureSize(shadowTex, 0);
+        shadowTexCoords = clamp(shadowTexCoords, rect.xy + halfTexel, rect.xy + rect.zw - halfTexel);
+        return evsmVisibility(texture(shadowTex, shadowTexCoords), evsmDepth(shadowFragDepth));
+    }
+    if (!pcfEnabled) {
+        return shadowTest(rect, shadowTexCoords, shadowFragDepth);
+    }
+    float dx = 1 / (4 * shadowMapRes.x);
+    float dy = 1 / (4 * shadowMapRes.y);
+    return (
+        shadowTest(rect, shadowTexCoords + vec2(dx, dy), shadowFragDepth)
+        + shadowTest(rect, shadowTexCoords + vec2(dx, -dy), shadowFragDepth)
+        + shadowTest(rect, shadowTexCoords + vec2(-dx, dy), shadowFragDepth)
+        + shadowTest(rect, shadowTexCoords + vec2(-dx, -dy), shadowFragDepth)
+    ) / 4.0;
+}
+
+void main() {
+    ShaderInput inputs = getShaderInputs(geom_texCoord);
+    if (!inputs.foreground || (!shadeOcean && inputs.ocean)) {
+        fragColor = vec4(0, 0, 0, 0);
+        return;
+    }
+
+    vec3 vPosition = inputs.positionView;
+    vec3 wPosition = (mV_inv * vec4(vPosition, 1)).xyz;
+
+    vec3 outgoingDirection = normalize(-vPosition);
+    float specular = isotropicMicrofacet(
+        vToSun,
+        outgoingDirection,
+        inputs.normal,
+        inputs.eta,
+        inputs.alpha
+    );
+    vec3 brdf = inputs.diffuseReflectance / PI + specular * vec3(1, 1, 1);
+
+    vec3 fragColor3 = shadowFactor(wPosition, -vPosition.z)
+        * sunIrradiance
+        * brdf
+        * max(0.0, dot(inputs.normal, vToSun));
+    fragColor = vec4(fragColor3, 1.0);
+}
@@ -0,0 +1,59 @@
+/**
+ * Exponential variance shadow maps. A shadow map stores the first two
+ * moments of two exponentially warped depths; filtering the moments, by
+ * blurring or bilinear fetches, filters the shadow, and Chebyshev's
+ * inequality bounds the lit fraction of the filtered region.
+ */
+#version 330
+
+uniform vec2 evsmExponents = vec2(40, 5);   // positive and negative warp; at most ~42 in 32-bit floats
+uniform float evsmBleedReduction = 0.2;     // lit fractions below this are cut to 0
+uniform float evsmMinVariance = 1e-4;       // in linear depth, against acne
+
+// How the shadow map's depth maps to linear depth
+uniform bool evsmPerspective = false;
+uniform float evsmNear = 0;
+uniform float evsmFar = 1;
+
+// Linear depth in [0, 1] of a depth in window coordinates
+float evsmDepth(float windowDepth) {
+    if (!evsmPerspective) {
+        return windowDepth;
+    }
+    float ndc = 2 * windowDepth - 1;
+    float eyeDepth = 2 * evsmNear * evsmFar / (evsmFar + evsmNear - ndc * (evsmFar - evsmNear));
+    return clamp((eyeDepth - evsmNear) / (evsmFar - evsmNear), 0, 1);
+}
+
+// Warped depths as (positive, negative)
+vec2 evsmWarp(float depth) {
+    float d = 2 * depth - 1;
+    return vec2(exp(evsmExponents.x * d), -exp(-evsmExponents.y * d));
+}
+
+vec4 evsmMoments(float depth) {
+    vec2 warped = evsmWarp(depth);
+    return vec4(warped.x, warped.x * warped.x, warped.y, warped.y * warped.y);
+}
+
+float chebyshevUpperBound(vec2 moments, float mean, float minVariance) {
+    if (mean <= moments.x) {
+        return 1;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float pMax = variance / (variance + d * d);
+    return clamp((pMax - evsmBleedReduction) / (1 - evsmBleedReduction), 0, 1);
+}
+
+float evsmVisibility(vec4 moments, float depth) {
+    vec2 warped = evsmWarp(depth);
+
+    // The minimum variance in linear depth, scaled by the warp's slope
+    vec2 slope = evsmExponents * warped * 2;
+    vec2 minVariance = evsmMinVariance * slope * slope;
+
+    float positive = chebyshevUpperBound(moments.xy, warped.x, minVariance.x);
+    float negative = chebyshevUpperBound(moments.zw, warped.y, minVariance.y);
+    return min(positive, negative);
+}
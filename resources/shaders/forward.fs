@@ -5,9 +5,15 @@ uniform float alpha;
 uniform float eta;
 uniform vec3 diffuseReflectance;
 
-// Light properties
-uniform vec3 lightPower;
-uniform vec3 vLightPos;
+// Per-light parameters (LightBlock in UniformBlocks.h)
+layout (std140) uniform Light {
+    mat4 mV_light;
+    mat4 mP_light;
+    vec4 wLightPos;
+    vec4 vLightPos; // light position in view space
+    vec4 lightPower;
+    vec4 shadowRect; // atlas tile as (offset, scale), 0 if unshadowed
+};
 
 // Inputs
 in vec3 vPosition;
@@ -37,7 +43,7 @@ vec3 linearToSrgb3(vec3 x) {
 }
 
 void main() {
-    vec3 positionToLight = vLightPos - vPosition;
+    vec3 positionToLight = vLightPos.xyz - vPosition;
     vec3 incomingDirection = normalize(positionToLight);
     vec3 positionToEye = vec3(0, 0, 0) - vPosition;
     vec3 outgoingDirection = normalize(positionToEye);
@@ -54,7 +60,7 @@ void main() {
     vec3 brdf = diffuseReflectance / PI + specular * vec3(1, 1, 1);
 
     vec3 fragColor3 =
-        lightPower / (4 * PI)
+        lightPower.xyz / (4 * PI)
         * brdf
         * max(0.0, dot(normal, incomingDirection))
         / dot(positionToLight, positionToLight);
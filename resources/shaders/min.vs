@@ -1,15 +1,33 @@
 #version 330
 
-uniform mat4 mM;  // Model matrix
-uniform mat4 mV;  // View matrix
-uniform mat4 mP;  // Projection matrix
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
+
+// Per-draw transforms (ObjectBlock in UniformBlocks.h)
+layout (std140) uniform Object {
+    mat4 mM;  // Model matrix
+    mat4 mN;  // Normal matrix, transpose(inverse(mM))
+};
 
 layout (location = 0) in vec3 position;
 
+// Instanced drawing: mM is then relative to the instance
+uniform bool useInstancing = false;
+layout (location = 6) in mat4 instanceTransform;
+
 out vec3 vPosition;  // vertex position in eye space
 
 void main()
 {
-    vPosition = (mV * mM * vec4(position, 1.0)).xyz;
+    mat4 modelMatrix = useInstancing ? instanceTransform * mM : mM;
+    vPosition = (mV * modelMatrix * vec4(position, 1.0)).xyz;
     gl_Position = mP * vec4(vPosition, 1.0);
 }
@@ -5,9 +5,15 @@ uniform float alpha;
 uniform float eta;
 uniform vec3 diffuseReflectance;
 
-// Light properties
-uniform vec3 lightPower;
-uniform vec3 vLightPos;
+// Per-light parameters (LightBlock in UniformBlocks.h)
+layout (std140) uniform Light {
+    mat4 mV_light;
+    mat4 mP_light;
+    vec4 wLightPos;
+    vec4 vLightPos; // light position in view space
+    vec4 lightPower;
+    vec4 shadowRect; // atlas tile as (offset, scale), 0 if unshadowed
+};
 
 // Inputs
 in vec3 vPosition;
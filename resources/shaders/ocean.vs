@@ -3,9 +3,22 @@
  */
 #version 330
 
-uniform mat4 mM;  // Model matrix
-uniform mat4 mV;  // View matrix
-uniform mat4 mP;  // Projection matrix
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
+
+// Per-draw transforms (ObjectBlock in UniformBlocks.h)
+layout (std140) uniform Object {
+    mat4 mM;  // Model matrix
+    mat4 mN;  // Normal matrix, transpose(inverse(mM))
+};
 
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 texCoords;
@@ -19,6 +32,13 @@ uniform float gradXA, gradXB;
 uniform sampler2D gradZMap;
 uniform float gradZA, gradZB;
 
+// Layered shadow pass: draw into the shadow atlas instead of the Frame's view
+uniform bool shadowLayered = false;
+out float gl_ClipDistance[4];
+
+// HEADERS: shadow_layers.vs
+vec4 shadowLayerPosition(vec4 wPosition, out vec4 clipDistances);
+
 out vec3 wNormal;
 out vec3 vPosition; // vertex position in eye space
 out vec3 vNormal;   // vertex normal in eye space
@@ -35,10 +55,19 @@ void main()
         0
     );
 
-    normal = transpose(inverse(mM)) * normal;
+    normal = mN * normal;
     wNormal = normal.xyz;
 
+    // The view is rigid, so it transforms normals as it does directions
     vPosition = (mV * mM * vec4(displaced, 1.0)).xyz;
-    vNormal = (transpose(inverse(mV)) * normal).xyz;
+    vNormal = (mV * normal).xyz;
     gl_Position = mP * vec4(vPosition, 1.0);
+
+    if (shadowLayered) {
+        vec4 clipDistances;
+        gl_Position = shadowLayerPosition(mM * vec4(displaced, 1.0), clipDistances);
+        for (int i = 0; i < 4; i++) {
+            gl_ClipDistance[i] = clipDistances[i];
+        }
+    }
 }
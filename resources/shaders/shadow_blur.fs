@@ -0,0 +1,40 @@
+/**
+ * One direction of a separable Gaussian blur of shadow moments, like
+ * blur.fs, but over all four channels and kept inside one tile so that
+ * neighbouring shadow maps do not bleed into each other. Drawn with the
+ * viewport covering the tile.
+ */
+#version 330
+
+const float PI = 3.14159265358979323846264;
+const float INV_SQRT_TWOPI = 1.0 / sqrt(2 * PI);
+
+uniform sampler2D image;
+
+uniform float stdev = 1;
+uniform int radius = 4;
+uniform vec2 dir = vec2(1.0, 0.0);
+uniform vec4 tileRect; // as (offset, scale) in texture coordinates
+
+out vec4 fragColor;
+
+float gaussianWeight(int r) {
+    return exp(-r*r/(2.0*stdev*stdev)) * INV_SQRT_TWOPI / stdev;
+}
+
+void main() {
+    vec2 d = 1.0 / textureSize(image, 0);
+    vec2 texCoord = gl_FragCoord.xy * d;
+    vec2 lo = tileRect.xy + 0.5 * d;
+    vec2 hi = tileRect.xy + tileRect.zw - 0.5 * d;
+
+    // Normalized, since the moments must stay unbiased
+    vec4 s = vec4(0);
+    float total = 0;
+    for (int i = -radius; i <= radius; i++) {
+        float w = gaussianWeight(i);
+        s += w * textureLod(image, clamp(texCoord + d * i * dir, lo, hi), 0);
+        total += w;
+    }
+    fragColor = s / total;
+}
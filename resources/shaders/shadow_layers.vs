@@ -0,0 +1,31 @@
+/**
+ * Layered shadow rendering. An instanced draw is repeated for each of
+ * shadowLayerCount layers (lights or cascades), instance i drawing for layer
+ * shadowLayerFirst + i % shadowLayerCount, and every copy lands in its
+ * layer's tile of the shadow texture, clipped to the tile by four clip
+ * distances.
+ */
+#version 330
+
+// Layers per draw; PLApp::maxShadowLayers must match
+const int MAX_SHADOW_LAYERS = 16;
+
+uniform int shadowLayerFirst = 0;
+uniform int shadowLayerCount = 1;
+uniform mat4 shadowViewProjections[MAX_SHADOW_LAYERS];
+uniform vec4 shadowRects[MAX_SHADOW_LAYERS]; // atlas tile as (offset, scale)
+
+// Clip-space position in the atlas of a world-space position. The caller
+// writes clipDistances to gl_ClipDistance[0..3].
+vec4 shadowLayerPosition(vec4 wPosition, out vec4 clipDistances) {
+    int layer = shadowLayerFirst + gl_InstanceID % shadowLayerCount;
+    vec4 clip = shadowViewProjections[layer] * wPosition;
+    vec4 rect = shadowRects[layer];
+
+    // Inside the light's own frustum in x and y
+    clipDistances = vec4(clip.w + clip.x, clip.w - clip.x, clip.w + clip.y, clip.w - clip.y);
+
+    // [-1, 1] maps to the tile, i.e. [2 offset - 1, 2 (offset + scale) - 1]
+    clip.xy = clip.xy * rect.zw + (2 * rect.xy + rect.zw - 1) * clip.w;
+    return clip;
+}
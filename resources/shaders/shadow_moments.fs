@@ -0,0 +1,24 @@
+/**
+ * Converts a shadow map's depth to EVSM moments at half its resolution,
+ * each texel averaging the moments of 2x2 depths
+ */
+#version 330
+
+uniform sampler2D depthTex;
+
+out vec4 fragColor;
+
+// HEADERS: evsm.fs
+float evsmDepth(float windowDepth);
+vec4 evsmMoments(float depth);
+
+void main() {
+    ivec2 texel = 2 * ivec2(gl_FragCoord.xy);
+    vec4 moments = vec4(0);
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            moments += evsmMoments(evsmDepth(texelFetch(depthTex, texel + ivec2(x, y), 0).x));
+        }
+    }
+    fragColor = moments / 4;
+}
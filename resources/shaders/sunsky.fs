@@ -2,18 +2,28 @@
 
 const float PI = 3.14159265358979323846264;
 
-uniform vec3 A, B, C, D, E, zenith;
-uniform float thetaSun = 60 * PI/180, phiSun = PI;
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
 const float sunAngularRadius = 0.5 * PI/180;
 const vec3 solarDiscRadiance = vec3(10000);
 const vec3 groundRadiance = vec3(0.5);
 const float skyScale = 0.06;
 
 vec3 perez(float theta, float gamma) {
-    return (1 + A * exp(B / cos(theta))) * (1 + C * exp(D * gamma) + E * pow(cos(gamma), 2.0));
+    return (1 + skyA.xyz * exp(skyB.xyz / cos(theta)))
+        * (1 + skyC.xyz * exp(skyD.xyz * gamma) + skyE.xyz * pow(cos(gamma), 2.0));
 }
 
 vec3 sunRadiance(vec3 dir) {
+    float thetaSun = sunAngles.x, phiSun = sunAngles.y;
     vec3 sunDir = vec3(sin(thetaSun) * cos(phiSun), cos(thetaSun), sin(thetaSun) * sin(phiSun));
     return dot(dir, sunDir) > cos(sunAngularRadius) ? solarDiscRadiance : vec3(0);
 }
@@ -25,11 +35,12 @@ const mat3 XYZ2RGB = mat3(
 );
 
 vec3 skyRadiance(vec3 dir) {
+    float thetaSun = sunAngles.x, phiSun = sunAngles.y;
     vec3 sunDir = vec3(sin(thetaSun) * cos(phiSun), cos(thetaSun), sin(thetaSun) * sin(phiSun));
     float gamma = acos(min(1.0, dot(dir, sunDir)));
     if (dir.y > 0) {
         float theta = acos(dir.y);
-        vec3 Yxy = zenith * perez(theta, gamma) / perez(0, thetaSun);
+        vec3 Yxy = skyZenith.xyz * perez(theta, gamma) / perez(0, thetaSun);
         return skyScale * XYZ2RGB * vec3(Yxy[1] * (Yxy[0]/Yxy[2]), Yxy[0], (1 - Yxy[1] - Yxy[2])*(Yxy[0]/Yxy[2]));
     } else {
         return groundRadiance;
@@ -46,7 +46,7 @@ struct ShaderInput {
     vec3 normal; // Fragment normal in eye-space
     float eta;
     float alpha;
-    vec3 fragPosNDC; // Fragment coordinates in NDC
+    vec3 positionView; // Fragment position in eye-space
 };
 ShaderInput getShaderInputs(vec2 texCoord);
 
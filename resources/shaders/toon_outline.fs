@@ -3,8 +3,6 @@
 // Uniforms
 uniform sampler2D imageTex;
 uniform sampler2D depthTex;
-uniform sampler2D normalsTex;
-uniform sampler2D materialsTex;
 uniform vec2 viewportSize;
 uniform bool fxaaEnabled;
 uniform bool shadeOcean = false;
@@ -25,6 +23,10 @@ in vec2 geom_texCoord;
 // Outputs
 out vec4 fragColor;
 
+// HEADERS: deferred_shader_inputs.fs
+vec3 getNormal(vec2 texCoord);
+bool isOcean(vec2 texCoord);
+
 float DepthCalc(vec2 ScreenSpaceUV) {
 	vec2 FrameBufferWH = viewportSize;
 	float MyDepth = texture(depthTex, ScreenSpaceUV).r;
@@ -45,20 +47,20 @@ float DepthCalc(vec2 ScreenSpaceUV) {
 
 float NormalCalc(vec2 ScreenSpaceUV) {
 	vec2 FrameBufferWH = viewportSize;
-	vec3 MyNormal = normalize(2 * texture(normalsTex, ScreenSpaceUV).xyz - 1);
-	vec3 TempNormal = normalize(2 * texture(normalsTex, ScreenSpaceUV + normalLineWidth * vec2(1, 0) / FrameBufferWH).xyz - 1);
+	vec3 MyNormal = getNormal(ScreenSpaceUV);
+	vec3 TempNormal = getNormal(ScreenSpaceUV + normalLineWidth * vec2(1, 0) / FrameBufferWH);
 	vec3 NormalDiff = abs(MyNormal - TempNormal);
     float NormalCount = NormalDiff.x + NormalDiff.y + NormalDiff.z;
 
-	TempNormal = normalize(2 * texture(normalsTex, ScreenSpaceUV + normalLineWidth * vec2(-1, 0) / FrameBufferWH).xyz - 1);
+	TempNormal = getNormal(ScreenSpaceUV + normalLineWidth * vec2(-1, 0) / FrameBufferWH);
 	NormalDiff = abs(MyNormal - TempNormal);
     NormalCount += NormalDiff.x + NormalDiff.y + NormalDiff.z;
 
-	TempNormal = normalize(2 * texture(normalsTex, ScreenSpaceUV + normalLineWidth * vec2(0, 1) / FrameBufferWH).xyz - 1);
+	TempNormal = getNormal(ScreenSpaceUV + normalLineWidth * vec2(0, 1) / FrameBufferWH);
 	NormalDiff = abs(MyNormal - TempNormal);
     NormalCount += NormalDiff.x + NormalDiff.y + NormalDiff.z;
 
-	TempNormal = normalize(2 * texture(normalsTex, ScreenSpaceUV + normalLineWidth * vec2(0, -1) / FrameBufferWH).xyz - 1);
+	TempNormal = getNormal(ScreenSpaceUV + normalLineWidth * vec2(0, -1) / FrameBufferWH);
 	NormalDiff = abs(MyNormal - TempNormal);
     NormalCount += NormalDiff.x + NormalDiff.y + NormalDiff.z;
 
@@ -78,7 +80,7 @@ vec3 lerp(vec3 oriColor, vec3 newColor, float alpha) {
 }
 
 bool isOceanPixel(vec2 texCoord) {
-    return texture(materialsTex, texCoord).z == 1;
+    return isOcean(texCoord);
 }
 
 void main() {
@@ -109,17 +111,17 @@ void main() {
 		fxaaDepth = true;
     }
 
-    vec3 myNormal = normalize(2 * texture(normalsTex, geom_texCoord).xyz - 1);
-    vec3 leftNormal = normalize(2 * texture(normalsTex, geom_texCoord + vec2(-normalLineWidth, 0) / viewportSize).xyz - 1);
+    vec3 myNormal = getNormal(geom_texCoord);
+    vec3 leftNormal = getNormal(geom_texCoord + vec2(-normalLineWidth, 0) / viewportSize);
     vec3 normalDiff = abs(myNormal - leftNormal);
     float normalCountL = normalDiff.x + normalDiff.y + normalDiff.z;
-    vec3 rightNormal = normalize(2 * texture(normalsTex, geom_texCoord + vec2(normalLineWidth, 0) / viewportSize).xyz - 1);
+    vec3 rightNormal = getNormal(geom_texCoord + vec2(normalLineWidth, 0) / viewportSize);
     normalDiff = abs(myNormal - rightNormal);
     float normalCountR = normalDiff.x + normalDiff.y + normalDiff.z;
-    vec3 downNormal = normalize(2 * texture(normalsTex, geom_texCoord + vec2(0, -normalLineWidth) / viewportSize).xyz - 1);
+    vec3 downNormal = getNormal(geom_texCoord + vec2(0, -normalLineWidth) / viewportSize);
     normalDiff = abs(myNormal - downNormal);
     float normalCountD = normalDiff.x + normalDiff.y + normalDiff.z;
-    vec3 upNormal = normalize(2 * texture(normalsTex, geom_texCoord + vec2(0, normalLineWidth) / viewportSize).xyz - 1);
+    vec3 upNormal = getNormal(geom_texCoord + vec2(0, normalLineWidth) / viewportSize);
     normalDiff = abs(myNormal - upNormal);
     float normalCountU = normalDiff.x + normalDiff.y + normalDiff.z;
 
@@ -2,15 +2,29 @@
 
 // Uniforms
 uniform float shadowBias = 1e-3;
-uniform mat4 mV;
-uniform mat4 mP;
-uniform vec3 wCamPos;
+uniform vec2 shadowMapRes; // of the whole atlas
 uniform bool shadeOcean = false;
 
-// Light Properties
-uniform vec3 wLightPos;
-uniform mat4 mV_light;
-uniform mat4 mP_light;
+// Per-frame camera and sky (FrameBlock in UniformBlocks.h)
+layout (std140) uniform Frame {
+    mat4 mV;  // View matrix
+    mat4 mP;  // Projection matrix
+    mat4 mV_inv;
+    mat4 mP_inv;
+    vec4 wCamPos;
+    vec4 skyA, skyB, skyC, skyD, skyE, skyZenith;
+    vec4 sunAngles; // thetaSun, phiSun
+};
+
+// Per-light parameters (LightBlock in UniformBlocks.h)
+layout (std140) uniform Light {
+    mat4 mV_light;
+    mat4 mP_light;
+    vec4 wLightPos;
+    vec4 vLightPos; // light position in view space
+    vec4 lightPower;
+    vec4 shadowRect; // atlas tile as (offset, scale), 0 if unshadowed
+};
 uniform sampler2D shadowTex;
 
 // Inputs
@@ -27,7 +41,7 @@ struct ShaderInput {
     vec3 normal; // Fragment normal in eye-space
     float eta;
     float alpha;
-    vec3 fragPosNDC; // Fragment coordinates in NDC
+    vec3 positionView; // Fragment position in eye-space
 };
 ShaderInput getShaderInputs(vec2 texCoord);
 
@@ -36,15 +50,12 @@ void main() {
     if (!inputs.foreground || (!shadeOcean && inputs.ocean)) {
         fragColor = vec4(0, 0, 0, 0);
     } else {
-        vec4 fragNDC4 = vec4(inputs.fragPosNDC, 1);
-
         // Position of the fragment in eye space
-        vec4 vPosition4 = inverse(mP) * fragNDC4;
-        vPosition4 /= vPosition4.w;
-        vec3 vPosition = vPosition4.xyz;
+        vec3 vPosition = inputs.positionView;
+        vec4 vPosition4 = vec4(vPosition, 1);
 
         // Position of the fragment in world space
-        vec4 wPosition4 = inverse(mV) * vPosition4;
+        vec4 wPosition4 = mV_inv * vPosition4;
         wPosition4 /= wPosition4.w;
 
         // Position of the fragment in light space
@@ -54,12 +65,20 @@ void main() {
         vec2 shadowTexCoords = lPosition4.xy / 2 + 0.5;
         float shadowFragDepth = lPosition4.z / 2 + 0.5;
 
-        float shadowDepth = texture(shadowTex, shadowTexCoords).x;
-        if (shadowDepth + shadowBias >= shadowFragDepth) {
-            vec3 wLightDir = wLightPos - wPosition4.xyz;
+        // Look up the light's tile, staying half a texel inside it; lights
+        // without a tile are unshadowed
+        bool lit = true;
+        if (shadowRect.z > 0) {
+            vec2 halfTexel = 0.5 / shadowMapRes;
+            vec2 atlasTexCoords = clamp(shadowRect.xy + shadowTexCoords * shadowRect.zw,
+                                        shadowRect.xy + halfTexel, shadowRect.xy + shadowRect.zw - halfTexel);
+            lit = texture(shadowTex, atlasTexCoords).x + shadowBias >= shadowFragDepth;
+        }
+        if (lit) {
+            vec3 wLightDir = wLightPos.xyz - wPosition4.xyz;
             float intensity = dot(normalize(wLightDir), inputs.normal) * 0.5 + 0.5;
 
-            vec3 wCamDir = wCamPos - wPosition4.xyz;
+            vec3 wCamDir = wCamPos.xyz - wPosition4.xyz;
             vec3 wHalfDir = normalize(wLightDir + wCamDir);
             float specularTest = dot(wHalfDir, inputs.normal) * 0.5 + 0.5;
 